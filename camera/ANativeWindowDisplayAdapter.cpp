@@ -156,15 +156,8 @@ ANativeWindowDisplayAdapter::ANativeWindowDisplayAdapter():mDisplayThread(NULL),
 {
     LOG_FUNCTION_NAME;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
     mShotToShot = false;
-    mStartCapture.tv_sec = 0;
-    mStartCapture.tv_usec = 0;
-    mStandbyToShot.tv_sec = 0;
-    mStandbyToShot.tv_usec = 0;
     mMeasureStandby = false;
-#endif
 
     mPixelFormat = NULL;
     mBuffers = NULL;
@@ -335,32 +328,13 @@ int ANativeWindowDisplayAdapter::setErrorHandler(ErrorNotifier *errorNotifier)
     return ret;
 }
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-status_t ANativeWindowDisplayAdapter::setSnapshotTimeRef(struct timeval *refTime)
-{
-    status_t ret = NO_ERROR;
-
-    LOG_FUNCTION_NAME;
-
-    if ( NULL != refTime )
-        {
-        android::AutoMutex lock(mLock);
-        memcpy(&mStartCapture, refTime, sizeof(struct timeval));
-    }
-
-    LOG_FUNCTION_NAME_EXIT;
-
-    return ret;
-}
-
-#endif
-
 
 int ANativeWindowDisplayAdapter::enableDisplay(int width, int height, struct timeval *refTime)
 {
     Utils::Semaphore sem;
     Utils::Message msg;
+    char value[PROPERTY_VALUE_MAX];
+    int deliveryDepth;
 
     LOG_FUNCTION_NAME;
 
@@ -372,17 +346,11 @@ int ANativeWindowDisplayAdapter::enableDisplay(int width, int height, struct tim
         return NO_ERROR;
     }
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    if ( NULL != refTime )
-        {
-        android::AutoMutex lock(mLock);
-        memcpy(&mStandbyToShot, refTime, sizeof(struct timeval));
-        mMeasureStandby = true;
+    {
+    android::AutoMutex lock(mLock);
+    mMeasureStandby = true;
     }
 
-#endif
-
     //Send START_DISPLAY COMMAND to display thread. Display thread will start and then wait for a message
     sem.Create();
     msg.command = DisplayThread::DISPLAY_START;
@@ -396,6 +364,15 @@ int ANativeWindowDisplayAdapter::enableDisplay(int width, int height, struct tim
     ///Wait for the ACK - implies that the thread is now started and waiting for frames
     sem.Wait();
 
+    // Queueing to the window can block on the compositor, optionally post
+    // frames from a thread of our own so the other subscribers don't wait
+    property_get("debug.camera.delivery.display", value, "0");
+    deliveryDepth = atoi(value);
+    if ( 0 < deliveryDepth )
+        {
+        mFrameProvider->enableAsyncDelivery(deliveryDepth, FrameNotifier::DELIVERY_DROP_OLDEST);
+        }
+
     // Register with the frame provider for frames
     mFrameProvider->enableFrameNotification(CameraFrame::PREVIEW_FRAME_SYNC);
     mFrameProvider->enableFrameNotification(CameraFrame::SNAPSHOT_FRAME);
@@ -428,6 +405,7 @@ int ANativeWindowDisplayAdapter::disableDisplay(bool cancel_buffer)
     // Unregister with the frame provider here
     mFrameProvider->disableFrameNotification(CameraFrame::PREVIEW_FRAME_SYNC);
     mFrameProvider->disableFrameNotification(CameraFrame::SNAPSHOT_FRAME);
+    mFrameProvider->disableAsyncDelivery();
     mFrameProvider->removeFramePointers();
 
     if ( NULL != mDisplayThread.get() )
@@ -623,6 +601,7 @@ CameraBuffer* ANativeWindowDisplayAdapter::allocateBufferList(int width, int hei
         CAMHAL_LOGDB("got handle %p", handle);
         mBuffers[i].opaque = (void *)handle;
         mBuffers[i].type = CAMERA_BUFFER_ANW;
+        mBuffers[i].index = i;
         mFramesWithCameraAdapterMap.add(handle, i);
 
         // Tag remaining preview buffers as preview frames
@@ -1090,6 +1069,8 @@ status_t ANativeWindowDisplayAdapter::PostFrame(ANativeWindowDisplayAdapter::Dis
         return BAD_VALUE;
     }
 
+    FrameTracer::trace(FrameTracer::POST_FRAME, dispFrame.mBuffer, dispFrame.mType);
+
     for ( i = 0; i < mBufferCount; i++ )
         {
         if ( dispFrame.mBuffer == &mBuffers[i] )
@@ -1148,6 +1129,7 @@ status_t ANativeWindowDisplayAdapter::PostFrame(ANativeWindowDisplayAdapter::Dis
             buffer_handle_t *handle = (buffer_handle_t *) mBuffers[i].opaque;
             // unlock buffer before sending to display
             mapper.unlock(*handle);
+            FrameTracer::trace(FrameTracer::ENQUEUE_BUFFER, dispFrame.mBuffer, dispFrame.mType);
             ret = mANativeWindow->enqueue_buffer(mANativeWindow, handle);
         }
         if ( NO_ERROR != ret ) {
@@ -1163,24 +1145,21 @@ status_t ANativeWindowDisplayAdapter::PostFrame(ANativeWindowDisplayAdapter::Dis
         mDisplayQ.put(&msg);
 
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
         if ( mMeasureStandby )
             {
-            CameraHal::PPM("Standby to first shot: Sensor Change completed - ", &mStandbyToShot);
+            EventLog::log(EventLog::FIRST_PREVIEW_FRAME);
             mMeasureStandby = false;
             }
         else if (CameraFrame::CameraFrame::SNAPSHOT_FRAME == dispFrame.mType)
             {
-            CameraHal::PPM("Shot to snapshot: ", &mStartCapture);
+            EventLog::log(EventLog::SNAPSHOT_DISPLAYED);
             mShotToShot = true;
             }
         else if ( mShotToShot )
             {
-            CameraHal::PPM("Shot to shot: ", &mStartCapture);
+            EventLog::log(EventLog::PREVIEW_AFTER_SHOT);
             mShotToShot = false;
         }
-#endif
 
     }
     else
@@ -68,6 +68,15 @@ TI_CAMERAHAL_COMMON_SRC := \
     Encoder_libjpeg.cpp \
     SensorListener.cpp  \
     NV12_resize.cpp \
+    FrameSlotRing.cpp \
+    FrameDeliveryQueue.cpp \
+    FrameTracer.cpp \
+    CameraMetrics.cpp \
+    EventLog.cpp \
+    CapabilityIndex.cpp \
+    ParameterDiff.cpp \
+    ZslRing.cpp \
+    YuvConvert.cpp \
     CameraParameters.cpp \
     TICameraParameters.cpp \
     CameraHalCommon.cpp
@@ -20,14 +20,15 @@
 #include <MetadataBufferType.h>
 #include <ui/GraphicBuffer.h>
 #include <ui/GraphicBufferMapper.h>
+#include <sys/poll.h>
 #include "NV12_resize.h"
+#include "FrameSlotRing.h"
 #include "TICameraParameters.h"
 
 namespace Ti {
 namespace Camera {
 
 const int AppCallbackNotifier::NOTIFIER_TIMEOUT = -1;
-android::KeyedVector<void*, android::sp<Encoder_libjpeg> > gEncoderQueue;
 
 void AppCallbackNotifierEncoderCallback(void* main_jpeg,
                                         void* thumb_jpeg,
@@ -60,7 +61,7 @@ void AppCallbackNotifierEncoderCallback(void* main_jpeg,
 void AppCallbackNotifier::EncoderDoneCb(void* main_jpeg, void* thumb_jpeg, CameraFrame::FrameType type, void* cookie1, void* cookie2, void *cookie3)
 {
     camera_memory_t* encoded_mem = NULL;
-    Encoder_libjpeg::params *main_param = NULL, *thumb_param = NULL;
+    Encoder_libjpeg::params *main_param = NULL;
     size_t jpeg_size;
     uint8_t* src = NULL;
     CameraBuffer *camera_buffer;
@@ -83,36 +84,21 @@ void AppCallbackNotifier::EncoderDoneCb(void* main_jpeg, void* thumb_jpeg, Camer
     camera_buffer = (CameraBuffer *)cookie3;
     src = main_param->src;
 
-    if(encoded_mem && encoded_mem->data && (jpeg_size > 0)) {
-        if (cookie2) {
-            ExifElementsTable* exif = (ExifElementsTable*) cookie2;
-            Section_t* exif_section = NULL;
-
-            exif->insertExifToJpeg((unsigned char*) encoded_mem->data, jpeg_size);
-
-            if(thumb_jpeg) {
-                thumb_param = (Encoder_libjpeg::params *) thumb_jpeg;
-                exif->insertExifThumbnailImage((const char*)thumb_param->dst,
-                                               (int)thumb_param->jpeg_size);
-            }
+    FrameTracer::trace(FrameTracer::ENCODE_END, camera_buffer, type);
 
-            exif_section = FindSection(M_EXIF);
-
-            if (exif_section) {
-                picture = mRequestMemory(-1, jpeg_size + exif_section->Size, 1, NULL);
-                if (picture && picture->data) {
-                    exif->saveJpeg((unsigned char*) picture->data, jpeg_size + exif_section->Size);
-                }
-            }
-            delete exif;
-            cookie2 = NULL;
-        } else {
-            picture = mRequestMemory(-1, jpeg_size, 1, NULL);
-            if (picture && picture->data) {
-                memcpy(picture->data, encoded_mem->data, jpeg_size);
-            }
+    // exif and thumbnail were already emitted by the encoder as APP1 of
+    // the main image, the encoded stream only needs to be handed over
+    if(encoded_mem && encoded_mem->data && (jpeg_size > 0)) {
+        picture = mRequestMemory(-1, jpeg_size, 1, NULL);
+        if (picture && picture->data) {
+            memcpy(picture->data, encoded_mem->data, jpeg_size);
         }
     }
+
+    if (cookie2) {
+        delete (ExifElementsTable*) cookie2;
+        cookie2 = NULL;
+    }
     } // scope for mutex lock
 
     if (!mRawAvailable) {
@@ -153,10 +139,16 @@ void AppCallbackNotifier::EncoderDoneCb(void* main_jpeg, void* thumb_jpeg, Camer
         if (cookie2) {
             delete (ExifElementsTable*) cookie2;
         }
-        encoder = gEncoderQueue.valueFor(src);
-        if (encoder.get()) {
-            gEncoderQueue.removeItem(src);
-            encoder.clear();
+        {
+            android::AutoMutex lock(mEncoderLock);
+            encoder = mEncoderQueue.valueFor(src);
+            if (encoder.get()) {
+                if (mMetrics.get()) {
+                    mMetrics->record(CameraMetrics::JPEG_ENCODE, encoder->getEncodeTime());
+                }
+                mEncoderQueue.removeItem(src);
+                encoder.clear();
+            }
         }
         mFrameProvider->returnFrame(camera_buffer, type);
     }
@@ -168,6 +160,19 @@ void AppCallbackNotifier::EncoderDoneCb(void* main_jpeg, void* thumb_jpeg, Camer
   * NotificationHandler class
   */
 
+// Defined out of line so that the encoder job map is instantiated
+// where Encoder_libjpeg is a complete type
+AppCallbackNotifier::AppCallbackNotifier()
+    : mEventProvider(NULL),
+      mFrameProvider(NULL),
+      mLastCopiedPreview(-1),
+      mZeroCopyPreview(false),
+      mZeroCopyHold(1),
+      mResizeDop(1),
+      mResizeDeadline(0)
+{
+}
+
 ///Initialization function for AppCallbackNotifier
 status_t AppCallbackNotifier::initialize()
 {
@@ -179,6 +184,22 @@ status_t AppCallbackNotifier::initialize()
 
     mNotifierState = NOTIFIER_STOPPED;
 
+    ///Create the frame slots the notifier thread is waiting on
+    mFrameRing = new FrameSlotRing(FRAME_RING_SLOTS);
+    if(!mFrameRing.get())
+        {
+        CAMHAL_LOGEA("Couldn't create frame ring");
+        return NO_MEMORY;
+        }
+
+    status_t ret = mFrameRing->initialize();
+    if(ret!=NO_ERROR)
+        {
+        CAMHAL_LOGEA("Couldn't initialize frame ring");
+        mFrameRing.clear();
+        return ret;
+        }
+
     ///Create the app notifier thread
     mNotificationThread = new NotificationThread(this);
     if(!mNotificationThread.get())
@@ -188,7 +209,7 @@ status_t AppCallbackNotifier::initialize()
         }
 
     ///Start the display thread
-    status_t ret = mNotificationThread->run("NotificationThread", android::PRIORITY_URGENT_DISPLAY);
+    ret = mNotificationThread->run("NotificationThread", android::PRIORITY_URGENT_DISPLAY);
     if(ret!=NO_ERROR)
         {
         CAMHAL_LOGEA("Couldn't run NotificationThread");
@@ -196,6 +217,38 @@ status_t AppCallbackNotifier::initialize()
         return ret;
         }
 
+    ///Create the jpeg encoder pool shared by all captures of this camera
+    mEncoderPool = new EncoderPool(ENCODER_POOL_THREADS, ENCODER_POOL_JOBS);
+    if(!mEncoderPool.get())
+        {
+        CAMHAL_LOGEA("Couldn't create encoder pool");
+        return NO_MEMORY;
+        }
+
+    ret = mEncoderPool->initialize();
+    if(ret!=NO_ERROR)
+        {
+        CAMHAL_LOGEA("Couldn't initialize encoder pool");
+        mEncoderPool.clear();
+        return ret;
+        }
+
+    ///Create the threads sharing the video frame resize with the notifier thread
+    mResizePool = new NV12ResizePool(RESIZE_POOL_THREADS);
+    if(!mResizePool.get())
+        {
+        CAMHAL_LOGEA("Couldn't create resize pool");
+        return NO_MEMORY;
+        }
+
+    ret = mResizePool->initialize();
+    if(ret!=NO_ERROR)
+        {
+        CAMHAL_LOGEA("Couldn't initialize resize pool");
+        mResizePool.clear();
+        return ret;
+        }
+
     mUseMetaDataBufferMode = true;
     mRawAvailable = false;
 
@@ -277,15 +330,30 @@ void AppCallbackNotifier::errorNotify(int error)
 bool AppCallbackNotifier::notificationThread()
 {
     bool shouldLive = true;
-    status_t ret;
+    struct pollfd pfd[3];
+    int ret;
 
     LOG_FUNCTION_NAME;
 
     //CAMHAL_LOGDA("Notification Thread waiting for message");
-    ret = Utils::MessageQueue::waitForMsg(&mNotificationThread->msgQ(),
-                                            &mEventQ,
-                                            &mFrameQ,
-                                            AppCallbackNotifier::NOTIFIER_TIMEOUT);
+    pfd[0].fd = mNotificationThread->msgQ().getInFd();
+    pfd[1].fd = mEventQ.getInFd();
+    pfd[2].fd = mFrameRing->getFd();
+    for (int i = 0; i < 3; i++) {
+        pfd[i].events = POLLIN;
+        pfd[i].revents = 0;
+    }
+
+    ret = poll(pfd, 3, AppCallbackNotifier::NOTIFIER_TIMEOUT);
+    if (ret < 0) {
+        CAMHAL_LOGEB("poll() error: %s", strerror(errno));
+        return shouldLive;
+    }
+
+    // isEmpty() updates hasMsg(), a queue descriptor may briefly stay
+    // signalled after its messages are gone
+    mNotificationThread->msgQ().isEmpty();
+    mEventQ.isEmpty();
 
     //CAMHAL_LOGDA("Notification Thread received message");
 
@@ -305,10 +373,14 @@ bool AppCallbackNotifier::notificationThread()
         notifyEvent();
      }
 
-    if(mFrameQ.hasMsg()) {
-       ///Received a frame from one of the frame providers
+    if(pfd[2].revents & POLLIN) {
+       ///Received frames from the frame providers, frames queued after
+       ///clearing the wakeup are handled on the next round
        //CAMHAL_LOGDA("Notification Thread received a frame from frame provider (CameraAdapter)");
-       notifyFrame();
+       mFrameRing->clearWakeup();
+       for (size_t i = mFrameRing->size(); i > 0; i--) {
+           notifyFrame();
+       }
     }
 
     LOG_FUNCTION_NAME_EXIT;
@@ -717,11 +789,129 @@ void AppCallbackNotifier::copyAndSendPictureFrame(CameraFrame* frame, int32_t ms
     }
 }
 
+bool AppCallbackNotifier::sendZeroCopyPreviewFrame(CameraFrame* frame, int32_t msgType)
+{
+    camera_memory_t* mem = NULL;
+    ssize_t index;
+    LentFrame lent;
+
+    // only plain preview frames starting at the top of their buffer
+    // can be handed out as they are
+    if ( ( CAMERA_MSG_PREVIEW_FRAME != msgType ) ||
+         ( CameraFrame::PREVIEW_FRAME_SYNC != frame->mFrameType ) ||
+         ( NULL == frame->mBuffer ) || ( 0 != frame->mOffset ) ) {
+        return false;
+    }
+
+    android::AutoMutex lock(mLock);
+
+    if ( mNotifierState != AppCallbackNotifier::NOTIFIER_STARTED ) {
+        return false;
+    }
+
+    index = mZeroCopyMemory.indexOfKey(frame->mBuffer);
+    if ( index < 0 ) {
+        CAMHAL_LOGDB("Buffer %p is not mapped for zero copy", frame->mBuffer);
+        return false;
+    }
+    mem = mZeroCopyMemory.valueAt(index);
+
+    // the client reads the buffer after the callback returns, give it back
+    // to the camera only once newer frames have been handed out
+    lent.mBuffer = frame->mBuffer;
+    lent.mFrameType = frame->mFrameType;
+    mLentFrames.push_back(lent);
+
+    // the copied preview frames are older than this one now
+    mLastCopiedPreview = -1;
+    while ( mLentFrames.size() > mZeroCopyHold ) {
+        mFrameProvider->returnFrame(mLentFrames[0].mBuffer,
+                                    (CameraFrame::FrameType) mLentFrames[0].mFrameType);
+        mLentFrames.removeAt(0);
+    }
+
+    if ( mCameraHal->msgTypeEnabled(msgType) ) {
+        mDataCb(msgType, mem, 0, NULL, mCallbackCookie);
+    }
+
+    return true;
+}
+
+void AppCallbackNotifier::returnLentPreviewFrames()
+{
+    // mLock has to be held by the caller
+    for ( size_t i = 0; i < mLentFrames.size(); i++ ) {
+        mFrameProvider->returnFrame(mLentFrames[i].mBuffer,
+                                    (CameraFrame::FrameType) mLentFrames[i].mFrameType);
+    }
+    mLentFrames.clear();
+}
+
+void AppCallbackNotifier::setupZeroCopyPreview(CameraBuffer *buffers, size_t length, size_t count)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    // mLock has to be held by the caller
+    if ( ( NULL == buffers ) || ( 0 == length ) ) {
+        return;
+    }
+
+    // frames held by the client on top of the one just sent
+    property_get("debug.camera.zerocopy.hold", value, "1");
+    mZeroCopyHold = atoi(value);
+    if ( mZeroCopyHold < 1 ) {
+        mZeroCopyHold = 1;
+    }
+
+    for ( size_t i = 0; i < count; i++ ) {
+        camera_memory_t *mem = NULL;
+        int fd = camera_buffer_get_fd(&buffers[i]);
+
+        if ( fd >= 0 ) {
+            mem = mRequestMemory(fd, length, 1, NULL);
+        }
+
+        if ( ( NULL == mem ) || ( NULL == mem->data ) ) {
+            CAMHAL_LOGEB("Couldn't map preview buffer %d (fd %d), copying preview callbacks", i, fd);
+            if ( mem ) {
+                mem->release(mem);
+            }
+            releaseZeroCopyPreview();
+            return;
+        }
+
+        mZeroCopyMemory.add(&buffers[i], mem);
+    }
+
+    mZeroCopyPreview = true;
+
+    CAMHAL_LOGDB("Zero copy preview callbacks on %d buffers, %d held by the client",
+                 count, mZeroCopyHold);
+}
+
+void AppCallbackNotifier::releaseZeroCopyPreview()
+{
+    // mLock has to be held by the caller
+    returnLentPreviewFrames();
+
+    for ( size_t i = 0; i < mZeroCopyMemory.size(); i++ ) {
+        camera_memory_t *mem = mZeroCopyMemory.valueAt(i);
+        mem->release(mem);
+    }
+    mZeroCopyMemory.clear();
+
+    mZeroCopyPreview = false;
+}
+
 void AppCallbackNotifier::copyAndSendPreviewFrame(CameraFrame* frame, int32_t msgType)
 {
     camera_memory_t* picture = NULL;
     CameraBuffer * dest = NULL;
 
+    if ( mZeroCopyPreview && sendZeroCopyPreviewFrame(frame, msgType) ) {
+        return;
+    }
+
     // scope for lock
     {
         android::AutoMutex lock(mLock);
@@ -772,6 +962,7 @@ void AppCallbackNotifier::copyAndSendPreviewFrame(CameraFrame* frame, int32_t ms
                            2,
                            frame->mLength,
                            mPreviewPixelFormat);
+                mLastCopiedPreview = mPreviewBufCount;
               }
             }
         }
@@ -829,345 +1020,393 @@ status_t AppCallbackNotifier::dummyRaw()
 void AppCallbackNotifier::notifyFrame()
 {
     ///Receive and send the frame notifications to app
-    Utils::Message msg;
-    CameraFrame *frame;
+    CameraFrame frameData;
+    CameraFrame *frame = &frameData;
     android::MemoryHeapBase *heap;
     android::MemoryBase *buffer = NULL;
     android::sp<android::MemoryBase> memBase;
     void *buf = NULL;
 
+    bool stale;
+
     LOG_FUNCTION_NAME;
 
     {
         android::AutoMutex lock(mLock);
-        if(!mFrameQ.isEmpty()) {
-            mFrameQ.get(&msg);
-        } else {
+        if ( NO_ERROR != mFrameRing->get(frameData, stale) ) {
             return;
         }
     }
 
+    ///The notifier is behind, newer preview frames are queued already
+    if ( stale ) {
+        CAMHAL_LOGDB("Dropping stale preview frame %p", frame->mBuffer);
+        if ( NULL != mMetrics.get() ) {
+            mMetrics->count(CameraMetrics::DROPPED_CALLBACK);
+        }
+        mFrameProvider->returnFrame(frame->mBuffer, (CameraFrame::FrameType) frame->mFrameType);
+        return;
+    }
+
     bool ret = true;
 
-    frame = NULL;
-    switch(msg.command)
+    if ( (CameraFrame::RAW_FRAME == frame->mFrameType )&&
+        ( NULL != mCameraHal ) &&
+        ( NULL != mDataCb) &&
+        ( NULL != mNotifyCb ) )
         {
-        case AppCallbackNotifier::NOTIFIER_CMD_PROCESS_FRAME:
-
-                frame = (CameraFrame *) msg.arg1;
-                if(!frame)
-                    {
-                    break;
-                    }
-
-                if ( (CameraFrame::RAW_FRAME == frame->mFrameType )&&
-                    ( NULL != mCameraHal ) &&
-                    ( NULL != mDataCb) &&
-                    ( NULL != mNotifyCb ) )
-                    {
 
-                    if ( mCameraHal->msgTypeEnabled(CAMERA_MSG_RAW_IMAGE) )
-                        {
+        if ( mCameraHal->msgTypeEnabled(CAMERA_MSG_RAW_IMAGE) )
+            {
 #ifdef COPY_IMAGE_BUFFER
-                        copyAndSendPictureFrame(frame, CAMERA_MSG_RAW_IMAGE);
+            copyAndSendPictureFrame(frame, CAMERA_MSG_RAW_IMAGE);
 #else
-                        //TODO: Find a way to map a Tiler buffer to a MemoryHeapBase
+            //TODO: Find a way to map a Tiler buffer to a MemoryHeapBase
 #endif
-                        }
-                    else {
-                        if ( mCameraHal->msgTypeEnabled(CAMERA_MSG_RAW_IMAGE_NOTIFY) ) {
-                            mNotifyCb(CAMERA_MSG_RAW_IMAGE_NOTIFY, 0, 0, mCallbackCookie);
-                        }
-                        mFrameProvider->returnFrame(frame->mBuffer,
-                                                    (CameraFrame::FrameType) frame->mFrameType);
-                    }
+            }
+        else {
+            if ( mCameraHal->msgTypeEnabled(CAMERA_MSG_RAW_IMAGE_NOTIFY) ) {
+                mNotifyCb(CAMERA_MSG_RAW_IMAGE_NOTIFY, 0, 0, mCallbackCookie);
+            }
+            mFrameProvider->returnFrame(frame->mBuffer,
+                                        (CameraFrame::FrameType) frame->mFrameType);
+        }
 
-                    mRawAvailable = true;
+        mRawAvailable = true;
 
-                    }
-                else if ( (CameraFrame::IMAGE_FRAME == frame->mFrameType) &&
-                          (NULL != mCameraHal) &&
-                          (NULL != mDataCb) &&
-                          (CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG & frame->mQuirks) )
-                    {
+        }
+    else if ( (CameraFrame::IMAGE_FRAME == frame->mFrameType) &&
+              (NULL != mCameraHal) &&
+              (NULL != mDataCb) &&
+              (CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG & frame->mQuirks) )
+        {
 
-                    int encode_quality = 100, tn_quality = 100;
-                    int tn_width, tn_height;
-                    unsigned int current_snapshot = 0;
-                    Encoder_libjpeg::params *main_jpeg = NULL, *tn_jpeg = NULL;
-                    void* exif_data = NULL;
-                    const char *previewFormat = NULL;
-                    camera_memory_t* raw_picture = mRequestMemory(-1, frame->mLength, 1, NULL);
+        int encode_quality = 100, tn_quality = 100;
+        int tn_width, tn_height;
+        unsigned int current_snapshot = 0;
+        Encoder_libjpeg::params *main_jpeg = NULL, *tn_jpeg = NULL;
+        void* exif_data = NULL;
+        const char *previewFormat = NULL;
+        camera_memory_t* raw_picture = mRequestMemory(-1, frame->mLength, 1, NULL);
 
-                    if(raw_picture) {
-                        buf = raw_picture->data;
-                    }
+        if(raw_picture) {
+            buf = raw_picture->data;
+        }
 
-                    android::CameraParameters parameters;
-                    char *params = mCameraHal->getParameters();
-                    const android::String8 strParams(params);
-                    parameters.unflatten(strParams);
+        android::CameraParameters parameters;
+        char *params = mCameraHal->getParameters();
+        const android::String8 strParams(params);
+        parameters.unflatten(strParams);
 
-                    encode_quality = parameters.getInt(android::CameraParameters::KEY_JPEG_QUALITY);
-                    if (encode_quality < 0 || encode_quality > 100) {
-                        encode_quality = 100;
-                    }
+        encode_quality = parameters.getInt(android::CameraParameters::KEY_JPEG_QUALITY);
+        if (encode_quality < 0 || encode_quality > 100) {
+            encode_quality = 100;
+        }
 
-                    tn_quality = parameters.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY);
-                    if (tn_quality < 0 || tn_quality > 100) {
-                        tn_quality = 100;
-                    }
+        tn_quality = parameters.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY);
+        if (tn_quality < 0 || tn_quality > 100) {
+            tn_quality = 100;
+        }
 
-                    if (CameraFrame::HAS_EXIF_DATA & frame->mQuirks) {
-                        exif_data = frame->mCookie2;
-                    }
+        if (CameraFrame::HAS_EXIF_DATA & frame->mQuirks) {
+            exif_data = frame->mCookie2;
+        }
 
-                    main_jpeg = (Encoder_libjpeg::params*)
-                                    malloc(sizeof(Encoder_libjpeg::params));
-
-                    // Video snapshot with LDCNSF on adds a few bytes start offset
-                    // and a few bytes on every line. They must be skipped.
-                    int rightCrop = frame->mAlignment/2 - frame->mWidth;
-
-                    CAMHAL_LOGDB("Video snapshot right crop = %d", rightCrop);
-                    CAMHAL_LOGDB("Video snapshot offset = %d", frame->mOffset);
-
-                    if (main_jpeg) {
-                        main_jpeg->src = (uint8_t *)frame->mBuffer->mapped;
-                        main_jpeg->src_size = frame->mLength;
-                        main_jpeg->dst = (uint8_t*) buf;
-                        main_jpeg->dst_size = frame->mLength;
-                        main_jpeg->quality = encode_quality;
-                        main_jpeg->in_width = frame->mAlignment/2; // use stride here
-                        main_jpeg->in_height = frame->mHeight;
-                        main_jpeg->out_width = frame->mAlignment/2;
-                        main_jpeg->out_height = frame->mHeight;
-                        main_jpeg->right_crop = rightCrop;
-                        main_jpeg->start_offset = frame->mOffset;
-                        if ( CameraFrame::FORMAT_YUV422I_UYVY & frame->mQuirks) {
-                            main_jpeg->format = TICameraParameters::PIXEL_FORMAT_YUV422I_UYVY;
-                        }
-                        else { //if ( CameraFrame::FORMAT_YUV422I_YUYV & frame->mQuirks)
-                            main_jpeg->format = android::CameraParameters::PIXEL_FORMAT_YUV422I;
-                        }
-                    }
+        main_jpeg = (Encoder_libjpeg::params*)
+                        malloc(sizeof(Encoder_libjpeg::params));
+
+        // Video snapshot with LDCNSF on adds a few bytes start offset
+        // and a few bytes on every line. They must be skipped.
+        int rightCrop = frame->mAlignment/2 - frame->mWidth;
+
+        CAMHAL_LOGDB("Video snapshot right crop = %d", rightCrop);
+        CAMHAL_LOGDB("Video snapshot offset = %d", frame->mOffset);
+
+        if (main_jpeg) {
+            main_jpeg->src = (uint8_t *)frame->mBuffer->mapped;
+            main_jpeg->src_size = frame->mLength;
+            main_jpeg->dst = (uint8_t*) buf;
+            main_jpeg->dst_size = frame->mLength;
+            main_jpeg->quality = encode_quality;
+            main_jpeg->in_width = frame->mAlignment/2; // use stride here
+            main_jpeg->in_height = frame->mHeight;
+            main_jpeg->out_width = frame->mAlignment/2;
+            main_jpeg->out_height = frame->mHeight;
+            main_jpeg->right_crop = rightCrop;
+            main_jpeg->start_offset = frame->mOffset;
+            if ( CameraFrame::FORMAT_YUV422I_UYVY & frame->mQuirks) {
+                main_jpeg->format = TICameraParameters::PIXEL_FORMAT_YUV422I_UYVY;
+            }
+            else { //if ( CameraFrame::FORMAT_YUV422I_YUYV & frame->mQuirks)
+                main_jpeg->format = android::CameraParameters::PIXEL_FORMAT_YUV422I;
+            }
+        }
 
-                    tn_width = parameters.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH);
-                    tn_height = parameters.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT);
-                    previewFormat = parameters.getPreviewFormat();
+        tn_width = parameters.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH);
+        tn_height = parameters.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT);
+        previewFormat = parameters.getPreviewFormat();
 
-                    if ((tn_width > 0) && (tn_height > 0) && ( NULL != previewFormat )) {
-                        tn_jpeg = (Encoder_libjpeg::params*)
-                                      malloc(sizeof(Encoder_libjpeg::params));
-                        // if malloc fails just keep going and encode main jpeg
-                        if (!tn_jpeg) {
-                            tn_jpeg = NULL;
-                        }
-                    }
+        if ((tn_width > 0) && (tn_height > 0) && ( NULL != previewFormat )) {
+            tn_jpeg = (Encoder_libjpeg::params*)
+                          malloc(sizeof(Encoder_libjpeg::params));
+            // if malloc fails just keep going and encode main jpeg
+            if (!tn_jpeg) {
+                tn_jpeg = NULL;
+            }
+        }
 
-                    if (tn_jpeg) {
-                        int width, height;
-                        parameters.getPreviewSize(&width,&height);
-                        current_snapshot = (mPreviewBufCount + MAX_BUFFERS - 1) % MAX_BUFFERS;
-                        tn_jpeg->src = (uint8_t *)mPreviewBuffers[current_snapshot].mapped;
-                        tn_jpeg->src_size = mPreviewMemory->size / MAX_BUFFERS;
-                        tn_jpeg->dst_size = calculateBufferSize(tn_width,
-                                                                tn_height,
-                                                                previewFormat);
-                        tn_jpeg->dst = (uint8_t*) malloc(tn_jpeg->dst_size);
-                        tn_jpeg->quality = tn_quality;
-                        tn_jpeg->in_width = width;
-                        tn_jpeg->in_height = height;
-                        tn_jpeg->out_width = tn_width;
-                        tn_jpeg->out_height = tn_height;
-                        tn_jpeg->right_crop = 0;
-                        tn_jpeg->start_offset = 0;
-                        tn_jpeg->format = android::CameraParameters::PIXEL_FORMAT_YUV420SP;;
-                    }
+        if (tn_jpeg) {
+            android::AutoMutex lock(mLock);
 
-                    android::sp<Encoder_libjpeg> encoder = new Encoder_libjpeg(main_jpeg,
-                                                      tn_jpeg,
-                                                      AppCallbackNotifierEncoderCallback,
-                                                      (CameraFrame::FrameType)frame->mFrameType,
-                                                      this,
-                                                      raw_picture,
-                                                      exif_data, frame->mBuffer);
-                    gEncoderQueue.add(frame->mBuffer->mapped, encoder);
-                    encoder->run();
-                    encoder.clear();
-                    if (params != NULL)
-                      {
-                        mCameraHal->putParameters(params);
-                      }
-                    }
-                else if ( ( CameraFrame::IMAGE_FRAME == frame->mFrameType ) &&
-                             ( NULL != mCameraHal ) &&
-                             ( NULL != mDataCb) )
-                    {
+            // zero copy preview callbacks don't leave a copy of the latest
+            // frame behind, the camera may be filling the buffer already
+            if (0 > mLastCopiedPreview) {
+                CAMHAL_LOGDA("No copied preview frame, encoding without thumbnail");
+                free(tn_jpeg);
+                tn_jpeg = NULL;
+            } else {
+                current_snapshot = mLastCopiedPreview;
+            }
+        }
 
-                    // CTS, MTS requirements: Every 'takePicture()' call
-                    // who registers a raw callback should receive one
-                    // as well. This is  not always the case with
-                    // CameraAdapters though.
-                    if (!mCameraHal->msgTypeEnabled(CAMERA_MSG_RAW_IMAGE)) {
-                        dummyRaw();
-                    } else {
-                        mRawAvailable = false;
-                    }
+        if (tn_jpeg) {
+            int width, height;
+            parameters.getPreviewSize(&width,&height);
+            tn_jpeg->src = (uint8_t *)mPreviewBuffers[current_snapshot].mapped;
+            tn_jpeg->src_size = mPreviewMemory->size / MAX_BUFFERS;
+            tn_jpeg->dst_size = calculateBufferSize(tn_width,
+                                                    tn_height,
+                                                    previewFormat);
+            tn_jpeg->dst = (uint8_t*) malloc(tn_jpeg->dst_size);
+            tn_jpeg->quality = tn_quality;
+            tn_jpeg->in_width = width;
+            tn_jpeg->in_height = height;
+            tn_jpeg->out_width = tn_width;
+            tn_jpeg->out_height = tn_height;
+            tn_jpeg->right_crop = 0;
+            tn_jpeg->start_offset = 0;
+            tn_jpeg->format = android::CameraParameters::PIXEL_FORMAT_YUV420SP;;
+        }
+
+        android::sp<Encoder_libjpeg> encoder = new Encoder_libjpeg(main_jpeg,
+                                          tn_jpeg,
+                                          AppCallbackNotifierEncoderCallback,
+                                          (CameraFrame::FrameType)frame->mFrameType,
+                                          this,
+                                          raw_picture,
+                                          exif_data, frame->mBuffer);
+        encoder->setExif((ExifElementsTable*) exif_data);
+        {
+            android::AutoMutex lock(mEncoderLock);
+            mEncoderQueue.add(frame->mBuffer->mapped, encoder);
+        }
+        FrameTracer::trace(FrameTracer::ENCODE_START, frame->mBuffer, frame->mFrameType);
+        if (mEncoderPool->queueJob(encoder) != NO_ERROR) {
+            CAMHAL_LOGEA("Couldn't queue jpeg encoder job");
+            {
+                android::AutoMutex lock(mEncoderLock);
+                mEncoderQueue.removeItem(frame->mBuffer->mapped);
+            }
+            // completes the job as canceled and frees its parameters
+            encoder->cancel();
+            encoder->process();
+            if (raw_picture) {
+                raw_picture->release(raw_picture);
+            }
+            if (exif_data) {
+                delete (ExifElementsTable*) exif_data;
+            }
+            mFrameProvider->returnFrame(frame->mBuffer,
+                                        (CameraFrame::FrameType) frame->mFrameType);
+        }
+        encoder.clear();
+        if (params != NULL)
+          {
+            mCameraHal->putParameters(params);
+          }
+        }
+    else if ( ( CameraFrame::IMAGE_FRAME == frame->mFrameType ) &&
+                 ( NULL != mCameraHal ) &&
+                 ( NULL != mDataCb) )
+        {
+
+        // CTS, MTS requirements: Every 'takePicture()' call
+        // who registers a raw callback should receive one
+        // as well. This is  not always the case with
+        // CameraAdapters though.
+        if (!mCameraHal->msgTypeEnabled(CAMERA_MSG_RAW_IMAGE)) {
+            dummyRaw();
+        } else {
+            mRawAvailable = false;
+        }
 
 #ifdef COPY_IMAGE_BUFFER
-                    {
-                        android::AutoMutex lock(mBurstLock);
+        {
+            android::AutoMutex lock(mBurstLock);
 #if defined(OMAP_ENHANCEMENT)
-                        if ( mBurst )
-                        {
-                            copyAndSendPictureFrame(frame, CAMERA_MSG_COMPRESSED_BURST_IMAGE);
-                        }
-                        else
+            if ( mBurst )
+            {
+                copyAndSendPictureFrame(frame, CAMERA_MSG_COMPRESSED_BURST_IMAGE);
+            }
+            else
 #endif
-                        {
-                            copyAndSendPictureFrame(frame, CAMERA_MSG_COMPRESSED_IMAGE);
-                        }
-                    }
+            {
+                copyAndSendPictureFrame(frame, CAMERA_MSG_COMPRESSED_IMAGE);
+            }
+        }
 #else
-                     //TODO: Find a way to map a Tiler buffer to a MemoryHeapBase
+         //TODO: Find a way to map a Tiler buffer to a MemoryHeapBase
 #endif
+        }
+    else if ( ( CameraFrame::VIDEO_FRAME_SYNC == frame->mFrameType ) &&
+                 ( NULL != mCameraHal ) &&
+                 ( NULL != mDataCb) &&
+                 ( mCameraHal->msgTypeEnabled(CAMERA_MSG_VIDEO_FRAME)  ) )
+        {
+        android::AutoMutex locker(mRecordingLock);
+        if(mRecording)
+            {
+            if(mUseMetaDataBufferMode)
+                {
+                camera_memory_t *videoMedatadaBufferMemory = NULL;
+                video_metadata_t *videoMetadataBuffer = NULL;
+                ssize_t index = -1;
+
+                if ( NULL != frame->mBuffer )
+                    {
+                    index = mVideoMetadataBufferMemoryMap.indexOfKey(frame->mBuffer->opaque);
                     }
-                else if ( ( CameraFrame::VIDEO_FRAME_SYNC == frame->mFrameType ) &&
-                             ( NULL != mCameraHal ) &&
-                             ( NULL != mDataCb) &&
-                             ( mCameraHal->msgTypeEnabled(CAMERA_MSG_VIDEO_FRAME)  ) )
+                if ( 0 <= index )
                     {
-                    android::AutoMutex locker(mRecordingLock);
-                    if(mRecording)
-                        {
-                        if(mUseMetaDataBufferMode)
-                            {
-                            camera_memory_t *videoMedatadaBufferMemory =
-                                             mVideoMetadataBufferMemoryMap.valueFor(frame->mBuffer->opaque);
-                            video_metadata_t *videoMetadataBuffer = (video_metadata_t *) videoMedatadaBufferMemory->data;
-
-                            if( (NULL == videoMedatadaBufferMemory) || (NULL == videoMetadataBuffer) || (NULL == frame->mBuffer) )
-                                {
-                                CAMHAL_LOGEA("Error! One of the video buffers is NULL");
-                                break;
-                                }
-
-                            if ( mUseVideoBuffers )
-                              {
-                                CameraBuffer *vBuf = mVideoMap.valueFor(frame->mBuffer->opaque);
-                                android::GraphicBufferMapper &mapper = android::GraphicBufferMapper::get();
-                                android::Rect bounds;
-                                bounds.left = 0;
-                                bounds.top = 0;
-                                bounds.right = mVideoWidth;
-                                bounds.bottom = mVideoHeight;
-
-                                void *y_uv[2];
-                                mapper.lock((buffer_handle_t)vBuf, CAMHAL_GRALLOC_USAGE, bounds, y_uv);
-                                y_uv[1] = y_uv[0] + mVideoHeight*4096;
-
-                                structConvImage input =  {frame->mWidth,
-                                                          frame->mHeight,
-                                                          4096,
-                                                          IC_FORMAT_YCbCr420_lp,
-                                                          (mmByte *)frame->mYuv[0],
-                                                          (mmByte *)frame->mYuv[1],
-                                                          frame->mOffset};
-
-                                structConvImage output = {mVideoWidth,
-                                                          mVideoHeight,
-                                                          4096,
-                                                          IC_FORMAT_YCbCr420_lp,
-                                                          (mmByte *)y_uv[0],
-                                                          (mmByte *)y_uv[1],
-                                                          0};
-
-                                VT_resizeFrame_Video_opt2_lp(&input, &output, NULL, 0);
-                                mapper.unlock((buffer_handle_t)vBuf->opaque);
-                                videoMetadataBuffer->metadataBufferType = (int) android::kMetadataBufferTypeCameraSource;
-                                /* FIXME remove cast */
-                                videoMetadataBuffer->handle = (void *)vBuf->opaque;
-                                videoMetadataBuffer->offset = 0;
-                              }
-                            else
-                              {
-                                videoMetadataBuffer->metadataBufferType = (int) android::kMetadataBufferTypeCameraSource;
-                                videoMetadataBuffer->handle = camera_buffer_get_omx_ptr(frame->mBuffer);
-                                videoMetadataBuffer->offset = frame->mOffset;
-                              }
-
-                            CAMHAL_LOGVB("mDataCbTimestamp : frame->mBuffer=0x%x, videoMetadataBuffer=0x%x, videoMedatadaBufferMemory=0x%x",
-                                            frame->mBuffer->opaque, videoMetadataBuffer, videoMedatadaBufferMemory);
-
-                            mDataCbTimestamp(frame->mTimestamp, CAMERA_MSG_VIDEO_FRAME,
-                                                videoMedatadaBufferMemory, 0, mCallbackCookie);
-                            }
-                        else
-                            {
-                            //TODO: Need to revisit this, should ideally be mapping the TILER buffer using mRequestMemory
-                            camera_memory_t* fakebuf = mRequestMemory(-1, sizeof(buffer_handle_t), 1, NULL);
-                            if( (NULL == fakebuf) || ( NULL == fakebuf->data) || ( NULL == frame->mBuffer))
-                                {
-                                CAMHAL_LOGEA("Error! One of the video buffers is NULL");
-                                break;
-                                }
-
-                            *reinterpret_cast<buffer_handle_t*>(fakebuf->data) = reinterpret_cast<buffer_handle_t>(frame->mBuffer->mapped);
-                            mDataCbTimestamp(frame->mTimestamp, CAMERA_MSG_VIDEO_FRAME, fakebuf, 0, mCallbackCookie);
-                            fakebuf->release(fakebuf);
-                            }
-                        }
+                    videoMedatadaBufferMemory = mVideoMetadataBufferMemoryMap.valueAt(index);
                     }
-                else if(( CameraFrame::SNAPSHOT_FRAME == frame->mFrameType ) &&
-                             ( NULL != mCameraHal ) &&
-                             ( NULL != mDataCb) &&
-                             ( NULL != mNotifyCb)) {
-                    //When enabled, measurement data is sent instead of video data
-                    if ( !mMeasurementEnabled ) {
-                        copyAndSendPreviewFrame(frame, CAMERA_MSG_POSTVIEW_FRAME);
-                    } else {
+                if ( NULL != videoMedatadaBufferMemory )
+                    {
+                    videoMetadataBuffer = (video_metadata_t *) videoMedatadaBufferMemory->data;
+                    }
+
+                if( (NULL == videoMedatadaBufferMemory) || (NULL == videoMetadataBuffer) )
+                    {
+                    CAMHAL_LOGEA("Error! One of the video buffers is NULL");
+                    if ( NULL != frame->mBuffer )
+                        {
                         mFrameProvider->returnFrame(frame->mBuffer,
                                                     (CameraFrame::FrameType) frame->mFrameType);
+                        }
+                    return;
                     }
+
+                if ( mUseVideoBuffers )
+                  {
+                    CameraBuffer *vBuf = mVideoMap.valueFor(frame->mBuffer->opaque);
+                    android::GraphicBufferMapper &mapper = android::GraphicBufferMapper::get();
+                    android::Rect bounds;
+                    bounds.left = 0;
+                    bounds.top = 0;
+                    bounds.right = mVideoWidth;
+                    bounds.bottom = mVideoHeight;
+
+                    void *y_uv[2];
+                    mapper.lock((buffer_handle_t)vBuf, CAMHAL_GRALLOC_USAGE, bounds, y_uv);
+                    y_uv[1] = y_uv[0] + mVideoHeight*4096;
+
+                    structConvImage input =  {frame->mWidth,
+                                              frame->mHeight,
+                                              4096,
+                                              IC_FORMAT_YCbCr420_lp,
+                                              (mmByte *)frame->mYuv[0],
+                                              (mmByte *)frame->mYuv[1],
+                                              frame->mOffset};
+
+                    structConvImage output = {mVideoWidth,
+                                              mVideoHeight,
+                                              4096,
+                                              IC_FORMAT_YCbCr420_lp,
+                                              (mmByte *)y_uv[0],
+                                              (mmByte *)y_uv[1],
+                                              0};
+
+                    if ( mResizePool.get() )
+                      {
+                        if ( mResizePool->resize(&input, &output, NULL,
+                                                 mResizeDop, mResizeDeadline) == TIMED_OUT )
+                          {
+                            CAMHAL_LOGDA("Video frame resize missed its deadline");
+                          }
+                      }
+                    else
+                      {
+                        VT_resizeFrame_Video_opt2_lp(&input, &output, NULL, 0);
+                      }
+                    mapper.unlock((buffer_handle_t)vBuf->opaque);
+                    videoMetadataBuffer->metadataBufferType = (int) android::kMetadataBufferTypeCameraSource;
+                    /* FIXME remove cast */
+                    videoMetadataBuffer->handle = (void *)vBuf->opaque;
+                    videoMetadataBuffer->offset = 0;
+                  }
+                else
+                  {
+                    videoMetadataBuffer->metadataBufferType = (int) android::kMetadataBufferTypeCameraSource;
+                    videoMetadataBuffer->handle = camera_buffer_get_omx_ptr(frame->mBuffer);
+                    videoMetadataBuffer->offset = frame->mOffset;
+                  }
+
+                CAMHAL_LOGVB("mDataCbTimestamp : frame->mBuffer=0x%x, videoMetadataBuffer=0x%x, videoMedatadaBufferMemory=0x%x",
+                                frame->mBuffer->opaque, videoMetadataBuffer, videoMedatadaBufferMemory);
+
+                mDataCbTimestamp(frame->mTimestamp, CAMERA_MSG_VIDEO_FRAME,
+                                    videoMedatadaBufferMemory, 0, mCallbackCookie);
                 }
-                else if ( ( CameraFrame::PREVIEW_FRAME_SYNC== frame->mFrameType ) &&
-                            ( NULL != mCameraHal ) &&
-                            ( NULL != mDataCb) &&
-                            ( mCameraHal->msgTypeEnabled(CAMERA_MSG_PREVIEW_FRAME)) ) {
-                    //When enabled, measurement data is sent instead of video data
-                    if ( !mMeasurementEnabled ) {
-                        copyAndSendPreviewFrame(frame, CAMERA_MSG_PREVIEW_FRAME);
-                    } else {
-                         mFrameProvider->returnFrame(frame->mBuffer,
-                                                     (CameraFrame::FrameType) frame->mFrameType);
+            else
+                {
+                //TODO: Need to revisit this, should ideally be mapping the TILER buffer using mRequestMemory
+                camera_memory_t* fakebuf = mRequestMemory(-1, sizeof(buffer_handle_t), 1, NULL);
+                if( (NULL == fakebuf) || ( NULL == fakebuf->data) || ( NULL == frame->mBuffer))
+                    {
+                    CAMHAL_LOGEA("Error! One of the video buffers is NULL");
+                    return;
                     }
-                }
-                else if ( ( CameraFrame::FRAME_DATA_SYNC == frame->mFrameType ) &&
-                            ( NULL != mCameraHal ) &&
-                            ( NULL != mDataCb) &&
-                            ( mCameraHal->msgTypeEnabled(CAMERA_MSG_PREVIEW_FRAME)) ) {
-                    copyAndSendPreviewFrame(frame, CAMERA_MSG_PREVIEW_FRAME);
-                } else {
-                    mFrameProvider->returnFrame(frame->mBuffer,
-                                                ( CameraFrame::FrameType ) frame->mFrameType);
-                    CAMHAL_LOGDB("Frame type 0x%x is still unsupported!", frame->mFrameType);
-                }
-
-                break;
-
-        default:
 
-            break;
-
-        };
-
-exit:
-
-    if ( NULL != frame )
-        {
-        delete frame;
+                *reinterpret_cast<buffer_handle_t*>(fakebuf->data) = reinterpret_cast<buffer_handle_t>(frame->mBuffer->mapped);
+                mDataCbTimestamp(frame->mTimestamp, CAMERA_MSG_VIDEO_FRAME, fakebuf, 0, mCallbackCookie);
+                fakebuf->release(fakebuf);
+                }
+            }
+        }
+    else if(( CameraFrame::SNAPSHOT_FRAME == frame->mFrameType ) &&
+                 ( NULL != mCameraHal ) &&
+                 ( NULL != mDataCb) &&
+                 ( NULL != mNotifyCb)) {
+        //When enabled, measurement data is sent instead of video data
+        if ( !mMeasurementEnabled ) {
+            copyAndSendPreviewFrame(frame, CAMERA_MSG_POSTVIEW_FRAME);
+        } else {
+            mFrameProvider->returnFrame(frame->mBuffer,
+                                        (CameraFrame::FrameType) frame->mFrameType);
         }
+    }
+    else if ( ( CameraFrame::PREVIEW_FRAME_SYNC== frame->mFrameType ) &&
+                ( NULL != mCameraHal ) &&
+                ( NULL != mDataCb) &&
+                ( mCameraHal->msgTypeEnabled(CAMERA_MSG_PREVIEW_FRAME)) ) {
+        //When enabled, measurement data is sent instead of video data
+        if ( !mMeasurementEnabled ) {
+            copyAndSendPreviewFrame(frame, CAMERA_MSG_PREVIEW_FRAME);
+        } else {
+             mFrameProvider->returnFrame(frame->mBuffer,
+                                         (CameraFrame::FrameType) frame->mFrameType);
+        }
+    }
+    else if ( ( CameraFrame::FRAME_DATA_SYNC == frame->mFrameType ) &&
+                ( NULL != mCameraHal ) &&
+                ( NULL != mDataCb) &&
+                ( mCameraHal->msgTypeEnabled(CAMERA_MSG_PREVIEW_FRAME)) ) {
+        copyAndSendPreviewFrame(frame, CAMERA_MSG_PREVIEW_FRAME);
+    } else {
+        mFrameProvider->returnFrame(frame->mBuffer,
+                                    ( CameraFrame::FrameType ) frame->mFrameType);
+        CAMHAL_LOGDB("Frame type 0x%x is still unsupported!", frame->mFrameType);
+    }
 
     LOG_FUNCTION_NAME_EXIT;
 }
@@ -1182,25 +1421,34 @@ void AppCallbackNotifier::frameCallbackRelay(CameraFrame* caFrame)
 
 void AppCallbackNotifier::frameCallback(CameraFrame* caFrame)
 {
-    ///Post the event to the event queue of AppCallbackNotifier
-    Utils::Message msg;
-    CameraFrame *frame;
+    ///Copy the frame to the frame ring of AppCallbackNotifier
+    status_t ret;
 
     LOG_FUNCTION_NAME;
 
     if ( NULL != caFrame )
         {
 
-        frame = new CameraFrame(*caFrame);
-        if ( NULL != frame )
+        ret = mFrameRing->put(*caFrame);
+
+        ///The ring is full, the preview frame is skipped
+        if ( WOULD_BLOCK == ret )
             {
-              msg.command = AppCallbackNotifier::NOTIFIER_CMD_PROCESS_FRAME;
-              msg.arg1 = frame;
-              mFrameQ.put(&msg);
+            CAMHAL_LOGDB("Dropping preview frame %p", caFrame->mBuffer);
+            if ( NULL != mMetrics.get() )
+                {
+                mMetrics->count(CameraMetrics::DROPPED_CALLBACK);
+                }
             }
-        else
+        else if ( NO_ERROR != ret )
+            {
+            CAMHAL_LOGEA("Couldn't queue CameraFrame");
+            }
+
+        if ( NO_ERROR != ret )
             {
-            CAMHAL_LOGEA("Not enough resources to allocate CameraFrame");
+            mFrameProvider->returnFrame(caFrame->mBuffer,
+                                        (CameraFrame::FrameType) caFrame->mFrameType);
             }
 
         }
@@ -1212,19 +1460,17 @@ void AppCallbackNotifier::flushAndReturnFrames()
 {
     LOG_FUNCTION_NAME;
 
-    Utils::Message msg;
-    CameraFrame *frame;
+    CameraFrame frame;
+    bool stale;
 
     android::AutoMutex lock(mLock);
-    while (!mFrameQ.isEmpty()) {
-        mFrameQ.get(&msg);
-        frame = (CameraFrame*) msg.arg1;
-        if (frame) {
-            mFrameProvider->returnFrame(frame->mBuffer,
-                                        (CameraFrame::FrameType) frame->mFrameType);
-        }
+    while ( NO_ERROR == mFrameRing->get(frame, stale) ) {
+        mFrameProvider->returnFrame(frame.mBuffer,
+                                    (CameraFrame::FrameType) frame.mFrameType);
     }
 
+    returnLentPreviewFrames();
+
     LOG_FUNCTION_NAME_EXIT;
 }
 
@@ -1301,6 +1547,12 @@ bool AppCallbackNotifier::processMessage()
             ret = false;
             break;
           }
+        case NotificationThread::NOTIFIER_RETURN_LENT_FRAMES:
+          {
+            android::AutoMutex lock(mLock);
+            returnLentPreviewFrames();
+            break;
+          }
         default:
           {
             CAMHAL_LOGEA("Error: ProcessMsg() command from Camera HAL");
@@ -1322,6 +1574,11 @@ AppCallbackNotifier::~AppCallbackNotifier()
     ///Stop app callback notifier if not already stopped
     stop();
 
+    ///Join the encoder threads, any job left is completed as canceled
+    mEncoderPool.clear();
+
+    mResizePool.clear();
+
     ///Unregister with the frame provider
     if ( NULL != mFrameProvider )
         {
@@ -1441,6 +1698,11 @@ void AppCallbackNotifier::setFrameProvider(FrameNotifier *frameNotifier)
     LOG_FUNCTION_NAME_EXIT;
 }
 
+void AppCallbackNotifier::setMetrics(const android::sp<CameraMetrics> &metrics)
+{
+    mMetrics = metrics;
+}
+
 size_t AppCallbackNotifier::calculateBufferSize(size_t width, size_t height, const char *pixelFormat)
 {
     size_t res = 0;
@@ -1527,6 +1789,18 @@ status_t AppCallbackNotifier::startPreviewCallbacks(android::CameraParameters &p
         mPreviewBuffers[i].mapped = mPreviewBuffers[i].opaque;
     }
 
+    // NV12 clients that can deal with the native stride may read the
+    // preview buffers directly, the copy above is still needed for postview
+    // frames and as fallback
+    const char *valstr = params.get(TICameraParameters::KEY_PREVIEW_CALLBACK_ZERO_COPY);
+    if ( ( NULL != valstr ) && ( strcmp(valstr, android::CameraParameters::TRUE) == 0 ) ) {
+        if ( strcmp(mPreviewPixelFormat, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0 ) {
+            setupZeroCopyPreview(buffers, length, count);
+        } else {
+            CAMHAL_LOGDB("Zero copy preview callbacks need NV12, not %s", mPreviewPixelFormat);
+        }
+    }
+
     if ( mCameraHal->msgTypeEnabled(CAMERA_MSG_PREVIEW_FRAME ) ) {
          mFrameProvider->enableFrameNotification(CameraFrame::PREVIEW_FRAME_SYNC);
     }
@@ -1536,6 +1810,7 @@ status_t AppCallbackNotifier::startPreviewCallbacks(android::CameraParameters &p
     }
 
     mPreviewBufCount = 0;
+    mLastCopiedPreview = -1;
 
     mPreviewing = true;
 
@@ -1599,6 +1874,7 @@ status_t AppCallbackNotifier::stopPreviewCallbacks()
 
     {
     android::AutoMutex lock(mLock);
+    releaseZeroCopyPreview();
     mPreviewMemory->release(mPreviewMemory);
     mPreviewMemory = 0;
     }
@@ -1643,6 +1919,33 @@ status_t AppCallbackNotifier::startRecording()
          mFrameProvider->enableFrameNotification(CameraFrame::VIDEO_FRAME_SYNC);
         }
 
+    if ( mResizePool.get() )
+        {
+        char value[PROPERTY_VALUE_MAX];
+        int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        // tiles per video frame resize, 0 uses every pool thread plus the
+        // notifier thread as far as there are cores for them, 1 disables tiling
+        property_get("debug.camera.resize.dop", value, "0");
+        mResizeDop = atoi(value);
+        if ( mResizeDop <= 0 )
+            {
+            mResizeDop = mResizePool->getThreadCount() + 1;
+            if ( ( cpus > 0 ) && ( mResizeDop > cpus ) )
+                {
+                mResizeDop = cpus;
+                }
+            }
+
+        // deadline per frame in ms, 0 for none
+        property_get("debug.camera.resize.deadline", value, "33");
+        mResizeDeadline = ms2ns(atoi(value));
+
+        mResizePool->resetStats();
+
+        CAMHAL_LOGDB("Video frame resize with %d tiles, deadline %d ms", mResizeDop, atoi(value));
+        }
+
     mRecording = true;
 
     LOG_FUNCTION_NAME_EXIT;
@@ -1724,6 +2027,22 @@ status_t AppCallbackNotifier::stopRecording()
     ///Release the shared video buffers
     releaseSharedVideoBuffers();
 
+    if ( mResizePool.get() )
+        {
+        NV12ResizePool::Stats stats;
+
+        mResizePool->getStats(stats);
+        if ( stats.frames )
+            {
+            CAMHAL_LOGI("Video frame resize: %u frames (%u tiled), avg %lld us, max %lld us, "
+                         "%u over deadline, %lld ms saved over serial resize",
+                         stats.frames, stats.tiledFrames,
+                         (long long) (ns2us(stats.totalFrameTime) / stats.frames),
+                         (long long) ns2us(stats.maxFrameTime), stats.deadlineMisses,
+                         (long long) ns2ms(stats.totalWorkTime - stats.totalFrameTime));
+            }
+        }
+
     mRecording = false;
 
     LOG_FUNCTION_NAME_EXIT;
@@ -1799,6 +2118,15 @@ status_t AppCallbackNotifier::disableMsgType(int32_t msgType)
 {
     if( msgType & CAMERA_MSG_PREVIEW_FRAME ) {
         mFrameProvider->disableFrameNotification(CameraFrame::PREVIEW_FRAME_SYNC);
+
+        // nobody consumes preview frames anymore. This can be called from
+        // inside a preview callback, with mLock held by the notifier thread,
+        // so the lent frames are given back from that thread
+        if ( NULL != mNotificationThread.get() ) {
+            Utils::Message msg = {0,0,0,0,0,0};
+            msg.command = NotificationThread::NOTIFIER_RETURN_LENT_FRAMES;
+            mNotificationThread->msgQ().put(&msg);
+        }
     }
 
     if( msgType & CAMERA_MSG_POSTVIEW_FRAME ) {
@@ -1846,7 +2174,12 @@ status_t AppCallbackNotifier::start()
     mNotifierState = AppCallbackNotifier::NOTIFIER_STARTED;
     CAMHAL_LOGDA(" --> AppCallbackNotifier NOTIFIER_STARTED \n");
 
-    gEncoderQueue.clear();
+    mFrameRing->resetStats();
+
+    {
+        android::AutoMutex lock(mEncoderLock);
+        mEncoderQueue.clear();
+    }
 
     LOG_FUNCTION_NAME_EXIT;
 
@@ -1871,11 +2204,33 @@ status_t AppCallbackNotifier::stop()
     CAMHAL_LOGDA(" --> AppCallbackNotifier NOTIFIER_STOPPED \n");
     }
 
-    while(!gEncoderQueue.isEmpty()) {
-        android::sp<Encoder_libjpeg> encoder = gEncoderQueue.valueAt(0);
+    {
+    FrameSlotRing::Stats stats;
+
+    mFrameRing->getStats(stats);
+    if ( stats.frames )
+        {
+        CAMHAL_LOGI("Frame delivery: %u frames, avg latency %u us, max %u us, "
+                     "%u waited for the ring, %u preview frames dropped",
+                     stats.frames, stats.totalLatency / stats.frames,
+                     stats.maxLatency, stats.waits, stats.drops);
+        }
+    }
+
+    for (;;) {
+        android::sp<Encoder_libjpeg> encoder;
         camera_memory_t* encoded_mem = NULL;
         ExifElementsTable* exif = NULL;
 
+        {
+            android::AutoMutex lock(mEncoderLock);
+            if (mEncoderQueue.isEmpty()) {
+                break;
+            }
+            encoder = mEncoderQueue.valueAt(0);
+            mEncoderQueue.removeItemsAt(0);
+        }
+
         if(encoder.get()) {
             encoder->cancel();
 
@@ -1889,7 +2244,6 @@ status_t AppCallbackNotifier::stop()
 
             encoder.clear();
         }
-        gEncoderQueue.removeItemsAt(0);
     }
 
     LOG_FUNCTION_NAME_EXIT;
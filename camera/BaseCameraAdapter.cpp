@@ -16,6 +16,9 @@
 
 #include "BaseCameraAdapter.h"
 
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+
 const int EVENT_MASK = 0xffff;
 
 namespace Ti {
@@ -86,15 +89,19 @@ BaseCameraAdapter::BaseCameraAdapter()
     mPreviewDataBuffersCount = 0;
     mPreviewDataBuffersLength = 0;
 
-    mAdapterState = INTIALIZED_STATE;
+    mFramePointersCount = 0;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-    mStartFocus.tv_sec = 0;
-    mStartFocus.tv_usec = 0;
-    mStartCapture.tv_sec = 0;
-    mStartCapture.tv_usec = 0;
-#endif
+    // nothing was reported yet
+    mParametersChanged = 1;
+
+    // the preview is starving while fewer buffers than this are queued
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.camera.starvation.threshold", value, "2");
+    memset(&mStarvationStats, 0, sizeof(mStarvationStats));
+    mStarvationStats.mThreshold = atoi(value);
+    mStarvedRun = 0;
 
+    mAdapterState = INTIALIZED_STATE;
 }
 
 BaseCameraAdapter::~BaseCameraAdapter()
@@ -114,6 +121,11 @@ BaseCameraAdapter::~BaseCameraAdapter()
      mSnapshotSubscribers.clear();
      mMetadataSubscribers.clear();
 
+     {
+     android::AutoMutex deliveryLock(mDeliveryQueueLock);
+     mDeliveryQueues.clear();
+     }
+
      LOG_FUNCTION_NAME_EXIT;
 }
 
@@ -275,6 +287,20 @@ void BaseCameraAdapter::disableMsgType(int32_t msgs, void* cookie)
                 CAMHAL_LOGEA("Frame message type id=0x%x subscription remove not supported yet!", frameMsg);
                 break;
             }
+
+        // frames already queued for the subscriber go back to the adapter
+        android::sp<FrameDeliveryQueue> queue = getDeliveryQueue((int) cookie);
+        if ( NULL != queue.get() )
+            {
+            if ( CameraFrame::ALL_FRAMES == frameMsg )
+                {
+                disableAsyncDelivery(cookie);
+                }
+            else
+                {
+                queue->flush(frameMsg);
+                }
+            }
         }
 
     if ( eventMsg != 0 )
@@ -304,13 +330,11 @@ void BaseCameraAdapter::addFramePointers(CameraBuffer *frameBuf, void *buf)
 
   if ((frameBuf != NULL) && ( pBuf != NULL) )
     {
-      CameraFrame *frame = new CameraFrame;
-      frame->mBuffer = frameBuf;
-      frame->mYuv[0] = pBuf[0];
-      frame->mYuv[1] = pBuf[1];
-      mFrameQueue.add(frameBuf, frame);
+      frameBuf->yuv[0] = pBuf[0];
+      frameBuf->yuv[1] = pBuf[1];
+      mFramePointersCount++;
 
-      CAMHAL_LOGVB("Adding Frame=0x%x Y=0x%x UV=0x%x", frame->mBuffer, frame->mYuv[0], frame->mYuv[1]);
+      CAMHAL_LOGVB("Adding Frame=0x%x Y=0x%x UV=0x%x", frameBuf, frameBuf->yuv[0], frameBuf->yuv[1]);
     }
 }
 
@@ -318,22 +342,113 @@ void BaseCameraAdapter::removeFramePointers()
 {
   android::AutoMutex lock(mSubscriberLock);
 
-  int size = mFrameQueue.size();
-  CAMHAL_LOGVB("Removing %d Frames = ", size);
-  for (int i = 0; i < size; i++)
+  // the plane addresses stay in the buffers until they are freed or
+  // registered again, lookups are gated by the count
+  CAMHAL_LOGVB("Removing %d Frames", mFramePointersCount);
+  mFramePointersCount = 0;
+}
+
+status_t BaseCameraAdapter::enableAsyncDelivery(void *cookie, size_t depth, DeliveryPolicy policy)
+{
+    android::sp<FrameDeliveryQueue> queue;
+    status_t ret = NO_ERROR;
+
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mDeliveryQueueLock);
+
+    if ( 0 <= mDeliveryQueues.indexOfKey((int) cookie) )
+        {
+        CAMHAL_LOGDB("Subscriber %p already has a delivery queue", cookie);
+        return ALREADY_EXISTS;
+        }
+
+    queue = new FrameDeliveryQueue(this, depth, policy, mMetrics);
+    if ( NULL == queue.get() )
+        {
+        CAMHAL_LOGEA("Couldn't create delivery queue");
+        return NO_MEMORY;
+        }
+
+    ret = queue->start("FrameDelivery");
+    if ( NO_ERROR == ret )
+        {
+        mDeliveryQueues.add((int) cookie, queue);
+        CAMHAL_LOGDB("Subscriber %p gets frames from a queue of %d, policy %d", cookie, depth, policy);
+        }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
+void BaseCameraAdapter::disableAsyncDelivery(void *cookie)
+{
+    android::sp<FrameDeliveryQueue> queue;
+    FrameDeliveryQueue::Stats stats;
+
+    LOG_FUNCTION_NAME;
+
     {
-      CameraFrame *frame = (CameraFrame *)mFrameQueue.valueAt(i);
-      CAMHAL_LOGVB("Free Frame=0x%x Y=0x%x UV=0x%x", frame->mBuffer, frame->mYuv[0], frame->mYuv[1]);
-      delete frame;
+    android::AutoMutex lock(mDeliveryQueueLock);
+    ssize_t index = mDeliveryQueues.indexOfKey((int) cookie);
+
+    if ( 0 > index )
+        {
+        return;
+        }
+
+    queue = mDeliveryQueues.valueAt(index);
+    mDeliveryQueues.removeItemsAt(index);
     }
-  mFrameQueue.clear();
+
+    // frames may still be posted by a dispatch that looked the queue up
+    // before it was removed, stop() returns them
+    queue->stop();
+
+    queue->getStats(stats);
+    if ( 0 < stats.frames )
+        {
+        CAMHAL_LOGI("Frame delivery to %p: %u frames, avg latency %lld us, max %lld us, "
+                    "%u dropped, max depth %u",
+                    cookie, stats.frames, (long long) (ns2us(stats.totalLatency) / stats.frames),
+                    (long long) ns2us(stats.maxLatency), stats.drops, stats.maxDepth);
+        }
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
+void BaseCameraAdapter::setMetrics(const android::sp<CameraMetrics> &metrics)
+{
+    mMetrics = metrics;
+}
+
+bool BaseCameraAdapter::takesCarvedBuffers(CameraMode mode)
+{
+    // buffers handed to the hardware by fd need an allocation of their own
+    return false;
+}
+
+android::sp<FrameDeliveryQueue> BaseCameraAdapter::getDeliveryQueue(int cookie)
+{
+    android::AutoMutex lock(mDeliveryQueueLock);
+    ssize_t index = mDeliveryQueues.indexOfKey(cookie);
+
+    if ( 0 > index )
+        {
+        return NULL;
+        }
+
+    return mDeliveryQueues.valueAt(index);
 }
 
 void BaseCameraAdapter::returnFrame(CameraBuffer * frameBuf, CameraFrame::FrameType frameType)
 {
     status_t res = NO_ERROR;
-    size_t subscriberCount = 0;
+    int shift = getRefCountShift(frameType);
+    int32_t oldCounts, newCounts;
     int refCount = -1;
+    nsecs_t returned = systemTime();
 
     if ( NULL == frameBuf )
         {
@@ -341,45 +456,52 @@ void BaseCameraAdapter::returnFrame(CameraBuffer * frameBuf, CameraFrame::FrameT
         return;
         }
 
-    if ( NO_ERROR == res)
-        {
-        android::AutoMutex lock(mReturnFrameLock);
-
-        refCount = getFrameRefCount(frameBuf,  frameType);
-
-        if(frameType == CameraFrame::PREVIEW_FRAME_SYNC)
-            {
-            mFramesWithDisplay--;
-            }
-        else if(frameType == CameraFrame::VIDEO_FRAME_SYNC)
-            {
-            mFramesWithEncoder--;
-            }
-
-        if ( 0 < refCount )
-            {
-
-            refCount--;
-            setFrameRefCount(frameBuf, frameType, refCount);
-
+    FrameTracer::trace(FrameTracer::RETURN_FRAME, frameBuf, frameType);
 
-            if ( mRecording && (CameraFrame::VIDEO_FRAME_SYNC == frameType) ) {
-                refCount += getFrameRefCount(frameBuf, CameraFrame::PREVIEW_FRAME_SYNC);
-            } else if ( mRecording && (CameraFrame::PREVIEW_FRAME_SYNC == frameType) ) {
-                refCount += getFrameRefCount(frameBuf, CameraFrame::VIDEO_FRAME_SYNC);
-            } else if ( mRecording && (CameraFrame::SNAPSHOT_FRAME == frameType) ) {
-                refCount += getFrameRefCount(frameBuf, CameraFrame::VIDEO_FRAME_SYNC);
-            }
+    if(frameType == CameraFrame::PREVIEW_FRAME_SYNC)
+        {
+        android_atomic_dec(&mFramesWithDisplay);
+        }
+    else if(frameType == CameraFrame::VIDEO_FRAME_SYNC)
+        {
+        android_atomic_dec(&mFramesWithEncoder);
+        }
 
+    if ( 0 > shift )
+        {
+        CAMHAL_LOGDA("Frame returned when ref count is already zero!!");
+        return;
+        }
 
-            }
-        else
+    // the counts of all frame types change together, so exactly one of the
+    // returns sharing a buffer sees the last reference go away
+    do
+        {
+        oldCounts = android_atomic_acquire_load(&frameBuf->refCounts);
+        refCount = ( oldCounts >> shift ) & REF_COUNT_MASK;
+        if ( 0 == refCount )
             {
             CAMHAL_LOGDA("Frame returned when ref count is already zero!!");
             return;
             }
+        newCounts = oldCounts - ( 1 << shift );
+        } while ( android_atomic_release_cas(oldCounts, newCounts, &frameBuf->refCounts) );
+
+    if ( NULL != mMetrics.get() )
+        {
+        mMetrics->framesHeld(frameType, -1);
         }
 
+    refCount--;
+
+    if ( mRecording && (CameraFrame::VIDEO_FRAME_SYNC == frameType) ) {
+        refCount += ( newCounts >> getRefCountShift(CameraFrame::PREVIEW_FRAME_SYNC) ) & REF_COUNT_MASK;
+    } else if ( mRecording && (CameraFrame::PREVIEW_FRAME_SYNC == frameType) ) {
+        refCount += ( newCounts >> getRefCountShift(CameraFrame::VIDEO_FRAME_SYNC) ) & REF_COUNT_MASK;
+    } else if ( mRecording && (CameraFrame::SNAPSHOT_FRAME == frameType) ) {
+        refCount += ( newCounts >> getRefCountShift(CameraFrame::VIDEO_FRAME_SYNC) ) & REF_COUNT_MASK;
+    }
+
     CAMHAL_LOGVB("REFCOUNT 0x%x %d", frameBuf, refCount);
 
     if ( NO_ERROR == res )
@@ -398,6 +520,11 @@ void BaseCameraAdapter::returnFrame(CameraBuffer * frameBuf, CameraFrame::FrameT
             mBuffersWithDucati.add((int)camera_buffer_get_omx_ptr(frameBuf),1);
 #endif
             res = fillThisBuffer(frameBuf, frameType);
+
+            if ( NULL != mMetrics.get() )
+                {
+                mMetrics->record(CameraMetrics::RETURN_TO_FILL, systemTime() - returned);
+                }
             }
         }
 
@@ -405,7 +532,6 @@ void BaseCameraAdapter::returnFrame(CameraBuffer * frameBuf, CameraFrame::FrameT
 
 status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, int value2, int value3, int value4) {
     status_t ret = NO_ERROR;
-    struct timeval *refTimestamp;
     BuffersDescriptor *desc = NULL;
     CameraFrame *frame = NULL;
 
@@ -432,17 +558,19 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
                     android::AutoMutex lock(mPreviewBufferLock);
                     mPreviewBuffers = desc->mBuffers;
                     mPreviewBuffersLength = desc->mLength;
-                    mPreviewBuffersAvailable.clear();
+                    clearFrameRefCounts(mPreviewBuffersAvailable, CameraFrame::PREVIEW_FRAME_SYNC);
                     mSnapshotBuffersAvailable.clear();
                     for ( uint32_t i = 0 ; i < desc->mMaxQueueable ; i++ )
                         {
                         mPreviewBuffersAvailable.add(&mPreviewBuffers[i], 0);
+                        resetFrameRefCounts(&mPreviewBuffers[i], CameraFrame::PREVIEW_FRAME_SYNC, 0);
                         }
                     // initial ref count for undeqeueued buffers is 1 since buffer provider
                     // is still holding on to it
                     for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ )
                         {
                         mPreviewBuffersAvailable.add(&mPreviewBuffers[i], 1);
+                        resetFrameRefCounts(&mPreviewBuffers[i], CameraFrame::PREVIEW_FRAME_SYNC, 1);
                         }
                     }
 
@@ -486,16 +614,18 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
                         android::AutoMutex lock(mPreviewDataBufferLock);
                         mPreviewDataBuffers = desc->mBuffers;
                         mPreviewDataBuffersLength = desc->mLength;
-                        mPreviewDataBuffersAvailable.clear();
+                        clearFrameRefCounts(mPreviewDataBuffersAvailable, CameraFrame::FRAME_DATA_SYNC);
                         for ( uint32_t i = 0 ; i < desc->mMaxQueueable ; i++ )
                             {
                             mPreviewDataBuffersAvailable.add(&mPreviewDataBuffers[i], 0);
+                            resetFrameRefCounts(&mPreviewDataBuffers[i], CameraFrame::FRAME_DATA_SYNC, 0);
                             }
                         // initial ref count for undeqeueued buffers is 1 since buffer provider
                         // is still holding on to it
                         for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ )
                             {
                             mPreviewDataBuffersAvailable.add(&mPreviewDataBuffers[i], 1);
+                            resetFrameRefCounts(&mPreviewDataBuffers[i], CameraFrame::FRAME_DATA_SYNC, 1);
                             }
                         }
 
@@ -539,16 +669,18 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
                     android::AutoMutex lock(mCaptureBufferLock);
                     mCaptureBuffers = desc->mBuffers;
                     mCaptureBuffersLength = desc->mLength;
-                    mCaptureBuffersAvailable.clear();
+                    clearFrameRefCounts(mCaptureBuffersAvailable, CameraFrame::IMAGE_FRAME);
                     for ( uint32_t i = 0 ; i < desc->mMaxQueueable ; i++ )
                         {
                         mCaptureBuffersAvailable.add(&mCaptureBuffers[i], 0);
+                        resetFrameRefCounts(&mCaptureBuffers[i], CameraFrame::IMAGE_FRAME, 0);
                         }
                     // initial ref count for undeqeueued buffers is 1 since buffer provider
                     // is still holding on to it
                     for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ )
                         {
                         mCaptureBuffersAvailable.add(&mCaptureBuffers[i], 1);
+                        resetFrameRefCounts(&mCaptureBuffers[i], CameraFrame::IMAGE_FRAME, 1);
                         }
                     }
 
@@ -589,14 +721,16 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
             if (ret == NO_ERROR) {
                 android::AutoMutex lock(mVideoInBufferLock);
                 mVideoInBuffers = desc->mBuffers;
-                mVideoInBuffersAvailable.clear();
+                clearFrameRefCounts(mVideoInBuffersAvailable, CameraFrame::REPROCESS_INPUT_FRAME);
                 for (uint32_t i = 0 ; i < desc->mMaxQueueable ; i++) {
                     mVideoInBuffersAvailable.add(&mVideoInBuffers[i], 0);
+                    resetFrameRefCounts(&mVideoInBuffers[i], CameraFrame::REPROCESS_INPUT_FRAME, 0);
                 }
                 // initial ref count for undeqeueued buffers is 1 since buffer provider
                 // is still holding on to it
                 for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ ) {
                     mVideoInBuffersAvailable.add(&mVideoInBuffers[i], 1);
+                    resetFrameRefCounts(&mVideoInBuffers[i], CameraFrame::REPROCESS_INPUT_FRAME, 1);
                 }
                 ret = useBuffers(CameraAdapter::CAMERA_REPROCESS,
                                  desc->mBuffers,
@@ -678,6 +812,7 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
 
             if ( ret == NO_ERROR )
                 {
+                resetPreviewStarvation();
                 ret = startPreview();
                 }
 
@@ -781,16 +916,6 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
         case CameraAdapter::CAMERA_START_IMAGE_CAPTURE:
             {
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-            refTimestamp = ( struct timeval * ) value1;
-            if ( NULL != refTimestamp )
-                {
-                memcpy( &mStartCapture, refTimestamp, sizeof( struct timeval ));
-                }
-
-#endif
-
             if ( ret == NO_ERROR )
                 {
                 ret = setState(operation);
@@ -843,16 +968,6 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
         case CameraAdapter::CAMERA_START_BRACKET_CAPTURE:
             {
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-            refTimestamp = ( struct timeval * ) value2;
-            if ( NULL != refTimestamp )
-                {
-                memcpy( &mStartCapture, refTimestamp, sizeof( struct timeval ));
-                }
-
-#endif
-
             if ( ret == NO_ERROR )
                 {
                 ret = setState(operation);
@@ -904,16 +1019,6 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
 
         case CameraAdapter::CAMERA_PERFORM_AUTOFOCUS:
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-            refTimestamp = ( struct timeval * ) value1;
-            if ( NULL != refTimestamp )
-                {
-                memcpy( &mStartFocus, refTimestamp, sizeof( struct timeval ));
-                }
-
-#endif
-
             if ( ret == NO_ERROR )
                 {
                 ret = setState(operation);
@@ -1084,14 +1189,16 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
                  android::AutoMutex lock(mVideoBufferLock);
                  mVideoBuffers = desc->mBuffers;
                  mVideoBuffersLength = desc->mLength;
-                 mVideoBuffersAvailable.clear();
+                 clearFrameRefCounts(mVideoBuffersAvailable, CameraFrame::VIDEO_FRAME_SYNC);
                  for ( uint32_t i = 0 ; i < desc->mMaxQueueable ; i++ ) {
                      mVideoBuffersAvailable.add(&mVideoBuffers[i], 1);
+                     resetFrameRefCounts(&mVideoBuffers[i], CameraFrame::VIDEO_FRAME_SYNC, 1);
                  }
                  // initial ref count for undeqeueued buffers is 1 since buffer provider
                  // is still holding on to it
                  for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ ) {
                      mVideoBuffersAvailable.add(&mPreviewBuffers[i], 1);
+                     setFrameRefCount(&mPreviewBuffers[i], CameraFrame::VIDEO_FRAME_SYNC, 1);
                  }
              }
 
@@ -1129,6 +1236,23 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
             ret = cameraPreviewInitialization();
             break;
 
+        case CameraAdapter::CAMERA_QUERY_PREVIEW_STARVATION:
+            {
+            StarvationStats *stats = ( StarvationStats * ) value1;
+
+            if ( NULL == stats )
+                {
+                ret = -EINVAL;
+                }
+            else
+                {
+                android::AutoMutex lock(mStarvationLock);
+                *stats = mStarvationStats;
+                }
+
+            break;
+            }
+
         default:
             CAMHAL_LOGEB("Command 0x%x unsupported!", operation);
             break;
@@ -1138,6 +1262,61 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
     return ret;
 }
 
+void BaseCameraAdapter::markParametersChanged()
+{
+    android_atomic_release_store(1, &mParametersChanged);
+}
+
+bool BaseCameraAdapter::takeParametersChanged()
+{
+    return 0 != android_atomic_and(0, &mParametersChanged);
+}
+
+void BaseCameraAdapter::resetPreviewStarvation()
+{
+    android::AutoMutex lock(mStarvationLock);
+    uint32_t threshold = mStarvationStats.mThreshold;
+
+    memset(&mStarvationStats, 0, sizeof(mStarvationStats));
+    mStarvationStats.mThreshold = threshold;
+    mStarvedRun = 0;
+}
+
+void BaseCameraAdapter::updatePreviewStarvation(int queued)
+{
+    android::AutoMutex lock(mStarvationLock);
+    StarvationStats &stats = mStarvationStats;
+    uint32_t count = ( 0 < queued ) ? queued : 0;
+
+    stats.mFrames++;
+    if ( ( 1 == stats.mFrames ) || ( count < stats.mMinQueued ) )
+        {
+        stats.mMinQueued = count;
+        }
+
+    if ( count >= stats.mThreshold )
+        {
+        if ( 0 < mStarvedRun )
+            {
+            CAMHAL_LOGDB("Preview recovered after %u starved frames", mStarvedRun);
+            }
+        mStarvedRun = 0;
+        return;
+        }
+
+    stats.mStarvedFrames++;
+    if ( 0 == mStarvedRun++ )
+        {
+        stats.mEvents++;
+        CAMHAL_LOGW("Preview starving: %u buffers queued, threshold %u", count, stats.mThreshold);
+        }
+
+    if ( mStarvedRun > stats.mLongestRun )
+        {
+        stats.mLongestRun = mStarvedRun;
+        }
+}
+
 status_t BaseCameraAdapter::notifyFocusSubscribers(CameraHalEvent::FocusStatus status)
 {
     event_callback eventCb;
@@ -1151,14 +1330,11 @@ status_t BaseCameraAdapter::notifyFocusSubscribers(CameraHalEvent::FocusStatus s
         return NO_INIT;
     }
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
     if (status == CameraHalEvent::FOCUS_STATUS_PENDING) {
-        gettimeofday(&mStartFocus, NULL);
+        EventLog::log(EventLog::AUTOFOCUS_START);
     } else {
-        //dump the AF latency
-        CameraHal::PPM("Focus finished in: ", &mStartFocus);
+        EventLog::log(EventLog::AUTOFOCUS_DONE);
     }
-#endif
 
     focusEvent.mEventData = new CameraHalEvent::CameraHalEventData();
     if ( NULL == focusEvent.mEventData.get() ) {
@@ -1308,9 +1484,7 @@ status_t BaseCameraAdapter::sendFrameToSubscribers(CameraFrame *frame)
 
         case CameraFrame::IMAGE_FRAME:
           {
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-            CameraHal::PPM("Shot to Jpeg: ", &mStartCapture);
-#endif
+            EventLog::log(EventLog::JPEG_READY);
             ret = __sendFrameToSubscribers(frame, &mImageSubscribers, CameraFrame::IMAGE_FRAME);
           }
           break;
@@ -1373,9 +1547,8 @@ status_t BaseCameraAdapter::__sendFrameToSubscribers(CameraFrame* frame,
     if ( (frameType == CameraFrame::PREVIEW_FRAME_SYNC) ||
          (frameType == CameraFrame::VIDEO_FRAME_SYNC) ||
          (frameType == CameraFrame::SNAPSHOT_FRAME) ){
-        if (mFrameQueue.size() > 0){
-          CameraFrame *lframe = (CameraFrame *)mFrameQueue.valueFor(frame->mBuffer);
-          frame->mYuv[0] = lframe->mYuv[0];
+        if ((mFramePointersCount > 0) && (0 != frame->mBuffer->yuv[0])){
+          frame->mYuv[0] = frame->mBuffer->yuv[0];
           frame->mYuv[1] = frame->mYuv[0] + (frame->mLength + frame->mOffset)*2/3;
         }
         else{
@@ -1402,6 +1575,10 @@ status_t BaseCameraAdapter::__sendFrameToSubscribers(CameraFrame* frame,
                      ( uint32_t ) frame->mBuffer,
                      refCount);
 
+        if ( NULL != mMetrics.get() ) {
+            mMetrics->frameArrived(frameType);
+        }
+
         for ( unsigned int i = 0 ; i < refCount; i++ ) {
             frame->mCookie = ( void * ) subscribers->keyAt(i);
             callback = (frame_callback) subscribers->valueAt(i);
@@ -1411,7 +1588,19 @@ status_t BaseCameraAdapter::__sendFrameToSubscribers(CameraFrame* frame,
                 return -EINVAL;
             }
 
-            callback(frame);
+            FrameTracer::trace(FrameTracer::DISPATCH, frame->mBuffer, frameType);
+
+            nsecs_t dispatched = systemTime();
+            android::sp<FrameDeliveryQueue> queue = getDeliveryQueue(subscribers->keyAt(i));
+            if ( NULL != queue.get() ) {
+                queue->post(*frame, callback);
+            } else {
+                callback(frame);
+            }
+
+            if ( NULL != mMetrics.get() ) {
+                mMetrics->frameDispatched(frameType, subscribers->keyAt(i), systemTime() - dispatched);
+            }
         }
     } else {
         CAMHAL_LOGEA("Subscribers is null??");
@@ -1483,53 +1672,39 @@ int BaseCameraAdapter::setInitFrameRefCount(CameraBuffer * buf, unsigned int mas
   return ret;
 }
 
-int BaseCameraAdapter::getFrameRefCount(CameraBuffer * frameBuf, CameraFrame::FrameType frameType)
+int BaseCameraAdapter::getRefCountShift(CameraFrame::FrameType frameType)
 {
-    int res = -1;
-
-    LOG_FUNCTION_NAME;
-
     switch ( frameType )
         {
         case CameraFrame::IMAGE_FRAME:
         case CameraFrame::RAW_FRAME:
-                {
-                android::AutoMutex lock(mCaptureBufferLock);
-                res = mCaptureBuffersAvailable.valueFor(frameBuf );
-                }
-            break;
+            return 0;
         case CameraFrame::SNAPSHOT_FRAME:
-                {
-                android::AutoMutex lock(mSnapshotBufferLock);
-                res = mSnapshotBuffersAvailable.valueFor( ( unsigned int ) frameBuf );
-                }
-            break;
+            return REF_COUNT_BITS;
         case CameraFrame::PREVIEW_FRAME_SYNC:
-                {
-                android::AutoMutex lock(mPreviewBufferLock);
-                res = mPreviewBuffersAvailable.valueFor(frameBuf );
-                }
-            break;
+            return 2 * REF_COUNT_BITS;
         case CameraFrame::FRAME_DATA_SYNC:
-                {
-                android::AutoMutex lock(mPreviewDataBufferLock);
-                res = mPreviewDataBuffersAvailable.valueFor(frameBuf );
-                }
-            break;
+            return 3 * REF_COUNT_BITS;
         case CameraFrame::VIDEO_FRAME_SYNC:
-                {
-                android::AutoMutex lock(mVideoBufferLock);
-                res = mVideoBuffersAvailable.valueFor(frameBuf );
-                }
-            break;
-        case CameraFrame::REPROCESS_INPUT_FRAME: {
-            android::AutoMutex lock(mVideoInBufferLock);
-            res = mVideoInBuffersAvailable.valueFor(frameBuf );
-        }
-            break;
+            return 4 * REF_COUNT_BITS;
+        case CameraFrame::REPROCESS_INPUT_FRAME:
+            return 5 * REF_COUNT_BITS;
         default:
-            break;
+            return -1;
         };
+}
+
+int BaseCameraAdapter::getFrameRefCount(CameraBuffer * frameBuf, CameraFrame::FrameType frameType)
+{
+    int shift = getRefCountShift(frameType);
+    int res = -1;
+
+    LOG_FUNCTION_NAME;
+
+    if ( ( NULL != frameBuf ) && ( 0 <= shift ) )
+        {
+        res = ( android_atomic_acquire_load(&frameBuf->refCounts) >> shift ) & REF_COUNT_MASK;
+        }
 
     LOG_FUNCTION_NAME_EXIT;
 
@@ -1538,55 +1713,73 @@ int BaseCameraAdapter::getFrameRefCount(CameraBuffer * frameBuf, CameraFrame::Fr
 
 void BaseCameraAdapter::setFrameRefCount(CameraBuffer * frameBuf, CameraFrame::FrameType frameType, int refCount)
 {
+    int shift = getRefCountShift(frameType);
+    int32_t oldCounts, newCounts;
+    int oldRefCount;
 
     LOG_FUNCTION_NAME;
 
-    switch ( frameType )
+    if ( ( NULL == frameBuf ) || ( 0 > shift ) )
         {
-        case CameraFrame::IMAGE_FRAME:
-        case CameraFrame::RAW_FRAME:
-                {
-                android::AutoMutex lock(mCaptureBufferLock);
-                mCaptureBuffersAvailable.replaceValueFor(frameBuf, refCount);
-                }
-            break;
-        case CameraFrame::SNAPSHOT_FRAME:
-                {
-                android::AutoMutex lock(mSnapshotBufferLock);
-                mSnapshotBuffersAvailable.replaceValueFor(  ( unsigned int ) frameBuf, refCount);
-                }
-            break;
-        case CameraFrame::PREVIEW_FRAME_SYNC:
-                {
-                android::AutoMutex lock(mPreviewBufferLock);
-                mPreviewBuffersAvailable.replaceValueFor(frameBuf, refCount);
-                }
-            break;
-        case CameraFrame::FRAME_DATA_SYNC:
-                {
-                android::AutoMutex lock(mPreviewDataBufferLock);
-                mPreviewDataBuffersAvailable.replaceValueFor(frameBuf, refCount);
-                }
-            break;
-        case CameraFrame::VIDEO_FRAME_SYNC:
-                {
-                android::AutoMutex lock(mVideoBufferLock);
-                mVideoBuffersAvailable.replaceValueFor(frameBuf, refCount);
-                }
-            break;
-        case CameraFrame::REPROCESS_INPUT_FRAME: {
-            android::AutoMutex lock(mVideoInBufferLock);
-            mVideoInBuffersAvailable.replaceValueFor(frameBuf, refCount);
+        return;
+        }
+
+    if ( ( 0 > refCount ) || ( REF_COUNT_MASK < refCount ) )
+        {
+        CAMHAL_LOGEB("Invalid ref count %d for frame type 0x%x", refCount, frameType);
+        return;
+        }
+
+    do
+        {
+        oldCounts = android_atomic_acquire_load(&frameBuf->refCounts);
+        oldRefCount = ( oldCounts >> shift ) & REF_COUNT_MASK;
+        newCounts = ( oldCounts & ~( REF_COUNT_MASK << shift ) ) | ( refCount << shift );
+        } while ( android_atomic_release_cas(oldCounts, newCounts, &frameBuf->refCounts) );
+
+    // the held references follow the ref counts, so the ones dropped here
+    // without a returnFrame() don't stay counted
+    if ( ( NULL != mMetrics.get() ) && ( refCount != oldRefCount ) )
+        {
+        mMetrics->framesHeld(frameType, refCount - oldRefCount);
         }
-            break;
-        default:
-            break;
-        };
 
     LOG_FUNCTION_NAME_EXIT;
 
 }
 
+void BaseCameraAdapter::resetFrameRefCounts(CameraBuffer * frameBuf, CameraFrame::FrameType frameType, int refCount)
+{
+    static const CameraFrame::FrameType types[] = {
+        CameraFrame::IMAGE_FRAME,
+        CameraFrame::SNAPSHOT_FRAME,
+        CameraFrame::PREVIEW_FRAME_SYNC,
+        CameraFrame::FRAME_DATA_SYNC,
+        CameraFrame::VIDEO_FRAME_SYNC,
+        CameraFrame::REPROCESS_INPUT_FRAME,
+    };
+
+    // only called while the buffer isn't in use, clearing the fields one by
+    // one takes the dropped references off the metrics
+    for ( size_t i = 0 ; i < sizeof(types) / sizeof(types[0]) ; i++ )
+        {
+        setFrameRefCount(frameBuf, types[i], 0);
+        }
+
+    setFrameRefCount(frameBuf, frameType, refCount);
+}
+
+void BaseCameraAdapter::clearFrameRefCounts(android::KeyedVector<CameraBuffer *, int> &buffers,
+                                            CameraFrame::FrameType frameType)
+{
+    for ( size_t i = 0 ; i < buffers.size() ; i++ )
+        {
+        setFrameRefCount(buffers.keyAt(i), frameType, 0);
+        }
+
+    buffers.clear();
+}
+
 status_t BaseCameraAdapter::startVideoCapture()
 {
     status_t ret = NO_ERROR;
@@ -1608,6 +1801,7 @@ status_t BaseCameraAdapter::startVideoCapture()
         for ( unsigned int i = 0 ; i < mPreviewBuffersAvailable.size() ; i++ )
             {
             mVideoBuffersAvailable.add(mPreviewBuffersAvailable.keyAt(i), 0);
+            setFrameRefCount(mPreviewBuffersAvailable.keyAt(i), CameraFrame::VIDEO_FRAME_SYNC, 0);
             }
 
         mRecording = true;
@@ -1640,7 +1834,7 @@ status_t BaseCameraAdapter::stopVideoCapture()
                 }
             }
 
-        mVideoBuffersAvailable.clear();
+        clearFrameRefCounts(mVideoBuffersAvailable, CameraFrame::VIDEO_FRAME_SYNC);
 
         mRecording = false;
         }
@@ -2534,6 +2728,9 @@ status_t BaseCameraAdapter::commitState()
 
     mAdapterState = mNextState;
 
+    // most of what getParameters() reports depends on the state
+    markParametersChanged();
+
     mLock.unlock();
 
     LOG_FUNCTION_NAME_EXIT;
@@ -55,6 +55,11 @@ const uint32_t MessageNotifier::FRAME_BIT_FIELD_POSITION = 0;
 // until faux-NPA mode is implemented
 const int CameraHal::NO_BUFFERS_IMAGE_CAPTURE_SYSTEM_HEAP = 15;
 
+// preview runs shorter than this don't change the buffer count
+static const unsigned int PREVIEW_STARVATION_MIN_FRAMES = 90;
+// starved share of the frames which adds a buffer for the next run
+static const unsigned int PREVIEW_STARVATION_GROW_PERCENT = 5;
+
 #ifdef CAMERAHAL_USE_RAW_IMAGE_SAVING
 // HACK: Default path to directory where RAW images coming from video port will be saved to.
 //       If directory not exists the saving is skipped and video port frame is ignored.
@@ -66,13 +71,6 @@ extern const char * const kYuvImagesOutputDirPath = "/data/misc/camera/YuV_PiCtU
 
 /******************************************************************************/
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-struct timeval CameraHal::mStartPreview;
-struct timeval CameraHal::mStartFocus;
-struct timeval CameraHal::mStartCapture;
-
-#endif
 
 static void orientation_cb(uint32_t orientation, uint32_t tilt, void* cookie) {
     CameraHal *camera = NULL;
@@ -247,13 +245,22 @@ int CameraHal::setParameters(const char* parameters)
     LOG_FUNCTION_NAME;
 
     android::CameraParameters params;
+    nsecs_t start = systemTime();
+    int ret;
 
     android::String8 str_params(parameters);
     params.unflatten(str_params);
 
+    ret = setParameters(params);
+
+    if ( NULL != mMetrics.get() )
+        {
+        mMetrics->record(CameraMetrics::SET_PARAMETERS, systemTime() - start);
+        }
+
     LOG_FUNCTION_NAME_EXIT;
 
-    return setParameters(params);
+    return ret;
 }
 
 /**
@@ -277,7 +284,10 @@ int CameraHal::setParameters(const android::CameraParameters& params)
     // Needed for KEY_RECORDING_HINT
     bool restartPreviewRequired = false;
     bool updateRequired = false;
-    android::CameraParameters oldParams(mParameters.flatten());
+    android::String8 flattened(params.flatten());
+    android::String8 oldFlattened(mParameters.flatten());
+    android::CameraParameters oldParams(oldFlattened);
+    ParameterDiff changes;
 
 #ifdef V4L_CAMERA_ADAPTER
     if (strcmp (V4L_CAMERA_NAME_USB, mCameraProperties->get(CameraProperties::CAMERA_NAME)) == 0 ) {
@@ -288,11 +298,22 @@ int CameraHal::setParameters(const android::CameraParameters& params)
     {
         android::AutoMutex lock(mLock);
 
+        if ( isParameterSetApplied(flattened, oldFlattened) ) {
+            CAMHAL_LOGDA("Parameters already applied");
+            return NO_ERROR;
+        }
+
+        invalidateParameters();
+
+        // The checks of keys which keep their value in mParameters are
+        // skipped, they went through them when they were set
+        changes.compare(oldFlattened.string(), flattened.string());
+
         ///Ensure that preview is not enabled when the below parameters are changed.
         if(!previewEnabled())
             {
             if ((valstr = params.getPreviewFormat()) != NULL) {
-                if ( isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FORMATS))) {
+                if ( mCapabilityIndex.isValid(CapabilityIndex::PREVIEW_FORMATS, valstr)) {
                     mParameters.setPreviewFormat(valstr);
                     CAMHAL_LOGDB("PreviewFormat set %s", valstr);
                 } else {
@@ -362,7 +383,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
 
             if ((valstr = params.get(TICameraParameters::KEY_IPP)) != NULL) {
-                if (isParameterValid(valstr,mCameraProperties->get(CameraProperties::SUPPORTED_IPP_MODES))) {
+                if (mCapabilityIndex.isValid(CapabilityIndex::IPP_MODES, valstr)) {
                     CAMHAL_LOGDB("IPP mode set %s", params.get(TICameraParameters::KEY_IPP));
                     mParameters.set(TICameraParameters::KEY_IPP, valstr);
                 } else {
@@ -371,6 +392,11 @@ int CameraHal::setParameters(const android::CameraParameters& params)
                 }
             }
 
+            if ((valstr = params.get(TICameraParameters::KEY_PREVIEW_CALLBACK_ZERO_COPY)) != NULL) {
+                CAMHAL_LOGDB("Zero copy preview callbacks %s", valstr);
+                mParameters.set(TICameraParameters::KEY_PREVIEW_CALLBACK_ZERO_COPY, valstr);
+            }
+
 #ifdef OMAP_ENHANCEMENT_VTC
             if ((valstr = params.get(TICameraParameters::KEY_VTC_HINT)) != NULL ) {
                 mParameters.set(TICameraParameters::KEY_VTC_HINT, valstr);
@@ -405,7 +431,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
 
         int orientation =0;
-        if((valstr = params.get(TICameraParameters::KEY_SENSOR_ORIENTATION)) != NULL)
+        if(!changes.isSame(TICameraParameters::KEY_SENSOR_ORIENTATION) && (valstr = params.get(TICameraParameters::KEY_SENSOR_ORIENTATION)) != NULL)
             {
             doesSetParameterNeedUpdate(valstr,
                                        mParameters.get(TICameraParameters::KEY_SENSOR_ORIENTATION),
@@ -475,10 +501,10 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             restartPreviewRequired |= resetVideoModeParameters();
             }
 
-        if ( (!isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SIZES)))
-                && (!isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SUBSAMPLED_SIZES)))
-                && (!isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SIDEBYSIDE_SIZES)))
-                && (!isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_TOPBOTTOM_SIZES))) ) {
+        if ( (!mCapabilityIndex.isResolutionValid(CapabilityIndex::PREVIEW_SIZES, w, h))
+                && (!mCapabilityIndex.isResolutionValid(CapabilityIndex::PREVIEW_SUBSAMPLED_SIZES, w, h))
+                && (!mCapabilityIndex.isResolutionValid(CapabilityIndex::PREVIEW_SIDEBYSIDE_SIZES, w, h))
+                && (!mCapabilityIndex.isResolutionValid(CapabilityIndex::PREVIEW_TOPBOTTOM_SIZES, w, h)) ) {
             CAMHAL_LOGEB("Invalid preview resolution %d x %d", w, h);
             return BAD_VALUE;
         }
@@ -494,7 +520,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         CAMHAL_LOGDB("Preview Resolution: %d x %d", w, h);
 
         if ((valstr = params.get(android::CameraParameters::KEY_FOCUS_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_FOCUS_MODES))) {
+            if (mCapabilityIndex.isValid(CapabilityIndex::FOCUS_MODES, valstr)) {
                 CAMHAL_LOGDB("Focus mode set %s", valstr);
 
                 // we need to take a decision on the capture mode based on whether CAF picture or
@@ -514,7 +540,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
 
         ///Below parameters can be changed when the preview is running
         if ( (valstr = params.getPictureFormat()) != NULL ) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_FORMATS))) {
+            if (mCapabilityIndex.isValid(CapabilityIndex::PICTURE_FORMATS, valstr)) {
                 mParameters.setPictureFormat(valstr);
             } else {
                 CAMHAL_LOGEB("ERROR: Invalid picture format: %s",valstr);
@@ -539,10 +565,10 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
 
         params.getPictureSize(&w, &h);
-        if ( (isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_SIZES)))
-                || (isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_SUBSAMPLED_SIZES)))
-                || (isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_TOPBOTTOM_SIZES)))
-                || (isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_SIDEBYSIDE_SIZES))) ) {
+        if ( (mCapabilityIndex.isResolutionValid(CapabilityIndex::PICTURE_SIZES, w, h))
+                || (mCapabilityIndex.isResolutionValid(CapabilityIndex::PICTURE_SUBSAMPLED_SIZES, w, h))
+                || (mCapabilityIndex.isResolutionValid(CapabilityIndex::PICTURE_TOPBOTTOM_SIZES, w, h))
+                || (mCapabilityIndex.isResolutionValid(CapabilityIndex::PICTURE_SIDEBYSIDE_SIZES, w, h)) ) {
             mParameters.setPictureSize(w, h);
         } else {
             CAMHAL_LOGEB("ERROR: Invalid picture resolution %d x %d", w, h);
@@ -552,7 +578,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         CAMHAL_LOGDB("Picture Size by App %d x %d", w, h);
 
         if ( (valstr = params.getPictureFormat()) != NULL ) {
-            if (isParameterValid(params.getPictureFormat(),mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_FORMATS))) {
+            if (mCapabilityIndex.isValid(CapabilityIndex::PICTURE_FORMATS, params.getPictureFormat())) {
                 if ((strcmp(valstr, android::CameraParameters::PIXEL_FORMAT_BAYER_RGGB) == 0) &&
                     mCameraProperties->get(CameraProperties::MAX_PICTURE_WIDTH) &&
                     mCameraProperties->get(CameraProperties::MAX_PICTURE_HEIGHT)) {
@@ -569,7 +595,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         }
 
-        if ((valstr = params.get(TICameraParameters::KEY_BURST)) != NULL) {
+        if (!changes.isSame(TICameraParameters::KEY_BURST) && (valstr = params.get(TICameraParameters::KEY_BURST)) != NULL) {
             if (params.getInt(TICameraParameters::KEY_BURST) >=0) {
                 CAMHAL_LOGDB("Burst set %s", params.get(TICameraParameters::KEY_BURST));
                 mParameters.set(TICameraParameters::KEY_BURST, valstr);
@@ -599,8 +625,8 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             params.getPreviewFpsRange(&minFPS, &maxFPS);
             CAMHAL_LOGDB("## requested minFPS = %d; maxFPS=%d",minFPS, maxFPS);
             // Validate VFR
-            if (!isFpsRangeValid(minFPS, maxFPS, params.get(android::CameraParameters::KEY_SUPPORTED_PREVIEW_FPS_RANGE)) &&
-                !isFpsRangeValid(minFPS, maxFPS, params.get(TICameraParameters::KEY_FRAMERATE_RANGES_EXT_SUPPORTED))) {
+            if (!mCapabilityIndex.isFpsRangeValid(CapabilityIndex::FPS_RANGES, minFPS, maxFPS) &&
+                !mCapabilityIndex.isFpsRangeValid(CapabilityIndex::FPS_RANGES_EXT, minFPS, maxFPS)) {
                 CAMHAL_LOGEA("Invalid FPS Range");
                 return BAD_VALUE;
             } else {
@@ -616,8 +642,8 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         } else {
             framerate = params.getPreviewFrameRate();
-            if (!isParameterValid(framerate, params.get(android::CameraParameters::KEY_SUPPORTED_PREVIEW_FRAME_RATES)) &&
-                !isParameterValid(framerate, params.get(TICameraParameters::KEY_FRAMERATES_EXT_SUPPORTED))) {
+            if (!mCapabilityIndex.isValid(CapabilityIndex::FRAME_RATES, framerate) &&
+                !mCapabilityIndex.isValid(CapabilityIndex::FRAME_RATES_EXT, framerate)) {
                 CAMHAL_LOGEA("Invalid frame rate");
                 return BAD_VALUE;
             }
@@ -666,7 +692,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             mParameters.set(TICameraParameters::KEY_AUTOCONVERGENCE_MODE, valstr);
         }
 
-        if ( (valstr = params.get(TICameraParameters::KEY_MANUAL_CONVERGENCE)) != NULL ) {
+        if ( !changes.isSame(TICameraParameters::KEY_MANUAL_CONVERGENCE) && (valstr = params.get(TICameraParameters::KEY_MANUAL_CONVERGENCE)) != NULL ) {
             int manualConvergence = (int)strtol(valstr, 0, 0);
 
             if ( ( manualConvergence < strtol(mCameraProperties->get(CameraProperties::SUPPORTED_MANUAL_CONVERGENCE_MIN), 0, 0) ) ||
@@ -679,7 +705,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         }
 
-        if((valstr = params.get(TICameraParameters::KEY_MECHANICAL_MISALIGNMENT_CORRECTION)) != NULL) {
+        if(!changes.isSame(TICameraParameters::KEY_MECHANICAL_MISALIGNMENT_CORRECTION) && (valstr = params.get(TICameraParameters::KEY_MECHANICAL_MISALIGNMENT_CORRECTION)) != NULL) {
             if ( strcmp(mCameraProperties->get(CameraProperties::MECHANICAL_MISALIGNMENT_CORRECTION_SUPPORTED),
                     android::CameraParameters::TRUE) == 0 ) {
                 CAMHAL_LOGDB("Mechanical Mialignment Correction is %s", valstr);
@@ -690,7 +716,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         }
 
         if ((valstr = params.get(TICameraParameters::KEY_EXPOSURE_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_EXPOSURE_MODES))) {
+            if (mCapabilityIndex.isValid(CapabilityIndex::EXPOSURE_MODES, valstr)) {
                 CAMHAL_LOGDB("Exposure mode set = %s", valstr);
                 mParameters.set(TICameraParameters::KEY_EXPOSURE_MODE, valstr);
                 if (!strcmp(valstr, TICameraParameters::EXPOSURE_MODE_MANUAL)) {
@@ -746,8 +772,8 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         }
 
-        if ((valstr = params.get(android::CameraParameters::KEY_WHITE_BALANCE)) != NULL) {
-           if ( isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_WHITE_BALANCE))) {
+        if (!changes.isSame(android::CameraParameters::KEY_WHITE_BALANCE) && (valstr = params.get(android::CameraParameters::KEY_WHITE_BALANCE)) != NULL) {
+           if ( mCapabilityIndex.isValid(CapabilityIndex::WHITE_BALANCE, valstr)) {
                CAMHAL_LOGDB("White balance set %s", valstr);
                mParameters.set(android::CameraParameters::KEY_WHITE_BALANCE, valstr);
             } else {
@@ -756,7 +782,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         }
 
-        if ((valstr = params.get(TICameraParameters::KEY_CONTRAST)) != NULL) {
+        if (!changes.isSame(TICameraParameters::KEY_CONTRAST) && (valstr = params.get(TICameraParameters::KEY_CONTRAST)) != NULL) {
             if (params.getInt(TICameraParameters::KEY_CONTRAST) >= 0 ) {
                 CAMHAL_LOGDB("Contrast set %s", valstr);
                 mParameters.set(TICameraParameters::KEY_CONTRAST, valstr);
@@ -766,7 +792,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         }
 
-        if ((valstr =params.get(TICameraParameters::KEY_SHARPNESS)) != NULL) {
+        if (!changes.isSame(TICameraParameters::KEY_SHARPNESS) && (valstr =params.get(TICameraParameters::KEY_SHARPNESS)) != NULL) {
             if (params.getInt(TICameraParameters::KEY_SHARPNESS) >= 0 ) {
                 CAMHAL_LOGDB("Sharpness set %s", valstr);
                 mParameters.set(TICameraParameters::KEY_SHARPNESS, valstr);
@@ -776,7 +802,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         }
 
-        if ((valstr = params.get(TICameraParameters::KEY_SATURATION)) != NULL) {
+        if (!changes.isSame(TICameraParameters::KEY_SATURATION) && (valstr = params.get(TICameraParameters::KEY_SATURATION)) != NULL) {
             if (params.getInt(TICameraParameters::KEY_SATURATION) >= 0 ) {
                 CAMHAL_LOGDB("Saturation set %s", valstr);
                 mParameters.set(TICameraParameters::KEY_SATURATION, valstr);
@@ -786,7 +812,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         }
 
-        if ((valstr = params.get(TICameraParameters::KEY_BRIGHTNESS)) != NULL) {
+        if (!changes.isSame(TICameraParameters::KEY_BRIGHTNESS) && (valstr = params.get(TICameraParameters::KEY_BRIGHTNESS)) != NULL) {
             if (params.getInt(TICameraParameters::KEY_BRIGHTNESS) >= 0 ) {
                 CAMHAL_LOGDB("Brightness set %s", valstr);
                 mParameters.set(TICameraParameters::KEY_BRIGHTNESS, valstr);
@@ -796,8 +822,8 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
          }
 
-        if ((valstr = params.get(android::CameraParameters::KEY_ANTIBANDING)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_ANTIBANDING))) {
+        if (!changes.isSame(android::CameraParameters::KEY_ANTIBANDING) && (valstr = params.get(android::CameraParameters::KEY_ANTIBANDING)) != NULL) {
+            if (mCapabilityIndex.isValid(CapabilityIndex::ANTIBANDING, valstr)) {
                 CAMHAL_LOGDB("Antibanding set %s", valstr);
                 mParameters.set(android::CameraParameters::KEY_ANTIBANDING, valstr);
              } else {
@@ -806,8 +832,8 @@ int CameraHal::setParameters(const android::CameraParameters& params)
              }
          }
 
-        if ((valstr = params.get(TICameraParameters::KEY_ISO)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_ISO_VALUES))) {
+        if (!changes.isSame(TICameraParameters::KEY_ISO) && (valstr = params.get(TICameraParameters::KEY_ISO)) != NULL) {
+            if (mCapabilityIndex.isValid(CapabilityIndex::ISO_VALUES, valstr)) {
                 CAMHAL_LOGDB("ISO set %s", valstr);
                 mParameters.set(TICameraParameters::KEY_ISO, valstr);
             } else {
@@ -848,8 +874,8 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             mParameters.set(android::CameraParameters::KEY_EXPOSURE_COMPENSATION, valstr);
             }
 
-        if ((valstr = params.get(android::CameraParameters::KEY_SCENE_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_SCENE_MODES))) {
+        if (!changes.isSame(android::CameraParameters::KEY_SCENE_MODE) && (valstr = params.get(android::CameraParameters::KEY_SCENE_MODE)) != NULL) {
+            if (mCapabilityIndex.isValid(CapabilityIndex::SCENE_MODES, valstr)) {
                 CAMHAL_LOGDB("Scene mode set %s", valstr);
                 doesSetParameterNeedUpdate(valstr,
                                            mParameters.get(android::CameraParameters::KEY_SCENE_MODE),
@@ -861,8 +887,8 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         }
 
-        if ((valstr = params.get(android::CameraParameters::KEY_FLASH_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_FLASH_MODES))) {
+        if (!changes.isSame(android::CameraParameters::KEY_FLASH_MODE) && (valstr = params.get(android::CameraParameters::KEY_FLASH_MODE)) != NULL) {
+            if (mCapabilityIndex.isValid(CapabilityIndex::FLASH_MODES, valstr)) {
                 CAMHAL_LOGDB("Flash mode set %s", valstr);
                 mParameters.set(android::CameraParameters::KEY_FLASH_MODE, valstr);
             } else {
@@ -871,8 +897,8 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         }
 
-        if ((valstr = params.get(android::CameraParameters::KEY_EFFECT)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_EFFECTS))) {
+        if (!changes.isSame(android::CameraParameters::KEY_EFFECT) && (valstr = params.get(android::CameraParameters::KEY_EFFECT)) != NULL) {
+            if (mCapabilityIndex.isValid(CapabilityIndex::EFFECTS, valstr)) {
                 CAMHAL_LOGDB("Effect set %s", valstr);
                 mParameters.set(android::CameraParameters::KEY_EFFECT, valstr);
              } else {
@@ -881,35 +907,35 @@ int CameraHal::setParameters(const android::CameraParameters& params)
              }
         }
 
-        if(( (valstr = params.get(android::CameraParameters::KEY_ROTATION)) != NULL)
+        if(( !changes.isSame(android::CameraParameters::KEY_ROTATION) && (valstr = params.get(android::CameraParameters::KEY_ROTATION)) != NULL)
             && (params.getInt(android::CameraParameters::KEY_ROTATION) >=0))
             {
             CAMHAL_LOGDB("Rotation set %s", params.get(android::CameraParameters::KEY_ROTATION));
             mParameters.set(android::CameraParameters::KEY_ROTATION, valstr);
             }
 
-        if(( (valstr = params.get(android::CameraParameters::KEY_JPEG_QUALITY)) != NULL)
+        if(( !changes.isSame(android::CameraParameters::KEY_JPEG_QUALITY) && (valstr = params.get(android::CameraParameters::KEY_JPEG_QUALITY)) != NULL)
             && (params.getInt(android::CameraParameters::KEY_JPEG_QUALITY) >=0))
             {
             CAMHAL_LOGDB("Jpeg quality set %s", params.get(android::CameraParameters::KEY_JPEG_QUALITY));
             mParameters.set(android::CameraParameters::KEY_JPEG_QUALITY, valstr);
             }
 
-        if(( (valstr = params.get(android::CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH)) != NULL)
+        if(( !changes.isSame(android::CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH) && (valstr = params.get(android::CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH)) != NULL)
             && (params.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH) >=0))
             {
             CAMHAL_LOGDB("Thumbnail width set %s", params.get(android::CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH));
             mParameters.set(android::CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH, valstr);
             }
 
-        if(( (valstr = params.get(android::CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT)) != NULL)
+        if(( !changes.isSame(android::CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT) && (valstr = params.get(android::CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT)) != NULL)
             && (params.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT) >=0))
             {
             CAMHAL_LOGDB("Thumbnail width set %s", params.get(android::CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT));
             mParameters.set(android::CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT, valstr);
             }
 
-        if(( (valstr = params.get(android::CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY)) != NULL )
+        if(( !changes.isSame(android::CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY) && (valstr = params.get(android::CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY)) != NULL )
             && (params.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY) >=0))
             {
             CAMHAL_LOGDB("Thumbnail quality set %s", params.get(android::CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY));
@@ -1014,7 +1040,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             mParameters.remove(TICameraParameters::KEY_ZOOM_BRACKETING_RANGE);
         }
 
-        if ((valstr = params.get(android::CameraParameters::KEY_ZOOM)) != NULL ) {
+        if (!changes.isSame(android::CameraParameters::KEY_ZOOM) && (valstr = params.get(android::CameraParameters::KEY_ZOOM)) != NULL ) {
             if ((params.getInt(android::CameraParameters::KEY_ZOOM) >= 0 ) &&
                 (params.getInt(android::CameraParameters::KEY_ZOOM) <= mMaxZoomSupported )) {
                 CAMHAL_LOGDB("Zoom set %s", valstr);
@@ -1028,7 +1054,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
         }
 
-        if( (valstr = params.get(android::CameraParameters::KEY_AUTO_EXPOSURE_LOCK)) != NULL )
+        if( !changes.isSame(android::CameraParameters::KEY_AUTO_EXPOSURE_LOCK) && (valstr = params.get(android::CameraParameters::KEY_AUTO_EXPOSURE_LOCK)) != NULL )
           {
             CAMHAL_LOGDB("Auto Exposure Lock set %s", params.get(android::CameraParameters::KEY_AUTO_EXPOSURE_LOCK));
             doesSetParameterNeedUpdate(valstr,
@@ -1037,7 +1063,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             mParameters.set(android::CameraParameters::KEY_AUTO_EXPOSURE_LOCK, valstr);
           }
 
-        if( (valstr = params.get(android::CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK)) != NULL )
+        if( !changes.isSame(android::CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK) && (valstr = params.get(android::CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK)) != NULL )
           {
             CAMHAL_LOGDB("Auto WhiteBalance Lock set %s", params.get(android::CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK));
             doesSetParameterNeedUpdate(valstr,
@@ -1196,6 +1222,8 @@ int CameraHal::setParameters(const android::CameraParameters& params)
     //On fail restore old parameters
     if ( NO_ERROR != ret ) {
         mParameters.unflatten(oldParams.flatten());
+        // the adapter may have taken part of them
+        mAppliedParameters.clear();
     }
 
     // Restart Preview if needed by KEY_RECODING_HINT only if preview is already running.
@@ -1216,9 +1244,15 @@ int CameraHal::setParameters(const android::CameraParameters& params)
     if (ret != NO_ERROR)
         {
         CAMHAL_LOGEA("Failed to restart Preview");
+        mAppliedParameters.clear();
         return ret;
         }
 
+    mAppliedParameters = flattened;
+    mAppliedState = mParameters.flatten();
+    mAppliedPreviewEnabled = previewEnabled();
+    mAppliedRecordingEnabled = mRecordingEnabled;
+
     LOG_FUNCTION_NAME_EXIT;
 
     return ret;
@@ -1279,6 +1313,7 @@ status_t CameraHal::freePreviewBufs()
         {
         ret = mBufProvider->freeBufferList(mPreviewBuffers);
         mPreviewBuffers = NULL;
+        mPreviewBufferCount = 0;
         LOG_FUNCTION_NAME_EXIT;
         return ret;
         }
@@ -1389,7 +1424,12 @@ status_t CameraHal::allocImageBufs(unsigned int width, unsigned int height, size
         mBufferSourceAdapter_Out->maxQueueableBuffers(*max_queueable);
     } else {
         bytes = ((bytes + 4095) / 4096) * 4096;
-        mImageBuffers = mMemoryManager->allocateBufferList(0, 0, previewFormat, bytes, bufferCount);
+        if ( ( NULL != mCameraAdapter ) &&
+             mCameraAdapter->takesCarvedBuffers(CameraAdapter::CAMERA_IMAGE_CAPTURE) ) {
+            mImageBuffers = mMemoryManager->allocateCarvedBufferList(bytes, bufferCount);
+        } else {
+            mImageBuffers = mMemoryManager->allocateBufferList(0, 0, previewFormat, bytes, bufferCount);
+        }
         *max_queueable = bufferCount;
     }
 
@@ -1453,6 +1493,7 @@ status_t CameraHal::allocVideoBufs(uint32_t width, uint32_t height, uint32_t buf
       }
 
       mVideoBuffers = buffers;
+      mVideoBufferCount = bufferCount;
     }
     else{
       CAMHAL_LOGEA("Couldn't allocate video buffers ");
@@ -1572,7 +1613,16 @@ status_t CameraHal::freeImageBufs()
     if (mBufferSourceAdapter_Out.get()) {
         ret = mBufferSourceAdapter_Out->freeBufferList(mImageBuffers);
     } else {
+        MemoryManager::PoolStats stats;
+
         ret = mMemoryManager->freeBufferList(mImageBuffers);
+
+        mMemoryManager->getPoolStats(stats);
+        CAMHAL_LOGDB("Buffer pool: %u hits, %u misses, %u evictions, %u buffers (%u KB) pooled, "
+                     "%u carved lists, %lld us spent allocating",
+                     stats.hits, stats.misses, stats.evictions, stats.pooledBuffers,
+                     ( unsigned int ) ( stats.pooledBytes >> 10 ), stats.carvedLists,
+                     ( long long ) ns2us(stats.allocTime));
     }
 
     if (ret == NO_ERROR) {
@@ -1590,7 +1640,6 @@ status_t CameraHal::freeVideoBufs(CameraBuffer *bufs)
 
   LOG_FUNCTION_NAME;
 
-  int count = atoi(mCameraProperties->get(CameraProperties::REQUIRED_PREVIEW_BUFS));
   if(bufs == NULL)
     {
       CAMHAL_LOGEA("NULL pointer passed to freeVideoBuffer");
@@ -1600,10 +1649,11 @@ status_t CameraHal::freeVideoBufs(CameraBuffer *bufs)
 
   android::GraphicBufferAllocator &GrallocAlloc = android::GraphicBufferAllocator::get();
 
-  for(int i = 0; i < count; i++){
+  for(unsigned int i = 0; i < mVideoBufferCount; i++){
     CAMHAL_LOGVB("Free Video Gralloc Handle 0x%x", bufs[i].opaque);
     GrallocAlloc.free((buffer_handle_t)bufs[i].opaque);
   }
+  mVideoBufferCount = 0;
 
   LOG_FUNCTION_NAME_EXIT;
 
@@ -1677,11 +1727,7 @@ status_t CameraHal::startPreview() {
         int width, height;
         mParameters.getPreviewSize(&width, &height);
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-        ret = mDisplayAdapter->enableDisplay(width, height, &mStartPreview);
-#else
         ret = mDisplayAdapter->enableDisplay(width, height, NULL);
-#endif
 
         if ( ret != NO_ERROR ) {
             CAMHAL_LOGEA("Couldn't enable display");
@@ -1711,6 +1757,8 @@ status_t CameraHal::startPreview() {
     }
     CAMHAL_LOGDA("Started preview");
 
+    EventLog::log(EventLog::PREVIEW_STARTED);
+
     mPreviewEnabled = true;
     mPreviewStartInProgress = false;
     return ret;
@@ -1721,6 +1769,7 @@ status_t CameraHal::startPreview() {
 
         //Do all the cleanup
         freePreviewBufs();
+        freePreviewDataBufs();
         mCameraAdapter->sendCommand(CameraAdapter::CAMERA_STOP_PREVIEW);
         if(mDisplayAdapter.get() != NULL) {
             mDisplayAdapter->disableDisplay(false);
@@ -1752,10 +1801,12 @@ status_t CameraHal::cameraPreviewInitialization()
     CameraFrame frame;
     unsigned int required_buffer_count;
     unsigned int max_queueble_buffers;
+    android::sp<PreviewInitThread> dataStep;
+    android::sp<PreviewInitThread> callbackStep;
+    status_t dataRet = NO_ERROR;
+    status_t callbackRet = NO_ERROR;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-        gettimeofday(&mStartPreview, NULL);
-#endif
+    EventLog::log(EventLog::PREVIEW_INIT);
 
     LOG_FUNCTION_NAME;
 
@@ -1823,49 +1874,102 @@ status_t CameraHal::cameraPreviewInitialization()
         }
 
     required_buffer_count = atoi(mCameraProperties->get(CameraProperties::REQUIRED_PREVIEW_BUFS));
+    if ( mTunedPreviewBufferCount > required_buffer_count )
+        {
+        CAMHAL_LOGDB("Using %u preview buffers instead of %u",
+                     mTunedPreviewBufferCount, required_buffer_count);
+        required_buffer_count = mTunedPreviewBufferCount;
+        }
+
+    // The preview data buffers come from the MemoryManager and only depend
+    // on the measurement port, they are allocated while the display adapter
+    // dequeues the preview buffers
+    if ( mMeasurementEnabled )
+        {
+        ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_QUERY_BUFFER_SIZE_PREVIEW_DATA,
+                                          ( int ) &frame,
+                                          required_buffer_count);
+        if ( NO_ERROR != ret )
+            {
+            return ret;
+            }
+
+        mPreviewInitDataSize = frame.mLength;
+        mPreviewInitBufferCount = required_buffer_count;
+        dataStep = startPreviewInitStep(&CameraHal::allocPreviewDataStep, dataRet);
+        }
 
     ///Allocate the preview buffers
     ret = allocPreviewBufs(mPreviewWidth, mPreviewHeight, mParameters.getPreviewFormat(), required_buffer_count, max_queueble_buffers);
 
+    if ( ( NO_ERROR != ret ) && ( NULL == mPreviewBuffers ) && ( 0 < mTunedPreviewBufferCount ) )
+        {
+        // the preview window may not take that many buffers
+        CAMHAL_LOGW("Couldn't allocate %u preview buffers, back to the required count",
+                     required_buffer_count);
+        mTunedPreviewBufferCount = 0;
+        required_buffer_count = atoi(mCameraProperties->get(CameraProperties::REQUIRED_PREVIEW_BUFS));
+        ret = allocPreviewBufs(mPreviewWidth, mPreviewHeight, mParameters.getPreviewFormat(), required_buffer_count, max_queueble_buffers);
+        }
+
+    // join point, both kinds of buffers are registered below
+    if ( NULL != dataStep.get() )
+        {
+        dataRet = dataStep->wait();
+        dataStep.clear();
+        }
+
     if ( NO_ERROR != ret )
         {
         CAMHAL_LOGEA("Couldn't allocate buffers for Preview");
         goto error;
         }
 
+    mPreviewBufferCount = required_buffer_count;
+
     if ( mMeasurementEnabled )
         {
 
-        ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_QUERY_BUFFER_SIZE_PREVIEW_DATA,
-                                          ( int ) &frame,
-                                          required_buffer_count);
-        if ( NO_ERROR != ret )
+        // the preview buffer count went back to the required one
+        if ( ( NO_ERROR == dataRet ) && ( mPreviewInitBufferCount != required_buffer_count ) )
             {
-            return ret;
+            ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_QUERY_BUFFER_SIZE_PREVIEW_DATA,
+                                              ( int ) &frame,
+                                              required_buffer_count);
+            if ( NO_ERROR != ret )
+                {
+                CAMHAL_LOGEB("Couldn't query the preview data buffer size: 0x%x", ret);
+                goto error;
+                }
+
+            dataRet = allocPreviewDataBufs(frame.mLength, required_buffer_count);
             }
 
-         ///Allocate the preview data buffers
-        ret = allocPreviewDataBufs(frame.mLength, required_buffer_count);
-        if ( NO_ERROR != ret ) {
+        if ( NO_ERROR != dataRet ) {
             CAMHAL_LOGEA("Couldn't allocate preview data buffers");
+            ret = dataRet;
             goto error;
            }
 
-        if ( NO_ERROR == ret )
-            {
-            desc.mBuffers = mPreviewDataBuffers;
-            desc.mOffsets = mPreviewDataOffsets;
-            desc.mFd = mPreviewDataFd;
-            desc.mLength = mPreviewDataLength;
-            desc.mCount = ( size_t ) required_buffer_count;
-            desc.mMaxQueueable = (size_t) required_buffer_count;
-
-            mCameraAdapter->sendCommand(CameraAdapter::CAMERA_USE_BUFFERS_PREVIEW_DATA,
-                                        ( int ) &desc);
-            }
+        desc.mBuffers = mPreviewDataBuffers;
+        desc.mOffsets = mPreviewDataOffsets;
+        desc.mFd = mPreviewDataFd;
+        desc.mLength = mPreviewDataLength;
+        desc.mCount = ( size_t ) required_buffer_count;
+        desc.mMaxQueueable = (size_t) required_buffer_count;
+
+        mCameraAdapter->sendCommand(CameraAdapter::CAMERA_USE_BUFFERS_PREVIEW_DATA,
+                                    ( int ) &desc);
 
         }
 
+    EventLog::log(EventLog::PREVIEW_BUFFERS_ALLOCATED);
+
+    // The callback notifier only needs the buffers, it is set up while the
+    // adapter registers them (the OMX Loaded to Idle transition)
+    mPreviewInitBufferCount = required_buffer_count;
+    callbackStep = startPreviewInitStep(&CameraHal::startPreviewCallbacksStep, callbackRet);
+
     ///Pass the buffers to Camera Adapter
     desc.mBuffers = mPreviewBuffers;
     desc.mOffsets = mPreviewOffsets;
@@ -1877,29 +1981,27 @@ status_t CameraHal::cameraPreviewInitialization()
     ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_USE_BUFFERS_PREVIEW,
                                       ( int ) &desc);
 
+    // join point, the adapter and the notifier have to be ready for frames
+    if ( NULL != callbackStep.get() )
+        {
+        callbackRet = callbackStep->wait();
+        callbackStep.clear();
+        }
+
     if ( NO_ERROR != ret )
         {
         CAMHAL_LOGEB("Failed to register preview buffers: 0x%x", ret);
+        mAppCallbackNotifier->stopPreviewCallbacks();
+        mAppCallbackNotifier->stop();
         freePreviewBufs();
+        freePreviewDataBufs();
         return ret;
         }
 
-    mAppCallbackNotifier->startPreviewCallbacks(mParameters, mPreviewBuffers, mPreviewOffsets, mPreviewFd, mPreviewLength, required_buffer_count);
+    EventLog::log(EventLog::PREVIEW_BUFFERS_REGISTERED);
 
-    ///Start the callback notifier
-    ret = mAppCallbackNotifier->start();
-
-    if( ALREADY_EXISTS == ret )
-        {
-        //Already running, do nothing
-        CAMHAL_LOGDA("AppCallbackNotifier already running");
-        ret = NO_ERROR;
-        }
-    else if ( NO_ERROR == ret ) {
-        CAMHAL_LOGDA("Started AppCallbackNotifier..");
-        mAppCallbackNotifier->setMeasurements(mMeasurementEnabled);
-        }
-    else
+    ret = callbackRet;
+    if ( NO_ERROR != ret )
         {
         CAMHAL_LOGDA("Couldn't start AppCallbackNotifier");
         goto error;
@@ -1914,6 +2016,7 @@ status_t CameraHal::cameraPreviewInitialization()
 
         //Do all the cleanup
         freePreviewBufs();
+        freePreviewDataBufs();
         mCameraAdapter->sendCommand(CameraAdapter::CAMERA_STOP_PREVIEW);
         if(mDisplayAdapter.get() != NULL)
             {
@@ -1927,6 +2030,52 @@ status_t CameraHal::cameraPreviewInitialization()
         return ret;
 }
 
+android::sp<CameraHal::PreviewInitThread> CameraHal::startPreviewInitStep(PreviewInitThread::Step step,
+                                                                           status_t &ret)
+{
+    android::sp<PreviewInitThread> thread = new PreviewInitThread(this, step);
+
+    ret = NO_ERROR;
+
+    if ( ( NULL == thread.get() ) ||
+         ( NO_ERROR != thread->run("CameraPrvInit", android::PRIORITY_URGENT_DISPLAY) ) )
+        {
+        CAMHAL_LOGW("Couldn't start a preview initialization thread, running the step inline");
+        thread.clear();
+        ret = (this->*step)();
+        }
+
+    return thread;
+}
+
+status_t CameraHal::allocPreviewDataStep()
+{
+    return allocPreviewDataBufs(mPreviewInitDataSize, mPreviewInitBufferCount);
+}
+
+status_t CameraHal::startPreviewCallbacksStep()
+{
+    status_t ret = NO_ERROR;
+
+    mAppCallbackNotifier->startPreviewCallbacks(mParameters, mPreviewBuffers, mPreviewOffsets, mPreviewFd, mPreviewLength, mPreviewInitBufferCount);
+
+    ///Start the callback notifier
+    ret = mAppCallbackNotifier->start();
+
+    if( ALREADY_EXISTS == ret )
+        {
+        //Already running, do nothing
+        CAMHAL_LOGDA("AppCallbackNotifier already running");
+        ret = NO_ERROR;
+        }
+    else if ( NO_ERROR == ret ) {
+        CAMHAL_LOGDA("Started AppCallbackNotifier..");
+        mAppCallbackNotifier->setMeasurements(mMeasurementEnabled);
+        }
+
+    return ret;
+}
+
 /**
    @brief Sets ANativeWindow object.
 
@@ -2188,10 +2337,22 @@ void CameraHal::stopPreview()
 
     forceStopPreview();
 
+    if ( FrameTracer::isEnabled() )
+        {
+        char traceFile[PROPERTY_VALUE_MAX];
+
+        property_get("debug.camera.trace.file", traceFile, "");
+        if ( '\0' != traceFile[0] )
+            {
+            FrameTracer::dumpToFile(traceFile);
+            }
+        }
+
     // Reset Capture-Mode to default, so that when we switch from VideoRecording
     // to ImageCapture, CAPTURE_MODE is not left to VIDEO_MODE.
     CAMHAL_LOGDA("Resetting Capture-Mode to default");
     mParameters.set(TICameraParameters::KEY_CAP_MODE, "");
+    invalidateParameters();
 
     LOG_FUNCTION_NAME_EXIT;
 }
@@ -2232,12 +2393,7 @@ status_t CameraHal::startRecording( )
 
     LOG_FUNCTION_NAME;
 
-
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-            gettimeofday(&mStartPreview, NULL);
-
-#endif
+    EventLog::log(EventLog::START_RECORDING);
 
     if(!previewEnabled())
         {
@@ -2247,6 +2403,7 @@ status_t CameraHal::startRecording( )
     // set internal recording hint in case camera adapter needs to make some
     // decisions....(will only be sent to camera adapter if camera restart is required)
     mParameters.set(TICameraParameters::KEY_RECORDING_HINT, android::CameraParameters::TRUE);
+    invalidateParameters();
 
     // if application starts recording in continuous focus picture mode...
     // then we need to force default capture mode (as opposed to video mode)
@@ -2268,7 +2425,7 @@ status_t CameraHal::startRecording( )
 
     if ( NO_ERROR == ret )
       {
-        int count = atoi(mCameraProperties->get(CameraProperties::REQUIRED_PREVIEW_BUFS));
+        int count = ( int ) mPreviewBufferCount;
         mParameters.getPreviewSize(&w, &h);
         CAMHAL_LOGDB("%s Video Width=%d Height=%d", __FUNCTION__, mVideoWidth, mVideoHeight);
 
@@ -2455,6 +2612,7 @@ status_t CameraHal::restartPreview()
         } else {
             mParameters.set(TICameraParameters::KEY_CAP_MODE, "");
         }
+        invalidateParameters();
         mCameraAdapter->setParameters(mParameters);
     }
 
@@ -2508,6 +2666,7 @@ void CameraHal::stopRecording()
     // reset internal recording hint in case camera adapter needs to make some
     // decisions....(will only be sent to camera adapter if camera restart is required)
     mParameters.remove(TICameraParameters::KEY_RECORDING_HINT);
+    invalidateParameters();
 
     LOG_FUNCTION_NAME_EXIT;
 }
@@ -2570,11 +2729,7 @@ status_t CameraHal::autoFocus()
 {
     status_t ret = NO_ERROR;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    gettimeofday(&mStartFocus, NULL);
-
-#endif
+    EventLog::log(EventLog::AUTOFOCUS_START);
 
     LOG_FUNCTION_NAME;
 
@@ -2601,17 +2756,8 @@ status_t CameraHal::autoFocus()
             goto EXIT;
         }
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    //pass the autoFocus timestamp along with the command to camera adapter
-    ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_PERFORM_AUTOFOCUS, ( int ) &mStartFocus);
-
-#else
-
     ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_PERFORM_AUTOFOCUS);
 
-#endif
-
 EXIT:
     LOG_FUNCTION_NAME_EXIT;
 
@@ -2702,11 +2848,7 @@ status_t CameraHal::startImageBracketing()
 
 
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-        gettimeofday(&mStartCapture, NULL);
-
-#endif
+        EventLog::log(EventLog::SHOT);
 
         LOG_FUNCTION_NAME;
 
@@ -2781,17 +2923,8 @@ status_t CameraHal::startImageBracketing()
             if ( NO_ERROR == ret )
                 {
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-                 //pass capture timestamp along with the camera adapter command
-                ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_BRACKET_CAPTURE,  ( mBracketRangePositive + 1 ),  (int) &mStartCapture);
-
-#else
-
                 ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_BRACKET_CAPTURE, ( mBracketRangePositive + 1 ));
 
-#endif
-
                 }
             }
 
@@ -2857,11 +2990,7 @@ status_t CameraHal::__takePicture(const char *params)
     unsigned int rawBufferCount = 1;
     bool isCPCamMode = false;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    gettimeofday(&mStartCapture, NULL);
-
-#endif
+    EventLog::log(EventLog::SHOT);
 
     LOG_FUNCTION_NAME;
 
@@ -2911,6 +3040,7 @@ status_t CameraHal::__takePicture(const char *params)
         android::String8 shotParams8(params);
 
         shotParams.unflatten(shotParams8);
+        invalidateParameters();
         mParameters.remove(TICameraParameters::KEY_EXP_GAIN_BRACKETING_RANGE);
         mParameters.remove(TICameraParameters::KEY_EXP_BRACKETING_RANGE);
 
@@ -2952,13 +3082,7 @@ status_t CameraHal::__takePicture(const char *params)
     if (((mCameraAdapter->getState() & CameraAdapter::CAPTURE_STATE) ==
               CameraAdapter::CAPTURE_STATE) &&
          (mCameraAdapter->getNextState() != CameraAdapter::PREVIEW_STATE)) {
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-        //pass capture timestamp along with the camera adapter command
-        ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_IMAGE_CAPTURE,
-                                          (int) &mStartCapture);
-#else
         ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_IMAGE_CAPTURE);
-#endif
         return ret;
     }
 
@@ -3010,10 +3134,6 @@ status_t CameraHal::__takePicture(const char *params)
                     mAppCallbackNotifier->disableMsgType (CAMERA_MSG_PREVIEW_FRAME);
                 }
             }
-
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-            mDisplayAdapter->setSnapshotTimeRef(&mStartCapture);
-#endif
         }
 
         // if we taking video snapshot...
@@ -3097,17 +3217,8 @@ status_t CameraHal::__takePicture(const char *params)
 
     if ((NO_ERROR == ret) && (NULL != mCameraAdapter)) {
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-         //pass capture timestamp along with the camera adapter command
-        ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_IMAGE_CAPTURE,  (int) &mStartCapture);
-
-#else
-
         ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_IMAGE_CAPTURE);
 
-#endif
-
     }
 
     return ret;
@@ -3141,61 +3252,75 @@ status_t CameraHal::cancelPicture( )
  */
 char* CameraHal::getParameters()
 {
-    android::String8 params_str8;
     char* params_string;
     const char * valstr = NULL;
+    int32_t generation;
+    bool adapterChanged = false;
 
     LOG_FUNCTION_NAME;
 
+    android::AutoMutex lock(mParametersCacheLock);
+
+    // taken first, a change while flattening makes the next call do it again
+    generation = android_atomic_acquire_load(&mParametersGeneration);
+
     if( NULL != mCameraAdapter )
     {
-        mCameraAdapter->getParameters(mParameters);
+        adapterChanged = mCameraAdapter->takeParametersChanged();
     }
 
-    if ( (valstr = mParameters.get(TICameraParameters::KEY_S3D_CAP_FRAME_LAYOUT)) != NULL ) {
-        if (!strcmp(TICameraParameters::S3D_TB_FULL, valstr)) {
-            mParameters.set(android::CameraParameters::KEY_SUPPORTED_PICTURE_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PICTURE_TOPBOTTOM_SIZES));
-        } else if (!strcmp(TICameraParameters::S3D_SS_FULL, valstr)) {
-            mParameters.set(android::CameraParameters::KEY_SUPPORTED_PICTURE_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PICTURE_SIDEBYSIDE_SIZES));
-        } else if ((!strcmp(TICameraParameters::S3D_TB_SUBSAMPLED, valstr))
-            || (!strcmp(TICameraParameters::S3D_SS_SUBSAMPLED, valstr))) {
-            mParameters.set(android::CameraParameters::KEY_SUPPORTED_PICTURE_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PICTURE_SUBSAMPLED_SIZES));
+    if ( adapterChanged || ( generation != mCachedGeneration ) ) {
+        if( NULL != mCameraAdapter )
+        {
+            mCameraAdapter->getParameters(mParameters);
         }
-    }
 
-    if ( (valstr = mParameters.get(TICameraParameters::KEY_S3D_PRV_FRAME_LAYOUT)) != NULL ) {
-        if (!strcmp(TICameraParameters::S3D_TB_FULL, valstr)) {
-            mParameters.set(android::CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PREVIEW_TOPBOTTOM_SIZES));
-        } else if (!strcmp(TICameraParameters::S3D_SS_FULL, valstr)) {
-            mParameters.set(android::CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PREVIEW_SIDEBYSIDE_SIZES));
-        } else if ((!strcmp(TICameraParameters::S3D_TB_SUBSAMPLED, valstr))
+        if ( (valstr = mParameters.get(TICameraParameters::KEY_S3D_CAP_FRAME_LAYOUT)) != NULL ) {
+            if (!strcmp(TICameraParameters::S3D_TB_FULL, valstr)) {
+                mParameters.set(android::CameraParameters::KEY_SUPPORTED_PICTURE_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PICTURE_TOPBOTTOM_SIZES));
+            } else if (!strcmp(TICameraParameters::S3D_SS_FULL, valstr)) {
+                mParameters.set(android::CameraParameters::KEY_SUPPORTED_PICTURE_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PICTURE_SIDEBYSIDE_SIZES));
+            } else if ((!strcmp(TICameraParameters::S3D_TB_SUBSAMPLED, valstr))
                 || (!strcmp(TICameraParameters::S3D_SS_SUBSAMPLED, valstr))) {
-            mParameters.set(android::CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PREVIEW_SUBSAMPLED_SIZES));
+                mParameters.set(android::CameraParameters::KEY_SUPPORTED_PICTURE_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PICTURE_SUBSAMPLED_SIZES));
+            }
         }
-    }
 
-    android::CameraParameters mParams = mParameters;
+        if ( (valstr = mParameters.get(TICameraParameters::KEY_S3D_PRV_FRAME_LAYOUT)) != NULL ) {
+            if (!strcmp(TICameraParameters::S3D_TB_FULL, valstr)) {
+                mParameters.set(android::CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PREVIEW_TOPBOTTOM_SIZES));
+            } else if (!strcmp(TICameraParameters::S3D_SS_FULL, valstr)) {
+                mParameters.set(android::CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PREVIEW_SIDEBYSIDE_SIZES));
+            } else if ((!strcmp(TICameraParameters::S3D_TB_SUBSAMPLED, valstr))
+                    || (!strcmp(TICameraParameters::S3D_SS_SUBSAMPLED, valstr))) {
+                mParameters.set(android::CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES, mParameters.get(TICameraParameters::KEY_SUPPORTED_PREVIEW_SUBSAMPLED_SIZES));
+            }
+        }
 
-    // Handle RECORDING_HINT to Set/Reset Video Mode Parameters
-    valstr = mParameters.get(android::CameraParameters::KEY_RECORDING_HINT);
-    if(valstr != NULL)
-      {
-        if(strcmp(valstr, android::CameraParameters::TRUE) == 0)
+        android::CameraParameters mParams = mParameters;
+
+        // Handle RECORDING_HINT to Set/Reset Video Mode Parameters
+        valstr = mParameters.get(android::CameraParameters::KEY_RECORDING_HINT);
+        if(valstr != NULL)
           {
-            //HACK FOR MMS MODE
-            resetPreviewRes(&mParams);
+            if(strcmp(valstr, android::CameraParameters::TRUE) == 0)
+              {
+                //HACK FOR MMS MODE
+                resetPreviewRes(&mParams);
+              }
           }
-      }
 
-    // do not send internal parameters to upper layers
-    mParams.remove(TICameraParameters::KEY_RECORDING_HINT);
-    mParams.remove(TICameraParameters::KEY_AUTO_FOCUS_LOCK);
+        // do not send internal parameters to upper layers
+        mParams.remove(TICameraParameters::KEY_RECORDING_HINT);
+        mParams.remove(TICameraParameters::KEY_AUTO_FOCUS_LOCK);
 
-    params_str8 = mParams.flatten();
+        mCachedParameters = mParams.flatten();
+        mCachedGeneration = generation;
+    }
 
     // camera service frees this string...
-    params_string = (char*) malloc(sizeof(char) * (params_str8.length()+1));
-    strcpy(params_string, params_str8.string());
+    params_string = (char*) malloc(sizeof(char) * (mCachedParameters.length()+1));
+    strcpy(params_string, mCachedParameters.string());
 
     LOG_FUNCTION_NAME_EXIT;
 
@@ -3204,6 +3329,11 @@ char* CameraHal::getParameters()
     return params_string;
 }
 
+void CameraHal::invalidateParameters()
+{
+    android_atomic_inc(&mParametersGeneration);
+}
+
 
 #ifdef OMAP_ENHANCEMENT_CPCAM
 /**
@@ -3297,6 +3427,16 @@ status_t CameraHal::sendCommand(int32_t cmd, int32_t arg1, int32_t arg2)
 
     LOG_FUNCTION_NAME;
 
+    // works with or without preview
+    if ( CAMERA_CMD_RESET_METRICS == cmd )
+        {
+        if ( NULL != mMetrics.get() )
+            {
+            mMetrics->reset();
+            }
+
+        return NO_ERROR;
+        }
 
     if ( ( NO_ERROR == ret ) && ( NULL == mCameraAdapter ) )
         {
@@ -3404,9 +3544,28 @@ void CameraHal::release()
  */
 status_t  CameraHal::dump(int fd) const
 {
+    status_t ret = NO_ERROR;
+
     LOG_FUNCTION_NAME;
     ///Implement this method when the h/w dump function is supported on Ducati side
-    return NO_ERROR;
+
+    if ( NULL != mMetrics.get() )
+        {
+        ret = mMetrics->dump(fd);
+        }
+
+    if ( NO_ERROR == ret )
+        {
+        ret = EventLog::dump(fd);
+        }
+
+    // the trace JSON comes last, cut it out before loading it
+    if ( ( NO_ERROR == ret ) && FrameTracer::isEnabled() )
+        {
+        ret = FrameTracer::dump(fd);
+        }
+
+    return ret;
 }
 
 /*-------------Camera Hal Interface Method definitions ENDS here--------------------*/
@@ -3430,10 +3589,12 @@ CameraHal::CameraHal(int cameraId)
     ///Initialize all the member variables to their defaults
     mPreviewEnabled = false;
     mPreviewBuffers = NULL;
+    mPreviewBufferCount = 0;
     mImageBuffers = NULL;
     mBufProvider = NULL;
     mPreviewStartInProgress = false;
     mVideoBuffers = NULL;
+    mVideoBufferCount = 0;
     mVideoBufProvider = NULL;
     mRecordingEnabled = false;
     mDisplayPaused = false;
@@ -3454,6 +3615,10 @@ CameraHal::CameraHal(int cameraId)
     mCameraProperties = NULL;
     mCurrentTime = 0;
     mFalsePreview = 0;
+    mPreviewBufferAutoTune = false;
+    mTunedPreviewBufferCount = 0;
+    mPreviewInitDataSize = 0;
+    mPreviewInitBufferCount = 0;
     mImageOffsets = NULL;
     mImageLength = 0;
     mImageFd = 0;
@@ -3480,18 +3645,17 @@ CameraHal::CameraHal(int cameraId)
     mTunnelSetup = false;
 #endif
     mPreviewInitializationDone = false;
+    mAppliedPreviewEnabled = false;
+    mAppliedRecordingEnabled = false;
+    mParametersGeneration = 0;
+    mCachedGeneration = -1;
 
     //These values depends on the sensor characteristics
 
     mRawCapture = false;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    //Initialize the CameraHAL constructor timestamp, which is used in the
-    // PPM() method as time reference if the user does not supply one.
-    gettimeofday(&ppm_start, NULL);
-
-#endif
+    //Reference of the times dump() prints for the events
+    EventLog::log(EventLog::CAMERA_OPEN);
 
     mCameraIndex = cameraId;
 
@@ -3559,6 +3723,7 @@ status_t CameraHal::initialize(CameraProperties::Properties* properties)
 
     int sensor_index = 0;
     const char* sensor_name = NULL;
+    char value[PROPERTY_VALUE_MAX];
 
     ///Initialize the event mask used for registering an event provider for AppCallbackNotifier
     ///Currently, registering all events as to be coming from CameraAdapter
@@ -3576,6 +3741,14 @@ status_t CameraHal::initialize(CameraProperties::Properties* properties)
     // will only print if DEBUG macro is defined
     mCameraProperties->dump();
 
+    // buffer transitions are recorded for dump() while this is set
+    property_get("debug.camera.trace", value, "0");
+    FrameTracer::setEnabled(0 != atoi(value));
+
+    // preview buffer count follows the starvation seen in previous runs
+    property_get("debug.camera.buffers.autotune", value, "0");
+    mPreviewBufferAutoTune = ( 0 != atoi(value) );
+
     if (strcmp(CameraProperties::DEFAULT_VALUE, mCameraProperties->get(CameraProperties::CAMERA_SENSOR_INDEX)) != 0 )
         {
         sensor_index = atoi(mCameraProperties->get(CameraProperties::CAMERA_SENSOR_INDEX));
@@ -3630,6 +3803,16 @@ status_t CameraHal::initialize(CameraProperties::Properties* properties)
             }
         }
 
+    if(!mMetrics.get())
+        {
+        mMetrics = new CameraMetrics();
+        if( NULL == mMetrics.get() )
+            {
+            CAMHAL_LOGEA("Unable to create CameraMetrics");
+            goto fail_loop;
+            }
+        }
+
     ///Setup the class dependencies...
 
     ///AppCallbackNotifier has to know where to get the Camera frames and the events like auto focus lock etc from.
@@ -3641,6 +3824,10 @@ status_t CameraHal::initialize(CameraProperties::Properties* properties)
     mAppCallbackNotifier->setEventProvider(eventMask, mCameraAdapter);
     mAppCallbackNotifier->setFrameProvider(mCameraAdapter);
 
+    ///Both record the frame timings and drops printed by dump()
+    mCameraAdapter->setMetrics(mMetrics);
+    mAppCallbackNotifier->setMetrics(mMetrics);
+
     ///Any dynamic errors that happen during the camera use case has to be propagated back to the application
     ///via CAMERA_MSG_ERROR. AppCallbackNotifier is the class that  notifies such errors to the application
     ///Set it as the error handler for CameraAdapter
@@ -3656,6 +3843,13 @@ status_t CameraHal::initialize(CameraProperties::Properties* properties)
     CAMHAL_LOGDA("Started AppCallbackNotifier..");
     mAppCallbackNotifier->setMeasurements(mMeasurementEnabled);
 
+    ///Parse the supported values setParameters() checks against
+    if ( NO_ERROR != mCapabilityIndex.build(mCameraProperties) )
+        {
+        CAMHAL_LOGEA("Couldn't build capability index");
+        goto fail_loop;
+        }
+
     ///Initialize default parameters
     initDefaultParameters();
 
@@ -3692,145 +3886,78 @@ status_t CameraHal::initialize(CameraProperties::Properties* properties)
 
 }
 
-bool CameraHal::isResolutionValid(unsigned int width, unsigned int height, const char *supportedResolutions)
-{
-    bool ret = false;
-    status_t status = NO_ERROR;
-    char tmpBuffer[MAX_PROP_VALUE_LENGTH];
-    char *pos = NULL;
-
-    LOG_FUNCTION_NAME;
-
-    if (NULL == supportedResolutions) {
-        CAMHAL_LOGEA("Invalid supported resolutions string");
-        goto exit;
+status_t CameraHal::doesSetParameterNeedUpdate(const char* new_param, const char* old_param, bool& update) {
+    if (!new_param || !old_param) {
+        return -EINVAL;
     }
 
-    status = snprintf(tmpBuffer, MAX_PROP_VALUE_LENGTH - 1, "%dx%d", width, height);
-    if (0 > status) {
-        CAMHAL_LOGEA("Error encountered while generating validation string");
-        goto exit;
+    // if params mismatch we should update parameters for camera adapter
+    if ((strcmp(new_param, old_param) != 0)) {
+       update = true;
     }
 
-    ret = isParameterValid(tmpBuffer, supportedResolutions);
-
-exit:
-    LOG_FUNCTION_NAME_EXIT;
-
-    return ret;
+   return NO_ERROR;
 }
 
-bool CameraHal::isFpsRangeValid(int fpsMin, int fpsMax, const char *supportedFpsRanges)
+bool CameraHal::isParameterSetApplied(const android::String8 &params, const android::String8 &current)
 {
-    bool ret = false;
-    char supported[MAX_PROP_VALUE_LENGTH];
-    char *pos;
-    int suppFpsRangeArray[2];
-    int i = 0;
+    ParameterDiff changes;
 
-    LOG_FUNCTION_NAME;
-
-    if ( NULL == supportedFpsRanges ) {
-        CAMHAL_LOGEA("Invalid supported FPS ranges string");
+    if ( mAppliedParameters.isEmpty() ) {
         return false;
     }
 
-    if (fpsMin <= 0 || fpsMax <= 0 || fpsMin > fpsMax) {
+    if ( ( previewEnabled() != mAppliedPreviewEnabled ) ||
+         ( mRecordingEnabled != mAppliedRecordingEnabled ) ) {
         return false;
     }
 
-    strncpy(supported, supportedFpsRanges, MAX_PROP_VALUE_LENGTH);
-    pos = strtok(supported, " (,)");
-    while (pos != NULL) {
-        suppFpsRangeArray[i] = atoi(pos);
-        if (i++) {
-            if (fpsMin >= suppFpsRangeArray[0] && fpsMax <= suppFpsRangeArray[1]) {
-                ret = true;
-                break;
-            }
-            i = 0;
-        }
-        pos = strtok(NULL, " (,)");
-    }
-
-    LOG_FUNCTION_NAME_EXIT;
-
-    return ret;
-}
-
-bool CameraHal::isParameterValid(const char *param, const char *supportedParams)
-{
-    bool ret = false;
-    char *pos;
-    char supported[MAX_PROP_VALUE_LENGTH];
-
-    LOG_FUNCTION_NAME;
-
-    if (NULL == supportedParams) {
-        CAMHAL_LOGEA("Invalid supported parameters string");
-        goto exit;
+    // applying them again would restart bracketing or the shutter message
+    if ( ( mBracketingEnabled && !mBracketingRunning ) ||
+         ( mShutterEnabled && !( mMsgEnabled & CAMERA_MSG_SHUTTER ) ) ) {
+        return false;
     }
 
-    if (NULL == param) {
-        CAMHAL_LOGEA("Invalid parameter string");
-        goto exit;
+    if ( ( params != mAppliedParameters ) &&
+         ( ( NO_ERROR != changes.compare(mAppliedParameters.string(), params.string()) ) ||
+           !hasOnlyReportedChanges(changes) ) ) {
+        return false;
     }
 
-    strncpy(supported, supportedParams, MAX_PROP_VALUE_LENGTH - 1);
-
-    pos = strtok(supported, ",");
-    while (pos != NULL) {
-        if (!strcmp(pos, param)) {
-            ret = true;
-            break;
-        }
-        pos = strtok(NULL, ",");
+    if ( ( current != mAppliedState ) &&
+         ( ( NO_ERROR != changes.compare(mAppliedState.string(), current.string()) ) ||
+           !hasOnlyReportedChanges(changes) ) ) {
+        return false;
     }
 
-exit:
-    LOG_FUNCTION_NAME_EXIT;
-
-    return ret;
+    return true;
 }
 
-bool CameraHal::isParameterValid(int param, const char *supportedParams)
+bool CameraHal::hasOnlyReportedChanges(const ParameterDiff &changes)
 {
-    bool ret = false;
-    status_t status;
-    char tmpBuffer[MAX_PROP_VALUE_LENGTH];
-
-    LOG_FUNCTION_NAME;
-
-    if (NULL == supportedParams) {
-        CAMHAL_LOGEA("Invalid supported parameters string");
-        goto exit;
-    }
-
-    status = snprintf(tmpBuffer, MAX_PROP_VALUE_LENGTH - 1, "%d", param);
-    if (0 > status) {
-        CAMHAL_LOGEA("Error encountered while generating validation string");
-        goto exit;
-    }
-
-    ret = isParameterValid(tmpBuffer, supportedParams);
-
-exit:
-    LOG_FUNCTION_NAME_EXIT;
-
-    return ret;
-}
-
-status_t CameraHal::doesSetParameterNeedUpdate(const char* new_param, const char* old_param, bool& update) {
-    if (!new_param || !old_param) {
-        return -EINVAL;
-    }
+    // filled in by the adapter on every getParameters(), an application
+    // usually hands them back unchanged
+    static const char * const reportedKeys[] = {
+        android::CameraParameters::KEY_FOCUS_DISTANCES,
+        TICameraParameters::KEY_CURRENT_ISO,
+    };
+
+    for ( size_t i = 0; i < changes.size(); i++ ) {
+        bool reported = false;
+
+        for ( size_t j = 0; j < sizeof(reportedKeys) / sizeof(reportedKeys[0]); j++ ) {
+            if ( 0 == strcmp(changes.keyAt(i), reportedKeys[j]) ) {
+                reported = true;
+                break;
+            }
+        }
 
-    // if params mismatch we should update parameters for camera adapter
-    if ((strcmp(new_param, old_param) != 0)) {
-       update = true;
+        if ( !reported ) {
+            return false;
+        }
     }
 
-   return NO_ERROR;
+    return true;
 }
 
 status_t CameraHal::parseResolution(const char *resStr, int &width, int &height)
@@ -3912,6 +4039,10 @@ void CameraHal::insertSupportedParams()
     p.set(TICameraParameters::KEY_FRAMERATES_EXT_SUPPORTED, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FRAME_RATES_EXT));
     p.set(android::CameraParameters::KEY_SUPPORTED_PREVIEW_FPS_RANGE, mCameraProperties->get(CameraProperties::FRAMERATE_RANGE_SUPPORTED));
     p.set(TICameraParameters::KEY_FRAMERATE_RANGES_EXT_SUPPORTED, mCameraProperties->get(CameraProperties::FRAMERATE_RANGE_EXT_SUPPORTED));
+    mCapabilityIndex.setValues(CapabilityIndex::FRAME_RATES, p.get(android::CameraParameters::KEY_SUPPORTED_PREVIEW_FRAME_RATES));
+    mCapabilityIndex.setValues(CapabilityIndex::FRAME_RATES_EXT, p.get(TICameraParameters::KEY_FRAMERATES_EXT_SUPPORTED));
+    mCapabilityIndex.setValues(CapabilityIndex::FPS_RANGES, p.get(android::CameraParameters::KEY_SUPPORTED_PREVIEW_FPS_RANGE));
+    mCapabilityIndex.setValues(CapabilityIndex::FPS_RANGES_EXT, p.get(TICameraParameters::KEY_FRAMERATE_RANGES_EXT_SUPPORTED));
     p.set(android::CameraParameters::KEY_SUPPORTED_JPEG_THUMBNAIL_SIZES, mCameraProperties->get(CameraProperties::SUPPORTED_THUMBNAIL_SIZES));
     p.set(android::CameraParameters::KEY_SUPPORTED_WHITE_BALANCE, mCameraProperties->get(CameraProperties::SUPPORTED_WHITE_BALANCE));
     p.set(android::CameraParameters::KEY_SUPPORTED_EFFECTS, mCameraProperties->get(CameraProperties::SUPPORTED_EFFECTS));
@@ -3966,6 +4097,7 @@ void CameraHal::initDefaultParameters()
 
     LOG_FUNCTION_NAME;
 
+    invalidateParameters();
     insertSupportedParams();
 
     ret = parseResolution(mCameraProperties->get(CameraProperties::PREVIEW_SIZE), width, height);
@@ -4070,6 +4202,67 @@ void CameraHal::initDefaultParameters()
     LOG_FUNCTION_NAME_EXIT;
 }
 
+/**
+   @brief Grows the preview buffer count for the next start if the camera ran
+          short of queued buffers, or gives the extra buffers back once it
+          kept enough of them queued.
+
+   The count stays between the required count of the sensor and
+   NO_BUFFERS_PREVIEW.
+
+   @param none
+   @return none
+
+ */
+void CameraHal::tunePreviewBufferCount()
+{
+    CameraAdapter::StarvationStats stats;
+    unsigned int required;
+    unsigned int current;
+    unsigned int next;
+    unsigned int starvedPercent;
+
+    LOG_FUNCTION_NAME;
+
+    if ( NO_ERROR != mCameraAdapter->sendCommand(CameraAdapter::CAMERA_QUERY_PREVIEW_STARVATION,
+                                                 ( int ) &stats) )
+        {
+        return;
+        }
+
+    // too short a run to tell anything
+    if ( PREVIEW_STARVATION_MIN_FRAMES > stats.mFrames )
+        {
+        return;
+        }
+
+    required = atoi(mCameraProperties->get(CameraProperties::REQUIRED_PREVIEW_BUFS));
+    current = ( mPreviewBufferCount > required ) ? mPreviewBufferCount : required;
+    next = current;
+    starvedPercent = ( stats.mStarvedFrames * 100 ) / stats.mFrames;
+
+    if ( ( PREVIEW_STARVATION_GROW_PERCENT <= starvedPercent ) &&
+         ( ( unsigned int ) NO_BUFFERS_PREVIEW > current ) )
+        {
+        next = current + 1;
+        }
+    else if ( ( 0 == stats.mStarvedFrames ) &&
+              ( stats.mMinQueued > stats.mThreshold ) &&
+              ( required < current ) )
+        {
+        next = current - 1;
+        }
+
+    CAMHAL_LOGI("Preview starved %u of %u frames (%u%%), %u times, longest %u frames, "
+                 "min queued %u, threshold %u: %u preview buffers -> %u",
+                 stats.mStarvedFrames, stats.mFrames, starvedPercent, stats.mEvents,
+                 stats.mLongestRun, stats.mMinQueued, stats.mThreshold, current, next);
+
+    mTunedPreviewBufferCount = ( next > required ) ? next : 0;
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
 /**
    @brief Stop a previously started preview.
    @param none
@@ -4107,6 +4300,10 @@ void CameraHal::forceStopPreview()
            mCameraAdapter->sendCommand(CameraAdapter::CAMERA_STOP_FD);
         }
 
+        if ( mPreviewBufferAutoTune && ( NULL != mPreviewBuffers ) ) {
+            tunePreviewBufferCount();
+        }
+
         mCameraAdapter->rollbackToInitializedState();
 
     }
@@ -4209,5 +4406,19 @@ camera_buffer_get_omx_ptr (CameraBuffer *buffer)
     }
 }
 
+int
+camera_buffer_get_fd (CameraBuffer *buffer)
+{
+    if (buffer->type == CAMERA_BUFFER_ANW) {
+        buffer_handle_t *handle = (buffer_handle_t *)buffer->opaque;
+        IMG_native_handle_t *img = (IMG_native_handle_t *)*handle;
+        return img->fd[0];
+    } else if (buffer->type == CAMERA_BUFFER_ION) {
+        return buffer->fd;
+    } else {
+        return -1;
+    }
+}
+
 } // namespace Camera
 } // namespace Ti
@@ -78,6 +78,16 @@ void FrameProvider::removeFramePointers()
   return;
 }
 
+int FrameProvider::enableAsyncDelivery(size_t depth, FrameNotifier::DeliveryPolicy policy)
+{
+    return mFrameNotifier->enableAsyncDelivery(mCookie, depth, policy);
+}
+
+void FrameProvider::disableAsyncDelivery()
+{
+    mFrameNotifier->disableAsyncDelivery(mCookie);
+}
+
 /*--------------------FrameProvider Class ENDS here-----------------------------*/
 
 /*--------------------EventProvider Class STARTS here-----------------------------*/
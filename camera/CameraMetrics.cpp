@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CameraHal.h"
+#include "CameraMetrics.h"
+
+#include <string.h>
+#include <unistd.h>
+
+namespace Ti {
+namespace Camera {
+
+namespace {
+
+const char * const sLatencyNames[CameraMetrics::LATENCY_COUNT] = {
+    "returnFrame to fill",
+    "jpeg encode",
+    "setParameters",
+};
+
+const char * const sCounterNames[CameraMetrics::COUNTER_COUNT] = {
+    "dropped by delivery queues",
+    "dropped by preview callbacks",
+};
+
+} // anonymous namespace
+
+CameraMetrics::CameraMetrics() {
+    memset(mFrameTypes, 0, sizeof(mFrameTypes));
+    memset(mConsumers, 0, sizeof(mConsumers));
+    memset(mLatencies, 0, sizeof(mLatencies));
+    memset((void *) mCounters, 0, sizeof(mCounters));
+    mSince = systemTime();
+}
+
+int CameraMetrics::getTypeIndex(int frameType) {
+    if ((0 >= frameType) || (0 != (frameType & (frameType - 1)))) {
+        return -1;
+    }
+
+    int index = __builtin_ctz(frameType);
+
+    return (FRAME_TYPE_COUNT > index) ? index : -1;
+}
+
+void CameraMetrics::raiseMax(volatile int32_t *max, int32_t value) {
+    int32_t old;
+
+    do {
+        old = android_atomic_acquire_load(max);
+        if (value <= old) {
+            return;
+        }
+    } while (android_atomic_release_cas(old, value, max));
+}
+
+void CameraMetrics::recordTime(Histogram &histogram, nsecs_t time) {
+    nsecs_t us = ns2us(time);
+    int32_t value;
+    int bucket;
+
+    if (0 > us) {
+        us = 0;
+    }
+    value = (0x7fffffff < us) ? 0x7fffffff : (int32_t) us;
+
+    // bucket i takes [2^(i-1), 2^i) us, bucket 0 everything below 1 us
+    bucket = (0 == value) ? 0 : 32 - __builtin_clz((uint32_t) value);
+    if (BUCKET_COUNT <= bucket) {
+        bucket = BUCKET_COUNT - 1;
+    }
+
+    android_atomic_inc(&histogram.mBuckets[bucket]);
+    android_atomic_inc(&histogram.mCount);
+    raiseMax(&histogram.mMax, value);
+}
+
+void CameraMetrics::resetHistogram(Histogram &histogram) {
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        android_atomic_release_store(0, &histogram.mBuckets[i]);
+    }
+    android_atomic_release_store(0, &histogram.mCount);
+    android_atomic_release_store(0, &histogram.mMax);
+}
+
+CameraMetrics::Consumer *CameraMetrics::getConsumer(int cookie) {
+    for (int i = 0; i < MAX_CONSUMERS; i++) {
+        Consumer &consumer = mConsumers[i];
+        int32_t current = android_atomic_acquire_load(&consumer.mCookie);
+
+        if (current == cookie) {
+            return &consumer;
+        }
+
+        // a subscriber showing up the first time takes the next free slot
+        if ((0 == current) &&
+            ((0 == android_atomic_release_cas(0, cookie, &consumer.mCookie)) ||
+             (android_atomic_acquire_load(&consumer.mCookie) == cookie))) {
+            return &consumer;
+        }
+    }
+
+    return NULL;
+}
+
+void CameraMetrics::frameArrived(int frameType) {
+    int index = getTypeIndex(frameType);
+    int32_t now;
+    int32_t last;
+
+    if (0 > index) {
+        return;
+    }
+
+    FrameTypeMetrics &type = mFrameTypes[index];
+
+    // only differences are taken, the wrap of the microseconds doesn't matter
+    now = (int32_t) ns2us(systemTime());
+    if (0 == now) {
+        now = 1;
+    }
+
+    last = android_atomic_acquire_load(&type.mLastArrival);
+    android_atomic_release_store(now, &type.mLastArrival);
+
+    if (0 != last) {
+        recordTime(type.mInterval, us2ns((nsecs_t) (uint32_t) (now - last)));
+    }
+}
+
+void CameraMetrics::frameDispatched(int frameType, int cookie, nsecs_t latency) {
+    Consumer *consumer = getConsumer(cookie);
+
+    if (NULL != consumer) {
+        android_atomic_or(frameType, &consumer->mFrameTypes);
+        recordTime(consumer->mDispatch, latency);
+    }
+}
+
+void CameraMetrics::framesHeld(int frameType, int references) {
+    int index = getTypeIndex(frameType);
+
+    if (0 <= index) {
+        FrameTypeMetrics &type = mFrameTypes[index];
+
+        raiseMax(&type.mMaxHeld, android_atomic_add(references, &type.mHeld) + references);
+    }
+}
+
+void CameraMetrics::record(Latency latency, nsecs_t time) {
+    if ((0 <= latency) && (LATENCY_COUNT > latency)) {
+        recordTime(mLatencies[latency], time);
+    }
+}
+
+void CameraMetrics::reset() {
+    for (int i = 0; i < FRAME_TYPE_COUNT; i++) {
+        FrameTypeMetrics &type = mFrameTypes[i];
+
+        // the buffers held right now stay held, only their peak restarts
+        resetHistogram(type.mInterval);
+        android_atomic_release_store(android_atomic_acquire_load(&type.mHeld), &type.mMaxHeld);
+    }
+
+    for (int i = 0; i < MAX_CONSUMERS; i++) {
+        resetHistogram(mConsumers[i].mDispatch);
+    }
+
+    for (int i = 0; i < LATENCY_COUNT; i++) {
+        resetHistogram(mLatencies[i]);
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        android_atomic_release_store(0, &mCounters[i]);
+    }
+
+    mSince = systemTime();
+}
+
+int32_t CameraMetrics::getPercentile(const Histogram &histogram, int32_t count, int percent) {
+    int64_t target = ((int64_t) count * percent + 99) / 100;
+    int64_t seen = 0;
+    int32_t max = android_atomic_acquire_load(&histogram.mMax);
+
+    for (int i = 0; i < BUCKET_COUNT - 1; i++) {
+        seen += android_atomic_acquire_load(&histogram.mBuckets[i]);
+        if (seen >= target) {
+            int32_t bound = 1 << i;
+
+            return (bound < max) ? bound : max;
+        }
+    }
+
+    return max;
+}
+
+void CameraMetrics::dumpHistogram(android::String8 &out, const char *name, const Histogram &histogram) {
+    int32_t count = android_atomic_acquire_load(&histogram.mCount);
+
+    if (0 == count) {
+        return;
+    }
+
+    out.appendFormat("    %-32s %8d %9d %9d %9d %9d\n", name, count,
+                     getPercentile(histogram, count, 50),
+                     getPercentile(histogram, count, 90),
+                     getPercentile(histogram, count, 99),
+                     android_atomic_acquire_load(&histogram.mMax));
+}
+
+status_t CameraMetrics::dump(int fd) {
+    android::String8 out;
+    char name[64];
+
+    out.appendFormat("Camera metrics of the last %lld ms, times in us\n",
+                     (long long) ns2ms(systemTime() - mSince));
+    out.appendFormat("    %-32s %8s %9s %9s %9s %9s\n", "", "count", "p50", "p90", "p99", "max");
+
+    for (int i = 0; i < FRAME_TYPE_COUNT; i++) {
+        snprintf(name, sizeof(name), "frame 0x%x interval", 1 << i);
+        dumpHistogram(out, name, mFrameTypes[i].mInterval);
+    }
+
+    for (int i = 0; i < MAX_CONSUMERS; i++) {
+        const Consumer &consumer = mConsumers[i];
+        int32_t cookie = android_atomic_acquire_load(&consumer.mCookie);
+
+        if (0 == cookie) {
+            break;
+        }
+
+        snprintf(name, sizeof(name), "dispatch to 0x%x (0x%x)", cookie,
+                 android_atomic_acquire_load(&consumer.mFrameTypes));
+        dumpHistogram(out, name, consumer.mDispatch);
+    }
+
+    for (int i = 0; i < LATENCY_COUNT; i++) {
+        dumpHistogram(out, sLatencyNames[i], mLatencies[i]);
+    }
+
+    out.append("  Buffers held by subscribers:\n");
+    for (int i = 0; i < FRAME_TYPE_COUNT; i++) {
+        const FrameTypeMetrics &type = mFrameTypes[i];
+        int32_t maxHeld = android_atomic_acquire_load(&type.mMaxHeld);
+
+        if (0 != maxHeld) {
+            out.appendFormat("    frame 0x%-24x %d now, %d at most\n", 1 << i,
+                             android_atomic_acquire_load(&type.mHeld), maxHeld);
+        }
+    }
+
+    out.append("  Frames:\n");
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        out.appendFormat("    %-32s %8d\n", sCounterNames[i],
+                         android_atomic_acquire_load(&mCounters[i]));
+    }
+
+    if (0 > write(fd, out.string(), out.length())) {
+        return -errno;
+    }
+
+    return NO_ERROR;
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CapabilityIndex.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Ti {
+namespace Camera {
+
+const CapabilityIndex::Info CapabilityIndex::sInfo[CapabilityIndex::SET_COUNT] = {
+    { CameraProperties::SUPPORTED_PREVIEW_FORMATS,            VALUES },
+    { CameraProperties::SUPPORTED_IPP_MODES,                  VALUES },
+    { CameraProperties::SUPPORTED_PREVIEW_SIZES,              SIZES },
+    { CameraProperties::SUPPORTED_PREVIEW_SUBSAMPLED_SIZES,   SIZES },
+    { CameraProperties::SUPPORTED_PREVIEW_SIDEBYSIDE_SIZES,   SIZES },
+    { CameraProperties::SUPPORTED_PREVIEW_TOPBOTTOM_SIZES,    SIZES },
+    { CameraProperties::SUPPORTED_FOCUS_MODES,                VALUES },
+    { CameraProperties::SUPPORTED_PICTURE_FORMATS,            VALUES },
+    { CameraProperties::SUPPORTED_PICTURE_SIZES,              SIZES },
+    { CameraProperties::SUPPORTED_PICTURE_SUBSAMPLED_SIZES,   SIZES },
+    { CameraProperties::SUPPORTED_PICTURE_TOPBOTTOM_SIZES,    SIZES },
+    { CameraProperties::SUPPORTED_PICTURE_SIDEBYSIDE_SIZES,   SIZES },
+    { CameraProperties::SUPPORTED_EXPOSURE_MODES,             VALUES },
+    { CameraProperties::SUPPORTED_WHITE_BALANCE,              VALUES },
+    { CameraProperties::SUPPORTED_ANTIBANDING,                VALUES },
+    { CameraProperties::SUPPORTED_ISO_VALUES,                 VALUES },
+    { CameraProperties::SUPPORTED_SCENE_MODES,                VALUES },
+    { CameraProperties::SUPPORTED_FLASH_MODES,                VALUES },
+    { CameraProperties::SUPPORTED_EFFECTS,                    VALUES },
+    { NULL,                                                   RANGES },
+    { NULL,                                                   RANGES },
+    { NULL,                                                   INTEGERS },
+    { NULL,                                                   INTEGERS },
+};
+
+namespace {
+
+int compareValues(const char * const *a, const char * const *b) {
+    return strcmp(*a, *b);
+}
+
+int compareSizes(const uint32_t *a, const uint32_t *b) {
+    return (*a == *b) ? 0 : ((*a < *b) ? -1 : 1);
+}
+
+int compareIntegers(const int *a, const int *b) {
+    return (*a == *b) ? 0 : ((*a < *b) ? -1 : 1);
+}
+
+template <typename T, typename K, typename C>
+bool contains(const android::Vector<T> &sorted, const K &key, C compare) {
+    ssize_t low = 0;
+    ssize_t high = (ssize_t) sorted.size() - 1;
+
+    while (low <= high) {
+        ssize_t mid = low + (high - low) / 2;
+        int cmp = compare(&sorted[mid], &key);
+
+        if (0 == cmp) {
+            return true;
+        }
+
+        if (0 > cmp) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return false;
+}
+
+// the whole token has to be a number, like the "%d" strings compared before
+bool parseInt(const char *str, char **end, int &value) {
+    char *pos;
+    long result;
+
+    if (('\0' == *str) || ('+' == *str) || isspace(*str)) {
+        return false;
+    }
+
+    result = strtol(str, &pos, 10);
+    if (pos == str) {
+        return false;
+    }
+
+    value = (int) result;
+    *end = pos;
+
+    return true;
+}
+
+} // anonymous namespace
+
+CapabilityIndex::CapabilityIndex()
+    : mProperties(NULL) {
+}
+
+CapabilityIndex::~CapabilityIndex() {
+    for (int mode = 0; mode < MODE_MAX; mode++) {
+        for (int set = 0; set < SET_COUNT; set++) {
+            clear(mEntries[mode][set]);
+        }
+    }
+}
+
+status_t CapabilityIndex::build(CameraProperties::Properties *properties) {
+    OperatingMode originalMode;
+
+    if (NULL == properties) {
+        return -EINVAL;
+    }
+
+    mProperties = properties;
+    originalMode = properties->getMode();
+
+    for (int mode = 0; mode < MODE_MAX; mode++) {
+        properties->setMode(static_cast<OperatingMode>(mode));
+
+        for (int set = 0; set < SET_COUNT; set++) {
+            if (NULL != sInfo[set].mKey) {
+                parse(mEntries[mode][set], sInfo[set].mType, properties->get(sInfo[set].mKey));
+            }
+        }
+    }
+
+    properties->setMode(originalMode);
+
+    return NO_ERROR;
+}
+
+void CapabilityIndex::setValues(Set set, const char *values) {
+    if ((0 > set) || (SET_COUNT <= set) || (NULL != sInfo[set].mKey)) {
+        CAMHAL_LOGEB("Set %d can't be given values", set);
+        return;
+    }
+
+    parse(mEntries[0][set], sInfo[set].mType, values);
+}
+
+void CapabilityIndex::clear(Entry &entry) {
+    free(entry.mStorage);
+    entry.mStorage = NULL;
+    entry.mValues.clear();
+    entry.mSizes.clear();
+    entry.mIntegers.clear();
+    entry.mRanges.clear();
+}
+
+void CapabilityIndex::parse(Entry &entry, Type type, const char *values) {
+    char *ctx = NULL;
+    char *token;
+
+    clear(entry);
+
+    if (NULL == values) {
+        return;
+    }
+
+    entry.mStorage = strdup(values);
+    if (NULL == entry.mStorage) {
+        CAMHAL_LOGEA("Couldn't copy supported values");
+        return;
+    }
+
+    if (RANGES == type) {
+        FpsRange range;
+        int count = 0;
+
+        for (token = strtok_r(entry.mStorage, " (,)", &ctx); NULL != token;
+             token = strtok_r(NULL, " (,)", &ctx)) {
+            if (0 == count++) {
+                range.mMin = atoi(token);
+            } else {
+                range.mMax = atoi(token);
+                entry.mRanges.push_back(range);
+                count = 0;
+            }
+        }
+    } else {
+        for (token = strtok_r(entry.mStorage, ",", &ctx); NULL != token;
+             token = strtok_r(NULL, ",", &ctx)) {
+            char *end;
+            int width;
+            int height;
+
+            switch (type) {
+                case VALUES:
+                    entry.mValues.push_back(token);
+                    break;
+
+                case SIZES:
+                    if (parseInt(token, &end, width) && ('x' == *end) &&
+                        parseInt(end + 1, &end, height) && ('\0' == *end) &&
+                        (0 <= width) && (0xffff >= width) && (0 <= height) && (0xffff >= height)) {
+                        entry.mSizes.push_back(((uint32_t) width << 16) | (uint32_t) height);
+                    }
+                    break;
+
+                case INTEGERS:
+                    if (parseInt(token, &end, width) && ('\0' == *end)) {
+                        entry.mIntegers.push_back(width);
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    entry.mValues.sort(compareValues);
+    entry.mSizes.sort(compareSizes);
+    entry.mIntegers.sort(compareIntegers);
+
+    // only the value tokens point into the copy
+    if (VALUES != type) {
+        free(entry.mStorage);
+        entry.mStorage = NULL;
+    }
+}
+
+const CapabilityIndex::Entry *CapabilityIndex::getEntry(Set set, Type type) const {
+    int mode = 0;
+
+    if ((0 > set) || (SET_COUNT <= set) || (type != sInfo[set].mType)) {
+        CAMHAL_LOGEB("Set %d isn't of type %d", set, type);
+        return NULL;
+    }
+
+    if (NULL != sInfo[set].mKey) {
+        if (NULL == mProperties) {
+            CAMHAL_LOGEA("Capability index not built");
+            return NULL;
+        }
+
+        mode = mProperties->getMode();
+        if ((0 > mode) || (MODE_MAX <= mode)) {
+            return NULL;
+        }
+    }
+
+    return &mEntries[mode][set];
+}
+
+bool CapabilityIndex::isValid(Set set, const char *value) const {
+    const Entry *entry = getEntry(set, VALUES);
+
+    if ((NULL == entry) || (NULL == value)) {
+        return false;
+    }
+
+    return contains(entry->mValues, value, compareValues);
+}
+
+bool CapabilityIndex::isValid(Set set, int value) const {
+    const Entry *entry = getEntry(set, INTEGERS);
+
+    if (NULL == entry) {
+        return false;
+    }
+
+    return contains(entry->mIntegers, value, compareIntegers);
+}
+
+bool CapabilityIndex::isResolutionValid(Set set, unsigned int width, unsigned int height) const {
+    const Entry *entry = getEntry(set, SIZES);
+
+    if ((NULL == entry) || (0xffff < width) || (0xffff < height)) {
+        return false;
+    }
+
+    return contains(entry->mSizes, (uint32_t) ((width << 16) | height), compareSizes);
+}
+
+bool CapabilityIndex::isFpsRangeValid(Set set, int fpsMin, int fpsMax) const {
+    const Entry *entry = getEntry(set, RANGES);
+
+    if (NULL == entry) {
+        return false;
+    }
+
+    if (fpsMin <= 0 || fpsMax <= 0 || fpsMin > fpsMax) {
+        return false;
+    }
+
+    // a handful of ranges, they are only scanned
+    for (size_t i = 0; i < entry->mRanges.size(); i++) {
+        if ((fpsMin >= entry->mRanges[i].mMin) && (fpsMax <= entry->mRanges[i].mMax)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -25,6 +25,7 @@
 
 #include "Encoder_libjpeg.h"
 #include "NV12_resize.h"
+#include "YuvConvert.h"
 #include "TICameraParameters.h"
 
 #include <stdlib.h>
@@ -43,10 +44,37 @@ extern "C" {
 
 #define ARRAY_SIZE(array) (sizeof((array)) / sizeof((array)[0]))
 #define MIN(x,y) ((x < y) ? x : y)
+#define MAX(x,y) ((x > y) ? x : y)
+
+// marker codes used when splicing stripes
+#define JPEG_SOF0 0xC0
+#define JPEG_RST0 0xD0
+#define JPEG_SOI  0xD8
+#define JPEG_EOI  0xD9
+#define JPEG_SOS  0xDA
+
+// largest payload jpeg_write_marker() accepts
+#define JPEG_MAX_MARKER_DATA 65533
 
 namespace Ti {
 namespace Camera {
 
+// jhead keeps the parsed jpeg in globals
+static android::Mutex sJheadLock;
+
+// smallest stream jhead accepts: SOF0 carrying the frame size, an empty scan
+// and EOI; only used as a carrier to let create_EXIF() build the APP1 section
+static const uint8_t exif_carrier_jpeg[] = {
+    0xFF, 0xD8,
+    0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0x00, 0x00, 0x00,
+    0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+    0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11,
+    0x00, 0x3F, 0x00,
+    0xFF, 0xD9,
+};
+#define EXIF_CARRIER_HEIGHT_OFFSET 7
+#define EXIF_CARRIER_WIDTH_OFFSET  9
+
 struct integer_string_pair {
     unsigned int integer;
     const char* string;
@@ -65,6 +93,7 @@ struct libjpeg_destination_mgr : jpeg_destination_mgr {
     uint8_t* buf;
     int bufsize;
     size_t jpegsize;
+    bool overflow;
 };
 
 static void libjpeg_init_destination (j_compress_ptr cinfo) {
@@ -80,6 +109,7 @@ static boolean libjpeg_empty_output_buffer(j_compress_ptr cinfo) {
 
     dest->next_output_byte = dest->buf;
     dest->free_in_buffer = dest->bufsize;
+    dest->overflow = true;
     return TRUE; // ?
 }
 
@@ -97,6 +127,7 @@ libjpeg_destination_mgr::libjpeg_destination_mgr(uint8_t* input, int size) {
     this->bufsize = size;
 
     jpegsize = 0;
+    overflow = false;
 }
 
 /* private static functions */
@@ -123,54 +154,7 @@ static void uyvy_to_yuv(uint8_t* dst, uint32_t* src, int width) {
         return;
     }
 
-    if (width % 2) {
-        return; // not supporting odd widths
-    }
-
-    // currently, neon routine only supports multiple of 16 width
-    if (width % 16) {
-        while ((width-=2) >= 0) {
-            uint8_t u0 = (src[0] >> 0) & 0xFF;
-            uint8_t y0 = (src[0] >> 8) & 0xFF;
-            uint8_t v0 = (src[0] >> 16) & 0xFF;
-            uint8_t y1 = (src[0] >> 24) & 0xFF;
-            dst[0] = y0;
-            dst[1] = u0;
-            dst[2] = v0;
-            dst[3] = y1;
-            dst[4] = u0;
-            dst[5] = v0;
-            dst += 6;
-            src++;
-        }
-    } else {
-        int n = width;
-        asm volatile (
-        "   pld [%[src], %[src_stride], lsl #2]                         \n\t"
-        "   cmp %[n], #16                                               \n\t"
-        "   blt 5f                                                      \n\t"
-        "0: @ 16 pixel swap                                             \n\t"
-        "   vld2.8  {q0, q1} , [%[src]]! @ q0 = uv q1 = y               \n\t"
-        "   vuzp.8 q0, q2                @ d0 = u d4 = v                \n\t"
-        "   vmov d1, d0                  @ q0 = u0u1u2..u0u1u2...       \n\t"
-        "   vmov d5, d4                  @ q2 = v0v1v2..v0v1v2...       \n\t"
-        "   vzip.8 d0, d1                @ q0 = u0u0u1u1u2u2...         \n\t"
-        "   vzip.8 d4, d5                @ q2 = v0v0v1v1v2v2...         \n\t"
-        "   vswp q0, q1                  @ now q0 = y q1 = u q2 = v     \n\t"
-        "   vst3.8  {d0,d2,d4},[%[dst]]!                                \n\t"
-        "   vst3.8  {d1,d3,d5},[%[dst]]!                                \n\t"
-        "   sub %[n], %[n], #16                                         \n\t"
-        "   cmp %[n], #16                                               \n\t"
-        "   bge 0b                                                      \n\t"
-        "5: @ end                                                       \n\t"
-#ifdef NEEDS_ARM_ERRATA_754319_754320
-        "   vmov s0,s0  @ add noop for errata item                      \n\t"
-#endif
-        : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (n)
-        : [src_stride] "r" (width)
-        : "cc", "memory", "q0", "q1", "q2"
-        );
-    }
+    yuv422iToYuv444Row(dst, (const uint8_t*) src, width, true);
 }
 
 static void yuyv_to_yuv(uint8_t* dst, uint32_t* src, int width) {
@@ -178,53 +162,44 @@ static void yuyv_to_yuv(uint8_t* dst, uint32_t* src, int width) {
         return;
     }
 
-    if (width % 2) {
-        return; // not supporting odd widths
+    yuv422iToYuv444Row(dst, (const uint8_t*) src, width, false);
+}
+
+static void nv21_to_planar(uint8_t* cb, uint8_t* cr, const uint8_t* uv, int width) {
+    // yuv420sp chroma is stored as v/u pairs, see nv21_to_yuv()
+    while ((width--) > 0) {
+        *cr++ = uv[0];
+        *cb++ = uv[1];
+        uv += 2;
     }
+}
 
-    // currently, neon routine only supports multiple of 16 width
-    if (width % 16) {
-        while ((width-=2) >= 0) {
-            uint8_t y0 = (src[0] >> 0) & 0xFF;
-            uint8_t u0 = (src[0] >> 8) & 0xFF;
-            uint8_t y1 = (src[0] >> 16) & 0xFF;
-            uint8_t v0 = (src[0] >> 24) & 0xFF;
-            dst[0] = y0;
-            dst[1] = u0;
-            dst[2] = v0;
-            dst[3] = y1;
-            dst[4] = u0;
-            dst[5] = v0;
-            dst += 6;
-            src++;
-        }
-    } else {
-        int n = width;
-        asm volatile (
-        "   pld [%[src], %[src_stride], lsl #2]                         \n\t"
-        "   cmp %[n], #16                                               \n\t"
-        "   blt 5f                                                      \n\t"
-        "0: @ 16 pixel swap                                             \n\t"
-        "   vld2.8  {q0, q1} , [%[src]]! @ q0 = yyyy.. q1 = uvuv..      \n\t"
-        "   vuzp.8 q1, q2                @ d2 = u d4 = v                \n\t"
-        "   vmov d3, d2                  @ q1 = u0u1u2..u0u1u2...       \n\t"
-        "   vmov d5, d4                  @ q2 = v0v1v2..v0v1v2...       \n\t"
-        "   vzip.8 d2, d3                @ q1 = u0u0u1u1u2u2...         \n\t"
-        "   vzip.8 d4, d5                @ q2 = v0v0v1v1v2v2...         \n\t"
-        "                                @ now q0 = y q1 = u q2 = v     \n\t"
-        "   vst3.8  {d0,d2,d4},[%[dst]]!                                \n\t"
-        "   vst3.8  {d1,d3,d5},[%[dst]]!                                \n\t"
-        "   sub %[n], %[n], #16                                         \n\t"
-        "   cmp %[n], #16                                               \n\t"
-        "   bge 0b                                                      \n\t"
-        "5: @ end                                                       \n\t"
-#ifdef NEEDS_ARM_ERRATA_754319_754320
-        "   vmov s0,s0  @ add noop for errata item                      \n\t"
-#endif
-        : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (n)
-        : [src_stride] "r" (width)
-        : "cc", "memory", "q0", "q1", "q2"
-        );
+static void yuv422i_to_planar(uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr,
+                              const uint8_t* src0, const uint8_t* src1, int width, bool uyvy) {
+    const int y_off = uyvy ? 1 : 0;
+    const int u_off = uyvy ? 0 : 1;
+    const int v_off = uyvy ? 2 : 3;
+
+    // two source rows produce two luma rows and one vertically averaged
+    // chroma row, matching libjpeg's own h2v2 downsampling of yuv444 input
+    for (int x = 0; x < width; x += 2) {
+        y0[0] = src0[y_off];
+        y0[1] = src0[y_off + 2];
+        y1[0] = src1[y_off];
+        y1[1] = src1[y_off + 2];
+        *cb++ = (uint8_t)((src0[u_off] + src1[u_off] + 1) >> 1);
+        *cr++ = (uint8_t)((src0[v_off] + src1[v_off] + 1) >> 1);
+        y0 += 2;
+        y1 += 2;
+        src0 += 4;
+        src1 += 4;
+    }
+}
+
+static void pad_row(uint8_t* row, int width, int padded_width) {
+    // replicate the right edge so that partial MCUs compress cleanly
+    if ((width > 0) && (padded_width > width)) {
+        memset(row + width, row[width - 1], padded_width - width);
     }
 }
 
@@ -318,33 +293,69 @@ bool ExifElementsTable::isAsciiTag(const char* tag) {
     return (strcmp(tag, TAG_GPS_PROCESSING_METHOD) == 0);
 }
 
-void ExifElementsTable::insertExifToJpeg(unsigned char* jpeg, size_t jpeg_size) {
+status_t ExifElementsTable::createExifSegment(const char* thumb, int thumb_len,
+                                              int width, int height) {
     ReadMode_t read_mode = (ReadMode_t)(READ_METADATA | READ_IMAGE);
+    uint8_t carrier[sizeof(exif_carrier_jpeg)];
+    Section_t* exif_section = NULL;
+    status_t ret = NO_ERROR;
 
-    ResetJpgfile();
-    if (ReadJpegSectionsFromBuffer(jpeg, jpeg_size, read_mode)) {
-        jpeg_opened = true;
-        create_EXIF(table, exif_tag_count, gps_tag_count);
+    android::AutoMutex lock(sJheadLock);
+
+    if (segment) {
+        free(segment);
+        segment = NULL;
+        segment_size = 0;
     }
-}
 
-status_t ExifElementsTable::insertExifThumbnailImage(const char* thumb, int len) {
-    status_t ret = NO_ERROR;
+    memcpy(carrier, exif_carrier_jpeg, sizeof(carrier));
+    carrier[EXIF_CARRIER_HEIGHT_OFFSET] = (height >> 8) & 0xFF;
+    carrier[EXIF_CARRIER_HEIGHT_OFFSET + 1] = height & 0xFF;
+    carrier[EXIF_CARRIER_WIDTH_OFFSET] = (width >> 8) & 0xFF;
+    carrier[EXIF_CARRIER_WIDTH_OFFSET + 1] = width & 0xFF;
 
-    if ((len > 0) && jpeg_opened) {
-        ret = ReplaceThumbnailFromBuffer(thumb, len) ? NO_ERROR : UNKNOWN_ERROR;
-        CAMHAL_LOGDB("insertExifThumbnailImage. ReplaceThumbnail(). ret=%d", ret);
+    ResetJpgfile();
+    if (!ReadJpegSectionsFromBuffer(carrier, sizeof(carrier), read_mode)) {
+        CAMHAL_LOGEA("Exif: failed to parse carrier jpeg");
+        return UNKNOWN_ERROR;
     }
 
-    return ret;
-}
+    // jhead isn't taking datetime tag...this is a WA. ImageInfo is jhead's
+    // global, so it is only written with sJheadLock held.
+    ImageInfo.numDateTimeTags = 0;
+    for (int i = 0; i < exif_tag_count + gps_tag_count; i++) {
+        if (!table[i].GpsTag && (table[i].Tag == TagNameToValue(TAG_DATETIME)) && table[i].Value) {
+            ImageInfo.numDateTimeTags = 1;
+            strncpy(ImageInfo.DateTime, table[i].Value, ARRAY_SIZE(ImageInfo.DateTime) - 1);
+            ImageInfo.DateTime[ARRAY_SIZE(ImageInfo.DateTime) - 1] = '\0';
+        }
+    }
+
+    create_EXIF(table, exif_tag_count, gps_tag_count);
+
+    if ((thumb_len > 0) && !ReplaceThumbnailFromBuffer(thumb, thumb_len)) {
+        CAMHAL_LOGEB("Exif: failed to insert %d bytes thumbnail", thumb_len);
+    }
 
-void ExifElementsTable::saveJpeg(unsigned char* jpeg, size_t jpeg_size) {
-    if (jpeg_opened) {
-       WriteJpegToBuffer(jpeg, jpeg_size);
-       DiscardData();
-       jpeg_opened = false;
+    // section data starts with the two length bytes, the marker is not stored
+    exif_section = FindSection(M_EXIF);
+    if (!exif_section || (exif_section->Size < 2) ||
+        (exif_section->Size - 2 > JPEG_MAX_MARKER_DATA)) {
+        CAMHAL_LOGEA("Exif: no usable APP1 section");
+        ret = UNKNOWN_ERROR;
+    } else {
+        segment = (uint8_t*) malloc(exif_section->Size - 2);
+        if (segment) {
+            segment_size = exif_section->Size - 2;
+            memcpy(segment, exif_section->Data + 2, segment_size);
+        } else {
+            ret = NO_MEMORY;
+        }
     }
+
+    DiscardData();
+
+    return ret;
 }
 
 /* public functions */
@@ -357,8 +368,8 @@ ExifElementsTable::~ExifElementsTable() {
         }
     }
 
-    if (jpeg_opened) {
-        DiscardData();
+    if (segment) {
+        free(segment);
     }
 }
 
@@ -389,13 +400,6 @@ status_t ExifElementsTable::insertElement(const char* tag, const char* value) {
         table[position].GpsTag = FALSE;
         table[position].Tag = TagNameToValue(tag);
         exif_tag_count++;
-
-        // jhead isn't taking datetime tag...this is a WA
-        if (strcmp(tag, TAG_DATETIME) == 0) {
-            ImageInfo.numDateTimeTags = 1;
-            memcpy(ImageInfo.DateTime, value,
-                   MIN(ARRAY_SIZE(ImageInfo.DateTime), value_length + 1));
-        }
     }
 
     table[position].DataLength = 0;
@@ -411,18 +415,407 @@ status_t ExifElementsTable::insertElement(const char* tag, const char* value) {
 }
 
 /* private member functions */
-size_t Encoder_libjpeg::encode(params* input) {
-    jpeg_compress_struct    cinfo;
-    jpeg_error_mgr jerr;
-    jpeg_destination_mgr jdest;
-    uint8_t* src = NULL, *resize_src = NULL;
+bool Encoder_libjpeg::isRawDataInEnabled() {
+    char value[PROPERTY_VALUE_MAX];
+
+    // raw planar input is the default, packed yuv444 input is kept as a fallback
+    property_get("debug.camera.jpeg.raw_data_in", value, "1");
+    return (atoi(value) != 0);
+}
+
+void Encoder_libjpeg::encodeScanlines(jpeg_compress_struct* cinfo, params* input,
+                                      uint8_t* src, int bpp, int first_row) {
     uint8_t* row_tmp = NULL;
     uint8_t* row_src = NULL;
     uint8_t* row_uv = NULL; // used only for NV12
+    int out_width = input->out_width;
+    int out_height = input->out_height;
+    int right_crop = input->right_crop;
+
+    row_tmp = (uint8_t*)malloc((out_width - right_crop) * 3);
+    if (!row_tmp) {
+        CAMHAL_LOGEA("Encoder: failed to allocate scanline buffer");
+        cancelEncoding();
+        return;
+    }
+
+    row_src = src + input->start_offset + first_row * out_width * bpp;
+    row_uv = src + out_width * out_height * bpp + (first_row / 2) * out_width * bpp;
+
+    while ((cinfo->next_scanline < cinfo->image_height) && !isCanceled()) {
+        JSAMPROW row[1];    /* pointer to JSAMPLE row[s] */
+
+        // convert input yuv format to yuv444
+        if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
+            nv21_to_yuv(row_tmp, row_src, row_uv, out_width - right_crop);
+        } else if (strcmp(input->format, TICameraParameters::PIXEL_FORMAT_YUV422I_UYVY) == 0) {
+            uyvy_to_yuv(row_tmp, (uint32_t*)row_src, out_width - right_crop);
+        } else if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV422I) == 0) {
+            yuyv_to_yuv(row_tmp, (uint32_t*)row_src, out_width - right_crop);
+        }
+
+        row[0] = row_tmp;
+        jpeg_write_scanlines(cinfo, row, 1);
+        row_src = row_src + out_width*bpp;
+
+        // move uv row if input format needs it
+        if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
+            if (!(cinfo->next_scanline % 2))
+                row_uv = row_uv +  out_width * bpp;
+        }
+    }
+
+    free(row_tmp);
+}
+
+void Encoder_libjpeg::encodeRawData(jpeg_compress_struct* cinfo, params* input,
+                                    uint8_t* src, int bpp, int first_row) {
+    const int width = input->out_width - input->right_crop;
+    const int height = cinfo->image_height;
+    const int stride = input->out_width * bpp;
+    const int luma_width = (width + RAW_MCU_SIZE - 1) & ~(RAW_MCU_SIZE - 1);
+    const int chroma_width = luma_width / 2;
+    const bool nv21 = (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0);
+    const bool uyvy = (strcmp(input->format, TICameraParameters::PIXEL_FORMAT_YUV422I_UYVY) == 0);
+    // luma of yuv420sp can be fed in place when no horizontal padding is needed
+    const bool direct_luma = nv21 && (luma_width == width);
+    uint8_t* luma_src = src + input->start_offset + first_row * stride;
+    uint8_t* uv_src = src + input->out_width * input->out_height * bpp + (first_row / 2) * stride;
+    uint8_t* scratch = NULL;
+    uint8_t* y_tmp = NULL;
+    uint8_t* cb_tmp = NULL;
+    uint8_t* cr_tmp = NULL;
+    JSAMPROW y_rows[RAW_MCU_SIZE];
+    JSAMPROW cb_rows[RAW_MCU_SIZE / 2];
+    JSAMPROW cr_rows[RAW_MCU_SIZE / 2];
+    JSAMPARRAY planes[3] = { y_rows, cb_rows, cr_rows };
+
+    scratch = (uint8_t*) malloc((direct_luma ? 0 : luma_width * RAW_MCU_SIZE) +
+                                chroma_width * RAW_MCU_SIZE);
+    if (!scratch) {
+        CAMHAL_LOGEA("Encoder: failed to allocate raw data buffers");
+        cancelEncoding();
+        return;
+    }
+
+    y_tmp = direct_luma ? NULL : scratch;
+    cb_tmp = scratch + (direct_luma ? 0 : luma_width * RAW_MCU_SIZE);
+    cr_tmp = cb_tmp + chroma_width * (RAW_MCU_SIZE / 2);
+
+    while ((cinfo->next_scanline < cinfo->image_height) && !isCanceled()) {
+        const int mcu_row = cinfo->next_scanline;
+        const int rows = MIN(RAW_MCU_SIZE, height - mcu_row);
+
+        for (int i = 0; i < RAW_MCU_SIZE / 2; i++) {
+            // rows past the bottom edge replicate the last valid row
+            const int y0 = MIN(mcu_row + 2 * i, height - 1);
+            const int y1 = MIN(mcu_row + 2 * i + 1, height - 1);
+            uint8_t* cb = cb_tmp + i * chroma_width;
+            uint8_t* cr = cr_tmp + i * chroma_width;
+
+            if (2 * i >= rows) {
+                y_rows[2 * i] = y_rows[2 * i - 1];
+                y_rows[2 * i + 1] = y_rows[2 * i - 1];
+                cb_rows[i] = cb_rows[i - 1];
+                cr_rows[i] = cr_rows[i - 1];
+                continue;
+            }
+
+            if (nv21) {
+                if (direct_luma) {
+                    y_rows[2 * i] = luma_src + y0 * stride;
+                    y_rows[2 * i + 1] = luma_src + y1 * stride;
+                } else {
+                    y_rows[2 * i] = y_tmp + (2 * i) * luma_width;
+                    y_rows[2 * i + 1] = y_tmp + (2 * i + 1) * luma_width;
+                    memcpy(y_rows[2 * i], luma_src + y0 * stride, width);
+                    memcpy(y_rows[2 * i + 1], luma_src + y1 * stride, width);
+                    pad_row(y_rows[2 * i], width, luma_width);
+                    pad_row(y_rows[2 * i + 1], width, luma_width);
+                }
+                nv21_to_planar(cb, cr, uv_src + (y0 / 2) * stride, (width + 1) / 2);
+            } else {
+                y_rows[2 * i] = y_tmp + (2 * i) * luma_width;
+                y_rows[2 * i + 1] = y_tmp + (2 * i + 1) * luma_width;
+                yuv422i_to_planar(y_rows[2 * i], y_rows[2 * i + 1], cb, cr,
+                                  luma_src + y0 * stride, luma_src + y1 * stride,
+                                  width, uyvy);
+                pad_row(y_rows[2 * i], width, luma_width);
+                pad_row(y_rows[2 * i + 1], width, luma_width);
+            }
+            pad_row(cb, (width + 1) / 2, chroma_width);
+            pad_row(cr, (width + 1) / 2, chroma_width);
+            cb_rows[i] = cb;
+            cr_rows[i] = cr;
+        }
+
+        jpeg_write_raw_data(cinfo, planes, RAW_MCU_SIZE);
+    }
+
+    free(scratch);
+}
+
+size_t Encoder_libjpeg::compress(params* input, uint8_t* src, int bpp,
+                                 int first_row, int num_rows,
+                                 uint8_t* dst, int dst_size, bool restart_rows) {
+    jpeg_compress_struct    cinfo;
+    jpeg_error_mgr jerr;
+    bool raw_data_in = isRawDataInEnabled();
+
+    libjpeg_destination_mgr dest_mgr(dst, dst_size);
+
+    cinfo.err = jpeg_std_error(&jerr);
+
+    jpeg_create_compress(&cinfo);
+
+    CAMHAL_LOGDB("encoding...  \n\t"
+                 "width: %d    \n\t"
+                 "height:%d    \n\t"
+                 "first row:%d \n\t"
+                 "dest %p      \n\t"
+                 "dest size:%d \n\t"
+                 "mSrc %p \n\t"
+                 "format: %s \n\t"
+                 "raw_data_in: %d",
+                 input->out_width, num_rows, first_row, dst,
+                 dst_size, src, input->format, raw_data_in);
+
+    cinfo.dest = &dest_mgr;
+    cinfo.image_width = input->out_width - input->right_crop;
+    cinfo.image_height = num_rows;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    cinfo.input_gamma = 1;
+
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, input->quality, TRUE);
+    cinfo.dct_method = JDCT_IFAST;
+
+    if (restart_rows) {
+        // every MCU row becomes its own restart interval, so that stripes
+        // encoded separately can be spliced at any MCU row boundary
+        cinfo.restart_in_rows = 1;
+    }
+
+    if (raw_data_in) {
+        // jpeg_set_defaults() already picked 2x2 luma / 1x1 chroma sampling,
+        // which is what encodeRawData() delivers
+        cinfo.raw_data_in = TRUE;
+    }
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    // exif goes right after the JFIF APP0 written by jpeg_start_compress(),
+    // stripes other than the first only contribute their scan data
+    if (mExif && (input == mMainInput) && (first_row == 0) && mExif->getExifSegment()) {
+        jpeg_write_marker(&cinfo, JPEG_APP0 + 1, mExif->getExifSegment(),
+                          mExif->getExifSegmentSize());
+    }
+
+    if (raw_data_in) {
+        encodeRawData(&cinfo, input, src, bpp, first_row);
+    } else {
+        encodeScanlines(&cinfo, input, src, bpp, first_row);
+    }
+
+    // no need to finish encoding routine if we are prematurely stopping
+    // we will end up crashing in dest_mgr since data is incomplete
+    if (!isCanceled())
+        jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    if (dest_mgr.overflow) {
+        CAMHAL_LOGEB("Encoder: output buffer of %d bytes overflowed", dst_size);
+        return 0;
+    }
+
+    return dest_mgr.jpegsize;
+}
+
+int Encoder_libjpeg::getStripeCount(params* input) {
+    char value[PROPERTY_VALUE_MAX];
+    int max_stripes = 0;
+    int stripes = 0;
+
+    // stripes run on the encoder pool workers, the calling one included
+    if (!mPool) {
+        return 1;
+    }
+
+    property_get("debug.camera.jpeg.stripes", value, "0");
+    max_stripes = atoi(value);
+    if (max_stripes <= 0) {
+        max_stripes = mPool->getThreadCount();
+    }
+    max_stripes = MIN(max_stripes, MAX_STRIPES);
+
+    // small images are not worth the splicing cost
+    if ((input->out_width - input->right_crop) * input->out_height < STRIPE_MIN_PIXELS) {
+        return 1;
+    }
+
+    stripes = input->out_height / STRIPE_ROW_ALIGN;
+    return MAX(1, MIN(stripes, max_stripes));
+}
+
+void Encoder_libjpeg::Stripe::run() {
+    jpeg_size = encoder->compress(input, src, bpp, first_row, num_rows, dst, dst_size, true);
+}
+
+size_t Encoder_libjpeg::encodeStriped(params* input, uint8_t* src, int bpp, int stripes) {
+    Stripe stripe[MAX_STRIPES];
+    int first_row[MAX_STRIPES + 1];
+    size_t jpeg_size = 0;
+    size_t header_size = 0;
+    size_t total = 0;
+    int rows = 0;
+
+    // stripes are a whole number of STRIPE_ROW_ALIGN rows, i.e. of eight
+    // MCU rows, so the RSTn numbering inside every stripe already matches
+    // the numbering of the spliced image and only the markers at stripe
+    // boundaries have to be inserted
+    rows = ((input->out_height / stripes) / STRIPE_ROW_ALIGN) * STRIPE_ROW_ALIGN;
+    for (int i = 0; i < stripes; i++) {
+        first_row[i] = i * rows;
+    }
+    first_row[stripes] = input->out_height;
+
+    memset(stripe, 0, sizeof(stripe));
+    for (int i = 0; i < stripes; i++) {
+        stripe[i].encoder = this;
+        stripe[i].input = input;
+        stripe[i].src = src;
+        stripe[i].bpp = bpp;
+        stripe[i].first_row = first_row[i];
+        stripe[i].num_rows = first_row[i + 1] - first_row[i];
+
+        // first stripe goes straight into the destination and provides the headers
+        if (i == 0) {
+            stripe[i].dst = input->dst;
+            stripe[i].dst_size = input->dst_size;
+            continue;
+        }
+
+        // same raw-to-jpeg size ratio the caller picked for the whole image
+        stripe[i].dst_size = (int) (((int64_t) input->dst_size * stripe[i].num_rows) /
+                                    input->out_height) + STRIPE_HEADER_SIZE;
+        stripe[i].dst = (uint8_t*) malloc(stripe[i].dst_size);
+        if (!stripe[i].dst) {
+            CAMHAL_LOGEA("Encoder: failed to allocate stripe buffer");
+            goto exit;
+        }
+    }
+
+    mPool->runStripes(stripe, stripes);
+
+    jpeg_size = stripe[0].jpeg_size;
+    if (isCanceled() || (jpeg_size == 0)) {
+        goto exit;
+    }
+
+    header_size = findScanData(input->dst, jpeg_size);
+    if ((header_size == 0) || !setFrameHeight(input->dst, header_size, input->out_height)) {
+        CAMHAL_LOGEA("Encoder: unexpected stripe header layout");
+        jpeg_size = 0;
+        goto exit;
+    }
+
+    // drop EOI of the first stripe, it is written once at the very end
+    total = jpeg_size - 2;
+    for (int i = 1; i < stripes; i++) {
+        size_t stripe_size = stripe[i].jpeg_size;
+        size_t scan_start = findScanData(stripe[i].dst, stripe_size);
+        size_t scan_size = 0;
+
+        if ((stripe_size == 0) || (scan_start == 0) || (scan_start + 2 > stripe_size)) {
+            CAMHAL_LOGEB("Encoder: stripe %d failed to encode", i);
+            jpeg_size = 0;
+            goto exit;
+        }
+
+        scan_size = stripe_size - scan_start - 2;
+        if (total + 2 + scan_size + 2 > (size_t) input->dst_size) {
+            CAMHAL_LOGEA("Encoder: spliced jpeg does not fit into destination buffer");
+            jpeg_size = 0;
+            goto exit;
+        }
+
+        // restart marker closing the last MCU row of the previous stripe
+        input->dst[total++] = 0xFF;
+        input->dst[total++] = JPEG_RST0 + (((first_row[i] / RAW_MCU_SIZE) - 1) % 8);
+        memcpy(input->dst + total, stripe[i].dst + scan_start, scan_size);
+        total += scan_size;
+    }
+
+    input->dst[total++] = 0xFF;
+    input->dst[total++] = JPEG_EOI;
+    jpeg_size = total;
+
+ exit:
+    for (int i = 1; i < stripes; i++) {
+        if (stripe[i].dst) {
+            free(stripe[i].dst);
+        }
+    }
+
+    return jpeg_size;
+}
+
+size_t Encoder_libjpeg::findScanData(const uint8_t* jpeg, size_t size) {
+    size_t pos = 2;
+
+    if ((size < 4) || (jpeg[0] != 0xFF) || (jpeg[1] != JPEG_SOI)) {
+        return 0;
+    }
+
+    // walk marker segments up to and including SOS
+    while (pos + 4 <= size) {
+        uint8_t marker;
+        size_t length;
+
+        if (jpeg[pos] != 0xFF) {
+            return 0;
+        }
+
+        marker = jpeg[pos + 1];
+        length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+        pos += 2 + length;
+
+        if (marker == JPEG_SOS) {
+            return (pos <= size) ? pos : 0;
+        }
+    }
+
+    return 0;
+}
+
+bool Encoder_libjpeg::setFrameHeight(uint8_t* jpeg, size_t header_size, int height) {
+    size_t pos = 2;
+
+    while (pos + 9 <= header_size) {
+        uint8_t marker = jpeg[pos + 1];
+        size_t length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+
+        if (marker == JPEG_SOF0) {
+            // SOF: length(2) precision(1) height(2) width(2)
+            jpeg[pos + 5] = (height >> 8) & 0xFF;
+            jpeg[pos + 6] = height & 0xFF;
+            return true;
+        }
+
+        pos += 2 + length;
+    }
+
+    return false;
+}
+
+size_t Encoder_libjpeg::encode(params* input) {
+    uint8_t* src = NULL, *resize_src = NULL;
     int out_width = 0, in_width = 0;
     int out_height = 0, in_height = 0;
     int bpp = 2; // for uyvy
-    int right_crop = 0, start_offset = 0;
+    int stripes = 1;
+    size_t jpeg_size = 0;
 
     if (!input) {
         return 0;
@@ -432,13 +825,9 @@ size_t Encoder_libjpeg::encode(params* input) {
     in_width = input->in_width;
     out_height = input->out_height;
     in_height = input->in_height;
-    right_crop = input->right_crop;
-    start_offset = input->start_offset;
     src = input->src;
     input->jpeg_size = 0;
 
-    libjpeg_destination_mgr dest_mgr(input->dst, input->dst_size);
-
     // param check...
     if ((in_width < 2) || (out_width < 2) || (in_height < 2) || (out_height < 2) ||
          (src == NULL) || (input->dst == NULL) || (input->quality < 1) || (input->src_size < 1) ||
@@ -463,72 +852,289 @@ size_t Encoder_libjpeg::encode(params* input) {
         goto exit;
     }
 
-    cinfo.err = jpeg_std_error(&jerr);
+    stripes = getStripeCount(input);
+    if (stripes > 1) {
+        jpeg_size = encodeStriped(input, src, bpp, stripes);
+        if ((jpeg_size == 0) && !isCanceled()) {
+            CAMHAL_LOGEA("Encoder: striped encoding failed, falling back to single stripe");
+        }
+    }
 
-    jpeg_create_compress(&cinfo);
+    if ((jpeg_size == 0) && !isCanceled()) {
+        jpeg_size = compress(input, src, bpp, 0, out_height, input->dst, input->dst_size, false);
+    }
 
-    CAMHAL_LOGDB("encoding...  \n\t"
-                 "width: %d    \n\t"
-                 "height:%d    \n\t"
-                 "dest %p      \n\t"
-                 "dest size:%d \n\t"
-                 "mSrc %p \n\t"
-                 "format: %s",
-                 out_width, out_height, input->dst,
-                 input->dst_size, src, input->format);
+    if (resize_src) free(resize_src);
 
-    cinfo.dest = &dest_mgr;
-    cinfo.image_width = out_width - right_crop;
-    cinfo.image_height = out_height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_YCbCr;
-    cinfo.input_gamma = 1;
+ exit:
+    input->jpeg_size = jpeg_size;
+    return jpeg_size;
+}
 
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, input->quality, TRUE);
-    cinfo.dct_method = JDCT_IFAST;
+void Encoder_libjpeg::setQueued(EncoderPool* pool) {
+    android::AutoMutex lock(mStateLock);
 
-    jpeg_start_compress(&cinfo, TRUE);
+    mPool = pool;
+    mState = JOB_QUEUED;
+    mQueueTime = systemTime();
+}
 
-    row_tmp = (uint8_t*)malloc((out_width - right_crop) * 3);
-    row_src = src + start_offset;
-    row_uv = src + out_width * out_height * bpp;
+void Encoder_libjpeg::process() {
+    {
+        android::AutoMutex lock(mStateLock);
+        mState = JOB_RUNNING;
+        mStartTime = systemTime();
+    }
 
-    while ((cinfo.next_scanline < cinfo.image_height) && !mCancelEncoding) {
-        JSAMPROW row[1];    /* pointer to JSAMPLE row[s] */
+    if (!isCanceled()) {
+        // thumbnail is small, encode it before the main image on the same thread
+        if (mThumbnailInput) {
+            encode(mThumbnailInput);
+        }
 
-        // convert input yuv format to yuv444
-        if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
-            nv21_to_yuv(row_tmp, row_src, row_uv, out_width - right_crop);
-        } else if (strcmp(input->format, TICameraParameters::PIXEL_FORMAT_YUV422I_UYVY) == 0) {
-            uyvy_to_yuv(row_tmp, (uint32_t*)row_src, out_width - right_crop);
-        } else if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV422I) == 0) {
-            yuyv_to_yuv(row_tmp, (uint32_t*)row_src, out_width - right_crop);
+        // exif (with the thumbnail) is ready before the main image headers
+        // are written, so the main jpeg comes out complete in one pass
+        if (mExif) {
+            mExif->createExifSegment(mThumbnailInput ? (const char*) mThumbnailInput->dst : NULL,
+                                     mThumbnailInput ? (int) mThumbnailInput->jpeg_size : 0,
+                                     mMainInput->out_width - mMainInput->right_crop,
+                                     mMainInput->out_height);
         }
 
-        row[0] = row_tmp;
-        jpeg_write_scanlines(&cinfo, row, 1);
-        row_src = row_src + out_width*bpp;
+        // encode our main image
+        encode(mMainInput);
+    }
 
-        // move uv row if input format needs it
-        if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
-            if (!(cinfo.next_scanline % 2))
-                row_uv = row_uv +  out_width * bpp;
+    {
+        android::AutoMutex lock(mStateLock);
+        mState = JOB_DONE;
+        mEndTime = systemTime();
+    }
+
+    // signal cancel semaphore incase somebody is waiting
+    mCancelSem.Signal();
+
+    if(mCb) {
+        mCb(mMainInput, mThumbnailInput, mType, mCookie1, mCookie2, mCookie3, mCookie4, isCanceled());
+    }
+}
+
+void Encoder_libjpeg::cancel() {
+    bool running = false;
+
+    {
+        android::AutoMutex lock(mStateLock);
+        cancelEncoding();
+        running = (mState == JOB_RUNNING);
+    }
+
+    // queued jobs are skipped by the worker, only a running job
+    // can still be reading from the input buffers
+    if (running) {
+        mCancelSem.WaitTimeout(CANCEL_TIMEOUT);
+    }
+}
+
+EncoderPool::EncoderPool(int numThreads, int maxJobs)
+    : mNumThreads(MIN(MAX(numThreads, 1), MAX_THREADS)),
+      mMaxJobs(MAX(maxJobs, 1)),
+      mExiting(false) {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+EncoderPool::~EncoderPool() {
+    {
+        android::AutoMutex lock(mLock);
+        mExiting = true;
+
+        // whatever is still queued gets completed as canceled so that
+        // the callbacks can release their resources
+        for (size_t i = 0; i < mJobs.size(); i++) {
+            mJobs.itemAt(i)->cancel();
         }
+
+        mJobAvailable.broadcast();
+        mSpaceAvailable.broadcast();
     }
 
-    // no need to finish encoding routine if we are prematurely stopping
-    // we will end up crashing in dest_mgr since data is incomplete
-    if (!mCancelEncoding)
-        jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
+    // the workers return from processNextJob() once the queue is drained,
+    // requestExit() would stop them after their current job instead
+    for (int i = 0; i < mNumThreads; i++) {
+        if (mThreads[i].get()) {
+            mThreads[i]->join();
+            mThreads[i].clear();
+        }
+    }
 
-    if (resize_src) free(resize_src);
-    if (row_tmp) free(row_tmp);
+    // no worker was left to run them
+    while (!mJobs.isEmpty()) {
+        android::sp<Encoder_libjpeg> job = mJobs.itemAt(0);
+        mJobs.removeAt(0);
+        job->process();
+    }
+}
 
- exit:
-    input->jpeg_size = dest_mgr.jpegsize;
-    return dest_mgr.jpegsize;
+status_t EncoderPool::initialize() {
+    status_t ret = NO_ERROR;
+
+    for (int i = 0; i < mNumThreads; i++) {
+        mThreads[i] = new WorkerThread(this);
+        if (!mThreads[i].get()) {
+            CAMHAL_LOGEA("Couldn't create encoder thread");
+            return NO_MEMORY;
+        }
+
+        ret = mThreads[i]->run("JpegEncoder", android::PRIORITY_DEFAULT);
+        if (ret != NO_ERROR) {
+            CAMHAL_LOGEB("Couldn't run encoder thread %d", i);
+            mThreads[i].clear();
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
+status_t EncoderPool::queueJob(const android::sp<Encoder_libjpeg>& job) {
+    android::AutoMutex lock(mLock);
+
+    if (!job.get()) {
+        return BAD_VALUE;
+    }
+
+    while ((mJobs.size() >= mMaxJobs) && !mExiting) {
+        CAMHAL_LOGDB("Encoder queue full (%d jobs), waiting", (int) mJobs.size());
+        mSpaceAvailable.wait(mLock);
+    }
+
+    if (mExiting) {
+        return NO_INIT;
+    }
+
+    job->setQueued(this);
+    mJobs.push_back(job);
+
+    mStats.queueDepth = mJobs.size();
+    if (mStats.queueDepth > mStats.maxQueueDepth) {
+        mStats.maxQueueDepth = mStats.queueDepth;
+    }
+
+    mJobAvailable.signal();
+
+    return NO_ERROR;
+}
+
+bool EncoderPool::processNextJob() {
+    android::sp<Encoder_libjpeg> job;
+
+    {
+        android::AutoMutex lock(mLock);
+
+        while (mJobs.isEmpty() && mStripes.isEmpty() && !mExiting) {
+            mJobAvailable.wait(mLock);
+        }
+
+        // a running job is waiting for its stripes
+        if (!mStripes.isEmpty()) {
+            Encoder_libjpeg::Stripe* stripe = mStripes.itemAt(0);
+            mStripes.removeAt(0);
+            runStripe(stripe);
+            return true;
+        }
+
+        if (mJobs.isEmpty()) {
+            // exiting and nothing left to drain
+            return false;
+        }
+
+        job = mJobs.itemAt(0);
+        mJobs.removeAt(0);
+        mStats.queueDepth = mJobs.size();
+        mStats.running++;
+        mSpaceAvailable.signal();
+    }
+
+    job->process();
+
+    {
+        android::AutoMutex lock(mLock);
+        nsecs_t queueTime = job->getQueueTime();
+        nsecs_t encodeTime = job->getEncodeTime();
+
+        mStats.running--;
+        mStats.completed++;
+        if (job->isCanceled()) {
+            mStats.canceled++;
+        }
+        mStats.lastQueueTime = queueTime;
+        mStats.lastEncodeTime = encodeTime;
+        mStats.totalEncodeTime += encodeTime;
+        if (queueTime > mStats.maxQueueTime) {
+            mStats.maxQueueTime = queueTime;
+        }
+        if (encodeTime > mStats.maxEncodeTime) {
+            mStats.maxEncodeTime = encodeTime;
+        }
+
+        CAMHAL_LOGDB("Encoder job %p: queued %lld us, encoded %lld us, %d left in queue",
+                     job.get(), (long long) ns2us(queueTime), (long long) ns2us(encodeTime), (int) mJobs.size());
+    }
+
+    return true;
+}
+
+// mLock held on entry and exit
+void EncoderPool::runStripe(Encoder_libjpeg::Stripe* stripe) {
+    mLock.unlock();
+    stripe->run();
+    mLock.lock();
+
+    stripe->done = true;
+    mStripeDone.broadcast();
+}
+
+void EncoderPool::runStripes(Encoder_libjpeg::Stripe* stripes, int count) {
+    android::AutoMutex lock(mLock);
+
+    for (int i = 0; i < count; i++) {
+        stripes[i].done = false;
+        mStripes.push_back(&stripes[i]);
+    }
+    mJobAvailable.broadcast();
+
+    // help out instead of just waiting, the stripes of other jobs are left
+    // to their own callers
+    for (size_t i = 0; i < mStripes.size(); ) {
+        Encoder_libjpeg::Stripe* stripe = mStripes.itemAt(i);
+
+        if ((stripe < stripes) || (stripe >= stripes + count)) {
+            i++;
+            continue;
+        }
+
+        mStripes.removeAt(i);
+        runStripe(stripe);
+        // the queue may have changed while the lock was dropped
+        i = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        while (!stripes[i].done) {
+            mStripeDone.wait(mLock);
+        }
+    }
+}
+
+unsigned int EncoderPool::getQueueDepth() {
+    android::AutoMutex lock(mLock);
+
+    return mJobs.size();
+}
+
+void EncoderPool::getStats(Stats& stats) {
+    android::AutoMutex lock(mLock);
+
+    stats = mStats;
 }
 
 } // namespace Camera
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CameraHal.h"
+#include "EventLog.h"
+
+#include <unistd.h>
+
+namespace Ti {
+namespace Camera {
+
+EventLog::Rings EventLog::sRings;
+
+const EventLog::Info EventLog::sInfo[EventLog::EVENT_COUNT] = {
+    { "camera open",                NO_EVENT },
+    { "preview init",               NO_EVENT },
+    { "preview buffers allocated",  PREVIEW_INIT },
+    { "preview buffers registered", PREVIEW_INIT },
+    { "preview started",            PREVIEW_INIT },
+    { "first preview frame",        PREVIEW_INIT },
+    { "start recording",            NO_EVENT },
+    { "autofocus start",            NO_EVENT },
+    { "autofocus done",             AUTOFOCUS_START },
+    { "shot",                       NO_EVENT },
+    { "snapshot displayed",         SHOT },
+    { "preview after shot",         SHOT },
+    { "jpeg ready",                 SHOT },
+};
+
+void EventLog::log(Event event) {
+    Rings::Ring *ring = sRings.getRing();
+    Record r;
+
+    if (NULL == ring) {
+        return;
+    }
+
+    r.mTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    r.mEvent = event;
+    ring->append(r);
+}
+
+namespace {
+
+struct LoggedRecord {
+    nsecs_t mTime;
+    int mEvent;
+    const char *mThread;
+    // events of one thread with the same time keep their order
+    size_t mOrder;
+};
+
+int compareRecords(const LoggedRecord *a, const LoggedRecord *b) {
+    if (a->mTime == b->mTime) {
+        return (a->mOrder < b->mOrder) ? -1 : ((a->mOrder > b->mOrder) ? 1 : 0);
+    }
+    return (a->mTime < b->mTime) ? -1 : 1;
+}
+
+// milliseconds with microsecond digits
+#define EVENT_MS(t) (long long) (ns2us(t) / 1000), (long long) (ns2us(t) % 1000)
+
+} // anonymous namespace
+
+status_t EventLog::dump(int fd) {
+    android::Vector<LoggedRecord> records;
+    android::Vector<Rings::Entry> entries;
+    Rings::Thread threads[MAX_RINGS];
+    nsecs_t last[EVENT_COUNT];
+    nsecs_t open = 0;
+    android::String8 out;
+
+    sRings.snapshot(entries, threads);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        LoggedRecord l;
+
+        l.mTime = entries[i].mRecord.mTime;
+        l.mEvent = entries[i].mRecord.mEvent;
+        l.mThread = threads[entries[i].mThread].mName;
+        l.mOrder = i;
+        records.push_back(l);
+    }
+
+    records.sort(compareRecords);
+
+    memset(last, 0, sizeof(last));
+    if (!records.isEmpty()) {
+        open = records[0].mTime;
+    }
+
+    out.append("Camera events, ms since the camera was opened\n");
+
+    for (size_t i = 0; i < records.size(); i++) {
+        const LoggedRecord &r = records[i];
+        Event reference;
+
+        if ((0 > r.mEvent) || (EVENT_COUNT <= r.mEvent)) {
+            continue;
+        }
+
+        if (CAMERA_OPEN == r.mEvent) {
+            open = r.mTime;
+        }
+
+        out.appendFormat("  %8lld.%03lld  %-16s ", EVENT_MS(r.mTime - open), r.mThread);
+
+        reference = sInfo[r.mEvent].mReference;
+        if ((NO_EVENT != reference) && (0 != last[reference])) {
+            out.appendFormat("%-28s %lld.%03lld ms since %s\n", sInfo[r.mEvent].mName,
+                             EVENT_MS(r.mTime - last[reference]), sInfo[reference].mName);
+        } else {
+            out.appendFormat("%s\n", sInfo[r.mEvent].mName);
+        }
+
+        last[r.mEvent] = r.mTime;
+    }
+
+    if (0 > write(fd, out.string(), out.length())) {
+        return -errno;
+    }
+
+    return NO_ERROR;
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FrameDeliveryQueue.h"
+
+namespace Ti {
+namespace Camera {
+
+FrameDeliveryQueue::FrameDeliveryQueue(FrameNotifier *notifier, size_t depth,
+                                       FrameNotifier::DeliveryPolicy policy,
+                                       const android::sp<CameraMetrics> &metrics)
+    : mNotifier(notifier),
+      mPolicy(policy),
+      mMetrics(metrics),
+      mEntries(NULL),
+      mCapacity(depth > 0 ? depth : 1),
+      mHead(0),
+      mCount(0),
+      mDelivering(false),
+      mStopping(false),
+      mDeliveryThreadId(0) {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+FrameDeliveryQueue::~FrameDeliveryQueue() {
+    // queued frames can't be returned anymore if the notifier is going away
+    stopThread();
+    delete [] mEntries;
+}
+
+status_t FrameDeliveryQueue::start(const char *name) {
+    status_t ret;
+
+    mEntries = new Entry[mCapacity];
+    if (NULL == mEntries) {
+        CAMHAL_LOGEA("Couldn't allocate delivery queue");
+        return NO_MEMORY;
+    }
+
+    mThread = new DeliveryThread(this);
+    if (NULL == mThread.get()) {
+        CAMHAL_LOGEA("Couldn't create delivery thread");
+        return NO_MEMORY;
+    }
+
+    ret = mThread->run(name, android::PRIORITY_URGENT_DISPLAY);
+    if (NO_ERROR != ret) {
+        CAMHAL_LOGEB("Couldn't run delivery thread: %d", ret);
+        mThread.clear();
+    }
+
+    return ret;
+}
+
+void FrameDeliveryQueue::stop() {
+    stopThread();
+    flush(CameraFrame::ALL_FRAMES);
+}
+
+void FrameDeliveryQueue::stopThread() {
+    bool ownThread;
+
+    {
+        android::AutoMutex lock(mLock);
+        mStopping = true;
+        mNotEmpty.broadcast();
+        mNotFull.broadcast();
+        ownThread = (0 != mDeliveryThreadId) && pthread_equal(mDeliveryThreadId, pthread_self());
+    }
+
+    if (NULL != mThread.get()) {
+        // the delivery thread can't wait for itself, it sees mStopping and
+        // exits when the callback it is in, or the last reference drop
+        // after deliver() returned, is done
+        if (ownThread) {
+            mThread->requestExit();
+        } else {
+            mThread->requestExitAndWait();
+        }
+        mThread.clear();
+    }
+}
+
+bool FrameDeliveryQueue::isDroppable(int frameType) {
+    return (CameraFrame::PREVIEW_FRAME_SYNC == frameType) ||
+           (CameraFrame::FRAME_DATA_SYNC == frameType);
+}
+
+status_t FrameDeliveryQueue::post(const CameraFrame &frame, frame_callback callback) {
+    CameraFrame dropped;
+    bool dropOld = false;
+    bool dropNew = false;
+    bool stopped = false;
+
+    {
+        android::AutoMutex lock(mLock);
+
+        while ((mCount == mCapacity) && !mStopping) {
+            if ((FrameNotifier::DELIVERY_DROP_NEWEST == mPolicy) && isDroppable(frame.mFrameType)) {
+                dropNew = true;
+                break;
+            }
+
+            if ((FrameNotifier::DELIVERY_DROP_OLDEST == mPolicy) && takeOldestDroppable(dropped)) {
+                dropOld = true;
+                break;
+            }
+
+            mNotFull.wait(mLock);
+        }
+
+        if (mStopping) {
+            stopped = true;
+        } else if (dropNew) {
+            mStats.drops++;
+        } else {
+            Entry &entry = mEntries[(mHead + mCount) % mCapacity];
+
+            entry.mFrame = frame;
+            entry.mCallback = callback;
+            entry.mQueued = systemTime();
+            mCount++;
+            if (mCount > mStats.maxDepth) {
+                mStats.maxDepth = mCount;
+            }
+            if (dropOld) {
+                mStats.drops++;
+            }
+            mNotEmpty.signal();
+        }
+    }
+
+    // the buffers go back without holding the queue lock, the notifier
+    // may refill them right away
+    if ((dropOld || dropNew) && (NULL != mMetrics.get())) {
+        mMetrics->count(CameraMetrics::DROPPED_DELIVERY);
+    }
+
+    if (dropOld) {
+        returnFrame(dropped);
+    }
+
+    if (dropNew || stopped) {
+        returnFrame(frame);
+    }
+
+    return stopped ? NO_INIT : NO_ERROR;
+}
+
+bool FrameDeliveryQueue::takeOldestDroppable(CameraFrame &dropped) {
+    // mLock is held
+    size_t pos;
+
+    for (pos = 0; pos < mCount; pos++) {
+        if (isDroppable(mEntries[(mHead + pos) % mCapacity].mFrame.mFrameType)) {
+            break;
+        }
+    }
+
+    if (pos == mCount) {
+        return false;
+    }
+
+    dropped = mEntries[(mHead + pos) % mCapacity].mFrame;
+
+    // keep the order of the remaining frames
+    for (; pos + 1 < mCount; pos++) {
+        mEntries[(mHead + pos) % mCapacity] = mEntries[(mHead + pos + 1) % mCapacity];
+    }
+    mCount--;
+
+    return true;
+}
+
+bool FrameDeliveryQueue::deliver() {
+    Entry entry;
+    nsecs_t latency;
+
+    {
+        android::AutoMutex lock(mLock);
+
+        mDeliveryThreadId = pthread_self();
+
+        while ((0 == mCount) && !mStopping) {
+            mNotEmpty.wait(mLock);
+        }
+
+        // frames left over are returned by stop()
+        if (mStopping) {
+            return false;
+        }
+
+        entry = mEntries[mHead];
+        mHead = (mHead + 1) % mCapacity;
+        mCount--;
+        mDelivering = true;
+        mNotFull.signal();
+    }
+
+    latency = systemTime() - entry.mQueued;
+    entry.mCallback(&entry.mFrame);
+
+    android::AutoMutex lock(mLock);
+
+    mDelivering = false;
+    mIdle.broadcast();
+
+    mStats.frames++;
+    mStats.lastLatency = latency;
+    mStats.totalLatency += latency;
+    if (latency > mStats.maxLatency) {
+        mStats.maxLatency = latency;
+    }
+
+    return true;
+}
+
+void FrameDeliveryQueue::flush(int32_t frameTypes) {
+    android::Vector<CameraFrame> flushed;
+
+    {
+        android::AutoMutex lock(mLock);
+        size_t kept = 0;
+
+        for (size_t i = 0; i < mCount; i++) {
+            Entry &entry = mEntries[(mHead + i) % mCapacity];
+
+            if (entry.mFrame.mFrameType & frameTypes) {
+                flushed.push_back(entry.mFrame);
+            } else {
+                if (kept != i) {
+                    mEntries[(mHead + kept) % mCapacity] = entry;
+                }
+                kept++;
+            }
+        }
+        mCount = kept;
+        mNotFull.broadcast();
+
+        // the subscriber is expected not to be called after this returns,
+        // unless it is flushing from its own callback
+        while (mDelivering && !pthread_equal(mDeliveryThreadId, pthread_self())) {
+            mIdle.wait(mLock);
+        }
+    }
+
+    for (size_t i = 0; i < flushed.size(); i++) {
+        returnFrame(flushed[i]);
+    }
+}
+
+void FrameDeliveryQueue::returnFrame(const CameraFrame &frame) {
+    mNotifier->returnFrame(frame.mBuffer, (CameraFrame::FrameType) frame.mFrameType);
+}
+
+void FrameDeliveryQueue::getStats(Stats &stats) {
+    android::AutoMutex lock(mLock);
+    stats = mStats;
+    stats.depth = mCount;
+}
+
+void FrameDeliveryQueue::resetStats() {
+    android::AutoMutex lock(mLock);
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FrameSlotRing.h"
+
+#include <cutils/atomic.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace Ti {
+namespace Camera {
+
+FrameSlotRing::FrameSlotRing(size_t capacity)
+    : mSlots(NULL),
+      mCapacity(2),
+      mEventFd(-1),
+      mHead(0),
+      mTail(0),
+      mWaiters(0) {
+    // positions wrap around 2^32, keep the slot index consistent across it
+    while (mCapacity < capacity) {
+        mCapacity <<= 1;
+    }
+    resetStats();
+}
+
+FrameSlotRing::~FrameSlotRing() {
+    if (mEventFd >= 0) {
+        close(mEventFd);
+    }
+    delete [] mSlots;
+}
+
+status_t FrameSlotRing::initialize() {
+    mEventFd = eventfd(0, EFD_NONBLOCK);
+    if (mEventFd < 0) {
+        CAMHAL_LOGEB("Couldn't create eventfd: %s", strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+
+    mSlots = new Slot[mCapacity];
+    if (NULL == mSlots) {
+        CAMHAL_LOGEA("Couldn't allocate frame slots");
+        return NO_MEMORY;
+    }
+
+    for (size_t i = 0; i < mCapacity; i++) {
+        mSlots[i].mSequence = i;
+    }
+
+    return NO_ERROR;
+}
+
+bool FrameSlotRing::isDroppable(int frameType) {
+    // frames only used for preview callbacks, a newer one is coming anyway
+    return (CameraFrame::PREVIEW_FRAME_SYNC == frameType) ||
+           (CameraFrame::FRAME_DATA_SYNC == frameType);
+}
+
+void FrameSlotRing::moveFrame(CameraFrame &to, CameraFrame &from) {
+#ifdef OMAP_ENHANCEMENT_CPCAM
+    // hand over the metadata buffer instead of cloning it
+    android::CameraMetadata metaData;
+    metaData.swap(from.mMetaData);
+    to = from;
+    to.mMetaData.swap(metaData);
+#else
+    to = from;
+#endif
+}
+
+bool FrameSlotRing::claimSlot(uint32_t &pos) {
+    for (;;) {
+        pos = android_atomic_acquire_load(&mTail);
+
+        Slot &slot = mSlots[pos & (mCapacity - 1)];
+        int32_t diff = android_atomic_acquire_load(&slot.mSequence) - (int32_t) pos;
+
+        // the consumer didn't free the slot of this position yet
+        if (diff < 0) {
+            return false;
+        }
+
+        // another producer may take the position first, try the next one
+        if ((0 == diff) &&
+            (0 == android_atomic_release_cas((int32_t) pos, (int32_t) (pos + 1), &mTail))) {
+            return true;
+        }
+    }
+}
+
+bool FrameSlotRing::isFull() {
+    uint32_t tail = android_atomic_acquire_load(&mTail);
+    const Slot &slot = mSlots[tail & (mCapacity - 1)];
+
+    return (android_atomic_acquire_load(&slot.mSequence) - (int32_t) tail) < 0;
+}
+
+void FrameSlotRing::waitForRoom() {
+    android::AutoMutex lock(mRoomLock);
+
+    // the consumer checks for waiters after freeing a slot, so either it
+    // sees this one or the check below sees the slot
+    android_atomic_inc(&mWaiters);
+    if (isFull()) {
+        mRoom.waitRelative(mRoomLock, ms2ns(ROOM_WAIT_MS));
+    }
+    android_atomic_dec(&mWaiters);
+}
+
+status_t FrameSlotRing::put(const CameraFrame &frame) {
+    bool waited = false;
+    uint32_t pos;
+
+    if (NULL == mSlots) {
+        return NO_INIT;
+    }
+
+    while (!claimSlot(pos)) {
+        // the consumer is behind and drops the older preview frames itself
+        if (isDroppable(frame.mFrameType)) {
+            android_atomic_inc(&mDrops);
+            return WOULD_BLOCK;
+        }
+
+        if (!waited) {
+            android_atomic_inc(&mWaits);
+            waited = true;
+        }
+        waitForRoom();
+    }
+
+    Slot &slot = mSlots[pos & (mCapacity - 1)];
+
+    slot.mFrame = frame;
+    slot.mQueued = systemTime();
+    android_atomic_release_store(pos + 1, &slot.mSequence);
+
+    wakeup();
+
+    return NO_ERROR;
+}
+
+status_t FrameSlotRing::get(CameraFrame &frame, bool &stale) {
+    uint32_t head = mHead;
+    uint32_t backlog;
+    nsecs_t queued;
+
+    stale = false;
+
+    if (NULL == mSlots) {
+        return NO_INIT;
+    }
+
+    Slot &slot = mSlots[head & (mCapacity - 1)];
+
+    // empty, or the producer of the oldest position is still copying
+    if ((android_atomic_acquire_load(&slot.mSequence) - (int32_t) (head + 1)) < 0) {
+        return NOT_ENOUGH_DATA;
+    }
+
+    moveFrame(frame, slot.mFrame);
+    queued = slot.mQueued;
+
+    // free the slot for the position one round later
+    android_atomic_release_store(head + mCapacity, &slot.mSequence);
+    android_atomic_release_store(head + 1, &mHead);
+
+    backlog = (uint32_t) android_atomic_acquire_load(&mTail) - (head + 1);
+    if (isDroppable(frame.mFrameType) && (backlog >= (mCapacity / 2))) {
+        stale = true;
+        android_atomic_inc(&mDrops);
+    } else {
+        updateStats(queued);
+    }
+
+    // a full barrier, pairs with the one taken by waitForRoom()
+    if (0 != android_atomic_or(0, &mWaiters)) {
+        android::AutoMutex lock(mRoomLock);
+        mRoom.broadcast();
+    }
+
+    return NO_ERROR;
+}
+
+size_t FrameSlotRing::size() {
+    uint32_t tail = android_atomic_acquire_load(&mTail);
+    uint32_t head = android_atomic_acquire_load(&mHead);
+
+    return tail - head;
+}
+
+void FrameSlotRing::wakeup() {
+    uint64_t count = 1;
+
+    if (write(mEventFd, &count, sizeof(count)) != sizeof(count)) {
+        CAMHAL_LOGEB("Couldn't signal frame ring: %s", strerror(errno));
+    }
+}
+
+void FrameSlotRing::clearWakeup() {
+    uint64_t count;
+
+    // non-blocking, fails with EAGAIN if nothing was signalled
+    read(mEventFd, &count, sizeof(count));
+}
+
+void FrameSlotRing::updateStats(nsecs_t queued) {
+    int32_t latency = (int32_t) ns2us(systemTime() - queued);
+
+    // only the consumer writes the latencies, readers may see a mix
+    android_atomic_inc(&mFrames);
+    android_atomic_release_store(latency, &mLastLatency);
+    android_atomic_add(latency, &mTotalLatency);
+    if (latency > android_atomic_acquire_load(&mMaxLatency)) {
+        android_atomic_release_store(latency, &mMaxLatency);
+    }
+}
+
+void FrameSlotRing::getStats(Stats &stats) {
+    stats.frames = android_atomic_acquire_load(&mFrames);
+    stats.drops = android_atomic_acquire_load(&mDrops);
+    stats.waits = android_atomic_acquire_load(&mWaits);
+    stats.lastLatency = android_atomic_acquire_load(&mLastLatency);
+    stats.maxLatency = android_atomic_acquire_load(&mMaxLatency);
+    stats.totalLatency = android_atomic_acquire_load(&mTotalLatency);
+}
+
+void FrameSlotRing::resetStats() {
+    android_atomic_release_store(0, &mFrames);
+    android_atomic_release_store(0, &mDrops);
+    android_atomic_release_store(0, &mWaits);
+    android_atomic_release_store(0, &mLastLatency);
+    android_atomic_release_store(0, &mMaxLatency);
+    android_atomic_release_store(0, &mTotalLatency);
+}
+
+} // namespace Camera
+} // namespace Ti
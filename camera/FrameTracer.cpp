@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CameraHal.h"
+#include "FrameTracer.h"
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+namespace Ti {
+namespace Camera {
+
+volatile int32_t FrameTracer::sEnabled = 0;
+FrameTracer::Rings FrameTracer::sRings;
+
+// per buffer tracks follow the thread ids
+static const int BUFFER_TRACK_BASE = 1 << 20;
+
+static const char * const sEventNames[FrameTracer::EVENT_COUNT] = {
+    "FillBuffer",
+    "FillBufferDone",
+    "Dispatch",
+    "PostFrame",
+    "EnqueueBuffer",
+    "ReturnFrame",
+    "EncodeStart",
+    "EncodeEnd",
+};
+
+// where the buffer is after the event
+static const char * const sStateNames[FrameTracer::EVENT_COUNT] = {
+    "camera",
+    "adapter",
+    "subscribers",
+    "display",
+    "window",
+    "returned",
+    "encoding",
+    "encoded",
+};
+
+void FrameTracer::setEnabled(bool enabled) {
+    android_atomic_release_store(enabled ? 1 : 0, &sEnabled);
+}
+
+void FrameTracer::record(Event event, const void *buffer, int frameType) {
+    Rings::Ring *ring = sRings.getRing();
+    Record r;
+
+    if (NULL == ring) {
+        return;
+    }
+
+    r.mTime = systemTime();
+    r.mBuffer = buffer;
+    r.mEvent = event;
+    r.mFrameType = frameType;
+    ring->append(r);
+}
+
+namespace {
+
+class JsonWriter {
+    public:
+        JsonWriter(int fd) : mFd(fd), mLength(0), mStatus(NO_ERROR), mFirst(true) { }
+
+        void event(const char *fmt, ...) {
+            va_list args;
+
+            if (!mFirst) {
+                append(",\n");
+            }
+            mFirst = false;
+
+            va_start(args, fmt);
+            vappend(fmt, args);
+            va_end(args);
+        }
+
+        void append(const char *fmt, ...) {
+            va_list args;
+
+            va_start(args, fmt);
+            vappend(fmt, args);
+            va_end(args);
+        }
+
+        status_t flush() {
+            size_t written = 0;
+
+            while ((NO_ERROR == mStatus) && (written < mLength)) {
+                ssize_t ret = write(mFd, mBuffer + written, mLength - written);
+                if (0 > ret) {
+                    if (EINTR == errno) {
+                        continue;
+                    }
+                    mStatus = -errno;
+                    break;
+                }
+                written += ret;
+            }
+            mLength = 0;
+
+            return mStatus;
+        }
+
+    private:
+        void vappend(const char *fmt, va_list args) {
+            int len;
+
+            // an event always fits into the space kept free
+            if (sizeof(mBuffer) - mLength < 512) {
+                flush();
+            }
+
+            len = vsnprintf(mBuffer + mLength, sizeof(mBuffer) - mLength, fmt, args);
+            if (0 < len) {
+                mLength += ((size_t) len < sizeof(mBuffer) - mLength) ? len : sizeof(mBuffer) - mLength - 1;
+            }
+        }
+
+        int mFd;
+        char mBuffer[4096];
+        size_t mLength;
+        status_t mStatus;
+        bool mFirst;
+};
+
+struct TracedRecord {
+    nsecs_t mTime;
+    const void *mBuffer;
+    pid_t mTid;
+    int mEvent;
+    int mFrameType;
+};
+
+int compareRecords(const TracedRecord *a, const TracedRecord *b) {
+    if (a->mTime == b->mTime) {
+        return 0;
+    }
+    return (a->mTime < b->mTime) ? -1 : 1;
+}
+
+// chrome traces count in microseconds
+#define TRACE_TS(t) (long long) ((t) / 1000), (int) ((t) % 1000)
+
+} // anonymous namespace
+
+status_t FrameTracer::dump(int fd) {
+    android::Vector<TracedRecord> records;
+    android::Vector<Rings::Entry> entries;
+    android::KeyedVector<const void *, int> bufferIds;
+    android::KeyedVector<const void *, size_t> lastEvents;
+    Rings::Thread threads[MAX_RINGS];
+    int count;
+    JsonWriter writer(fd);
+    pid_t pid = getpid();
+
+    writer.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    count = sRings.snapshot(entries, threads);
+
+    for (int i = 0; i < count; i++) {
+        if (threads[i].mInUse) {
+            writer.event("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                         "\"args\":{\"name\":\"%s\"}}",
+                         pid, threads[i].mTid, threads[i].mName);
+        }
+    }
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const Record &r = entries[i].mRecord;
+        TracedRecord t;
+
+        t.mTime = r.mTime;
+        t.mBuffer = r.mBuffer;
+        t.mTid = threads[entries[i].mThread].mTid;
+        t.mEvent = r.mEvent;
+        t.mFrameType = r.mFrameType;
+        records.push_back(t);
+    }
+
+    records.sort(compareRecords);
+
+    for (size_t i = 0; i < records.size(); i++) {
+        const TracedRecord &r = records[i];
+        int event = (r.mEvent < EVENT_COUNT) ? r.mEvent : 0;
+        ssize_t index;
+        int id;
+
+        writer.event("{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld.%03d,"
+                     "\"pid\":%d,\"tid\":%d,\"args\":{\"buffer\":\"%p\",\"type\":\"0x%x\"}}",
+                     sEventNames[event], TRACE_TS(r.mTime), pid, r.mTid, r.mBuffer, r.mFrameType);
+
+        if (NULL == r.mBuffer) {
+            continue;
+        }
+
+        index = bufferIds.indexOfKey(r.mBuffer);
+        if (0 > index) {
+            id = bufferIds.size();
+            bufferIds.add(r.mBuffer, id);
+            writer.event("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                         "\"args\":{\"name\":\"buffer %d (%p)\"}}",
+                         pid, BUFFER_TRACK_BASE + id, id, r.mBuffer);
+        } else {
+            id = bufferIds.valueAt(index);
+        }
+
+        // the time since the previous transition goes to the buffer's track
+        index = lastEvents.indexOfKey(r.mBuffer);
+        if (0 <= index) {
+            const TracedRecord &last = records[lastEvents.valueAt(index)];
+            int lastEvent = (last.mEvent < EVENT_COUNT) ? last.mEvent : 0;
+
+            writer.event("{\"name\":\"%s\",\"cat\":\"buffer\",\"ph\":\"X\",\"ts\":%lld.%03d,"
+                         "\"dur\":%lld.%03d,\"pid\":%d,\"tid\":%d}",
+                         sStateNames[lastEvent], TRACE_TS(last.mTime), TRACE_TS(r.mTime - last.mTime),
+                         pid, BUFFER_TRACK_BASE + id);
+            lastEvents.replaceValueAt(index, i);
+        } else {
+            lastEvents.add(r.mBuffer, i);
+        }
+    }
+
+    writer.append("\n]}\n");
+
+    return writer.flush();
+}
+
+status_t FrameTracer::dumpToFile(const char *path) {
+    status_t ret;
+    int fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (0 > fd) {
+        CAMHAL_LOGEB("Couldn't open %s: %s", path, strerror(errno));
+        return -errno;
+    }
+
+    ret = dump(fd);
+    close(fd);
+
+    if (NO_ERROR == ret) {
+        CAMHAL_LOGDB("Frame trace written to %s", path);
+    }
+
+    return ret;
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -37,11 +37,44 @@ namespace Camera {
 ///Utility Macro Declarations
 
 /*--------------------MemoryManager Class STARTS here-----------------------------*/
+
+// buffers are pooled by size rounded up to whole pages
+#define POOL_SIZE_CLASS(size) ((((size_t) (size)) + 4095) & ~((size_t) 4095))
+
 MemoryManager::MemoryManager() {
+    char value[PROPERTY_VALUE_MAX];
+
     mIonFd = -1;
+
+    // released buffers are kept mapped up to this many MB, 0 disables the pool
+    property_get("debug.camera.bufpool.size", value, "64");
+    mPoolLimit = (size_t) atoi(value) << 20;
+
+    // pooled buffers unused for this many ms are unmapped, 0 keeps them
+    property_get("debug.camera.bufpool.timeout", value, "5000");
+    mPoolTimeout = ms2ns(atoi(value));
+
+    mPoolExiting = false;
+    memset(&mPoolStats, 0, sizeof(mPoolStats));
+
+    // 0 gives every buffer of a list its own allocation, even where carving is possible
+    property_get("debug.camera.bufcarve", value, "1");
+    mCarveEnabled = ( 0 != atoi(value) );
 }
 
 MemoryManager::~MemoryManager() {
+    if ( NULL != mPoolTrimThread.get() ) {
+        {
+            android::AutoMutex lock(mPoolLock);
+            mPoolExiting = true;
+            mPoolChanged.signal();
+        }
+        mPoolTrimThread->requestExitAndWait();
+        mPoolTrimThread.clear();
+    }
+
+    flushPool();
+
     if ( mIonFd >= 0 ) {
         ion_close(mIonFd);
         mIonFd = -1;
@@ -58,15 +91,199 @@ status_t MemoryManager::initialize() {
         }
     }
 
+    if ( ( 0 < mPoolLimit ) && ( 0 < mPoolTimeout ) && ( NULL == mPoolTrimThread.get() ) ) {
+        mPoolTrimThread = new PoolTrimThread(this);
+        if ( NULL != mPoolTrimThread.get() ) {
+            mPoolTrimThread->run("CameraBufPool");
+        }
+    }
+
     return OK;
 }
 
+status_t MemoryManager::allocateBuffer(size_t size, CameraBuffer &buffer)
+{
+    const size_t sizeClass = POOL_SIZE_CLASS(size);
+    struct ion_handle *handle;
+    unsigned char *data;
+    int mmap_fd;
+
+    {
+        android::AutoMutex lock(mPoolLock);
+
+        // the most recently released buffer first
+        for ( ssize_t i = (ssize_t) mPool.size() - 1; i >= 0; i-- ) {
+            if ( mPool[i].size == sizeClass ) {
+                const PooledBuffer &pooled = mPool[i];
+
+                buffer.type = CAMERA_BUFFER_ION;
+                buffer.opaque = pooled.data;
+                buffer.mapped = pooled.data;
+                buffer.ion_handle = pooled.handle;
+                buffer.ion_fd = mIonFd;
+                buffer.fd = pooled.fd;
+                buffer.size = size;
+
+                mPool.removeAt(i);
+                mPoolStats.pooledBuffers--;
+                mPoolStats.pooledBytes -= sizeClass;
+                mPoolStats.hits++;
+
+                return NO_ERROR;
+            }
+        }
+
+        mPoolStats.misses++;
+    }
+
+    if ( NO_ERROR != mapBuffer(sizeClass, handle, data, mmap_fd) ) {
+        return NO_MEMORY;
+    }
+
+    buffer.type = CAMERA_BUFFER_ION;
+    buffer.opaque = data;
+    buffer.mapped = data;
+    buffer.ion_handle = handle;
+    buffer.ion_fd = mIonFd;
+    buffer.fd = mmap_fd;
+    buffer.size = size;
+
+    return NO_ERROR;
+}
+
+status_t MemoryManager::mapBuffer(size_t size, struct ion_handle *&handle, unsigned char *&data, int &fd)
+{
+    size_t stride;
+    int ret;
+
+    ret = ion_alloc(mIonFd, size, 0, 1 << ION_HEAP_TYPE_CARVEOUT, &handle);
+    if((ret < 0) || ((int)handle == -ENOMEM)) {
+        ret = ion_alloc_tiler(mIonFd, size, 1, TILER_PIXEL_FMT_PAGE,
+        OMAP_ION_HEAP_TILER_MASK, &handle, &stride);
+    }
+
+    if((ret < 0) || ((int)handle == -ENOMEM)) {
+        CAMHAL_LOGEB("FAILED to allocate ion buffer of size=%d. ret=%d(0x%x)", (int) size, ret, ret);
+        return NO_MEMORY;
+    }
+
+    CAMHAL_LOGDB("Before mapping, handle = %p, nSize = %d", handle, (int) size);
+    if ((ret = ion_map(mIonFd, handle, size, PROT_READ | PROT_WRITE, MAP_SHARED, 0,
+                  &data, &fd)) < 0) {
+        CAMHAL_LOGEB("Userspace mapping of ION buffers returned error %d", ret);
+        ion_free(mIonFd, handle);
+        return NO_MEMORY;
+    }
+
+    return NO_ERROR;
+}
+
+void MemoryManager::unmapBuffer(struct ion_handle *handle, unsigned char *data, int fd, size_t size)
+{
+    munmap(data, size);
+    close(fd);
+    ion_free(mIonFd, handle);
+}
+
+void MemoryManager::evictPooled(size_t index)
+{
+    const PooledBuffer &pooled = mPool[index];
+
+    unmapBuffer(pooled.handle, pooled.data, pooled.fd, pooled.size);
+    mPoolStats.pooledBuffers--;
+    mPoolStats.pooledBytes -= pooled.size;
+    mPoolStats.evictions++;
+    mPool.removeAt(index);
+}
+
+void MemoryManager::releaseBuffer(CameraBuffer &buffer)
+{
+    PooledBuffer pooled;
+
+    pooled.handle = buffer.ion_handle;
+    pooled.data = (unsigned char *) buffer.opaque;
+    pooled.fd = buffer.fd;
+    pooled.size = POOL_SIZE_CLASS(buffer.size);
+
+    android::AutoMutex lock(mPoolLock);
+
+    if ( pooled.size > mPoolLimit ) {
+        unmapBuffer(pooled.handle, pooled.data, pooled.fd, pooled.size);
+        return;
+    }
+
+    // make room by dropping the buffers released the longest time ago
+    while ( mPoolStats.pooledBytes + pooled.size > mPoolLimit ) {
+        evictPooled(0);
+    }
+
+    pooled.released = systemTime();
+    mPool.push_back(pooled);
+    mPoolStats.pooledBuffers++;
+    mPoolStats.pooledBytes += pooled.size;
+
+    // the trim thread waits for the first buffer
+    if ( 1 == mPool.size() ) {
+        mPoolChanged.signal();
+    }
+}
+
+bool MemoryManager::trimPool()
+{
+    android::AutoMutex lock(mPoolLock);
+
+    if ( mPoolExiting ) {
+        return false;
+    }
+
+    if ( mPool.isEmpty() ) {
+        mPoolChanged.wait(mPoolLock);
+    } else {
+        nsecs_t expiry = mPool[0].released + mPoolTimeout;
+        nsecs_t now = systemTime();
+
+        if ( expiry > now ) {
+            mPoolChanged.waitRelative(mPoolLock, expiry - now);
+        }
+    }
+
+    if ( mPoolExiting ) {
+        return false;
+    }
+
+    const nsecs_t now = systemTime();
+    while ( !mPool.isEmpty() && ( mPool[0].released + mPoolTimeout <= now ) ) {
+        CAMHAL_LOGDB("Unmapping idle pooled buffer of %d bytes", (int) mPool[0].size);
+        evictPooled(0);
+    }
+
+    return true;
+}
+
+void MemoryManager::flushPool()
+{
+    android::AutoMutex lock(mPoolLock);
+
+    while ( !mPool.isEmpty() ) {
+        evictPooled(mPool.size() - 1);
+    }
+}
+
+void MemoryManager::getPoolStats(PoolStats &stats)
+{
+    android::AutoMutex lock(mPoolLock);
+
+    stats = mPoolStats;
+}
+
 CameraBuffer* MemoryManager::allocateBufferList(int width, int height, const char* format, int &size, int numBufs)
 {
     LOG_FUNCTION_NAME;
 
     CAMHAL_ASSERT(mIonFd != -1);
 
+    const nsecs_t start = systemTime();
+
     ///We allocate numBufs+1 because the last entry will be marked NULL to indicate end of array, which is used when freeing
     ///the buffers
     const uint numArrayEntriesC = (uint)(numBufs+1);
@@ -84,44 +301,23 @@ CameraBuffer* MemoryManager::allocateBufferList(int width, int height, const cha
 
     //2D Allocations are not supported currently
     if(size != 0) {
-        struct ion_handle *handle;
-        int mmap_fd;
-        size_t stride;
-
         ///1D buffers
         for (int i = 0; i < numBufs; i++) {
-            unsigned char *data;
-            int ret = ion_alloc(mIonFd, size, 0, 1 << ION_HEAP_TYPE_CARVEOUT,
-                    &handle);
-            if((ret < 0) || ((int)handle == -ENOMEM)) {
-                ret = ion_alloc_tiler(mIonFd, (size_t)size, 1, TILER_PIXEL_FMT_PAGE,
-                OMAP_ION_HEAP_TILER_MASK, &handle, &stride);
-            }
-
-            if((ret < 0) || ((int)handle == -ENOMEM)) {
-                CAMHAL_LOGEB("FAILED to allocate ion buffer of size=%d. ret=%d(0x%x)", size, ret, ret);
-                goto error;
+            if ( NO_ERROR != allocateBuffer(size, buffers[i]) ) {
+                // buffers of other sizes may be what keeps the heap full
+                flushPool();
+                if ( NO_ERROR != allocateBuffer(size, buffers[i]) ) {
+                    goto error;
+                }
             }
-
-            CAMHAL_LOGDB("Before mapping, handle = %p, nSize = %d", handle, size);
-            if ((ret = ion_map(mIonFd, handle, size, PROT_READ | PROT_WRITE, MAP_SHARED, 0,
-                          &data, &mmap_fd)) < 0) {
-                CAMHAL_LOGEB("Userspace mapping of ION buffers returned error %d", ret);
-                ion_free(mIonFd, handle);
-                goto error;
-            }
-
-            buffers[i].type = CAMERA_BUFFER_ION;
-            buffers[i].opaque = data;
-            buffers[i].mapped = data;
-            buffers[i].ion_handle = handle;
-            buffers[i].ion_fd = mIonFd;
-            buffers[i].fd = mmap_fd;
-            buffers[i].size = size;
-
         }
     }
 
+    {
+        android::AutoMutex lock(mPoolLock);
+        mPoolStats.allocTime += systemTime() - start;
+    }
+
     LOG_FUNCTION_NAME_EXIT;
 
     return buffers;
@@ -139,6 +335,72 @@ error:
     return NULL;
 }
 
+CameraBuffer* MemoryManager::allocateCarvedBufferList(int &size, int numBufs)
+{
+    LOG_FUNCTION_NAME;
+
+    CAMHAL_ASSERT(mIonFd != -1);
+
+    const nsecs_t start = systemTime();
+    // every buffer starts on a page of its own
+    const size_t stride = POOL_SIZE_CLASS(size);
+    CarvedRegion region;
+    CameraBuffer *buffers;
+
+    if ( !mCarveEnabled || ( 0 >= size ) || ( 1 >= numBufs ) ) {
+        LOG_FUNCTION_NAME_EXIT;
+        return allocateBufferList(0, 0, NULL, size, numBufs);
+    }
+
+    region.size = stride * numBufs;
+    if ( NO_ERROR != mapBuffer(region.size, region.handle, region.data, region.fd) ) {
+        // pooled buffers may be what keeps the heap full
+        flushPool();
+        if ( NO_ERROR != mapBuffer(region.size, region.handle, region.data, region.fd) ) {
+            CAMHAL_LOGEB("Couldn't carve %d buffers of %d bytes, allocating them one by one",
+                         numBufs, size);
+            LOG_FUNCTION_NAME_EXIT;
+            return allocateBufferList(0, 0, NULL, size, numBufs);
+        }
+    }
+
+    ///The last entry stays zeroed to mark the end of the array, like in allocateBufferList()
+    buffers = new CameraBuffer [numBufs + 1];
+    if ( NULL == buffers ) {
+        CAMHAL_LOGEB("Allocation failed when creating buffers array of %d CameraBuffer elements", numBufs + 1);
+        unmapBuffer(region.handle, region.data, region.fd, region.size);
+        LOG_FUNCTION_NAME_EXIT;
+        return NULL;
+    }
+    memset(buffers, 0, sizeof(CameraBuffer) * (numBufs + 1));
+
+    for ( int i = 0; i < numBufs; i++ ) {
+        buffers[i].type = CAMERA_BUFFER_ION;
+        buffers[i].opaque = region.data + i * stride;
+        buffers[i].mapped = buffers[i].opaque;
+        buffers[i].ion_handle = region.handle;
+        buffers[i].ion_fd = mIonFd;
+        buffers[i].fd = region.fd;
+        buffers[i].size = size;
+        buffers[i].offset = i * stride;
+    }
+
+    region.list = buffers;
+
+    {
+        android::AutoMutex lock(mPoolLock);
+        mCarvedRegions.push_back(region);
+        mPoolStats.carvedLists++;
+        mPoolStats.allocTime += systemTime() - start;
+    }
+
+    CAMHAL_LOGDB("Carved %d buffers of %d bytes out of %d bytes", numBufs, size, (int) region.size);
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return buffers;
+}
+
 CameraBuffer* MemoryManager::getBufferList(int *numBufs) {
     LOG_FUNCTION_NAME;
     if (numBufs) *numBufs = -1;
@@ -180,14 +442,30 @@ int MemoryManager::freeBufferList(CameraBuffer *buffers)
         return BAD_VALUE;
         }
 
+    {
+        android::AutoMutex lock(mPoolLock);
+
+        // a carved list goes back as a whole, it isn't pooled
+        for ( size_t r = 0; r < mCarvedRegions.size(); r++ ) {
+            if ( mCarvedRegions[r].list == buffers ) {
+                const CarvedRegion &region = mCarvedRegions[r];
+
+                unmapBuffer(region.handle, region.data, region.fd, region.size);
+                mCarvedRegions.removeAt(r);
+                delete [] buffers;
+
+                LOG_FUNCTION_NAME_EXIT;
+                return ret;
+            }
+        }
+    }
+
     i = 0;
     while(buffers[i].type == CAMERA_BUFFER_ION)
         {
         if(buffers[i].size)
             {
-            munmap(buffers[i].opaque, buffers[i].size);
-            close(buffers[i].fd);
-            ion_free(mIonFd, buffers[i].ion_handle);
+            releaseBuffer(buffers[i]);
             }
         else
             {
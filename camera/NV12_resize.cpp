@@ -15,6 +15,10 @@
  */
 
 #include "NV12_resize.h"
+#include "YuvConvert.h"
+
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
 
 #ifdef LOG_TAG
 #undef LOG_TAG
@@ -23,6 +27,274 @@
 
 #define STRIDE 4096
 
+#define MIN(x,y) ((x < y) ? x : y)
+
+// geometries in use at the same time: preview/video and thumbnail
+#define RESIZE_TABLES_CACHE_SIZE 4
+
+/* source position and weights (summing up to 8) of one output column,
+ * for chroma the offset is in bytes of the interleaved CbCr row */
+struct ResizeColumn {
+    mmUint32 offset;
+    mmUint16 w0;
+    mmUint16 w1;
+};
+
+/* source row and vertical weight (out of 8) of one output row */
+struct ResizeRow {
+    mmUint32 y;
+    mmUint16 yf;
+};
+
+/* Coefficient and offset tables of one input/output geometry. They use
+ * the same 9 bit fixed point steps and 3 bit weights as bWeights, whose
+ * entries are the products of the horizontal and vertical weights, so the
+ * separable result is identical to the 2x2 filter.
+ * Downscaling by more than 2x averages boxes of source pixels instead, a
+ * 2x2 filter would skip most of the source and alias; then only the box
+ * boundaries of the output columns are kept. */
+class NV12ResizeTables : public android::LightRefBase<NV12ResizeTables> {
+public:
+    NV12ResizeTables(mmUint32 inWidth, mmUint32 inHeight, mmUint32 outWidth, mmUint32 outHeight)
+        : mInWidth(inWidth), mInHeight(inHeight), mOutWidth(outWidth), mOutHeight(outHeight),
+          mArea(false), mLumaColumns(NULL), mChromaColumns(NULL), mRows(NULL),
+          mLumaBoxes(NULL), mChromaBoxes(NULL) {
+        mArea = (inWidth >= outWidth) && (inHeight >= outHeight) &&
+                ((inWidth > 2 * outWidth) || (inHeight > 2 * outHeight));
+
+        if (mArea) {
+            buildBoxes();
+        } else {
+            buildBilinear();
+        }
+    }
+
+    ~NV12ResizeTables() {
+        delete [] mLumaColumns;
+        delete [] mChromaColumns;
+        delete [] mRows;
+        delete [] mLumaBoxes;
+        delete [] mChromaBoxes;
+    }
+
+    bool matches(mmUint32 inWidth, mmUint32 inHeight, mmUint32 outWidth, mmUint32 outHeight) const {
+        return (mInWidth == inWidth) && (mInHeight == inHeight) &&
+               (mOutWidth == outWidth) && (mOutHeight == outHeight);
+    }
+
+    bool isArea() const { return mArea; }
+    const ResizeColumn* lumaColumns() const { return mLumaColumns; }
+    const ResizeColumn* chromaColumns() const { return mChromaColumns; }
+    const ResizeRow* rows() const { return mRows; }
+    // first source column of every output column, plus the end of the last box
+    const mmUint32* lumaBoxes() const { return mLumaBoxes; }
+    const mmUint32* chromaBoxes() const { return mChromaBoxes; }
+
+private:
+    void buildBilinear() {
+        mmUint32 resizeFactorX = ((mInWidth - 1) << 9) / mOutWidth;
+        mmUint32 resizeFactorY = ((mInHeight - 1) << 9) / mOutHeight;
+
+        mLumaColumns = new ResizeColumn[mOutWidth];
+        mChromaColumns = new ResizeColumn[(mOutWidth >> 1) + 1];
+        mRows = new ResizeRow[mOutHeight];
+
+        for (mmUint32 col = 0; col < mOutWidth; col++) {
+            mmUint32 x = (col * resizeFactorX) >> 9;
+            mmUint16 xf = ((col * resizeFactorX) >> 6) & 0x7;
+
+            mLumaColumns[col].offset = x;
+            mLumaColumns[col].w0 = 8 - xf;
+            mLumaColumns[col].w1 = xf;
+
+            // chroma columns step like luma columns, over CbCr pairs
+            if (col < (mOutWidth >> 1)) {
+                mChromaColumns[col].offset = x * 2;
+                mChromaColumns[col].w0 = 8 - xf;
+                mChromaColumns[col].w1 = xf;
+            }
+        }
+
+        // chroma rows reuse the first half of the luma row table
+        for (mmUint32 row = 0; row < mOutHeight; row++) {
+            mRows[row].y = (row * resizeFactorY) >> 9;
+            mRows[row].yf = ((row * resizeFactorY) >> 6) & 0x7;
+        }
+    }
+
+    void buildBoxes() {
+        mmUint32 chromaIn = mInWidth >> 1;
+        mmUint32 chromaOut = mOutWidth >> 1;
+
+        mLumaBoxes = new mmUint32[mOutWidth + 1];
+        mChromaBoxes = new mmUint32[chromaOut + 1];
+
+        // input is at least as wide as the output, every box has a pixel
+        for (mmUint32 col = 0; col <= mOutWidth; col++) {
+            mLumaBoxes[col] = (col * mInWidth) / mOutWidth;
+        }
+
+        for (mmUint32 col = 0; col <= chromaOut; col++) {
+            mChromaBoxes[col] = chromaOut ? (col * chromaIn) / chromaOut : 0;
+        }
+    }
+
+    mmUint32 mInWidth;
+    mmUint32 mInHeight;
+    mmUint32 mOutWidth;
+    mmUint32 mOutHeight;
+    bool mArea;
+    ResizeColumn* mLumaColumns;
+    ResizeColumn* mChromaColumns;
+    ResizeRow* mRows;
+    mmUint32* mLumaBoxes;
+    mmUint32* mChromaBoxes;
+};
+
+static android::Mutex gResizeTablesLock;
+static android::sp<NV12ResizeTables> gResizeTables[RESIZE_TABLES_CACHE_SIZE];
+static int gResizeTablesNext = 0;
+
+static android::sp<NV12ResizeTables> getResizeTables(mmUint32 inWidth, mmUint32 inHeight,
+                                                     mmUint32 outWidth, mmUint32 outHeight) {
+    android::AutoMutex lock(gResizeTablesLock);
+    android::sp<NV12ResizeTables> tables;
+
+    for (int i = 0; i < RESIZE_TABLES_CACHE_SIZE; i++) {
+        if (gResizeTables[i].get() && gResizeTables[i]->matches(inWidth, inHeight, outWidth, outHeight)) {
+            return gResizeTables[i];
+        }
+    }
+
+    tables = new NV12ResizeTables(inWidth, inHeight, outWidth, outHeight);
+    gResizeTables[gResizeTablesNext] = tables;
+    gResizeTablesNext = (gResizeTablesNext + 1) % RESIZE_TABLES_CACHE_SIZE;
+
+    return tables;
+}
+
+static void interpolateLumaRow(mmUint16* dst, const mmUchar* src,
+                               const ResizeColumn* cols, mmUint32 count) {
+    for (mmUint32 i = 0; i < count; i++) {
+        const mmUchar* in = src + cols[i].offset;
+        dst[i] = in[0] * cols[i].w0 + in[1] * cols[i].w1;
+    }
+}
+
+static void interpolateChromaRow(mmUint16* dst, const mmUchar* src,
+                                 const ResizeColumn* cols, mmUint32 count) {
+    // Cb and Cr of a pair share position and weights
+    for (mmUint32 i = 0; i < count; i++) {
+        const mmUchar* in = src + cols[i].offset;
+        dst[0] = in[0] * cols[i].w0 + in[2] * cols[i].w1;
+        dst[1] = in[1] * cols[i].w0 + in[3] * cols[i].w1;
+        dst += 2;
+    }
+}
+
+/* Resizes rowCount rows of one plane. Each source row is interpolated
+ * horizontally once into a 16 bit row and kept around while following
+ * output rows still use it, the vertical blend is done by the vector
+ * kernels in YuvConvert. scratch holds two rows of 16 bit samples. */
+static void resizePlane(mmUchar* dst, mmUint32 dstStride,
+                        const mmUchar* src, mmUint32 srcStride,
+                        const ResizeRow* rows, mmUint32 rowCount,
+                        const ResizeColumn* cols, mmUint32 colCount,
+                        bool chroma, mmUint16* scratch) {
+    const mmUint32 samples = chroma ? colCount * 2 : colCount;
+    mmUint16* row0 = scratch;
+    mmUint16* row1 = scratch + samples;
+    mmInt32 y0 = -1;
+    mmInt32 y1 = -1;
+
+    for (mmUint32 row = 0; row < rowCount; row++) {
+        mmInt32 y = rows[row].y;
+        mmUint16 yf = rows[row].yf;
+
+        if (y0 != y) {
+            if (y1 == y) {
+                mmUint16* tmp = row0;
+                row0 = row1;
+                row1 = tmp;
+                y1 = y0;
+            } else if (chroma) {
+                interpolateChromaRow(row0, src + y * srcStride, cols, colCount);
+            } else {
+                interpolateLumaRow(row0, src + y * srcStride, cols, colCount);
+            }
+            y0 = y;
+        }
+
+        // second row only contributes with a non zero weight
+        if (yf && (y1 != y + 1)) {
+            if (chroma) {
+                interpolateChromaRow(row1, src + (y + 1) * srcStride, cols, colCount);
+            } else {
+                interpolateLumaRow(row1, src + (y + 1) * srcStride, cols, colCount);
+            }
+            y1 = y + 1;
+        }
+
+        Ti::Camera::bilinearBlendRow(dst, row0, yf ? row1 : row0, yf, samples);
+        dst += dstStride;
+    }
+}
+
+/* Area averaging of rows [firstRow, firstRow + rowCount) out of outRows
+ * output rows. The source rows of an output row are summed up in one
+ * streaming pass by the vector kernel in YuvConvert, which then turns the
+ * column sums into running sums, so that every box takes one subtraction
+ * and a division by the box size with rounding. acc holds one 32 bit sum
+ * per source byte. */
+static void areaPlane(mmUchar* dst, mmUint32 dstStride,
+                      const mmUchar* src, mmUint32 srcStride,
+                      mmUint32 srcRows, mmUint32 outRows,
+                      mmUint32 firstRow, mmUint32 rowCount,
+                      const mmUint32* boxes, mmUint32 colCount,
+                      bool chroma, mmUint32* acc) {
+    const mmUint32 width = chroma ? boxes[colCount] * 2 : boxes[colCount];
+
+    for (mmUint32 row = firstRow; row < firstRow + rowCount; row++) {
+        mmUint32 y0 = (row * srcRows) / outRows;
+        mmUint32 y1 = ((row + 1) * srcRows) / outRows;
+        mmUchar* out = dst;
+
+        memset(acc, 0, width * sizeof(mmUint32));
+        for (mmUint32 y = y0; y < y1; y++) {
+            Ti::Camera::boxAccumulateRow(acc, src + y * srcStride, width);
+        }
+        Ti::Camera::boxPrefixSumRow(acc, width, chroma ? 2 : 1);
+
+        for (mmUint32 col = 0; col < colCount; col++) {
+            mmUint32 x0 = boxes[col];
+            mmUint32 x1 = boxes[col + 1];
+            mmUint32 area = (x1 - x0) * (y1 - y0);
+
+            if (chroma) {
+                mmUint32 sumCb = acc[2 * x1 - 2];
+                mmUint32 sumCr = acc[2 * x1 - 1];
+
+                if (x0) {
+                    sumCb -= acc[2 * x0 - 2];
+                    sumCr -= acc[2 * x0 - 1];
+                }
+                out[0] = (mmUchar) ((sumCb + area / 2) / area);
+                out[1] = (mmUchar) ((sumCr + area / 2) / area);
+                out += 2;
+            } else {
+                mmUint32 sum = acc[x1 - 1];
+
+                if (x0) {
+                    sum -= acc[x0 - 1];
+                }
+                *out++ = (mmUchar) ((sum + area / 2) / area);
+            }
+        }
+
+        dst += dstStride;
+    }
+}
+
 /*==========================================================================
 * Function Name  : VT_resizeFrame_Video_opt2_lp
 *
@@ -34,8 +306,8 @@
 *
 * Value Returned : mmBool               -> FALSE on error TRUE on success
 * NOTE:
-*            Not tested for crop funtionallity.
-*            faster version.
+*            Bilinear with 1/8 pel weights, done as a horizontal pass
+*            through per geometry tables and a vectorized vertical pass.
 ============================================================================*/
 mmBool
 VT_resizeFrame_Video_opt2_lp(
@@ -44,33 +316,50 @@ VT_resizeFrame_Video_opt2_lp(
         IC_rect_type*  cropout,          /* how much to resize to in final image */
         mmUint16 dummy                   /* Transparent pixel value              */
         ) {
-    LOG_FUNCTION_NAME;
+    mmUint32 cody;
 
-    mmUint16 row,col;
-    mmUint32 resizeFactorX;
-    mmUint32 resizeFactorY;
+    if ( !o_img_ptr ) {
+        CAMHAL_LOGE("Image Point NULL");
+        return false;
+    }
 
-    mmUint16 x, y;
+    cody = cropout ? cropout->uHeight : o_img_ptr->uHeight;
 
-    mmUchar* ptr8;
-    mmUchar *ptr8Cb, *ptr8Cr;
+    return VT_resizeFrameRows_Video_opt2_lp(i_img_ptr, o_img_ptr, cropout, 0, cody);
+}
 
-    mmUint16 xf, yf;
+/*==========================================================================
+* Function Name  : VT_resizeFrameRows_Video_opt2_lp
+*
+* Description    : Resize rows [firstRow, firstRow + numRows) of a yuv frame.
+*
+* Input(s)       : input_img_ptr        -> Input Image Structure
+*                : output_img_ptr       -> Output Image Structure
+*                : cropout             -> crop structure
+*                : firstRow            -> first output row, even
+*                : numRows             -> number of output rows
+*
+* Value Returned : mmBool               -> FALSE on error TRUE on success
+============================================================================*/
+mmBool
+VT_resizeFrameRows_Video_opt2_lp(
+        structConvImage* i_img_ptr,      /* Points to the input image            */
+        structConvImage* o_img_ptr,      /* Points to the output image           */
+        IC_rect_type*  cropout,          /* how much to resize to in final image */
+        mmUint32 firstRow,               /* First output row of the tile         */
+        mmUint32 numRows                 /* Output rows in the tile              */
+        ) {
+    LOG_FUNCTION_NAME;
+
+    android::sp<NV12ResizeTables> tables;
+    void* scratch = NULL;
     mmUchar* inImgPtrY;
-    mmUchar* inImgPtrU;
-    mmUchar* inImgPtrV;
+    mmUchar* inImgPtrUV;
+    mmUchar* outImgPtrY;
+    mmUchar* outImgPtrUV;
     mmUint32 cox, coy, codx, cody;
-    mmUint16 idx,idy, idxC;
-
-    if ( i_img_ptr->uWidth == o_img_ptr->uWidth ) {
-        if ( i_img_ptr->uHeight == o_img_ptr->uHeight ) {
-            CAMHAL_LOGV("************************f(i_img_ptr->uHeight == o_img_ptr->uHeight) are same *********************\n");
-            CAMHAL_LOGV("************************(i_img_ptr->width == %d" , i_img_ptr->uWidth );
-            CAMHAL_LOGV("************************(i_img_ptr->uHeight == %d" , i_img_ptr->uHeight );
-            CAMHAL_LOGV("************************(o_img_ptr->width == %d" ,o_img_ptr->uWidth );
-            CAMHAL_LOGV("************************(o_img_ptr->uHeight == %d" , o_img_ptr->uHeight );
-        }
-    }
+    mmUint32 idx, idy;
+    mmUint32 lastRow, chromaRows;
 
     if ( !i_img_ptr || !i_img_ptr->imgPtr || !o_img_ptr || !o_img_ptr->imgPtr ) {
         CAMHAL_LOGE("Image Point NULL");
@@ -78,8 +367,7 @@ VT_resizeFrame_Video_opt2_lp(
     }
 
     inImgPtrY = (mmUchar *) i_img_ptr->imgPtr + i_img_ptr->uOffset;
-    inImgPtrU = (mmUchar *) i_img_ptr->clrPtr + i_img_ptr->uOffset/2;
-    inImgPtrV = (mmUchar*)inImgPtrU + 1;
+    inImgPtrUV = (mmUchar *) i_img_ptr->clrPtr + i_img_ptr->uOffset/2;
 
     if ( !cropout ) {
         cox = 0;
@@ -101,8 +389,10 @@ VT_resizeFrame_Video_opt2_lp(
         return false;
     }
 
-    resizeFactorX = ((idx-1)<<9) / codx;
-    resizeFactorY = ((idy-1)<<9) / cody;
+    if ( codx < 1 || cody < 1 ) {
+        CAMHAL_LOGE("output size less then 1 codx = %d cody = %d", codx, cody);
+        return false;
+    }
 
     if( i_img_ptr->eFormat != IC_FORMAT_YCbCr420_lp ||
             o_img_ptr->eFormat != IC_FORMAT_YCbCr420_lp ) {
@@ -110,181 +400,266 @@ VT_resizeFrame_Video_opt2_lp(
         return false;
     }
 
-    ptr8 = (mmUchar*)o_img_ptr->imgPtr + cox + coy*o_img_ptr->uWidth;
-
-    ////////////////////////////for Y//////////////////////////
-    for ( row = 0; row < cody; row++ ) {
-        mmUchar *pu8Yrow1 = NULL;
-        mmUchar *pu8Yrow2 = NULL;
-        y  = (mmUint16) ((mmUint32) (row*resizeFactorY) >> 9);
-        yf = (mmUchar)  ((mmUint32)((row*resizeFactorY) >> 6) & 0x7);
-        pu8Yrow1 = inImgPtrY + (y) * i_img_ptr->uStride;
-        pu8Yrow2 = pu8Yrow1 + i_img_ptr->uStride;
-
-        for ( col = 0; col < codx; col++ ) {
-            mmUchar in11, in12, in21, in22;
-            mmUchar *pu8ptr1 = NULL;
-            mmUchar *pu8ptr2 = NULL;
-            mmUchar w;
-            mmUint16 accum_1;
-            //mmUint32 accum_W;
-
-            x  = (mmUint16) ((mmUint32)  (col*resizeFactorX) >> 9);
-            xf = (mmUchar)  ((mmUint32) ((col*resizeFactorX) >> 6) & 0x7);
-
-            //accum_W = 0;
-            accum_1 =  0;
-
-            pu8ptr1 = pu8Yrow1 + (x);
-            pu8ptr2 = pu8Yrow2 + (x);
-
-            /* A pixel */
-            //in = *(inImgPtrY + (y)*idx + (x));
-            in11 = *(pu8ptr1);
-
-            w = bWeights[xf][yf][0];
-            accum_1 = (w * in11);
-            //accum_W += (w);
-
-            /* B pixel */
-            //in = *(inImgPtrY + (y)*idx + (x+1));
-            in12 = *(pu8ptr1+1);
-            w = bWeights[xf][yf][1];
-            accum_1 += (w * in12);
-            //accum_W += (w);
-
-            /* C pixel */
-            //in = *(inImgPtrY + (y+1)*idx + (x));
-            in21 = *(pu8ptr2);
-            w = bWeights[xf][yf][3];
-            accum_1 += (w * in21);
-            //accum_W += (w);
-
-            /* D pixel */
-            //in = *(inImgPtrY + (y+1)*idx + (x+1));
-            in22 = *(pu8ptr2+1);
-            w = bWeights[xf][yf][2];
-            accum_1 += (w * in22);
-            //accum_W += (w);
-
-            /* divide by sum of the weights */
-            //accum_1 /= (accum_W);
-            //accum_1 = (accum_1/64);
-            accum_1 = (accum_1>>6);
-            *ptr8 = (mmUchar)accum_1 ;
-
-            ptr8++;
+    if ( (firstRow & 1) || (firstRow >= cody) ) {
+        CAMHAL_LOGE("invalid tile firstRow = %d cody = %d", firstRow, cody);
+        return false;
+    }
+    lastRow = MIN(firstRow + numRows, cody);
+
+    tables = getResizeTables(idx, idy, codx, cody);
+    if ( !tables.get() ) {
+        CAMHAL_LOGE("Failed to allocate resize tables");
+        return false;
+    }
+
+    // area sums need one accumulator per source byte, bilinear two rows of samples
+    if ( tables->isArea() ) {
+        scratch = malloc(idx * sizeof(mmUint32));
+    } else {
+        scratch = malloc(2 * codx * sizeof(mmUint16));
+    }
+    if ( !scratch ) {
+        CAMHAL_LOGE("Failed to allocate resize scratch rows");
+        return false;
+    }
+
+    // crop rectangle is in luma pixels, chroma rows are half as many
+    outImgPtrY = (mmUchar*)o_img_ptr->imgPtr + cox + coy*o_img_ptr->uStride;
+    outImgPtrUV = (mmUchar*)o_img_ptr->clrPtr + cox + (coy>>1)*o_img_ptr->uStride;
+
+    // an odd last luma row has no chroma row of its own
+    chromaRows = MIN(lastRow, (cody & ~1))/2 - (firstRow>>1);
+
+    if ( tables->isArea() ) {
+        areaPlane(outImgPtrY + firstRow*o_img_ptr->uStride, o_img_ptr->uStride,
+                  inImgPtrY, i_img_ptr->uStride, idy, cody,
+                  firstRow, lastRow - firstRow,
+                  tables->lumaBoxes(), codx, false, (mmUint32 *) scratch);
+
+        if ( (idy>>1) && (codx>>1) ) {
+            areaPlane(outImgPtrUV + (firstRow>>1)*o_img_ptr->uStride, o_img_ptr->uStride,
+                      inImgPtrUV, i_img_ptr->uStride, idy>>1, cody>>1,
+                      firstRow>>1, chromaRows,
+                      tables->chromaBoxes(), codx>>1, true, (mmUint32 *) scratch);
         }
-        ptr8 = ptr8 + (o_img_ptr->uStride - codx);
+    } else {
+        resizePlane(outImgPtrY + firstRow*o_img_ptr->uStride, o_img_ptr->uStride,
+                    inImgPtrY, i_img_ptr->uStride,
+                    tables->rows() + firstRow, lastRow - firstRow,
+                    tables->lumaColumns(), codx, false, (mmUint16 *) scratch);
+
+        resizePlane(outImgPtrUV + (firstRow>>1)*o_img_ptr->uStride, o_img_ptr->uStride,
+                    inImgPtrUV, i_img_ptr->uStride,
+                    tables->rows() + (firstRow>>1), chromaRows,
+                    tables->chromaColumns(), codx>>1, true, (mmUint16 *) scratch);
+    }
+
+    free(scratch);
+
+    CAMHAL_LOGV("success");
+    return true;
+}
+
+namespace Ti {
+namespace Camera {
+
+NV12ResizePool::NV12ResizePool(int numThreads)
+    : mNumThreads(MIN(numThreads, MAX_THREADS)),
+      mExiting(false),
+      mHasCrop(false),
+      mTileRows(0),
+      mNumTiles(0),
+      mNextTile(0),
+      mDoneTiles(0),
+      mWorkTime(0) {
+    if (mNumThreads < 0) {
+        mNumThreads = 0;
+    }
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+NV12ResizePool::~NV12ResizePool() {
+    {
+        android::AutoMutex lock(mLock);
+        mExiting = true;
+        mTileAvailable.broadcast();
     }
-    ////////////////////////////for Y//////////////////////////
 
-    ///////////////////////////////for Cb-Cr//////////////////////
+    for (int i = 0; i < mNumThreads; i++) {
+        if (mThreads[i].get()) {
+            mThreads[i]->requestExit();
+            mThreads[i]->join();
+            mThreads[i].clear();
+        }
+    }
+}
 
-    ptr8Cb = (mmUchar*)o_img_ptr->clrPtr + cox + coy*o_img_ptr->uWidth;
+status_t NV12ResizePool::initialize() {
+    status_t ret = NO_ERROR;
 
-    ptr8Cr = (mmUchar*)(ptr8Cb+1);
+    for (int i = 0; i < mNumThreads; i++) {
+        mThreads[i] = new WorkerThread(this);
+        if (!mThreads[i].get()) {
+            CAMHAL_LOGEA("Couldn't create resize thread");
+            return NO_MEMORY;
+        }
 
-    idxC = (idx>>1);
-    for ( row = 0; row < (((cody)>>1)); row++ ) {
-        mmUchar *pu8Cbr1 = NULL;
-        mmUchar *pu8Cbr2 = NULL;
-        mmUchar *pu8Crr1 = NULL;
-        mmUchar *pu8Crr2 = NULL;
+        ret = mThreads[i]->run("NV12Resize", android::PRIORITY_URGENT_DISPLAY);
+        if (ret != NO_ERROR) {
+            CAMHAL_LOGEB("Couldn't run resize thread %d", i);
+            mThreads[i].clear();
+            return ret;
+        }
+    }
 
-        y  = (mmUint16) ((mmUint32) (row*resizeFactorY) >> 9);
-        yf = (mmUchar)  ((mmUint32)((row*resizeFactorY) >> 6) & 0x7);
+    return ret;
+}
 
-        pu8Cbr1 = inImgPtrU + (y) * i_img_ptr->uStride;
-        pu8Cbr2 = pu8Cbr1 + i_img_ptr->uStride;
-        pu8Crr1 = inImgPtrV + (y) * i_img_ptr->uStride;
-        pu8Crr2 = pu8Crr1 + i_img_ptr->uStride;
+// claims and resizes one tile of the current frame, mLock held on entry and exit
+bool NV12ResizePool::runNextTile() {
+    int tile;
+    mmUint32 firstRow;
+    nsecs_t start;
+    structConvImage input, output;
+    IC_rect_type crop;
+    bool hasCrop;
 
-        for ( col = 0; col < (((codx)>>1)); col++ ) {
-            mmUchar in11, in12, in21, in22;
-            mmUchar *pu8Cbc1 = NULL;
-            mmUchar *pu8Cbc2 = NULL;
-            mmUchar *pu8Crc1 = NULL;
-            mmUchar *pu8Crc2 = NULL;
+    if (mNextTile >= mNumTiles) {
+        return false;
+    }
 
-            mmUchar w;
-            mmUint16 accum_1Cb, accum_1Cr;
-            //mmUint32 accum_WCb, accum_WCr;
+    tile = mNextTile++;
+    firstRow = tile * mTileRows;
+    input = mInput;
+    output = mOutput;
+    crop = mCrop;
+    hasCrop = mHasCrop;
 
-            x  = (mmUint16) ((mmUint32)  (col*resizeFactorX) >> 9);
-            xf = (mmUchar)  ((mmUint32) ((col*resizeFactorX) >> 6) & 0x7);
+    mLock.unlock();
 
-            //accum_WCb = accum_WCr =  0;
-            accum_1Cb = accum_1Cr =  0;
+    start = systemTime();
+    VT_resizeFrameRows_Video_opt2_lp(&input, &output, hasCrop ? &crop : NULL,
+                                     firstRow, mTileRows);
 
-            pu8Cbc1 = pu8Cbr1 + (x*2);
-            pu8Cbc2 = pu8Cbr2 + (x*2);
-            pu8Crc1 = pu8Crr1 + (x*2);
-            pu8Crc2 = pu8Crr2 + (x*2);
+    mLock.lock();
 
-            /* A pixel */
-            w = bWeights[xf][yf][0];
+    mWorkTime += systemTime() - start;
+    if (++mDoneTiles == mNumTiles) {
+        mFrameDone.broadcast();
+    }
 
-            in11 = *(pu8Cbc1);
-            accum_1Cb = (w * in11);
-            //    accum_WCb += (w);
+    return true;
+}
 
-            in11 = *(pu8Crc1);
-            accum_1Cr = (w * in11);
-            //accum_WCr += (w);
+bool NV12ResizePool::processTiles() {
+    android::AutoMutex lock(mLock);
 
-            /* B pixel */
-            w = bWeights[xf][yf][1];
+    while ((mNextTile >= mNumTiles) && !mExiting) {
+        mTileAvailable.wait(mLock);
+    }
 
-            in12 = *(pu8Cbc1+2);
-            accum_1Cb += (w * in12);
-            //accum_WCb += (w);
+    if (mExiting) {
+        return false;
+    }
 
-            in12 = *(pu8Crc1+2);
-            accum_1Cr += (w * in12);
-            //accum_WCr += (w);
+    runNextTile();
 
-            /* C pixel */
-            w = bWeights[xf][yf][3];
+    return true;
+}
 
-            in21 = *(pu8Cbc2);
-            accum_1Cb += (w * in21);
-            //accum_WCb += (w);
+status_t NV12ResizePool::resize(structConvImage* input, structConvImage* output,
+                                IC_rect_type* crop, int dop, nsecs_t deadline) {
+    android::AutoMutex frameLock(mFrameLock);
+    status_t ret = NO_ERROR;
+    nsecs_t start = systemTime();
+    nsecs_t frameTime, workTime;
+    mmUint32 rows;
+    int tiles;
+
+    if (!input || !output) {
+        return BAD_VALUE;
+    }
 
-            in21 = *(pu8Crc2);
-            accum_1Cr += (w * in21);
-            //accum_WCr += (w);
+    rows = crop ? crop->uHeight : output->uHeight;
+    tiles = MIN(MIN(dop, mNumThreads + 1), (int) (rows / TILE_ROW_ALIGN));
 
-            /* D pixel */
-            w = bWeights[xf][yf][2];
+    if (tiles <= 1) {
+        if (!VT_resizeFrame_Video_opt2_lp(input, output, crop, 0)) {
+            return BAD_VALUE;
+        }
+        workTime = systemTime() - start;
+    } else {
+        android::AutoMutex lock(mLock);
 
-            in22 = *(pu8Cbc2+2);
-            accum_1Cb += (w * in22);
-            //accum_WCb += (w);
+        mInput = *input;
+        mOutput = *output;
+        mHasCrop = (crop != NULL);
+        if (crop) {
+            mCrop = *crop;
+        }
+        mTileRows = ((rows / tiles + TILE_ROW_ALIGN - 1) / TILE_ROW_ALIGN) * TILE_ROW_ALIGN;
+        mNumTiles = (rows + mTileRows - 1) / mTileRows;
+        mNextTile = 0;
+        mDoneTiles = 0;
+        mWorkTime = 0;
+
+        mTileAvailable.broadcast();
+
+        // help out instead of just waiting
+        while (runNextTile());
+
+        while (mDoneTiles < mNumTiles) {
+            nsecs_t left = (deadline > 0) ? (start + deadline - systemTime()) : 0;
+
+            if (left > 0) {
+                mFrameDone.waitRelative(mLock, left);
+            } else {
+                // too late already, the output still has to be complete
+                mFrameDone.wait(mLock);
+            }
+        }
 
-            in22 = *(pu8Crc2+2);
-            accum_1Cr += (w * in22);
-            //accum_WCr += (w);
+        workTime = mWorkTime;
+        mNumTiles = 0;
+        mNextTile = 0;
+    }
 
-            /* divide by sum of the weights */
-            //accum_1Cb /= (accum_WCb);
-            accum_1Cb = (accum_1Cb>>6);
-            *ptr8Cb = (mmUchar)accum_1Cb ;
+    frameTime = systemTime() - start;
 
-            accum_1Cr = (accum_1Cr >> 6);
-            *ptr8Cr = (mmUchar)accum_1Cr ;
+    {
+        android::AutoMutex lock(mLock);
 
-            ptr8Cb++;
-            ptr8Cr++;
+        mStats.frames++;
+        if (tiles > 1) {
+            mStats.tiledFrames++;
+        }
+        mStats.lastFrameTime = frameTime;
+        if (frameTime > mStats.maxFrameTime) {
+            mStats.maxFrameTime = frameTime;
+        }
+        mStats.totalFrameTime += frameTime;
+        mStats.totalWorkTime += workTime;
 
-            ptr8Cb++;
-            ptr8Cr++;
+        if ((deadline > 0) && (frameTime > deadline)) {
+            mStats.deadlineMisses++;
+            ret = TIMED_OUT;
         }
-        ptr8Cb = ptr8Cb + (o_img_ptr->uStride-codx);
-        ptr8Cr = ptr8Cr + (o_img_ptr->uStride-codx);
     }
-    ///////////////////For Cb- Cr////////////////////////////////////////
 
-    CAMHAL_LOGV("success");
-    return true;
+    return ret;
+}
+
+void NV12ResizePool::getStats(Stats& stats) {
+    android::AutoMutex lock(mLock);
+
+    stats = mStats;
 }
+
+void NV12ResizePool::resetStats() {
+    android::AutoMutex lock(mLock);
+
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+} // namespace Camera
+} // namespace Ti
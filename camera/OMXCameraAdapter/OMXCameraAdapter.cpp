@@ -29,6 +29,7 @@
 #include <math.h>
 
 #include <cutils/properties.h>
+#include <cutils/atomic.h>
 #define UNLIKELY( exp ) (__builtin_expect( (exp) != 0, false ))
 static int mDebugFps = 0;
 static int mDebugFcs = 0;
@@ -47,6 +48,27 @@ const char OMXCameraAdapter::DEFAULT_PROFILE_PATH[] = "/data/dbg/profile_data.bi
 //frames skipped before recalculating the framerate
 #define FPS_PERIOD 30
 
+//Keys read by the setParameters groups which only depend on them
+static const char * const sFocusKeys[] = {
+    android::CameraParameters::KEY_FOCUS_AREAS,
+    android::CameraParameters::KEY_MAX_NUM_FOCUS_AREAS,
+};
+
+static const char * const sEXIFKeys[] = {
+    android::CameraParameters::KEY_GPS_LATITUDE,
+    android::CameraParameters::KEY_GPS_LONGITUDE,
+    android::CameraParameters::KEY_GPS_ALTITUDE,
+    android::CameraParameters::KEY_GPS_TIMESTAMP,
+    android::CameraParameters::KEY_GPS_PROCESSING_METHOD,
+    TICameraParameters::KEY_GPS_MAPDATUM,
+    TICameraParameters::KEY_GPS_VERSION,
+    TICameraParameters::KEY_EXIF_MODEL,
+    TICameraParameters::KEY_EXIF_MAKE,
+    android::CameraParameters::KEY_FOCAL_LENGTH,
+};
+
+const nsecs_t OMXCameraAdapter::CURRENT_ISO_REFRESH = milliseconds_to_nanoseconds(100);
+
 android::Mutex gAdapterLock;
 /*--------------------Camera Adapter Class STARTS here-----------------------------*/
 
@@ -231,6 +253,7 @@ status_t OMXCameraAdapter::initialize(CameraProperties::Properties* caps)
     mCapabilities = caps;
     mZoomUpdating = false;
     mZoomUpdate = false;
+    mCurrentIsoTime = 0;
     mGBCE = BRIGHTNESS_OFF;
     mGLBCE = BRIGHTNESS_OFF;
     mParameters3A.ExposureLock = OMX_FALSE;
@@ -480,6 +503,7 @@ status_t OMXCameraAdapter::fillThisBuffer(CameraBuffer * frameBuf, CameraFrame::
                     mBurstFramesQueued++;
                 }
                 port->mStatus[i] = OMXCameraPortParameters::FILL;
+                FrameTracer::trace(FrameTracer::FILL_BUFFER, frameBuf, frameType);
                 eError = OMX_FillThisBuffer(mCameraAdapterParameters.mHandleComp, port->mBufferHeader[i]);
                 if ( eError != OMX_ErrorNone )
                 {
@@ -553,9 +577,15 @@ status_t OMXCameraAdapter::setParameters(const android::CameraParameters &params
     const char *valstr = NULL;
     int w, h;
     OMX_COLOR_FORMATTYPE pixFormat;
+    ParameterDiff changes;
     BaseCameraAdapter::AdapterState state;
     BaseCameraAdapter::getState(state);
 
+    //Everything counts as changed on the first call
+    if ( !mFirstTimeInit ) {
+        changes.compare(mParams.flatten().string(), params.flatten().string());
+    }
+
     ///@todo Include more camera parameters
     if ( (valstr = params.getPreviewFormat()) != NULL ) {
         if(strcmp(valstr, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0 ||
@@ -676,16 +706,25 @@ status_t OMXCameraAdapter::setParameters(const android::CameraParameters &params
 
     ret |= setParametersAlgo(params, state);
 
-    ret |= setParametersFocus(params, state);
+    // 3A, Algo and Capture compare against their own state, which can
+    // change without the parameters changing. Zoom is applied again since
+    // zoom bracketing moves it without touching mCurrentZoomIdx.
+    // mFirstTimeInit can be set again by setParameters3A().
+    if ( mFirstTimeInit || changes.changedAny(sFocusKeys, ARRAY_SIZE(sFocusKeys)) ) {
+        ret |= setParametersFocus(params, state);
+    }
 
     ret |= setParametersFD(params, state);
 
     ret |= setParametersZoom(params, state);
 
-    ret |= setParametersEXIF(params, state);
+    if ( mFirstTimeInit || changes.changedAny(sEXIFKeys, ARRAY_SIZE(sEXIFKeys)) ) {
+        ret |= setParametersEXIF(params, state);
+    }
 
     mParams = params;
     mFirstTimeInit = false;
+    markParametersChanged();
 
     if ( MODE_MAX != mCapabilitiesOpMode ) {
         mCapabilities->setMode(mCapabilitiesOpMode);
@@ -764,6 +803,28 @@ static status_t saveBufferToFile(const void *buf, int size, const char *filename
 #endif
 
 
+bool OMXCameraAdapter::takeParametersChanged()
+{
+    BaseCameraAdapter::AdapterState state;
+    bool changed = BaseCameraAdapter::takeParametersChanged();
+
+    BaseCameraAdapter::getState(state);
+
+    //Focus distances are read back while focusing and every
+    //getParameters() steps the reported smooth zoom index
+    if ( ( AF_ACTIVE | ZOOM_ACTIVE ) & state ) {
+        changed = true;
+    }
+
+    //The current ISO follows the exposure while previewing
+    if ( ( PREVIEW_ACTIVE & state ) &&
+         ( CURRENT_ISO_REFRESH < ( systemTime() - mCurrentIsoTime ) ) ) {
+        changed = true;
+    }
+
+    return changed;
+}
+
 void OMXCameraAdapter::getParameters(android::CameraParameters& params)
 {
     status_t ret = NO_ERROR;
@@ -831,6 +892,7 @@ void OMXCameraAdapter::getParameters(android::CameraParameters& params)
     if ( OMX_ErrorNone == eError )
         {
         params.set(TICameraParameters::KEY_CURRENT_ISO, exp.nSensitivity);
+        mCurrentIsoTime = systemTime();
         }
     else
         {
@@ -2215,6 +2277,8 @@ status_t OMXCameraAdapter::startPreview()
         {
         CAMHAL_LOGDB("Queuing buffer on Preview port - 0x%x", (uint32_t)mPreviewData->mBufferHeader[index]->pBuffer);
         mPreviewData->mStatus[index] = OMXCameraPortParameters::FILL;
+        FrameTracer::trace(FrameTracer::FILL_BUFFER, mPreviewData->mBufferHeader[index]->pAppPrivate,
+                           CameraFrame::PREVIEW_FRAME_SYNC);
         eError = OMX_FillThisBuffer(mCameraAdapterParameters.mHandleComp,
                     (OMX_BUFFERHEADERTYPE*)mPreviewData->mBufferHeader[index]);
         if(eError!=OMX_ErrorNone)
@@ -2376,7 +2440,7 @@ EXIT:
     {
         android::AutoMutex lock(mPreviewBufferLock);
         ///Clear all the available preview buffers
-        mPreviewBuffersAvailable.clear();
+        clearFrameRefCounts(mPreviewBuffersAvailable, CameraFrame::PREVIEW_FRAME_SYNC);
     }
     performCleanupAfterError();
     LOG_FUNCTION_NAME_EXIT;
@@ -2432,7 +2496,7 @@ status_t OMXCameraAdapter::stopPreview() {
 
         {
             android::AutoMutex lock(mPreviewDataBufferLock);
-            mPreviewDataBuffersAvailable.clear();
+            clearFrameRefCounts(mPreviewDataBuffersAvailable, CameraFrame::FRAME_DATA_SYNC);
         }
 
     }
@@ -2440,7 +2504,7 @@ status_t OMXCameraAdapter::stopPreview() {
     {
         android::AutoMutex lock(mPreviewBufferLock);
         ///Clear all the available preview buffers
-        mPreviewBuffersAvailable.clear();
+        clearFrameRefCounts(mPreviewBuffersAvailable, CameraFrame::PREVIEW_FRAME_SYNC);
     }
 
     switchToLoaded();
@@ -2461,7 +2525,7 @@ EXIT:
     {
         android::AutoMutex lock(mPreviewBufferLock);
         ///Clear all the available preview buffers
-        mPreviewBuffersAvailable.clear();
+        clearFrameRefCounts(mPreviewBuffersAvailable, CameraFrame::PREVIEW_FRAME_SYNC);
     }
     performCleanupAfterError();
     LOG_FUNCTION_NAME_EXIT;
@@ -3413,6 +3477,8 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLE
         return OMX_ErrorNone;
     }
 
+    FrameTracer::trace(FrameTracer::FILL_BUFFER_DONE, pBuffHeader->pAppPrivate);
+
     pPortParam = &(mCameraAdapterParameters.mCameraPortParams[pBuffHeader->nOutputPortIndex]);
 
     // Find buffer and mark it as filled
@@ -3476,7 +3542,7 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLE
         if (mRecording)
             {
             mask |= (unsigned int)CameraFrame::VIDEO_FRAME_SYNC;
-            mFramesWithEncoder++;
+            android_atomic_inc(&mFramesWithEncoder);
             }
 
         //CAMHAL_LOGV("FBD pBuffer = 0x%x", pBuffHeader->pBuffer);
@@ -3493,9 +3559,10 @@ OMX_ERRORTYPE OMXCameraAdapter::OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLE
             }
 
         stat = sendCallBacks(cameraFrame, pBuffHeader, mask, pPortParam);
-        mFramesWithDisplay++;
+        android_atomic_inc(&mFramesWithDisplay);
 
         mFramesWithDucati--;
+        updatePreviewStarvation(mFramesWithDucati);
 
 #ifdef CAMERAHAL_DEBUG
         if(mBuffersWithDucati.indexOfKey((uint32_t)pBuffHeader->pBuffer)<0)
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CameraHal.h"
+#include "ParameterDiff.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace Ti {
+namespace Camera {
+
+namespace {
+
+ssize_t findKey(const android::Vector<const char *> &sorted, const char *key) {
+    ssize_t low = 0;
+    ssize_t high = (ssize_t) sorted.size() - 1;
+
+    while (low <= high) {
+        ssize_t mid = low + (high - low) / 2;
+        int cmp = strcmp(sorted[mid], key);
+
+        if (0 == cmp) {
+            return mid;
+        }
+
+        if (0 > cmp) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return -1;
+}
+
+} // anonymous namespace
+
+ParameterDiff::ParameterDiff()
+    : mFrom(NULL),
+      mTo(NULL),
+      mCompared(false) {
+}
+
+ParameterDiff::~ParameterDiff() {
+    clear();
+}
+
+void ParameterDiff::clear() {
+    free(mFrom);
+    free(mTo);
+    mFrom = NULL;
+    mTo = NULL;
+    mCompared = false;
+    mToPairs.clear();
+    mChanged.clear();
+}
+
+void ParameterDiff::parse(char *str, android::Vector<Pair> &pairs) {
+    char *ctx = NULL;
+    char *token;
+
+    // same split as CameraParameters::unflatten()
+    for (token = strtok_r(str, ";", &ctx); NULL != token; token = strtok_r(NULL, ";", &ctx)) {
+        char *separator = strchr(token, '=');
+        Pair pair;
+
+        if (NULL == separator) {
+            continue;
+        }
+
+        *separator = '\0';
+        pair.mKey = token;
+        pair.mValue = separator + 1;
+        pairs.push_back(pair);
+    }
+
+    pairs.sort(comparePairs);
+}
+
+int ParameterDiff::comparePairs(const Pair *a, const Pair *b) {
+    return strcmp(a->mKey, b->mKey);
+}
+
+status_t ParameterDiff::compare(const char *from, const char *to) {
+    android::Vector<Pair> fromPairs;
+    size_t i = 0;
+    size_t j = 0;
+
+    clear();
+
+    mFrom = strdup((NULL != from) ? from : "");
+    mTo = strdup((NULL != to) ? to : "");
+    if ((NULL == mFrom) || (NULL == mTo)) {
+        CAMHAL_LOGEA("Couldn't copy parameters");
+        clear();
+        return NO_MEMORY;
+    }
+
+    parse(mFrom, fromPairs);
+    parse(mTo, mToPairs);
+
+    // both sides are sorted, walking them together keeps mChanged sorted
+    while ((i < fromPairs.size()) || (j < mToPairs.size())) {
+        int cmp;
+
+        if (i == fromPairs.size()) {
+            cmp = 1;
+        } else if (j == mToPairs.size()) {
+            cmp = -1;
+        } else {
+            cmp = strcmp(fromPairs[i].mKey, mToPairs[j].mKey);
+        }
+
+        if (0 > cmp) {
+            mChanged.push_back(fromPairs[i++].mKey);
+        } else if (0 < cmp) {
+            mChanged.push_back(mToPairs[j++].mKey);
+        } else {
+            if (0 != strcmp(fromPairs[i].mValue, mToPairs[j].mValue)) {
+                mChanged.push_back(mToPairs[j].mKey);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    mCompared = true;
+
+    return NO_ERROR;
+}
+
+bool ParameterDiff::changed(const char *key) const {
+    if (!mCompared) {
+        return true;
+    }
+
+    return 0 <= findKey(mChanged, key);
+}
+
+bool ParameterDiff::changedAny(const char * const *keys, size_t count) const {
+    for (size_t i = 0; i < count; i++) {
+        if (changed(keys[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ParameterDiff::isSame(const char *key) const {
+    ssize_t low = 0;
+    ssize_t high;
+
+    if (changed(key)) {
+        return false;
+    }
+
+    high = (ssize_t) mToPairs.size() - 1;
+    while (low <= high) {
+        ssize_t mid = low + (high - low) / 2;
+        int cmp = strcmp(mToPairs[mid].mKey, key);
+
+        if (0 == cmp) {
+            return true;
+        }
+
+        if (0 > cmp) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return false;
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -120,6 +120,8 @@ const char TICameraParameters::KEY_GPS_MAPDATUM[] = "gps-mapdatum";
 const char TICameraParameters::KEY_GPS_VERSION[] = "gps-version";
 const char TICameraParameters::KEY_GPS_DATESTAMP[] = "gps-datestamp";
 
+const char TICameraParameters::KEY_PREVIEW_CALLBACK_ZERO_COPY[] = "preview-callback-zero-copy";
+
 // TI extensions for slice mode implementation for VTC
 const char TICameraParameters::KEY_VTC_HINT[] = "internal-vtc-hint";
 const char TICameraParameters::KEY_VIDEO_ENCODER_HANDLE[] = "encoder_handle";
@@ -25,6 +25,8 @@
 #include "V4LCameraAdapter.h"
 #include "CameraHal.h"
 #include "TICameraParameters.h"
+#include "YuvConvert.h"
+#include "NV12_resize.h"
 #include "DebugUtils.h"
 #include <signal.h>
 #include <stdio.h>
@@ -42,6 +44,7 @@
 #include <ui/GraphicBufferMapper.h>
 
 #include <cutils/properties.h>
+#include <cutils/atomic.h>
 #define UNLIKELY( exp ) (__builtin_expect( (exp) != 0, false ))
 static int mDebugFps = 0;
 
@@ -55,6 +58,9 @@ namespace Camera {
 //frames skipped before recalculating the framerate
 #define FPS_PERIOD 30
 
+//longest wait for the first ZSL frame after preview started
+#define ZSL_FRAME_TIMEOUT_MS 200
+
 //define this macro to save first few raw frames when starting the preview.
 //#define SAVE_RAW_FRAMES 1
 //#define DUMP_CAPTURE_FRAME 1
@@ -63,6 +69,8 @@ namespace Camera {
 //Proto Types
 static void convertYUV422i_yuyvTouyvy(uint8_t *src, uint8_t *dest, size_t size );
 static void convertYUV422ToNV12Tiler(unsigned char *src, unsigned char *dest, int width, int height );
+static void scaleYUV422ToNV12Tiler(unsigned char *src, int srcWidth, int srcHeight, unsigned char *tmp,
+                                   unsigned char *dest, int width, int height );
 static void convertYUV422ToNV12(unsigned char *src, unsigned char *dest, int width, int height );
 
 android::Mutex gV4LAdapterLock;
@@ -239,7 +247,7 @@ status_t V4LCameraAdapter::restartPreview ()
     struct v4l2_streamparm streamParams;
 
     //configure for preview size and pixel format.
-    mParams.getPreviewSize(&width, &height);
+    getStreamSize(mParams, width, height);
 
     ret = v4lSetFormat (width, height, DEFAULT_PIXEL_FORMAT);
     if (ret < 0) {
@@ -247,6 +255,10 @@ status_t V4LCameraAdapter::restartPreview ()
         goto EXIT;
     }
 
+    if (mZslMode) {
+        allocateZslRing();
+    }
+
     ret = v4lInitMmap(mPreviewBufferCount);
     if (ret < 0) {
         CAMHAL_LOGEB("v4lInitMmap Failed: %s", strerror(errno));
@@ -366,6 +378,7 @@ status_t V4LCameraAdapter::fillThisBuffer(CameraBuffer *frameBuf, CameraFrame::F
     mVideoInfo->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     mVideoInfo->buf.memory = V4L2_MEMORY_MMAP;
 
+    FrameTracer::trace(FrameTracer::FILL_BUFFER, frameBuf, frameType);
     ret = v4lIoctl(mCameraHandle, VIDIOC_QBUF, &mVideoInfo->buf);
     if (ret < 0) {
        CAMHAL_LOGEA("VIDIOC_QBUF Failed");
@@ -387,7 +400,11 @@ status_t V4LCameraAdapter::setParameters(const android::CameraParameters &params
     LOG_FUNCTION_NAME;
 
     if(!mPreviewing && !mCapturing) {
-        params.getPreviewSize(&width, &height);
+        const char *valstr = params.get(TICameraParameters::KEY_CAP_MODE);
+
+        mZslMode = valstr && !strcmp(valstr, TICameraParameters::HIGH_QUALITY_ZSL_MODE);
+
+        getStreamSize(params, width, height);
         CAMHAL_LOGDB("Width * Height %d x %d format 0x%x", width, height, DEFAULT_PIXEL_FORMAT);
 
         ret = v4lSetFormat( width, height, DEFAULT_PIXEL_FORMAT);
@@ -413,6 +430,7 @@ status_t V4LCameraAdapter::setParameters(const android::CameraParameters &params
 
     // Udpate the current parameter set
     mParams = params;
+    markParametersChanged();
 
 EXIT:
     LOG_FUNCTION_NAME_EXIT;
@@ -493,6 +511,12 @@ EXIT:
 
 }
 
+bool V4LCameraAdapter::takesCarvedBuffers(CameraMode mode) {
+    // captured frames are copied into the mapping of the buffer, the
+    // buffer itself is never queued to the driver
+    return (CAMERA_IMAGE_CAPTURE == mode);
+}
+
 status_t V4LCameraAdapter::UseBuffersPreview(CameraBuffer *bufArr, int num)
 {
     int ret = NO_ERROR;
@@ -539,6 +563,15 @@ status_t V4LCameraAdapter::takePicture() {
         goto EXIT;
     }
 
+    if (mZslMode && mZslRing.isAllocated()) {
+        mParams.getPictureSize(&width, &height);
+        if ((width == mVideoInfo->width) && (height == mVideoInfo->height)) {
+            ret = takeZslPicture();
+            goto EXIT;
+        }
+        CAMHAL_LOGDA("Picture size changed since the stream started, restarting it");
+    }
+
     mCapturing = true;
     mPreviewing = false;
 
@@ -654,6 +687,99 @@ EXIT:
     return ret;
 }
 
+status_t V4LCameraAdapter::allocateZslRing()
+{
+    status_t ret = NO_ERROR;
+    char value[PROPERTY_VALUE_MAX];
+    int count;
+
+    if (mZslRing.isAllocated() && (mZslRing.getFrameSize() == (size_t) mVideoInfo->framesizeIn)) {
+        return NO_ERROR;
+    }
+
+    // full resolution frames kept during preview
+    property_get("debug.camera.zsl.frames", value, "3");
+    count = atoi(value);
+    if (count < 1) {
+        count = 1;
+    }
+
+    ret = mZslRing.allocate(count, mVideoInfo->framesizeIn);
+    if (ret != NO_ERROR) {
+        CAMHAL_LOGEA("Couldn't allocate the ZSL ring, captures will restart the stream");
+        return ret;
+    }
+
+    CAMHAL_LOGI("ZSL ring of %d frames of %dx%d, %u KB",
+                count, mVideoInfo->width, mVideoInfo->height,
+                (unsigned int) (mZslRing.getMemorySize() >> 10));
+
+    return ret;
+}
+
+status_t V4LCameraAdapter::takeZslPicture()
+{
+    status_t ret = NO_ERROR;
+    const nsecs_t shutter = systemTime(SYSTEM_TIME_MONOTONIC);
+    ZslRing::Frame zslFrame;
+    CameraBuffer *buffer = NULL;
+    CameraFrame frame;
+
+    LOG_FUNCTION_NAME;
+
+    if (mCaptureBufs.isEmpty()) {
+        CAMHAL_LOGEA("No capture buffers");
+        return NO_INIT;
+    }
+
+    buffer = mCaptureBufs.keyAt(0);
+
+    // the ring is only empty right after the stream started
+    ret = mZslRing.acquire(shutter, ms2ns(ZSL_FRAME_TIMEOUT_MS), zslFrame);
+    if (ret != NO_ERROR) {
+        CAMHAL_LOGEA("No ZSL frame available");
+        return ret;
+    }
+
+    if (zslFrame.size > buffer->size) {
+        CAMHAL_LOGEB("ZSL frame of %d bytes doesn't fit the capture buffer of %d bytes",
+                     (int) zslFrame.size, (int) buffer->size);
+        mZslRing.release(zslFrame);
+        return BAD_VALUE;
+    }
+
+    mCapturing = true;
+
+    memcpy(buffer->opaque, zslFrame.data, zslFrame.size);
+    mZslRing.release(zslFrame);
+
+    CAMHAL_LOGDB("ZSL frame taken %lld us %s the shutter press",
+                 (long long) ns2us((zslFrame.timestamp > shutter) ? zslFrame.timestamp - shutter : shutter - zslFrame.timestamp),
+                 (zslFrame.timestamp > shutter) ? "after" : "before");
+
+    frame.mFrameType = CameraFrame::IMAGE_FRAME;
+    frame.mBuffer = buffer;
+    frame.mLength = zslFrame.size;
+    frame.mWidth = mVideoInfo->width;
+    frame.mHeight = mVideoInfo->height;
+    frame.mAlignment = mVideoInfo->width * 2;
+    frame.mOffset = 0;
+    frame.mTimestamp = zslFrame.timestamp;
+    frame.mFrameMask = (unsigned int)CameraFrame::IMAGE_FRAME;
+    frame.mQuirks |= CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG;
+    frame.mQuirks |= CameraFrame::FORMAT_YUV422I_YUYV;
+
+    ret = setInitFrameRefCount(frame.mBuffer, frame.mFrameMask);
+    if (ret != NO_ERROR) {
+        CAMHAL_LOGDB("Error in setInitFrameRefCount %d", ret);
+    } else {
+        ret = sendFrameToSubscribers(&frame);
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+    return ret;
+}
+
 status_t V4LCameraAdapter::stopImageCapture()
 {
     status_t ret = NO_ERROR;
@@ -709,6 +835,10 @@ status_t V4LCameraAdapter::startPreview()
 
     ret = v4lStartStreaming();
 
+    if (mZslMode) {
+        allocateZslRing();
+    }
+
     // Create and start preview thread for receiving buffers from V4L Camera
     if(!mCapturing) {
         mPreviewThread = new PreviewThread(this);
@@ -751,6 +881,16 @@ status_t V4LCameraAdapter::stopPreview()
     mPreviewThread->requestExitAndWait();
     mPreviewThread.clear();
 
+    if (mZslRing.isAllocated()) {
+        ZslRing::Stats stats;
+
+        mZslRing.getStats(stats);
+        CAMHAL_LOGI("ZSL ring: %u frames, %u captures, last %lld us max %lld us from the shutter press, %u KB",
+                    stats.frames, stats.captures, (long long) ns2us(stats.lastOffset),
+                    (long long) ns2us(stats.maxOffset), (unsigned int) (mZslRing.getMemorySize() >> 10));
+        mZslRing.clear();
+    }
+
     LOG_FUNCTION_NAME_EXIT;
     return ret;
 }
@@ -793,6 +933,17 @@ status_t V4LCameraAdapter::getFrameSize(size_t &width, size_t &height)
     return ret;
 }
 
+void V4LCameraAdapter::getStreamSize(const android::CameraParameters &params, int &width, int &height)
+{
+    // in ZSL mode the sensor streams full resolution frames for the ring
+    // and the preview is scaled down from them
+    if (mZslMode) {
+        params.getPictureSize(&width, &height);
+    } else {
+        params.getPreviewSize(&width, &height);
+    }
+}
+
 status_t V4LCameraAdapter::getFrameDataSize(size_t &dataFrameSize, size_t bufferCount)
 {
     // We don't support meta data, so simply return
@@ -887,6 +1038,9 @@ V4LCameraAdapter::V4LCameraAdapter(size_t sensor_index)
 
     // Nothing useful to do in the constructor
     mFramesWithEncoder = 0;
+    mZslMode = false;
+    mScaleBuffer = NULL;
+    mScaleBufferSize = 0;
 
     LOG_FUNCTION_NAME_EXIT;
 }
@@ -904,6 +1058,9 @@ V4LCameraAdapter::~V4LCameraAdapter()
         mVideoInfo = NULL;
       }
 
+    free(mScaleBuffer);
+    mScaleBuffer = NULL;
+
     LOG_FUNCTION_NAME_EXIT;
 }
 
@@ -942,60 +1099,14 @@ static void convertYUV422ToNV12Tiler(unsigned char *src, unsigned char *dest, in
 
     LOG_FUNCTION_NAME;
 
-    if (width % 16 ) {
-        for(int i = 0; i < height; i++) {
-            for(int j = 0; j < width; j++) {
-                *dst_y = *bf;
-                dst_y++;
-                bf = bf + 2;
-            }
-            dst_y += (stride - width);
-        }
-
-        bf = src;
-        bf++;  //UV sample
-        for(int i = 0; i < height/2; i++) {
-            for(int j=0; j<width; j++) {
-                *dst_uv = *bf;
-                dst_uv++;
-                bf = bf + 2;
-            }
-            bf = bf + width*2;
-            dst_uv = dst_uv + (stride - width);
+    for(int i = 0; i < height; i++) {
+        // UV is taken from the even rows only
+        yuyvToNV12Row(dst_y, (i & 0x1) ? NULL : dst_uv, bf, width);
+        bf += width * 2;
+        dst_y += stride;
+        if (!(i & 0x1)) {
+            dst_uv += stride;
         }
-    } else {
-        //neon conversion
-        for(int i = 0; i < height; i++) {
-            int n = width;
-            int skip = i & 0x1;       // skip uv elements for the odd rows
-            asm volatile (
-                "   pld [%[src], %[src_stride], lsl #2]                         \n\t"
-                "   cmp %[n], #16                                               \n\t"
-                "   blt 5f                                                      \n\t"
-                "0: @ 16 pixel copy                                             \n\t"
-                "   vld2.8  {q0, q1} , [%[src]]! @ q0 = yyyy.. q1 = uvuv..      \n\t"
-                "                                @ now q0 = y q1 = uv           \n\t"
-                "   vst1.32   {d0,d1}, [%[dst_y]]!                              \n\t"
-                "   cmp    %[skip], #0                                          \n\t"
-                "   bne 1f                                                      \n\t"
-                "   vst1.32  {d2,d3},[%[dst_uv]]!                               \n\t"
-                "1: @ skip odd rows for UV                                      \n\t"
-                "   sub %[n], %[n], #16                                         \n\t"
-                "   cmp %[n], #16                                               \n\t"
-                "   bge 0b                                                      \n\t"
-                "5: @ end                                                       \n\t"
-#ifdef NEEDS_ARM_ERRATA_754319_754320
-                "   vmov s0,s0  @ add noop for errata item                      \n\t"
-#endif
-                : [dst_y] "+r" (dst_y), [dst_uv] "+r" (dst_uv), [src] "+r" (src), [n] "+r" (n)
-                : [src_stride] "r" (width), [skip] "r" (skip)
-                : "cc", "memory", "q0", "q1", "q2", "d0", "d1", "d2", "d3"
-            );
-            dst_y = dst_y + (stride - width);
-            if (skip == 0) {
-                dst_uv = dst_uv + (stride - width);
-            }
-        } //end of for()
     }
 
 #ifdef PPM_PER_FRAME_CONVERSION
@@ -1022,59 +1133,70 @@ static void convertYUV422ToNV12(unsigned char *src, unsigned char *dest, int wid
 
     LOG_FUNCTION_NAME;
 
-    if (width % 16 ) {
-        for(int i = 0; i < height; i++) {
-            for(int j = 0; j < width; j++) {
-                *dst_y = *bf;
-                dst_y++;
-                bf = bf + 2;
-            }
-        }
-
-        bf = src;
-        bf++;  //UV sample
-        for(int i = 0; i < height/2; i++) {
-            for(int j=0; j<width; j++) {
-                *dst_uv = *bf;
-                dst_uv++;
-                bf = bf + 2;
-            }
-            bf = bf + width*2;
-        }
-    } else {
-        //neon conversion
-        for(int i = 0; i < height; i++) {
-            int n = width;
-            int skip = i & 0x1;       // skip uv elements for the odd rows
-            asm volatile (
-                "   pld [%[src], %[src_stride], lsl #2]                         \n\t"
-                "   cmp %[n], #16                                               \n\t"
-                "   blt 5f                                                      \n\t"
-                "0: @ 16 pixel copy                                             \n\t"
-                "   vld2.8  {q0, q1} , [%[src]]! @ q0 = yyyy.. q1 = uvuv..      \n\t"
-                "                                @ now q0 = y q1 = uv           \n\t"
-                "   vst1.32   {d0,d1}, [%[dst_y]]!                              \n\t"
-                "   cmp    %[skip], #0                                          \n\t"
-                "   bne 1f                                                      \n\t"
-                "   vst1.32  {d2,d3},[%[dst_uv]]!                               \n\t"
-                "1: @ skip odd rows for UV                                      \n\t"
-                "   sub %[n], %[n], #16                                         \n\t"
-                "   cmp %[n], #16                                               \n\t"
-                "   bge 0b                                                      \n\t"
-                "5: @ end                                                       \n\t"
-#ifdef NEEDS_ARM_ERRATA_754319_754320
-                "   vmov s0,s0  @ add noop for errata item                      \n\t"
-#endif
-                : [dst_y] "+r" (dst_y), [dst_uv] "+r" (dst_uv), [src] "+r" (src), [n] "+r" (n)
-                : [src_stride] "r" (width), [skip] "r" (skip)
-                : "cc", "memory", "q0", "q1", "q2", "d0", "d1", "d2", "d3"
-            );
+    for(int i = 0; i < height; i++) {
+        // UV is taken from the even rows only
+        yuyvToNV12Row(dst_y, (i & 0x1) ? NULL : dst_uv, bf, width);
+        bf += width * 2;
+        dst_y += width;
+        if (!(i & 0x1)) {
+            dst_uv += width;
         }
     }
 
     LOG_FUNCTION_NAME_EXIT;
 }
 
+static void scaleYUV422ToNV12Tiler(unsigned char *src, int srcWidth, int srcHeight, unsigned char *tmp,
+                                   unsigned char *dest, int width, int height ) {
+    //scales YUV422I to NV12 in the preview buffers (Tiler memory), converted to NV12
+    //at the source size in tmp first and then bilinearly scaled like the video frames.
+    int stride = 4096;
+
+    LOG_FUNCTION_NAME;
+
+    convertYUV422ToNV12(src, tmp, srcWidth, srcHeight);
+
+    structConvImage input = {srcWidth,
+                             srcHeight,
+                             srcWidth,
+                             IC_FORMAT_YCbCr420_lp,
+                             (mmByte *) tmp,
+                             (mmByte *) tmp + srcWidth * srcHeight,
+                             0};
+
+    structConvImage output = {width,
+                              height,
+                              stride,
+                              IC_FORMAT_YCbCr420_lp,
+                              (mmByte *) dest,
+                              (mmByte *) dest + height * stride,
+                              0};
+
+    VT_resizeFrame_Video_opt2_lp(&input, &output, NULL, 0);
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
+static nsecs_t getBufferTimestamp(const struct v4l2_buffer &buf) {
+    //capture time of a dequeued buffer on the SYSTEM_TIME_MONOTONIC clock the
+    //shutter and the ZSL ring use.
+    nsecs_t timestamp = s2ns((nsecs_t) buf.timestamp.tv_sec) + us2ns((nsecs_t) buf.timestamp.tv_usec);
+
+    if (0 == timestamp) {
+        // the driver doesn't stamp its buffers
+        return systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MASK
+    if (V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC == (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK)) {
+        return timestamp;
+    }
+#endif
+
+    // older drivers stamp with gettimeofday()
+    return timestamp - systemTime(SYSTEM_TIME_REALTIME) + systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
 #ifdef SAVE_RAW_FRAMES
 void saveFile(unsigned char* buff, int buff_size) {
     static int      counter = 1;
@@ -1125,9 +1247,16 @@ int V4LCameraAdapter::previewThread()
             ret = BAD_VALUE;
             goto EXIT;
         }
+        const nsecs_t timestamp = getBufferTimestamp(mVideoInfo->buf);
         CameraBuffer *buffer = mPreviewBufs.keyAt(index);
-        CameraFrame *lframe = (CameraFrame *)mFrameQueue.valueFor(buffer);
-        if (!lframe) {
+        FrameTracer::trace(FrameTracer::FILL_BUFFER_DONE, buffer, CameraFrame::PREVIEW_FRAME_SYNC);
+
+        if (mZslMode && mZslRing.isAllocated()) {
+            mZslRing.put(fp, mVideoInfo->framesizeIn, timestamp);
+        }
+
+        updatePreviewStarvation(nQueued - nDequeued);
+        if ((0 == mFramePointersCount) || (0 == buffer->yuv[0])) {
             ret = BAD_VALUE;
             goto EXIT;
         }
@@ -1138,10 +1267,27 @@ int V4LCameraAdapter::previewThread()
             ret = BAD_VALUE;
             goto EXIT;
         }
-        y_uv[0] = (void*) lframe->mYuv[0];
-        //y_uv[1] = (void*) lframe->mYuv[1];
-        //y_uv[1] = (void*) (lframe->mYuv[0] + height*stride);
-        convertYUV422ToNV12Tiler ( (unsigned char*)fp, (unsigned char*)y_uv[0], width, height);
+        y_uv[0] = (void*) buffer->yuv[0];
+        //y_uv[1] = (void*) buffer->yuv[1];
+        //y_uv[1] = (void*) (buffer->yuv[0] + height*stride);
+        if ((width == mVideoInfo->width) && (height == mVideoInfo->height)) {
+            convertYUV422ToNV12Tiler ( (unsigned char*)fp, (unsigned char*)y_uv[0], width, height);
+        } else {
+            size_t scaleSize = mVideoInfo->width * mVideoInfo->height * 3 / 2;
+
+            if (mScaleBufferSize < scaleSize) {
+                free(mScaleBuffer);
+                mScaleBuffer = (unsigned char*) malloc(scaleSize);
+                mScaleBufferSize = (NULL != mScaleBuffer) ? scaleSize : 0;
+            }
+            if (NULL == mScaleBuffer) {
+                CAMHAL_LOGEA("Couldn't allocate the preview scaling buffer");
+                ret = NO_MEMORY;
+                goto EXIT;
+            }
+            scaleYUV422ToNV12Tiler ( (unsigned char*)fp, mVideoInfo->width, mVideoInfo->height,
+                                     mScaleBuffer, (unsigned char*)y_uv[0], width, height);
+        }
         CAMHAL_LOGVB("##...index= %d.;camera buffer= 0x%x; y= 0x%x; UV= 0x%x.",index, buffer, y_uv[0], y_uv[1] );
 
 #ifdef SAVE_RAW_FRAMES
@@ -1157,13 +1303,13 @@ int V4LCameraAdapter::previewThread()
         frame.mLength = width*height*3/2;
         frame.mAlignment = stride;
         frame.mOffset = 0;
-        frame.mTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+        frame.mTimestamp = timestamp;
         frame.mFrameMask = (unsigned int)CameraFrame::PREVIEW_FRAME_SYNC;
 
         if (mRecording)
         {
             frame.mFrameMask |= (unsigned int)CameraFrame::VIDEO_FRAME_SYNC;
-            mFramesWithEncoder++;
+            android_atomic_inc(&mFramesWithEncoder);
         }
 
         ret = setInitFrameRefCount(frame.mBuffer, frame.mFrameMask);
@@ -196,6 +196,9 @@ status_t V4LCameraAdapter::insertCapabilities(CameraProperties::Properties* para
 
     params->set(CameraProperties::SUPPORTED_PICTURE_FORMATS, "jpeg");
 
+    //high-quality-zsl keeps a ring of full resolution frames during preview
+    params->set(CameraProperties::CAP_MODE_VALUES, "high-quality,high-quality-zsl");
+
     if ( NO_ERROR == ret ) {
         ret = insertDefaults(params, caps);
     }
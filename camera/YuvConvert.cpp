@@ -0,0 +1,537 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file YuvConvert.cpp
+*
+* YUV422I row converters used by the jpeg encoder and the USB camera adapter.
+* Every vectorized kernel handles the largest multiple of its block size and
+* leaves the remaining pixels to the C kernel, so results are identical for
+* every width regardless of the kernel set in use.
+*
+*/
+
+#include "YuvConvert.h"
+#include "Common.h"
+
+#include <pthread.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define YUV_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#define YUV_CONVERT_X86
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+#define YUV_TARGET(x) __attribute__((target(x)))
+#endif
+
+namespace Ti {
+namespace Camera {
+
+typedef void (*yuv444_row_func) (uint8_t *dst, const uint8_t *src, int width, bool uyvy);
+typedef void (*nv12_row_func) (uint8_t *dstY, uint8_t *dstUV, const uint8_t *src, int width);
+typedef void (*blend_row_func) (uint8_t *dst, const uint16_t *row0, const uint16_t *row1, int yf, int count);
+typedef void (*accumulate_row_func) (uint32_t *acc, const uint8_t *src, int count);
+typedef void (*prefix_row_func) (uint32_t *acc, int count, int step);
+
+struct YuvKernels {
+    YuvKernelSet set;
+    yuv444_row_func toYuv444;
+    nv12_row_func toNV12;
+    blend_row_func blendRow;
+    accumulate_row_func accumulateRow;
+    prefix_row_func prefixSumRow;
+};
+
+static YuvKernels gYuvKernels;
+static pthread_once_t gYuvKernelsOnce = PTHREAD_ONCE_INIT;
+
+static const char * const gYuvKernelSetNames[] = {
+    "C",
+    "NEON",
+    "SSE2",
+    "SSSE3",
+    "AVX2",
+};
+
+/*--------------------C kernels---------------------------------*/
+
+static void yuv422iToYuv444Row_C(uint8_t *dst, const uint8_t *src, int width, bool uyvy) {
+    const int y = uyvy ? 1 : 0;
+    const int u = uyvy ? 0 : 1;
+    const int v = uyvy ? 2 : 3;
+
+    for ( ; width >= 2; width -= 2) {
+        dst[0] = src[y];
+        dst[1] = src[u];
+        dst[2] = src[v];
+        dst[3] = src[y + 2];
+        dst[4] = src[u];
+        dst[5] = src[v];
+        dst += 6;
+        src += 4;
+    }
+
+    // odd width, last pixel still has a full chroma pair
+    if (width) {
+        dst[0] = src[y];
+        dst[1] = src[u];
+        dst[2] = src[v];
+    }
+}
+
+static void yuyvToNV12Row_C(uint8_t *dstY, uint8_t *dstUV, const uint8_t *src, int width) {
+    for (int x = 0; x < width; x += 2) {
+        dstY[x] = src[0];
+        if (x + 1 < width) {
+            dstY[x + 1] = src[2];
+        }
+        if (dstUV) {
+            dstUV[x] = src[1];
+            dstUV[x + 1] = src[3];
+        }
+        src += 4;
+    }
+}
+
+static void bilinearBlendRow_C(uint8_t * __restrict dst, const uint16_t * __restrict row0,
+                               const uint16_t * __restrict row1, int yf, int count) {
+    // 8 * 255 * 8 fits 16 bits, and blocks of a fixed size let the compiler
+    // vectorize the row without a run time alias check or a cost guess
+    const uint16_t w0 = 8 - yf;
+    const uint16_t w1 = yf;
+    int i = 0;
+
+    for (; i + 64 <= count; i += 64) {
+        for (int j = 0; j < 64; j++) {
+            dst[i + j] = (uint8_t) ((uint16_t) (row0[i + j] * w0 + row1[i + j] * w1) >> 6);
+        }
+    }
+
+    for (; i < count; i++) {
+        dst[i] = (uint8_t) ((uint16_t) (row0[i] * w0 + row1[i] * w1) >> 6);
+    }
+}
+
+static void boxAccumulateRow_C(uint32_t *acc, const uint8_t *src, int count) {
+    for (int i = 0; i < count; i++) {
+        acc[i] += src[i];
+    }
+}
+
+// start is where a vector kernel stopped, the sums before it are done
+static void prefixSumTail_C(uint32_t *acc, int start, int count, int step) {
+    for (int i = (start > step) ? start : step; i < count; i++) {
+        acc[i] += acc[i - step];
+    }
+}
+
+static void boxPrefixSumRow_C(uint32_t *acc, int count, int step) {
+    prefixSumTail_C(acc, 0, count, step);
+}
+
+/*--------------------NEON kernels---------------------------------*/
+
+#ifdef YUV_CONVERT_NEON
+
+static void yuv422iToYuv444Row_NEON(uint8_t *dst, const uint8_t *src, int width, bool uyvy) {
+    const int blocks = width / 16;
+
+    for (int i = 0; i < blocks; i++) {
+        uint8x16x2_t in = vld2q_u8(src);
+        uint8x16_t y = uyvy ? in.val[1] : in.val[0];
+        uint8x16_t uv = uyvy ? in.val[0] : in.val[1];
+        uint8x8x2_t chroma = vuzp_u8(vget_low_u8(uv), vget_high_u8(uv));
+        uint8x8x2_t u = vzip_u8(chroma.val[0], chroma.val[0]);
+        uint8x8x2_t v = vzip_u8(chroma.val[1], chroma.val[1]);
+        uint8x16x3_t out;
+
+        out.val[0] = y;
+        out.val[1] = vcombine_u8(u.val[0], u.val[1]);
+        out.val[2] = vcombine_u8(v.val[0], v.val[1]);
+        vst3q_u8(dst, out);
+
+        src += 32;
+        dst += 48;
+    }
+
+    yuv422iToYuv444Row_C(dst, src, width - blocks * 16, uyvy);
+}
+
+static void yuyvToNV12Row_NEON(uint8_t *dstY, uint8_t *dstUV, const uint8_t *src, int width) {
+    const int blocks = width / 16;
+
+    for (int i = 0; i < blocks; i++) {
+        uint8x16x2_t in = vld2q_u8(src);
+
+        vst1q_u8(dstY, in.val[0]);
+        if (dstUV) {
+            vst1q_u8(dstUV, in.val[1]);
+            dstUV += 16;
+        }
+
+        src += 32;
+        dstY += 16;
+    }
+
+    yuyvToNV12Row_C(dstY, dstUV, src, width - blocks * 16);
+}
+
+static void bilinearBlendRow_NEON(uint8_t *dst, const uint16_t *row0, const uint16_t *row1, int yf, int count) {
+    const int blocks = count / 16;
+    const uint16_t w0 = 8 - yf;
+    const uint16_t w1 = yf;
+
+    // 8 * 255 * 8 still fits 16 bits, so the whole blend stays in u16 lanes
+    for (int i = 0; i < blocks; i++) {
+        uint16x8_t lo = vmlaq_n_u16(vmulq_n_u16(vld1q_u16(row0), w0), vld1q_u16(row1), w1);
+        uint16x8_t hi = vmlaq_n_u16(vmulq_n_u16(vld1q_u16(row0 + 8), w0), vld1q_u16(row1 + 8), w1);
+
+        vst1q_u8(dst, vcombine_u8(vshrn_n_u16(lo, 6), vshrn_n_u16(hi, 6)));
+
+        row0 += 16;
+        row1 += 16;
+        dst += 16;
+    }
+
+    bilinearBlendRow_C(dst, row0, row1, yf, count - blocks * 16);
+}
+
+static void boxAccumulateRow_NEON(uint32_t *acc, const uint8_t *src, int count) {
+    const int blocks = count / 16;
+
+    for (int i = 0; i < blocks; i++) {
+        uint8x16_t in = vld1q_u8(src);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(in));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(in));
+
+        vst1q_u32(acc,      vaddw_u16(vld1q_u32(acc),      vget_low_u16(lo)));
+        vst1q_u32(acc + 4,  vaddw_u16(vld1q_u32(acc + 4),  vget_high_u16(lo)));
+        vst1q_u32(acc + 8,  vaddw_u16(vld1q_u32(acc + 8),  vget_low_u16(hi)));
+        vst1q_u32(acc + 12, vaddw_u16(vld1q_u32(acc + 12), vget_high_u16(hi)));
+
+        src += 16;
+        acc += 16;
+    }
+
+    boxAccumulateRow_C(acc, src, count - blocks * 16);
+}
+
+// the sums are built inside each vector by adding it shifted up by one and
+// two lanes (two lanes only for interleaved CbCr), then the last sum of
+// the previous vector is carried in
+static void boxPrefixSumRow_NEON(uint32_t *acc, int count, int step) {
+    const uint32x4_t zero = vdupq_n_u32(0);
+    uint32x4_t carry = zero;
+    int i = 0;
+
+    for ( ; i + 4 <= count; i += 4) {
+        uint32x4_t v = vld1q_u32(acc + i);
+
+        if (1 == step) {
+            v = vaddq_u32(v, vextq_u32(zero, v, 3));
+        }
+        v = vaddq_u32(v, vextq_u32(zero, v, 2));
+        v = vaddq_u32(v, carry);
+        vst1q_u32(acc + i, v);
+
+        carry = (1 == step) ? vdupq_n_u32(vgetq_lane_u32(v, 3)) :
+                              vcombine_u32(vget_high_u32(v), vget_high_u32(v));
+    }
+
+    prefixSumTail_C(acc, i, count, step);
+}
+
+#endif
+
+/*--------------------x86 kernels---------------------------------*/
+
+#ifdef YUV_CONVERT_X86
+
+// byte shuffles expanding 8 yuv422i pixels into 24 bytes of yuv444
+static const int8_t kYuyvTo444Lo[16] = { 0, 1, 3, 2, 1, 3, 4, 5, 7, 6, 5, 7, 8, 9, 11, 10 };
+static const int8_t kYuyvTo444Hi[16] = { 9, 11, 12, 13, 15, 14, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1 };
+static const int8_t kUyvyTo444Lo[16] = { 1, 0, 2, 3, 0, 2, 5, 4, 6, 7, 4, 6, 9, 8, 10, 11 };
+static const int8_t kUyvyTo444Hi[16] = { 8, 10, 13, 12, 14, 15, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1 };
+
+YUV_TARGET("ssse3")
+static void yuv422iToYuv444Row_SSSE3(uint8_t *dst, const uint8_t *src, int width, bool uyvy) {
+    const int blocks = width / 8;
+    const __m128i lo = _mm_loadu_si128((const __m128i *) (uyvy ? kUyvyTo444Lo : kYuyvTo444Lo));
+    const __m128i hi = _mm_loadu_si128((const __m128i *) (uyvy ? kUyvyTo444Hi : kYuyvTo444Hi));
+
+    for (int i = 0; i < blocks; i++) {
+        __m128i in = _mm_loadu_si128((const __m128i *) src);
+
+        _mm_storeu_si128((__m128i *) dst, _mm_shuffle_epi8(in, lo));
+        _mm_storel_epi64((__m128i *) (dst + 16), _mm_shuffle_epi8(in, hi));
+
+        src += 16;
+        dst += 24;
+    }
+
+    yuv422iToYuv444Row_C(dst, src, width - blocks * 8, uyvy);
+}
+
+YUV_TARGET("avx2")
+static void yuv422iToYuv444Row_AVX2(uint8_t *dst, const uint8_t *src, int width, bool uyvy) {
+    const int blocks = width / 16;
+    const __m128i lo128 = _mm_loadu_si128((const __m128i *) (uyvy ? kUyvyTo444Lo : kYuyvTo444Lo));
+    const __m128i hi128 = _mm_loadu_si128((const __m128i *) (uyvy ? kUyvyTo444Hi : kYuyvTo444Hi));
+    const __m256i lo = _mm256_broadcastsi128_si256(lo128);
+    const __m256i hi = _mm256_broadcastsi128_si256(hi128);
+
+    for (int i = 0; i < blocks; i++) {
+        // vpshufb stays within 128-bit lanes, each lane is one block of 8 pixels
+        __m256i in = _mm256_loadu_si256((const __m256i *) src);
+        __m256i outLo = _mm256_shuffle_epi8(in, lo);
+        __m256i outHi = _mm256_shuffle_epi8(in, hi);
+
+        _mm_storeu_si128((__m128i *) dst, _mm256_castsi256_si128(outLo));
+        _mm_storel_epi64((__m128i *) (dst + 16), _mm256_castsi256_si128(outHi));
+        _mm_storeu_si128((__m128i *) (dst + 24), _mm256_extracti128_si256(outLo, 1));
+        _mm_storel_epi64((__m128i *) (dst + 40), _mm256_extracti128_si256(outHi, 1));
+
+        src += 32;
+        dst += 48;
+    }
+
+    yuv422iToYuv444Row_C(dst, src, width - blocks * 16, uyvy);
+}
+
+YUV_TARGET("sse2")
+static void yuyvToNV12Row_SSE2(uint8_t *dstY, uint8_t *dstUV, const uint8_t *src, int width) {
+    const int blocks = width / 16;
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+
+    for (int i = 0; i < blocks; i++) {
+        __m128i a = _mm_loadu_si128((const __m128i *) src);
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+
+        _mm_storeu_si128((__m128i *) dstY,
+                         _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+        if (dstUV) {
+            _mm_storeu_si128((__m128i *) dstUV,
+                             _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+            dstUV += 16;
+        }
+
+        src += 32;
+        dstY += 16;
+    }
+
+    yuyvToNV12Row_C(dstY, dstUV, src, width - blocks * 16);
+}
+
+YUV_TARGET("avx2")
+static void yuyvToNV12Row_AVX2(uint8_t *dstY, uint8_t *dstUV, const uint8_t *src, int width) {
+    const int blocks = width / 32;
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+
+    for (int i = 0; i < blocks; i++) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) src);
+        __m256i b = _mm256_loadu_si256((const __m256i *) (src + 32));
+        // packus interleaves the 64-bit halves of a and b, put them back in order
+        __m256i y = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+
+        _mm256_storeu_si256((__m256i *) dstY, _mm256_permute4x64_epi64(y, 0xD8));
+        if (dstUV) {
+            __m256i uv = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+            _mm256_storeu_si256((__m256i *) dstUV, _mm256_permute4x64_epi64(uv, 0xD8));
+            dstUV += 32;
+        }
+
+        src += 64;
+        dstY += 32;
+    }
+
+    yuyvToNV12Row_SSE2(dstY, dstUV, src, width - blocks * 32);
+}
+
+YUV_TARGET("sse2")
+static void boxAccumulateRow_SSE2(uint32_t *acc, const uint8_t *src, int count) {
+    const int blocks = count / 16;
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int i = 0; i < blocks; i++) {
+        __m128i in = _mm_loadu_si128((const __m128i *) src);
+        __m128i lo = _mm_unpacklo_epi8(in, zero);
+        __m128i hi = _mm_unpackhi_epi8(in, zero);
+        __m128i *out = (__m128i *) acc;
+
+        _mm_storeu_si128(out,     _mm_add_epi32(_mm_loadu_si128(out),     _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(out + 2, _mm_add_epi32(_mm_loadu_si128(out + 2), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(out + 3, _mm_add_epi32(_mm_loadu_si128(out + 3), _mm_unpackhi_epi16(hi, zero)));
+
+        src += 16;
+        acc += 16;
+    }
+
+    boxAccumulateRow_C(acc, src, count - blocks * 16);
+}
+
+YUV_TARGET("avx2")
+static void boxAccumulateRow_AVX2(uint32_t *acc, const uint8_t *src, int count) {
+    const int blocks = count / 32;
+
+    for (int i = 0; i < blocks; i++) {
+        __m256i *out = (__m256i *) acc;
+
+        for (int j = 0; j < 4; j++) {
+            __m256i in = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (src + j * 8)));
+            _mm256_storeu_si256(out + j, _mm256_add_epi32(_mm256_loadu_si256(out + j), in));
+        }
+
+        src += 32;
+        acc += 32;
+    }
+
+    boxAccumulateRow_SSE2(acc, src, count - blocks * 32);
+}
+
+// same scheme as the NEON kernel, AVX2 has no shift across its two halves
+// so it shares this one
+YUV_TARGET("sse2")
+static void boxPrefixSumRow_SSE2(uint32_t *acc, int count, int step) {
+    __m128i carry = _mm_setzero_si128();
+    int i = 0;
+
+    for ( ; i + 4 <= count; i += 4) {
+        __m128i *out = (__m128i *) (acc + i);
+        __m128i v = _mm_loadu_si128(out);
+
+        if (1 == step) {
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        }
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, carry);
+        _mm_storeu_si128(out, v);
+
+        carry = (1 == step) ? _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)) :
+                              _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 2, 3, 2));
+    }
+
+    prefixSumTail_C(acc, i, count, step);
+}
+
+#endif
+
+/*--------------------Dispatch---------------------------------*/
+
+static void selectYuvKernels() {
+    gYuvKernels.set = YUV_KERNELS_C;
+    gYuvKernels.toYuv444 = yuv422iToYuv444Row_C;
+    gYuvKernels.toNV12 = yuyvToNV12Row_C;
+    gYuvKernels.blendRow = bilinearBlendRow_C;
+    gYuvKernels.accumulateRow = boxAccumulateRow_C;
+    gYuvKernels.prefixSumRow = boxPrefixSumRow_C;
+
+#if defined(YUV_CONVERT_NEON)
+    // NEON is a build time property of the armv7-a-neon targets we run on
+    gYuvKernels.set = YUV_KERNELS_NEON;
+    gYuvKernels.toYuv444 = yuv422iToYuv444Row_NEON;
+    gYuvKernels.toNV12 = yuyvToNV12Row_NEON;
+    gYuvKernels.blendRow = bilinearBlendRow_NEON;
+    gYuvKernels.accumulateRow = boxAccumulateRow_NEON;
+    gYuvKernels.prefixSumRow = boxPrefixSumRow_NEON;
+#elif defined(YUV_CONVERT_X86)
+    // bilinearBlendRow keeps the C kernel, yuv_convert_test measured it
+    // faster than SSE2 and AVX2 intrinsics
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2")) {
+        gYuvKernels.set = YUV_KERNELS_SSE2;
+        gYuvKernels.toNV12 = yuyvToNV12Row_SSE2;
+        gYuvKernels.accumulateRow = boxAccumulateRow_SSE2;
+        gYuvKernels.prefixSumRow = boxPrefixSumRow_SSE2;
+    }
+
+    if (__builtin_cpu_supports("ssse3")) {
+        gYuvKernels.set = YUV_KERNELS_SSSE3;
+        gYuvKernels.toYuv444 = yuv422iToYuv444Row_SSSE3;
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        gYuvKernels.set = YUV_KERNELS_AVX2;
+        gYuvKernels.toYuv444 = yuv422iToYuv444Row_AVX2;
+        gYuvKernels.toNV12 = yuyvToNV12Row_AVX2;
+        gYuvKernels.accumulateRow = boxAccumulateRow_AVX2;
+    }
+#endif
+
+    CAMHAL_LOGDB("YUV422I converters use %s kernels", gYuvKernelSetNames[gYuvKernels.set]);
+}
+
+static inline const YuvKernels & yuvKernels() {
+    pthread_once(&gYuvKernelsOnce, selectYuvKernels);
+    return gYuvKernels;
+}
+
+void yuv422iToYuv444Row(uint8_t *dst, const uint8_t *src, int width, bool uyvy) {
+    if (!dst || !src || (width <= 0)) {
+        return;
+    }
+
+    yuvKernels().toYuv444(dst, src, width, uyvy);
+}
+
+void yuyvToNV12Row(uint8_t *dstY, uint8_t *dstUV, const uint8_t *src, int width) {
+    if (!dstY || !src || (width <= 0)) {
+        return;
+    }
+
+    yuvKernels().toNV12(dstY, dstUV, src, width);
+}
+
+void bilinearBlendRow(uint8_t *dst, const uint16_t *row0, const uint16_t *row1, int yf, int count) {
+    if (!dst || !row0 || !row1 || (count <= 0)) {
+        return;
+    }
+
+    yuvKernels().blendRow(dst, row0, row1, yf, count);
+}
+
+void boxAccumulateRow(uint32_t *acc, const uint8_t *src, int count) {
+    if (!acc || !src || (count <= 0)) {
+        return;
+    }
+
+    yuvKernels().accumulateRow(acc, src, count);
+}
+
+void boxPrefixSumRow(uint32_t *acc, int count, int step) {
+    if (!acc || (count <= 0) || ((1 != step) && (2 != step))) {
+        return;
+    }
+
+    yuvKernels().prefixSumRow(acc, count, step);
+}
+
+YuvKernelSet getYuvKernelSet() {
+    return yuvKernels().set;
+}
+
+const char *getYuvKernelSetName() {
+    return gYuvKernelSetNames[yuvKernels().set];
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CameraHal.h"
+#include "ZslRing.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace Ti {
+namespace Camera {
+
+ZslRing::ZslRing()
+    : mFrameSize(0),
+      mNext(0) {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+ZslRing::~ZslRing() {
+    clear();
+}
+
+status_t ZslRing::allocate(size_t count, size_t frameSize) {
+    clear();
+
+    android::AutoMutex lock(mLock);
+
+    for (size_t i = 0; i < count; i++) {
+        Slot slot;
+
+        slot.mData = (unsigned char *) malloc(frameSize);
+        if (NULL == slot.mData) {
+            CAMHAL_LOGEB("Couldn't allocate ZSL slot %d of %d bytes", (int) i, (int) frameSize);
+            break;
+        }
+        slot.mSize = 0;
+        slot.mTimestamp = 0;
+        slot.mState = SLOT_EMPTY;
+        mSlots.push_back(slot);
+    }
+
+    // a shorter ring still works, it only reaches back less far
+    if (mSlots.isEmpty()) {
+        return NO_MEMORY;
+    }
+
+    mFrameSize = frameSize;
+    mNext = 0;
+    memset(&mStats, 0, sizeof(mStats));
+
+    return NO_ERROR;
+}
+
+void ZslRing::clear() {
+    android::AutoMutex lock(mLock);
+
+    for (size_t i = 0; i < mSlots.size(); i++) {
+        free(mSlots[i].mData);
+    }
+    mSlots.clear();
+    mFrameSize = 0;
+    mNext = 0;
+}
+
+status_t ZslRing::put(const void *data, size_t size, nsecs_t timestamp) {
+    Slot *slot = NULL;
+    size_t count;
+
+    if (size > mFrameSize) {
+        return BAD_VALUE;
+    }
+
+    {
+        android::AutoMutex lock(mLock);
+
+        count = mSlots.size();
+        for (size_t i = 0; i < count; i++) {
+            size_t index = (mNext + i) % count;
+
+            if (SLOT_HELD != mSlots[index].mState) {
+                slot = &mSlots.editItemAt(index);
+                mNext = (index + 1) % count;
+                break;
+            }
+        }
+
+        if (NULL == slot) {
+            return NOT_ENOUGH_DATA;
+        }
+
+        slot->mState = SLOT_WRITING;
+    }
+
+    memcpy(slot->mData, data, size);
+
+    {
+        android::AutoMutex lock(mLock);
+
+        slot->mSize = size;
+        slot->mTimestamp = timestamp;
+        slot->mState = SLOT_FILLED;
+        mStats.frames++;
+        mFilled.broadcast();
+    }
+
+    return NO_ERROR;
+}
+
+status_t ZslRing::acquire(nsecs_t shutter, nsecs_t timeout, Frame &frame) {
+    android::AutoMutex lock(mLock);
+    const nsecs_t deadline = systemTime() + timeout;
+    ssize_t best = -1;
+    nsecs_t bestOffset = 0;
+
+    for (;;) {
+        for (size_t i = 0; i < mSlots.size(); i++) {
+            const Slot &slot = mSlots[i];
+            nsecs_t offset;
+
+            if (SLOT_FILLED != slot.mState) {
+                continue;
+            }
+
+            offset = (slot.mTimestamp > shutter) ? slot.mTimestamp - shutter : shutter - slot.mTimestamp;
+            if ((0 > best) || (offset < bestOffset)) {
+                best = i;
+                bestOffset = offset;
+            }
+        }
+
+        if (0 <= best) {
+            break;
+        }
+
+        nsecs_t now = systemTime();
+        if (now >= deadline) {
+            return NOT_ENOUGH_DATA;
+        }
+        mFilled.waitRelative(mLock, deadline - now);
+    }
+
+    Slot &slot = mSlots.editItemAt(best);
+    slot.mState = SLOT_HELD;
+
+    frame.slot = best;
+    frame.data = slot.mData;
+    frame.size = slot.mSize;
+    frame.timestamp = slot.mTimestamp;
+
+    mStats.captures++;
+    mStats.lastOffset = bestOffset;
+    if (bestOffset > mStats.maxOffset) {
+        mStats.maxOffset = bestOffset;
+    }
+
+    return NO_ERROR;
+}
+
+void ZslRing::release(const Frame &frame) {
+    android::AutoMutex lock(mLock);
+
+    if ((0 <= frame.slot) && ((size_t) frame.slot < mSlots.size())) {
+        mSlots.editItemAt(frame.slot).mState = SLOT_FILLED;
+    }
+}
+
+void ZslRing::getStats(Stats &stats) {
+    android::AutoMutex lock(mLock);
+
+    stats = mStats;
+}
+
+} // namespace Camera
+} // namespace Ti
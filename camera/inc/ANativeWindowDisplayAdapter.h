@@ -67,13 +67,6 @@ public:
     virtual int disableDisplay(bool cancel_buffer = true);
     virtual status_t pauseDisplay(bool pause);
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    //Used for shot to snapshot measurement
-    virtual status_t setSnapshotTimeRef(struct timeval *refTime = NULL);
-
-#endif
-
     virtual bool supportsExternalBuffering();
 
     //Implementation of inherited interfaces
@@ -173,16 +166,11 @@ private:
 
     const char *mPixelFormat;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-    //Used for calculating standby to first shot
-    struct timeval mStandbyToShot;
+    //First frame after enableDisplay() goes to the event log
     bool mMeasureStandby;
-    //Used for shot to snapshot/shot calculation
-    struct timeval mStartCapture;
+    //Snapshot shown, the next preview frame goes to the event log
     bool mShotToShot;
 
-#endif
-
 };
 
 } // namespace Camera
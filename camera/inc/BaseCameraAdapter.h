@@ -20,6 +20,7 @@
 #define BASE_CAMERA_ADAPTER_H
 
 #include "CameraHal.h"
+#include "FrameDeliveryQueue.h"
 
 namespace Ti {
 namespace Camera {
@@ -53,10 +54,15 @@ public:
     virtual void returnFrame(CameraBuffer * frameBuf, CameraFrame::FrameType frameType);
     virtual void addFramePointers(CameraBuffer *frameBuf, void *y_uv);
     virtual void removeFramePointers();
+    virtual status_t enableAsyncDelivery(void *cookie, size_t depth, DeliveryPolicy policy);
+    virtual void disableAsyncDelivery(void *cookie);
+    virtual void setMetrics(const android::sp<CameraMetrics> &metrics);
+    virtual bool takesCarvedBuffers(CameraMode mode);
 
     //APIs to configure Camera adapter and get the current parameter set
     virtual status_t setParameters(const android::CameraParameters& params) = 0;
     virtual void getParameters(android::CameraParameters& params)  = 0;
+    virtual bool takeParametersChanged();
 
     //API to send a command to the camera
     virtual status_t sendCommand(CameraCommands operation, int value1 = 0, int value2 = 0, int value3 = 0, int value4 = 0 );
@@ -177,10 +183,27 @@ protected:
     void setFrameRefCount(CameraBuffer* frameBuf, CameraFrame::FrameType frameType, int refCount);
     int getFrameRefCount(CameraBuffer* frameBuf, CameraFrame::FrameType frameType);
     int setInitFrameRefCount(CameraBuffer* buf, unsigned int mask);
+    //Drops all references of a buffer when it gets registered
+    void resetFrameRefCounts(CameraBuffer* frameBuf, CameraFrame::FrameType frameType, int refCount);
+    //Unregisters buffers, frames returned afterwards are ignored
+    void clearFrameRefCounts(android::KeyedVector<CameraBuffer *, int> &buffers,
+                             CameraFrame::FrameType frameType);
     static const char* getLUTvalue_translateHAL(int Value, LUTtypeHAL LUT);
 
+    //Called for every preview frame with the buffers still queued to the camera
+    void updatePreviewStarvation(int queued);
+
+    //Flags that getParameters() reports something new
+    void markParametersChanged();
+
 // private member functions
 private:
+    static int getRefCountShift(CameraFrame::FrameType frameType);
+
+    android::sp<FrameDeliveryQueue> getDeliveryQueue(int cookie);
+
+    void resetPreviewStarvation();
+
     status_t __sendFrameToSubscribers(CameraFrame* frame,
                                       android::KeyedVector<int, frame_callback> *subscribers,
                                       CameraFrame::FrameType frameType);
@@ -209,14 +232,9 @@ protected:
         ERROR
     };
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    struct timeval mStartFocus;
-    struct timeval mStartCapture;
-
-#endif
-
-    mutable android::Mutex mReturnFrameLock;
+    //Each frame type has a field of REF_COUNT_BITS in CameraBuffer::refCounts
+    static const int REF_COUNT_BITS = 5;
+    static const int32_t REF_COUNT_MASK = ( 1 << REF_COUNT_BITS ) - 1;
 
     //Lock protecting the Adapter state
     mutable android::Mutex mLock;
@@ -284,14 +302,28 @@ protected:
     bool mRecording;
 
     uint32_t mFramesWithDucati;
-    uint32_t mFramesWithDisplay;
-    uint32_t mFramesWithEncoder;
+    volatile int32_t mFramesWithDisplay;
+    volatile int32_t mFramesWithEncoder;
 
 #ifdef CAMERAHAL_DEBUG
     android::KeyedVector<int, bool> mBuffersWithDucati;
 #endif
 
-    android::KeyedVector<void *, CameraFrame *> mFrameQueue;
+    int mFramePointersCount;
+
+    volatile int32_t mParametersChanged;
+
+    //Preview buffer starvation tracking
+    android::Mutex mStarvationLock;
+    StarvationStats mStarvationStats;
+    uint32_t mStarvedRun;
+
+    // subscribers which get their frames from a delivery thread
+    android::Mutex mDeliveryQueueLock;
+    android::KeyedVector<int, android::sp<FrameDeliveryQueue> > mDeliveryQueues;
+
+    // set once before the first frame, NULL leaves the metrics out
+    android::sp<CameraMetrics> mMetrics;
 };
 
 } // namespace Camera
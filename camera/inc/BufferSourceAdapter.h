@@ -135,10 +135,6 @@ public:
     virtual int enableDisplay(int width, int height, struct timeval *refTime = NULL);
     virtual int disableDisplay(bool cancel_buffer = true);
     virtual status_t pauseDisplay(bool pause);
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-    // Not implemented in this class
-    virtual status_t setSnapshotTimeRef(struct timeval *refTime = NULL) { return NO_ERROR; }
-#endif
     virtual bool supportsExternalBuffering();
     virtual CameraBuffer * allocateBufferList(int width, int height, const char* format, int &bytes, int numBufs);
     virtual CameraBuffer *getBufferList(int *numBufs);
@@ -54,7 +54,12 @@
 #include "MessageQueue.h"
 #include "Semaphore.h"
 #include "CameraProperties.h"
+#include "CapabilityIndex.h"
+#include "ParameterDiff.h"
 #include "SensorListener.h"
+#include "FrameTracer.h"
+#include "CameraMetrics.h"
+#include "EventLog.h"
 
 //temporarily define format here
 #define HAL_PIXEL_FORMAT_TI_NV12 0x100
@@ -88,9 +93,6 @@
                              GRALLOC_USAGE_SW_READ_RARELY | \
                              GRALLOC_USAGE_SW_WRITE_NEVER
 
-//Enables Absolute PPM measurements in logcat
-#define PPM_INSTRUMENTATION_ABS 1
-
 #define LOCK_BUFFER_TRIES 5
 #define HAL_PIXEL_FORMAT_NV12 0x100
 
@@ -100,6 +102,10 @@
 
 #define CAMHAL_SIZE_OF_ARRAY(x) static_cast<int>(sizeof(x)/sizeof(x[0]))
 
+// sendCommand() id clearing the metrics printed by dump(), kept clear of
+// the framework's CAMERA_CMD_* values
+#define CAMERA_CMD_RESET_METRICS 0x1000
+
 namespace Ti {
 namespace Camera {
 
@@ -117,6 +123,10 @@ class CameraHal;
 class CameraFrame;
 class CameraHalEvent;
 class DisplayFrame;
+class Encoder_libjpeg;
+class EncoderPool;
+class NV12ResizePool;
+class FrameSlotRing;
 
 class FpsRange {
 public:
@@ -313,6 +323,10 @@ typedef struct _CameraBuffer {
     int ion_fd;
     int fd;
     size_t size;
+    /* Position of the buffer in the allocation behind fd, non-zero only
+     * for buffers carved out of one shared allocation. opaque and mapped
+     * already point at the buffer itself. */
+    size_t offset;
     int index;
 
     /* These describe the camera buffer */
@@ -320,9 +334,19 @@ typedef struct _CameraBuffer {
     int stride;
     int height;
     const char *format;
+
+    /* Y and UV plane addresses, set when the buffer is registered with
+     * the frame provider through addFramePointers(), 0 otherwise */
+    unsigned int yuv[2];
+
+    /* Reference counts of the frame types the buffer is sent as, packed
+     * so they can be updated and checked together. Maintained by
+     * BaseCameraAdapter. */
+    volatile int32_t refCounts;
 } CameraBuffer;
 
 void * camera_buffer_get_omx_ptr (CameraBuffer *buffer);
+int camera_buffer_get_fd (CameraBuffer *buffer);
 
 class CameraFrame
 {
@@ -523,10 +547,22 @@ public:
 class FrameNotifier : public MessageNotifier
 {
 public:
+    ///What to do with a frame for a subscriber whose delivery queue is full
+    enum DeliveryPolicy
+        {
+        DELIVERY_DROP_OLDEST, ///Return the oldest queued preview frame
+        DELIVERY_DROP_NEWEST, ///Return the new preview frame
+        DELIVERY_BLOCK        ///Wait for room
+        };
+
     virtual void returnFrame(CameraBuffer* frameBuf, CameraFrame::FrameType frameType) = 0;
     virtual void addFramePointers(CameraBuffer *frameBuf, void *buf) = 0;
     virtual void removeFramePointers() = 0;
 
+    ///Calls the frame callbacks of a subscriber from its own thread instead of the notifier's
+    virtual status_t enableAsyncDelivery(void *cookie, size_t depth, DeliveryPolicy policy) = 0;
+    virtual void disableAsyncDelivery(void *cookie) = 0;
+
     virtual ~FrameNotifier() {};
 };
 
@@ -547,6 +583,8 @@ public:
     int returnFrame(CameraBuffer *frameBuf, CameraFrame::FrameType frameType);
     void addFramePointers(CameraBuffer *frameBuf, void *buf);
     void removeFramePointers();
+    int enableAsyncDelivery(size_t depth, FrameNotifier::DeliveryPolicy policy);
+    void disableAsyncDelivery();
 };
 
 /** Wrapper class around MessageNotifier, which is used by display and notification classes for interacting with
@@ -600,6 +638,10 @@ public:
     ///Constants
     static const int NOTIFIER_TIMEOUT;
     static const int32_t MAX_BUFFERS = 8;
+    static const int ENCODER_POOL_THREADS = 2;
+    static const int ENCODER_POOL_JOBS = 16;
+    static const int RESIZE_POOL_THREADS = 2;
+    static const int FRAME_RING_SLOTS = 32;
 
     enum NotifierCommands
         {
@@ -617,6 +659,7 @@ public:
 
 public:
 
+    AppCallbackNotifier();
     ~AppCallbackNotifier();
 
     ///Initialzes the callback notifier, creates any resources required
@@ -630,6 +673,7 @@ public:
 
     void setEventProvider(int32_t eventMask, MessageNotifier * eventProvider);
     void setFrameProvider(FrameNotifier *frameProvider);
+    void setMetrics(const android::sp<CameraMetrics> &metrics);
 
     //All sub-components of Camera HAL call this whenever any error happens
     virtual void errorNotify(int error);
@@ -690,6 +734,7 @@ public:
         NOTIFIER_START,
         NOTIFIER_STOP,
         NOTIFIER_EXIT,
+        NOTIFIER_RETURN_LENT_FRAMES,
         };
     public:
         NotificationThread(AppCallbackNotifier* nh)
@@ -712,6 +757,10 @@ private:
     status_t dummyRaw();
     void copyAndSendPictureFrame(CameraFrame* frame, int32_t msgType);
     void copyAndSendPreviewFrame(CameraFrame* frame, int32_t msgType);
+    bool sendZeroCopyPreviewFrame(CameraFrame* frame, int32_t msgType);
+    void setupZeroCopyPreview(CameraBuffer *buffers, size_t length, size_t count);
+    void releaseZeroCopyPreview();
+    void returnLentPreviewFrames();
     size_t calculateBufferSize(size_t width, size_t height, const char *pixelFormat);
     const char* getContstantForPixelFormat(const char *pixelFormat);
 
@@ -741,13 +790,17 @@ private:
     EventProvider *mEventProvider;
     FrameProvider *mFrameProvider;
     Utils::MessageQueue mEventQ;
-    Utils::MessageQueue mFrameQ;
+    android::sp<FrameSlotRing> mFrameRing;
+    android::sp<CameraMetrics> mMetrics;
     NotifierState mNotifierState;
 
     bool mPreviewing;
     camera_memory_t* mPreviewMemory;
     CameraBuffer mPreviewBuffers[MAX_BUFFERS];
     int mPreviewBufCount;
+    //Slot of the latest copied preview frame, the thumbnail source, -1 while
+    //there is none or a newer frame went out without a copy
+    int mLastCopiedPreview;
     int mPreviewWidth;
     int mPreviewHeight;
     int mPreviewStride;
@@ -755,6 +808,18 @@ private:
     android::KeyedVector<unsigned int, android::sp<android::MemoryHeapBase> > mSharedPreviewHeaps;
     android::KeyedVector<unsigned int, android::sp<android::MemoryBase> > mSharedPreviewBuffers;
 
+    //Zero copy preview callbacks: every preview buffer is mapped once into a
+    //camera_memory_t, frames handed to the client are kept from the camera
+    //until mZeroCopyHold newer frames were handed out or callbacks stop
+    struct LentFrame {
+        CameraBuffer *mBuffer;
+        int mFrameType;
+    };
+    bool mZeroCopyPreview;
+    unsigned int mZeroCopyHold;
+    android::KeyedVector<CameraBuffer *, camera_memory_t *> mZeroCopyMemory;
+    android::Vector<LentFrame> mLentFrames;
+
     //Burst mode active
     bool mBurst;
     mutable android::Mutex mRecordingLock;
@@ -769,6 +834,16 @@ private:
     int mVideoWidth;
     int mVideoHeight;
 
+    //Jpeg encoding jobs in flight, keyed by the mapped source buffer
+    mutable android::Mutex mEncoderLock;
+    android::KeyedVector<void*, android::sp<Encoder_libjpeg> > mEncoderQueue;
+    android::sp<EncoderPool> mEncoderPool;
+
+    //Tiled NV12 resize of recording frames into the video buffers
+    android::sp<NV12ResizePool> mResizePool;
+    int mResizeDop;
+    nsecs_t mResizeDeadline;
+
 };
 
 
@@ -778,6 +853,19 @@ private:
 class MemoryManager : public BufferProvider, public virtual android::RefBase
 {
 public:
+    struct PoolStats {
+        unsigned int hits;
+        unsigned int misses;
+        // buffers unmapped to stay under the cap or after the idle timeout
+        unsigned int evictions;
+        unsigned int pooledBuffers;
+        size_t pooledBytes;
+        // time spent in allocateBufferList() and allocateCarvedBufferList()
+        nsecs_t allocTime;
+        // lists served by a single carved allocation
+        unsigned int carvedLists;
+    };
+
     MemoryManager();
     ~MemoryManager();
 
@@ -790,9 +878,72 @@ public:
     virtual int getFd() ;
     virtual int freeBufferList(CameraBuffer * buflist);
 
+    // Like allocateBufferList(), but all buffers share one ION allocation
+    // and mapping, each starting on a page at CameraBuffer::offset. Only for
+    // consumers which don't need a separate fd per buffer, falls back to
+    // allocateBufferList() when carving is disabled or fails.
+    CameraBuffer * allocateCarvedBufferList(int &bytes, int numBufs);
+
+    void getPoolStats(PoolStats &stats);
+    // Unmaps every pooled buffer
+    void flushPool();
+
 private:
+    // A released ION buffer kept mapped for the next allocation of its size class
+    struct PooledBuffer {
+        struct ion_handle *handle;
+        unsigned char *data;
+        int fd;
+        size_t size;
+        nsecs_t released;
+    };
+
+    // One allocation all buffers of a list were carved out of
+    struct CarvedRegion {
+        CameraBuffer *list;
+        struct ion_handle *handle;
+        unsigned char *data;
+        int fd;
+        size_t size;
+    };
+
+    class PoolTrimThread : public android::Thread {
+        public:
+            PoolTrimThread(MemoryManager *manager)
+                : Thread(false), mManager(manager) { }
+
+            virtual bool threadLoop() {
+                return mManager->trimPool();
+            }
+
+        private:
+            MemoryManager *mManager;
+    };
+
+    status_t allocateBuffer(size_t size, CameraBuffer &buffer);
+    status_t mapBuffer(size_t size, struct ion_handle *&handle, unsigned char *&data, int &fd);
+    void releaseBuffer(CameraBuffer &buffer);
+    void unmapBuffer(struct ion_handle *handle, unsigned char *data, int fd, size_t size);
+    // mPoolLock is held
+    void evictPooled(size_t index);
+    bool trimPool();
+
     android::sp<ErrorNotifier> mErrorNotifier;
     int mIonFd;
+
+    android::Mutex mPoolLock;
+    android::Condition mPoolChanged;
+    // in release order, the oldest first
+    android::Vector<PooledBuffer> mPool;
+    size_t mPoolLimit;
+    nsecs_t mPoolTimeout;
+    bool mPoolExiting;
+    PoolStats mPoolStats;
+    android::sp<PoolTrimThread> mPoolTrimThread;
+
+    bool mCarveEnabled;
+    // guarded by mPoolLock
+    android::Vector<CarvedRegion> mCarvedRegions;
 };
 
 
@@ -830,6 +981,16 @@ public:
          size_t mMaxQueueable;
         } BuffersDescriptor;
 
+    typedef struct
+        {
+         uint32_t mThreshold;       // starving below this many queued buffers
+         uint32_t mFrames;
+         uint32_t mStarvedFrames;
+         uint32_t mEvents;          // times the queue dropped below the threshold
+         uint32_t mMinQueued;
+         uint32_t mLongestRun;      // most consecutive starved frames
+        } StarvationStats;
+
     enum CameraCommands
         {
         CAMERA_START_PREVIEW                        = 0,
@@ -867,6 +1028,7 @@ public:
         CAMERA_DESTROY_TUNNEL                       = 29,
 #endif
         CAMERA_PREVIEW_INITIALIZATION               = 30,
+        CAMERA_QUERY_PREVIEW_STARVATION             = 31,
         };
 
     enum CameraMode
@@ -916,10 +1078,22 @@ public:
     virtual void returnFrame(CameraBuffer* frameBuf, CameraFrame::FrameType frameType) = 0;
     virtual void addFramePointers(CameraBuffer *frameBuf, void *buf) = 0;
     virtual void removeFramePointers() = 0;
+    virtual status_t enableAsyncDelivery(void *cookie, size_t depth, DeliveryPolicy policy) = 0;
+    virtual void disableAsyncDelivery(void *cookie) = 0;
+
+    //Registry the frame paths record their timings and drops in
+    virtual void setMetrics(const android::sp<CameraMetrics> &metrics) = 0;
+
+    //True if the buffers of the given mode may be carved out of one shared
+    //allocation, i.e. the adapter only touches them through their mapping
+    virtual bool takesCarvedBuffers(CameraMode mode) = 0;
 
     //APIs to configure Camera adapter and get the current parameter set
     virtual int setParameters(const android::CameraParameters& params) = 0;
     virtual void getParameters(android::CameraParameters& params) = 0;
+    // True if getParameters() may report something new since the flag
+    // was last taken, clears it
+    virtual bool takeParametersChanged() = 0;
 
     //Registers callback for returning image buffers back to CameraHAL
     virtual int registerImageReleaseCallback(release_image_buffers_callback callback, void *user_data) = 0;
@@ -973,11 +1147,6 @@ public:
     //Used for Snapshot review temp. pause
     virtual int pauseDisplay(bool pause) = 0;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-    //Used for shot to snapshot measurement
-    virtual int setSnapshotTimeRef(struct timeval *refTime = NULL) = 0;
-#endif
-
     virtual bool supportsExternalBuffering() = 0;
 
     // Get max queueable buffers display supports
@@ -1192,17 +1361,6 @@ public:
     /** Deinitialize CameraHal */
     void deinitialize();
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    //Uses the constructor timestamp as a reference to calcluate the
-    // elapsed time
-    static void PPM(const char *);
-    //Uses a user provided timestamp as a reference to calcluate the
-    // elapsed time
-    static void PPM(const char *, struct timeval*, ...);
-
-#endif
-
     /** Free image bufs */
     status_t freeImageBufs();
 
@@ -1242,6 +1400,10 @@ private:
     /** Allocate preview buffers */
     status_t allocPreviewBufs(int width, int height, const char* previewFormat, unsigned int bufferCount, unsigned int &max_queueable);
 
+    // Steps of cameraPreviewInitialization() which run on a PreviewInitThread
+    status_t allocPreviewDataStep();
+    status_t startPreviewCallbacksStep();
+
     /** Allocate video buffers */
     status_t allocVideoBufs(uint32_t width, uint32_t height, uint32_t bufferCount);
 
@@ -1262,19 +1424,15 @@ private:
     /** Free RAW bufs */
     status_t freeRawBufs();
 
-    //Check if a given resolution is supported by the current camera
-    //instance
-    bool isResolutionValid(unsigned int width, unsigned int height, const char *supportedResolutions);
+    status_t doesSetParameterNeedUpdate(const char *new_param, const char *old_params, bool &update);
 
-    //Check if a given variable frame rate range is supported by the current camera
-    //instance
-    bool isFpsRangeValid(int fpsMin, int fpsMax, const char *supportedFpsRanges);
+    // True if the flattened parameters were the last ones applied and
+    // nothing changed the HAL state since
+    bool isParameterSetApplied(const android::String8 &params, const android::String8 &current);
+    bool hasOnlyReportedChanges(const ParameterDiff &changes);
 
-    //Check if a given parameter is supported by the current camera
-    // instance
-    bool isParameterValid(const char *param, const char *supportedParams);
-    bool isParameterValid(int param, const char *supportedParams);
-    status_t doesSetParameterNeedUpdate(const char *new_param, const char *old_params, bool &update);
+    // Makes the next getParameters() flatten mParameters again
+    void invalidateParameters();
 
     /** Initialize default parameters */
     void initDefaultParameters();
@@ -1289,6 +1447,10 @@ private:
 
     void forceStopPreview();
 
+    // Picks the preview buffer count for the next start from the starvation
+    // seen by the adapter
+    void tunePreviewBufferCount();
+
     void getPreferredPreviewRes(int *width, int *height);
     void resetPreviewRes(android::CameraParameters *params);
 
@@ -1317,6 +1479,7 @@ public:
     android::sp<AppCallbackNotifier> mAppCallbackNotifier;
     android::sp<DisplayAdapter> mDisplayAdapter;
     android::sp<MemoryManager> mMemoryManager;
+    android::sp<CameraMetrics> mMetrics;
     // TODO(XXX): May need to keep this as a vector in the future
     // when we can have multiple tap-in/tap-out points
     android::sp<DisplayAdapter> mBufferSourceAdapter_In;
@@ -1337,18 +1500,6 @@ public:
 
     static const int SW_SCALING_FPS_LIMIT;
 
-#if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
-
-    //Timestamp from the CameraHal constructor
-    static struct timeval ppm_start;
-    //Timestamp of the autoFocus command
-    static struct timeval mStartFocus;
-    //Timestamp of the startPreview command
-    static struct timeval mStartPreview;
-    //Timestamp of the takePicture command
-    static struct timeval mStartCapture;
-
-#endif
 
 /*----------Member variables - Private ---------------------*/
 private:
@@ -1388,7 +1539,11 @@ private:
     uint32_t *mPreviewOffsets;
     int mPreviewLength;
     int mPreviewFd;
+    ///Preview and video buffer counts actually allocated, autotuning can
+    ///raise them above REQUIRED_PREVIEW_BUFS
+    unsigned int mPreviewBufferCount;
     CameraBuffer *mVideoBuffers;
+    unsigned int mVideoBufferCount;
     uint32_t *mVideoOffsets;
     int mVideoFd;
     int mVideoLength;
@@ -1403,9 +1558,50 @@ private:
 
     CameraProperties::Properties* mCameraProperties;
 
+    ///Supported values of mCameraProperties, checked by setParameters()
+    CapabilityIndex mCapabilityIndex;
+
     bool mPreviewStartInProgress;
     bool mPreviewInitializationDone;
 
+    // Runs one step of cameraPreviewInitialization() next to the caller,
+    // wait() is the join point
+    class PreviewInitThread : public android::Thread {
+        public:
+            typedef status_t (CameraHal::*Step)();
+
+            PreviewInitThread(CameraHal *hal, Step step)
+                : Thread(false), mHal(hal), mStep(step), mStatus(NO_ERROR) { }
+
+            status_t wait() {
+                join();
+                return mStatus;
+            }
+
+            virtual bool threadLoop() {
+                mStatus = (mHal->*mStep)();
+                return false;
+            }
+
+        private:
+            CameraHal *mHal;
+            Step mStep;
+            status_t mStatus;
+    };
+
+    // Starts step on a PreviewInitThread, runs it right away if the thread
+    // couldn't be started and returns NULL with its status in ret then
+    android::sp<PreviewInitThread> startPreviewInitStep(PreviewInitThread::Step step, status_t &ret);
+
+    // Input of the preview initialization steps
+    size_t mPreviewInitDataSize;
+    unsigned int mPreviewInitBufferCount;
+
+    // Preview buffer count picked by tunePreviewBufferCount(), 0 until
+    // it moved away from the required count
+    bool mPreviewBufferAutoTune;
+    unsigned int mTunedPreviewBufferCount;
+
     bool mSetPreviewWindowCalled;
 
     uint32_t mPreviewWidth;
@@ -1416,6 +1612,21 @@ private:
     int mVideoHeight;
 
     android::String8 mCapModeBackup;
+
+    ///Last parameters setParameters() went through with, mParameters
+    ///and the preview state right after them
+    android::String8 mAppliedParameters;
+    android::String8 mAppliedState;
+    bool mAppliedPreviewEnabled;
+    bool mAppliedRecordingEnabled;
+
+    ///Bumped on every change of mParameters, getParameters() hands out
+    ///mCachedParameters while it matches mCachedGeneration and the
+    ///adapter reports nothing new
+    volatile int32_t mParametersGeneration;
+    android::Mutex mParametersCacheLock;
+    int32_t mCachedGeneration;
+    android::String8 mCachedParameters;
 };
 
 } // namespace Camera
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAMERA_METRICS_H
+#define CAMERA_METRICS_H
+
+#include <cutils/atomic.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Counters and latency histograms of one camera, printed by
+ * CameraHal::dump().
+ *
+ * Recording only does atomic operations on fixed arrays, without locks or
+ * allocations, so the frame paths can call it. The histograms have one
+ * bucket per power of two microseconds and report percentiles as the
+ * upper bound of the bucket they fall in.
+ *
+ * reset() doesn't stop the recording threads, a sample taken while it
+ * runs may survive it.
+ */
+class CameraMetrics : public virtual android::RefBase {
+    public:
+        enum Latency {
+            RETURN_TO_FILL = 0,     // last returnFrame() of a buffer until fillThisBuffer() is done
+            JPEG_ENCODE,
+            SET_PARAMETERS,
+            LATENCY_COUNT
+        };
+
+        enum Counter {
+            DROPPED_DELIVERY = 0,   // the delivery queue of a subscriber was full
+            DROPPED_CALLBACK,       // the preview callback ring was full
+            COUNTER_COUNT
+        };
+
+        enum {
+            // frame type bits up to CameraFrame::REPROCESS_INPUT_FRAME
+            FRAME_TYPE_COUNT = 11,
+            MAX_CONSUMERS = 8,
+            // the last bucket takes everything from 2^24 us on
+            BUCKET_COUNT = 26
+        };
+
+        CameraMetrics();
+
+        // a frame of the given type is about to go to its subscribers
+        void frameArrived(int frameType);
+        // the callback of one subscriber, or the post to its delivery queue, took latency
+        void frameDispatched(int frameType, int cookie, nsecs_t latency);
+        // the ref count of the given type changed by references on a buffer,
+        // negative when references were returned or cleared
+        void framesHeld(int frameType, int references);
+
+        void record(Latency latency, nsecs_t time);
+
+        void count(Counter counter) {
+            android_atomic_inc(&mCounters[counter]);
+        }
+
+        void reset();
+        status_t dump(int fd);
+
+    private:
+        struct Histogram {
+            volatile int32_t mBuckets[BUCKET_COUNT];
+            volatile int32_t mCount;
+            // in microseconds
+            volatile int32_t mMax;
+        };
+
+        struct FrameTypeMetrics {
+            Histogram mInterval;
+            // microseconds, wrapping, 0 until the first frame
+            volatile int32_t mLastArrival;
+            // sum of the ref counts of this type over all buffers
+            volatile int32_t mHeld;
+            volatile int32_t mMaxHeld;
+        };
+
+        struct Consumer {
+            // 0 while the slot is free, slots are never given back
+            volatile int32_t mCookie;
+            volatile int32_t mFrameTypes;
+            Histogram mDispatch;
+        };
+
+        static int getTypeIndex(int frameType);
+        static void recordTime(Histogram &histogram, nsecs_t time);
+        static void resetHistogram(Histogram &histogram);
+        static void raiseMax(volatile int32_t *max, int32_t value);
+        static int32_t getPercentile(const Histogram &histogram, int32_t count, int percent);
+        static void dumpHistogram(android::String8 &out, const char *name, const Histogram &histogram);
+
+        Consumer *getConsumer(int cookie);
+
+        FrameTypeMetrics mFrameTypes[FRAME_TYPE_COUNT];
+        Consumer mConsumers[MAX_CONSUMERS];
+        Histogram mLatencies[LATENCY_COUNT];
+        volatile int32_t mCounters[COUNTER_COUNT];
+        nsecs_t mSince;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif //CAMERA_METRICS_H
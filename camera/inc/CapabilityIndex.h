@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAPABILITY_INDEX_H
+#define CAPABILITY_INDEX_H
+
+#include <utils/Errors.h>
+#include <utils/Vector.h>
+
+#include "CameraProperties.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Supported value lists checked by CameraHal::setParameters, parsed once
+ * into sorted arrays so a check doesn't have to copy and tokenize the list.
+ *
+ * Sets backed by CameraProperties are parsed for every operating mode and
+ * looked up in the mode the properties are in. The other sets hold the
+ * lists published through CameraParameters and are given with setValues().
+ */
+class CapabilityIndex {
+    public:
+        enum Set {
+            PREVIEW_FORMATS = 0,
+            IPP_MODES,
+            PREVIEW_SIZES,
+            PREVIEW_SUBSAMPLED_SIZES,
+            PREVIEW_SIDEBYSIDE_SIZES,
+            PREVIEW_TOPBOTTOM_SIZES,
+            FOCUS_MODES,
+            PICTURE_FORMATS,
+            PICTURE_SIZES,
+            PICTURE_SUBSAMPLED_SIZES,
+            PICTURE_TOPBOTTOM_SIZES,
+            PICTURE_SIDEBYSIDE_SIZES,
+            EXPOSURE_MODES,
+            WHITE_BALANCE,
+            ANTIBANDING,
+            ISO_VALUES,
+            SCENE_MODES,
+            FLASH_MODES,
+            EFFECTS,
+            // given with setValues()
+            FPS_RANGES,
+            FPS_RANGES_EXT,
+            FRAME_RATES,
+            FRAME_RATES_EXT,
+            SET_COUNT
+        };
+
+        CapabilityIndex();
+        ~CapabilityIndex();
+
+        // parses the property backed sets of all operating modes
+        status_t build(CameraProperties::Properties *properties);
+        void setValues(Set set, const char *values);
+
+        bool isValid(Set set, const char *value) const;
+        bool isValid(Set set, int value) const;
+        bool isResolutionValid(Set set, unsigned int width, unsigned int height) const;
+        // true if one of the ranges contains [fpsMin, fpsMax]
+        bool isFpsRangeValid(Set set, int fpsMin, int fpsMax) const;
+
+    private:
+        enum Type {
+            VALUES = 0,
+            SIZES,
+            INTEGERS,
+            RANGES
+        };
+
+        struct Info {
+            // NULL for the sets given with setValues()
+            const char *mKey;
+            Type mType;
+        };
+
+        struct FpsRange {
+            int mMin;
+            int mMax;
+        };
+
+        struct Entry {
+            Entry() : mStorage(NULL) { }
+
+            // the tokens of VALUES sets point into mStorage
+            char *mStorage;
+            android::Vector<const char *> mValues;
+            android::Vector<uint32_t> mSizes;
+            android::Vector<int> mIntegers;
+            android::Vector<FpsRange> mRanges;
+        };
+
+        static const Info sInfo[SET_COUNT];
+
+        const Entry *getEntry(Set set, Type type) const;
+        static void parse(Entry &entry, Type type, const char *values);
+        static void clear(Entry &entry);
+
+        CameraProperties::Properties *mProperties;
+        Entry mEntries[MODE_MAX][SET_COUNT];
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif //CAPABILITY_INDEX_H
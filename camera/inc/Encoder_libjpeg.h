@@ -26,6 +26,8 @@
 
 #include <utils/threads.h>
 #include <utils/RefBase.h>
+#include <utils/Vector.h>
+#include <cutils/atomic.h>
 
 extern "C" {
 #include "jhead.h"
@@ -39,9 +41,13 @@ extern "C" {
 
 #define CANCEL_TIMEOUT 5000000 // 5 seconds
 
+struct jpeg_compress_struct;
+
 namespace Ti {
 namespace Camera {
 
+class EncoderPool;
+
 /**
  * libjpeg encoder class - uses libjpeg to encode yuv
  */
@@ -95,13 +101,16 @@ class ExifElementsTable {
     public:
         ExifElementsTable() :
            gps_tag_count(0), exif_tag_count(0), position(0),
-           jpeg_opened(false) { }
+           segment(NULL), segment_size(0) { }
         ~ExifElementsTable();
 
         status_t insertElement(const char* tag, const char* value);
-        void insertExifToJpeg(unsigned char* jpeg, size_t jpeg_size);
-        status_t insertExifThumbnailImage(const char*, int);
-        void saveJpeg(unsigned char* picture, size_t jpeg_size);
+        // builds the APP1 payload (without marker and length) from the
+        // inserted elements and an optional jpeg thumbnail, so that the
+        // encoder can emit it while writing the main image headers
+        status_t createExifSegment(const char* thumb, int thumb_len, int width, int height);
+        const uint8_t* getExifSegment() const { return segment; }
+        size_t getExifSegmentSize() const { return segment_size; }
         static const char* degreesToExifOrientation(unsigned int);
         static void stringToRational(const char*, unsigned int*, unsigned int*);
         static bool isAsciiTag(const char* tag);
@@ -110,12 +119,22 @@ class ExifElementsTable {
         unsigned int gps_tag_count;
         unsigned int exif_tag_count;
         unsigned int position;
-        bool jpeg_opened;
+        uint8_t* segment;
+        size_t segment_size;
 };
 
-class Encoder_libjpeg : public android::Thread {
+class Encoder_libjpeg : public virtual android::RefBase {
     /* public member types and variables */
     public:
+        // rows of luma fed per jpeg_write_raw_data() call (one 2x2 subsampled MCU row)
+        static const int RAW_MCU_SIZE = 16;
+        // main images are split in horizontal stripes encoded in parallel,
+        // each stripe is a multiple of eight MCU rows (one RST0..RST7 cycle)
+        static const int MAX_STRIPES = 8;
+        static const int STRIPE_ROW_ALIGN = RAW_MCU_SIZE * 8;
+        static const int STRIPE_MIN_PIXELS = 1024 * 1024;
+        static const int STRIPE_HEADER_SIZE = 4096;
+
         struct params {
             uint8_t* src;
             int src_size;
@@ -131,6 +150,31 @@ class Encoder_libjpeg : public android::Thread {
             const char* format;
             size_t jpeg_size;
          };
+
+        enum JobState {
+            JOB_IDLE,
+            JOB_QUEUED,
+            JOB_RUNNING,
+            JOB_DONE
+        };
+
+        // one stripe of the main image, encoded by whichever pool worker
+        // claims it first
+        struct Stripe {
+            Encoder_libjpeg* encoder;
+            params* input;
+            uint8_t* src;
+            int bpp;
+            int first_row;
+            int num_rows;
+            uint8_t* dst;
+            int dst_size;
+            size_t jpeg_size;
+            bool done;
+
+            void run();
+        };
+
     /* public member functions */
     public:
         Encoder_libjpeg(params* main_jpeg,
@@ -140,10 +184,9 @@ class Encoder_libjpeg : public android::Thread {
                         void* cookie1,
                         void* cookie2,
                         void* cookie3, void *cookie4)
-            : android::Thread(false), mMainInput(main_jpeg), mThumbnailInput(tn_jpeg), mCb(cb),
-              mCancelEncoding(false), mCookie1(cookie1), mCookie2(cookie2), mCookie3(cookie3), mCookie4(cookie4),
-              mType(type), mThumb(NULL) {
-            this->incStrong(this);
+            : mMainInput(main_jpeg), mThumbnailInput(tn_jpeg), mCb(cb),
+              mCancelEncoding(0), mCookie1(cookie1), mCookie2(cookie2), mCookie3(cookie3), mCookie4(cookie4),
+              mType(type), mExif(NULL), mPool(NULL), mState(JOB_IDLE), mQueueTime(0), mStartTime(0), mEndTime(0) {
             mCancelSem.Create(0);
         }
 
@@ -151,44 +194,13 @@ class Encoder_libjpeg : public android::Thread {
             CAMHAL_LOGVB("~Encoder_libjpeg(%p)", this);
         }
 
-        virtual bool threadLoop() {
-            size_t size = 0;
-            if (mThumbnailInput) {
-                // start thread to encode thumbnail
-                mThumb = new Encoder_libjpeg(mThumbnailInput, NULL, NULL, mType, NULL, NULL, NULL, NULL);
-                mThumb->run();
-            }
-
-            // encode our main image
-            size = encode(mMainInput);
-
-            // signal cancel semaphore incase somebody is waiting
-            mCancelSem.Signal();
-
-            // check if it is main jpeg thread
-            if(mThumb.get()) {
-                // wait until tn jpeg thread exits.
-                mThumb->join();
-                mThumb.clear();
-                mThumb = NULL;
-            }
-
-            if(mCb) {
-                mCb(mMainInput, mThumbnailInput, mType, mCookie1, mCookie2, mCookie3, mCookie4, mCancelEncoding);
-            }
-
-            // encoder thread runs, self-destructs, and then exits
-            this->decStrong(this);
-            return false;
-        }
+        // runs the job on the calling (pool worker) thread: thumbnail first,
+        // then the main image, then the completion callback
+        void process();
 
-        void cancel() {
-           mCancelEncoding = true;
-           if (mThumb.get()) {
-               mThumb->cancel();
-               mCancelSem.WaitTimeout(CANCEL_TIMEOUT);
-           }
-        }
+        // marks the job as canceled, blocks until the encoder is done touching
+        // the input buffers if the job is already running
+        void cancel();
 
         void getCookies(void **cookie1, void **cookie2, void **cookie3) {
             if (cookie1) *cookie1 = mCookie1;
@@ -196,20 +208,119 @@ class Encoder_libjpeg : public android::Thread {
             if (cookie3) *cookie3 = mCookie3;
         }
 
+        // the stripes of the main image are run on the workers of pool
+        void setQueued(EncoderPool* pool);
+
+        // exif written as APP1 of the main image, ownership stays with the caller
+        void setExif(ExifElementsTable* exif) { mExif = exif; }
+
+        // read without mStateLock by the stripes running on other workers
+        bool isCanceled() const { return android_atomic_acquire_load(&mCancelEncoding) != 0; }
+
+        // per-job timing in ns, valid once the job is done
+        nsecs_t getQueueTime() const { return mStartTime - mQueueTime; }
+        nsecs_t getEncodeTime() const { return mEndTime - mStartTime; }
+
     private:
         params* mMainInput;
         params* mThumbnailInput;
         encoder_libjpeg_callback_t mCb;
-        bool mCancelEncoding;
+        volatile int32_t mCancelEncoding;
         void* mCookie1;
         void* mCookie2;
         void* mCookie3;
         void* mCookie4;
         CameraFrame::FrameType mType;
-        android::sp<Encoder_libjpeg> mThumb;
+        ExifElementsTable* mExif;
+        EncoderPool* mPool;
         Utils::Semaphore mCancelSem;
+        android::Mutex mStateLock;
+        JobState mState;
+        nsecs_t mQueueTime;
+        nsecs_t mStartTime;
+        nsecs_t mEndTime;
 
         size_t encode(params*);
+        size_t compress(params* input, uint8_t* src, int bpp, int first_row, int num_rows,
+                        uint8_t* dst, int dst_size, bool restart_rows);
+        size_t encodeStriped(params* input, uint8_t* src, int bpp, int stripes);
+        void encodeScanlines(jpeg_compress_struct* cinfo, params* input, uint8_t* src,
+                             int bpp, int first_row);
+        void encodeRawData(jpeg_compress_struct* cinfo, params* input, uint8_t* src,
+                           int bpp, int first_row);
+        void cancelEncoding() { android_atomic_release_store(1, &mCancelEncoding); }
+        int getStripeCount(params* input);
+        static size_t findScanData(const uint8_t* jpeg, size_t size);
+        static bool setFrameHeight(uint8_t* jpeg, size_t header_size, int height);
+        static bool isRawDataInEnabled();
+};
+
+/**
+ * Long-lived pool of jpeg encoder threads with a bounded job queue
+ */
+class EncoderPool : public virtual android::RefBase {
+    public:
+        struct Stats {
+            unsigned int queueDepth;
+            unsigned int maxQueueDepth;
+            unsigned int running;
+            unsigned int completed;
+            unsigned int canceled;
+            nsecs_t lastQueueTime;
+            nsecs_t lastEncodeTime;
+            nsecs_t maxQueueTime;
+            nsecs_t maxEncodeTime;
+            nsecs_t totalEncodeTime;
+        };
+
+        EncoderPool(int numThreads, int maxJobs);
+        ~EncoderPool();
+
+        status_t initialize();
+
+        // blocks while the queue is full
+        status_t queueJob(const android::sp<Encoder_libjpeg>& job);
+
+        int getThreadCount() const { return mNumThreads; }
+
+        // queues the stripes for the idle workers, runs the ones nobody
+        // claimed on the calling thread and returns once all are done
+        void runStripes(Encoder_libjpeg::Stripe* stripes, int count);
+
+        unsigned int getQueueDepth();
+        void getStats(Stats& stats);
+
+    private:
+        class WorkerThread : public android::Thread {
+            public:
+                WorkerThread(EncoderPool* pool)
+                    : android::Thread(false), mPool(pool) { }
+
+                virtual bool threadLoop() {
+                    return mPool->processNextJob();
+                }
+
+            private:
+                EncoderPool* mPool;
+        };
+
+        bool processNextJob();
+        void runStripe(Encoder_libjpeg::Stripe* stripe);
+
+        static const int MAX_THREADS = 4;
+
+        android::Mutex mLock;
+        android::Condition mJobAvailable;
+        android::Condition mSpaceAvailable;
+        android::Condition mStripeDone;
+        android::Vector< android::sp<Encoder_libjpeg> > mJobs;
+        // stripes of the running jobs, claimed before new jobs
+        android::Vector<Encoder_libjpeg::Stripe*> mStripes;
+        android::sp<WorkerThread> mThreads[MAX_THREADS];
+        int mNumThreads;
+        unsigned int mMaxJobs;
+        bool mExiting;
+        Stats mStats;
 };
 
 } // namespace Camera
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <cutils/atomic.h>
+#include <utils/Errors.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <sys/types.h>
+
+#include "ThreadRings.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Always on log of the camera milestones (camera open, preview start,
+ * shot, snapshot, jpeg...) replacing the PPM printouts.
+ *
+ * log() only stores the event id and a monotonic timestamp in a ring of
+ * the calling thread, without locks or formatting. dump() decodes the
+ * last RING_SIZE events of every thread: each one with the time since
+ * the camera was opened and, where it has one, the time since its
+ * reference event, like "shot to snapshot".
+ */
+class EventLog {
+    public:
+        enum Event {
+            CAMERA_OPEN = 0,
+            PREVIEW_INIT,               // startPreview() or preview initialization
+            PREVIEW_BUFFERS_ALLOCATED,
+            PREVIEW_BUFFERS_REGISTERED,
+            PREVIEW_STARTED,
+            FIRST_PREVIEW_FRAME,        // displayed after the display was enabled
+            START_RECORDING,
+            AUTOFOCUS_START,
+            AUTOFOCUS_DONE,
+            SHOT,                       // takePicture() or bracketing started
+            SNAPSHOT_DISPLAYED,
+            PREVIEW_AFTER_SHOT,         // first preview frame displayed after the snapshot
+            JPEG_READY,                 // compressed image handed to the subscribers
+            EVENT_COUNT,
+            NO_EVENT = EVENT_COUNT
+        };
+
+        static void log(Event event);
+
+        // writes the decoded events as text
+        static status_t dump(int fd);
+
+    private:
+        enum {
+            RING_SIZE = 128,
+            MAX_RINGS = 32,
+        };
+
+        struct Record {
+            nsecs_t mTime;
+            int32_t mEvent;
+        };
+
+        typedef ThreadRings<Record, RING_SIZE, MAX_RINGS> Rings;
+
+        struct Info {
+            const char *mName;
+            // what the event is measured from, NO_EVENT for none
+            Event mReference;
+        };
+
+        static const Info sInfo[EVENT_COUNT];
+
+        static Rings sRings;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif //EVENT_LOG_H
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_DELIVERY_QUEUE_H
+#define FRAME_DELIVERY_QUEUE_H
+
+#include "CameraHal.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Bounded queue and thread calling the frame callbacks of one subscriber,
+ * so the adapter thread only has to copy the frame.
+ *
+ * When the queue is full, preview and preview data frames are dropped
+ * according to the policy and returned to the frame notifier. Other frame
+ * types always wait for room.
+ */
+class FrameDeliveryQueue : public virtual android::RefBase {
+    public:
+        struct Stats {
+            unsigned int frames;
+            unsigned int drops;
+            // frames waiting right now and the most seen at once
+            unsigned int depth;
+            unsigned int maxDepth;
+            // time between post() and the callback being called
+            nsecs_t lastLatency;
+            nsecs_t maxLatency;
+            nsecs_t totalLatency;
+        };
+
+        // metrics may be NULL
+        FrameDeliveryQueue(FrameNotifier *notifier, size_t depth,
+                           FrameNotifier::DeliveryPolicy policy,
+                           const android::sp<CameraMetrics> &metrics);
+        ~FrameDeliveryQueue();
+
+        status_t start(const char *name);
+
+        // returns the frames still queued to the notifier, when called from
+        // a callback the thread exits once that callback returns
+        void stop();
+
+        // queues a copy of the frame for callback
+        status_t post(const CameraFrame &frame, frame_callback callback);
+
+        // returns the queued frames of the given types to the notifier and
+        // waits for a callback in progress to finish
+        void flush(int32_t frameTypes);
+
+        void getStats(Stats &stats);
+        void resetStats();
+
+    private:
+        class DeliveryThread : public android::Thread {
+            public:
+                DeliveryThread(FrameDeliveryQueue *queue)
+                    : Thread(false), mQueue(queue) { }
+
+                virtual bool threadLoop() {
+                    // the queue stays alive until the callback returns, even
+                    // if its last reference is dropped from the callback
+                    android::sp<FrameDeliveryQueue> queue = mQueue.promote();
+
+                    return (NULL != queue.get()) && queue->deliver();
+                }
+
+            private:
+                android::wp<FrameDeliveryQueue> mQueue;
+        };
+
+        struct Entry {
+            CameraFrame mFrame;
+            frame_callback mCallback;
+            nsecs_t mQueued;
+        };
+
+        static bool isDroppable(int frameType);
+
+        void stopThread();
+        bool deliver();
+        bool takeOldestDroppable(CameraFrame &dropped);
+        void returnFrame(const CameraFrame &frame);
+
+        FrameNotifier *mNotifier;
+        FrameNotifier::DeliveryPolicy mPolicy;
+        android::sp<CameraMetrics> mMetrics;
+        android::sp<DeliveryThread> mThread;
+
+        android::Mutex mLock;
+        android::Condition mNotEmpty;
+        android::Condition mNotFull;
+        android::Condition mIdle;
+
+        Entry *mEntries;
+        size_t mCapacity;
+        size_t mHead;
+        size_t mCount;
+        bool mDelivering;
+        bool mStopping;
+        pthread_t mDeliveryThreadId;
+
+        Stats mStats;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif //FRAME_DELIVERY_QUEUE_H
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_SLOT_RING_H
+#define FRAME_SLOT_RING_H
+
+#include "CameraHal.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Fixed ring of preallocated CameraFrame slots between the frame providers
+ * and the AppCallbackNotifier thread, with an eventfd to wake the consumer.
+ *
+ * Neither side takes a lock and nothing is allocated after initialize().
+ * Every slot carries a sequence number telling whether it is free for the
+ * position a producer claims or filled for the position the consumer
+ * reads. Producers claim positions with a compare and swap, since the
+ * adapters may send frames from more than one thread (bracketing frames
+ * come from the command thread, preview frames from the callback thread).
+ * There is a single consumer, callers of get() serialize among themselves.
+ *
+ * A preview frame which finds the ring full isn't queued, and while the
+ * backlog is over half the ring the consumer gets the oldest preview frames
+ * back as stale, to be returned without a callback. Image, raw, snapshot
+ * and video frames are never dropped, they wait for a free slot instead.
+ */
+class FrameSlotRing : public virtual android::RefBase {
+    public:
+        struct Stats {
+            unsigned int frames;
+            // preview frames dropped on either side of the ring
+            unsigned int drops;
+            // frames which had to wait for a free slot
+            unsigned int waits;
+            // time between put() and get(), in microseconds
+            unsigned int lastLatency;
+            unsigned int maxLatency;
+            unsigned int totalLatency;
+        };
+
+        FrameSlotRing(size_t capacity);
+        ~FrameSlotRing();
+
+        status_t initialize();
+
+        // readable while frames are queued
+        int getFd() const { return mEventFd; }
+
+        // copies the frame into a free slot, WOULD_BLOCK if the ring is full
+        // and the frame is a preview frame, which the caller has to return
+        status_t put(const CameraFrame &frame);
+
+        // moves the oldest frame to frame, NOT_ENOUGH_DATA if none is queued.
+        // stale frames are to be returned without a callback
+        status_t get(CameraFrame &frame, bool &stale);
+
+        // frames queued right now, including ones still being copied in
+        size_t size();
+
+        // to be called before draining size() frames, frames queued
+        // afterwards wake the consumer again
+        void clearWakeup();
+
+        void getStats(Stats &stats);
+        void resetStats();
+
+    private:
+        enum {
+            // producers waiting for room poll at least this often
+            ROOM_WAIT_MS = 100,
+        };
+
+        struct Slot {
+            CameraFrame mFrame;
+            nsecs_t mQueued;
+            // the position the slot is free for, or that position + 1
+            // once it is filled
+            volatile int32_t mSequence;
+        };
+
+        static bool isDroppable(int frameType);
+        static void moveFrame(CameraFrame &to, CameraFrame &from);
+
+        bool claimSlot(uint32_t &pos);
+        bool isFull();
+        void waitForRoom();
+        void wakeup();
+        void updateStats(nsecs_t queued);
+
+        Slot *mSlots;
+        size_t mCapacity;
+        int mEventFd;
+
+        // positions only ever increase, the head is written by the
+        // consumer, the tail claimed by the producers
+        volatile int32_t mHead;
+        volatile int32_t mTail;
+
+        // only used by producers waiting for room and the consumer waking them
+        volatile int32_t mWaiters;
+        android::Mutex mRoomLock;
+        android::Condition mRoom;
+
+        volatile int32_t mFrames;
+        volatile int32_t mDrops;
+        volatile int32_t mWaits;
+        volatile int32_t mLastLatency;
+        volatile int32_t mMaxLatency;
+        volatile int32_t mTotalLatency;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif //FRAME_SLOT_RING_H
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_TRACER_H
+#define FRAME_TRACER_H
+
+#include <cutils/atomic.h>
+#include <utils/Errors.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <sys/types.h>
+
+#include "ThreadRings.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Records the transitions of camera buffers through the HAL and exports
+ * them in the Chrome trace event format (chrome://tracing, Perfetto).
+ *
+ * Every thread writes to its own ring of records, so tracing takes no
+ * locks after the first event of a thread. Old records are overwritten,
+ * a dump shows the last RING_SIZE events of each thread, plus one track
+ * per buffer with the time spent between its transitions.
+ *
+ * Disabled by default, debug.camera.trace=1 turns it on.
+ */
+class FrameTracer {
+    public:
+        enum Event {
+            FILL_BUFFER = 0,    // queued to Ducati or V4L2
+            FILL_BUFFER_DONE,   // FillBufferDone or DQBUF
+            DISPATCH,           // handed to a subscriber
+            POST_FRAME,         // display adapter got it
+            ENQUEUE_BUFFER,     // queued to the preview window
+            RETURN_FRAME,       // a subscriber gave it back
+            ENCODE_START,
+            ENCODE_END,
+            EVENT_COUNT
+        };
+
+        static void setEnabled(bool enabled);
+
+        static bool isEnabled() {
+            return 0 != android_atomic_acquire_load(&sEnabled);
+        }
+
+        static void trace(Event event, const void *buffer, int frameType = 0) {
+            if (isEnabled()) {
+                record(event, buffer, frameType);
+            }
+        }
+
+        // writes the recorded events as Chrome trace JSON
+        static status_t dump(int fd);
+        static status_t dumpToFile(const char *path);
+
+    private:
+        enum {
+            RING_SIZE = 2048,
+            MAX_RINGS = 32,
+        };
+
+        struct Record {
+            nsecs_t mTime;
+            const void *mBuffer;
+            uint16_t mEvent;
+            uint16_t mFrameType;
+        };
+
+        typedef ThreadRings<Record, RING_SIZE, MAX_RINGS> Rings;
+
+        static void record(Event event, const void *buffer, int frameType);
+
+        static volatile int32_t sEnabled;
+
+        static Rings sRings;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif //FRAME_TRACER_H
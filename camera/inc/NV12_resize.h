@@ -19,6 +19,8 @@
 
 #include "Common.h"
 
+#include <utils/threads.h>
+
 typedef unsigned char  mmBool;
 typedef unsigned char  mmUchar;
 typedef unsigned char  mmUint8;
@@ -121,8 +123,10 @@ typedef struct IC_crop_struct {
 *
 * Value Returned : mmBool               -> FALSE on error TRUE on success
 * NOTE:
-*            Not tested for crop funtionallity.
-*            faster version.
+*            Bilinear with 1/8 pel weights (see bWeights), downscaling by
+*            more than 2x averages boxes of source pixels instead. Tables
+*            are computed once per geometry and cached. A crop rectangle
+*            places the scaled image inside the output frame.
 ============================================================================*/
 mmBool
 VT_resizeFrame_Video_opt2_lp(
@@ -132,4 +136,109 @@ VT_resizeFrame_Video_opt2_lp(
         mmUint16 dummy                         /* Transparent pixel value              */
         );
 
+/*==========================================================================
+* Function Name  : VT_resizeFrameRows_Video_opt2_lp
+*
+* Description    : Same as VT_resizeFrame_Video_opt2_lp but only produces
+*                  output rows [firstRow, firstRow + numRows) of the
+*                  (cropped) output, so that a frame can be split in tiles.
+*                  firstRow has to be even, chroma rows follow luma rows.
+*
+* Value Returned : mmBool               -> FALSE on error TRUE on success
+============================================================================*/
+mmBool
+VT_resizeFrameRows_Video_opt2_lp(
+        structConvImage* i_img_ptr,        /* Points to the input image           */
+        structConvImage* o_img_ptr,        /* Points to the output image          */
+        IC_rect_type*  cropout,          /* how much to resize to in final image */
+        mmUint32 firstRow,                     /* First output row of the tile        */
+        mmUint32 numRows                       /* Output rows in the tile             */
+        );
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Runs VT_resizeFrameRows_Video_opt2_lp on horizontal tiles of the output
+ * with a small fixed set of threads. The calling thread works on tiles as
+ * well, so a frame is never waiting on an idle pool.
+ */
+class NV12ResizePool : public virtual android::RefBase {
+    public:
+        static const int MAX_THREADS = 4;
+        // tiles are a whole number of luma rows of a 2x2 chroma block pair
+        static const int TILE_ROW_ALIGN = 16;
+
+        struct Stats {
+            unsigned int frames;
+            unsigned int tiledFrames;
+            unsigned int deadlineMisses;
+            nsecs_t lastFrameTime;
+            nsecs_t maxFrameTime;
+            // wall clock time of all frames
+            nsecs_t totalFrameTime;
+            // sum of all tile times, i.e. what a serial resize would have taken
+            nsecs_t totalWorkTime;
+        };
+
+        NV12ResizePool(int numThreads);
+        ~NV12ResizePool();
+
+        status_t initialize();
+
+        int getThreadCount() const { return mNumThreads; }
+
+        // splits the frame in up to dop tiles (1 resizes on the calling thread),
+        // returns TIMED_OUT if the frame is complete but took longer than
+        // deadline (0 for none)
+        status_t resize(structConvImage* input, structConvImage* output,
+                        IC_rect_type* crop, int dop, nsecs_t deadline);
+
+        void getStats(Stats& stats);
+        void resetStats();
+
+    private:
+        class WorkerThread : public android::Thread {
+            public:
+                WorkerThread(NV12ResizePool* pool)
+                    : android::Thread(false), mPool(pool) { }
+
+                virtual bool threadLoop() {
+                    return mPool->processTiles();
+                }
+
+            private:
+                NV12ResizePool* mPool;
+        };
+
+        bool processTiles();
+        bool runNextTile();
+
+        // serializes callers of resize(), one frame is tiled at a time
+        android::Mutex mFrameLock;
+
+        android::Mutex mLock;
+        android::Condition mTileAvailable;
+        android::Condition mFrameDone;
+        android::sp<WorkerThread> mThreads[MAX_THREADS];
+        int mNumThreads;
+        bool mExiting;
+
+        // frame being tiled, guarded by mLock
+        structConvImage mInput;
+        structConvImage mOutput;
+        IC_rect_type mCrop;
+        bool mHasCrop;
+        mmUint32 mTileRows;
+        int mNumTiles;
+        int mNextTile;
+        int mDoneTiles;
+        nsecs_t mWorkTime;
+
+        Stats mStats;
+};
+
+} // namespace Camera
+} // namespace Ti
+
 #endif //#define NV12_RESIZE_H_
@@ -400,6 +400,7 @@ public:
     //APIs to configure Camera adapter and get the current parameter set
     virtual status_t setParameters(const android::CameraParameters& params);
     virtual void getParameters(android::CameraParameters& params);
+    virtual bool takeParametersChanged();
 
     // API
     status_t UseBuffersPreview(CameraBuffer *bufArr, int num);
@@ -1159,6 +1160,11 @@ private:
     android::Condition mFirstFrameCondition;
 
     static const nsecs_t CANCEL_AF_TIMEOUT;
+
+    //The current ISO reported by getParameters() is read again
+    //after this while previewing
+    static const nsecs_t CURRENT_ISO_REFRESH;
+    nsecs_t mCurrentIsoTime;
     android::Mutex mCancelAFMutex;
     android::Condition mCancelAFCond;
 
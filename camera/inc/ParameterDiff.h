@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PARAMETER_DIFF_H
+#define PARAMETER_DIFF_H
+
+#include <utils/Errors.h>
+#include <utils/Vector.h>
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Keys which differ between two flattened CameraParameters strings
+ * ("key=value;key=value"). Both sides are split and sorted once, so the
+ * setParameters paths can ask per key without going through the
+ * parameter maps again.
+ */
+class ParameterDiff {
+    public:
+        ParameterDiff();
+        ~ParameterDiff();
+
+        status_t compare(const char *from, const char *to);
+
+        bool isEmpty() const { return mCompared && mChanged.isEmpty(); }
+        size_t size() const { return mChanged.size(); }
+        const char *keyAt(size_t index) const { return mChanged[index]; }
+
+        // added, removed or set to another value, every key counts as
+        // changed until compare() succeeded
+        bool changed(const char *key) const;
+        bool changedAny(const char * const *keys, size_t count) const;
+        // present on both sides with the same value
+        bool isSame(const char *key) const;
+
+    private:
+        struct Pair {
+            const char *mKey;
+            const char *mValue;
+        };
+
+        static void parse(char *str, android::Vector<Pair> &pairs);
+        static int comparePairs(const Pair *a, const Pair *b);
+        void clear();
+
+        // the keys and values point into the copies
+        char *mFrom;
+        char *mTo;
+        bool mCompared;
+        android::Vector<Pair> mToPairs;
+        android::Vector<const char *> mChanged;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif //PARAMETER_DIFF_H
@@ -115,6 +115,10 @@ static const char  KEY_GPS_MAPDATUM[];
 static const char  KEY_GPS_VERSION[];
 static const char  KEY_GPS_DATESTAMP[];
 
+// preview callbacks share the preview buffers (NV12, 4096 byte stride)
+// instead of getting a copy
+static const char KEY_PREVIEW_CALLBACK_ZERO_COPY[];
+
 // TI extensions for VTC
 static const char KEY_VTC_HINT[];
 static const char KEY_VIDEO_ENCODER_HANDLE[];
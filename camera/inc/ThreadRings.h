@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THREAD_RINGS_H
+#define THREAD_RINGS_H
+
+#include <cutils/atomic.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Per thread rings of records, written without locks after the first
+ * record of a thread.
+ *
+ * A thread gets its ring on its first record and gives it back when it
+ * exits. The records of exited threads are kept for snapshot() until all
+ * MAX_RINGS rings exist, after that the next new thread takes over a free
+ * ring and starts it empty. Threads finding no free ring record nothing.
+ */
+template <typename T, int RING_SIZE, int MAX_RINGS>
+class ThreadRings {
+    public:
+        enum {
+            // prctl(PR_GET_NAME) length
+            THREAD_NAME_SIZE = 16,
+        };
+
+        struct Ring {
+            T mRecords[RING_SIZE];
+            // records written by the current owner, only the owning thread
+            // writes, getRing() resets it when the ring changes owner
+            volatile int32_t mPos;
+            volatile int32_t mInUse;
+            pid_t mTid;
+            char mName[THREAD_NAME_SIZE];
+
+            void append(const T &record) {
+                int32_t pos = mPos;
+
+                mRecords[pos % RING_SIZE] = record;
+
+                // keep the counter positive, the index stays consistent since
+                // RING_SIZE divides the wrap around point
+                android_atomic_release_store((pos + 1) & 0x3fffffff, &mPos);
+            }
+        };
+
+        // owner of the records copied by snapshot()
+        struct Thread {
+            pid_t mTid;
+            char mName[THREAD_NAME_SIZE];
+            bool mInUse;
+        };
+
+        struct Entry {
+            T mRecord;
+            int mThread;
+        };
+
+        ThreadRings() : mKeyCreated(0), mRingCount(0) { }
+
+        // ring of the calling thread, NULL if it found none free
+        Ring *getRing();
+
+        // appends the records of every ring, oldest first within a ring, and
+        // fills threads (MAX_RINGS entries) with their owners, returns the
+        // number of rings
+        int snapshot(android::Vector<Entry> &records, Thread *threads);
+
+    private:
+        static void releaseRing(void *ring);
+
+        // marks threads which found no free ring
+        static char sNoRing;
+
+        android::Mutex mLock;
+        pthread_key_t mKey;
+        volatile int32_t mKeyCreated;
+        Ring *mRings[MAX_RINGS];
+        volatile int32_t mRingCount;
+};
+
+template <typename T, int RING_SIZE, int MAX_RINGS>
+char ThreadRings<T, RING_SIZE, MAX_RINGS>::sNoRing;
+
+template <typename T, int RING_SIZE, int MAX_RINGS>
+void ThreadRings<T, RING_SIZE, MAX_RINGS>::releaseRing(void *ring) {
+    // the records stay for snapshot() until the ring changes owner
+    if ((NULL != ring) && (&sNoRing != ring)) {
+        android_atomic_release_store(0, &((Ring *) ring)->mInUse);
+    }
+}
+
+template <typename T, int RING_SIZE, int MAX_RINGS>
+typename ThreadRings<T, RING_SIZE, MAX_RINGS>::Ring *ThreadRings<T, RING_SIZE, MAX_RINGS>::getRing() {
+    Ring *ring = NULL;
+
+    if (0 != android_atomic_acquire_load(&mKeyCreated)) {
+        ring = (Ring *) pthread_getspecific(mKey);
+        if (NULL != ring) {
+            return ((void *) &sNoRing == (void *) ring) ? NULL : ring;
+        }
+    }
+
+    {
+        android::AutoMutex lock(mLock);
+        int32_t count = mRingCount;
+
+        if (0 == mKeyCreated) {
+            if (0 != pthread_key_create(&mKey, releaseRing)) {
+                return NULL;
+            }
+            android_atomic_release_store(1, &mKeyCreated);
+        }
+
+        // the records of exited threads are kept as long as there are
+        // rings left to allocate
+        if (MAX_RINGS > count) {
+            ring = new Ring;
+            if (NULL != ring) {
+                ring->mPos = 0;
+                mRings[count] = ring;
+                android_atomic_release_store(count + 1, &mRingCount);
+            }
+        }
+
+        for (int32_t i = 0; (NULL == ring) && (i < count); i++) {
+            if (0 == android_atomic_acquire_load(&mRings[i]->mInUse)) {
+                ring = mRings[i];
+                // drop the previous owner's records, they would be
+                // attributed to the new thread
+                android_atomic_release_store(0, &ring->mPos);
+            }
+        }
+
+        if (NULL != ring) {
+            ring->mInUse = 1;
+            ring->mTid = gettid();
+            memset(ring->mName, 0, sizeof(ring->mName));
+            prctl(PR_GET_NAME, (unsigned long) ring->mName, 0, 0, 0);
+        }
+    }
+
+    pthread_setspecific(mKey, (NULL != ring) ? (void *) ring : (void *) &sNoRing);
+
+    return ring;
+}
+
+template <typename T, int RING_SIZE, int MAX_RINGS>
+int ThreadRings<T, RING_SIZE, MAX_RINGS>::snapshot(android::Vector<Entry> &records, Thread *threads) {
+    // rings change owner under the lock
+    android::AutoMutex lock(mLock);
+    int32_t count = mRingCount;
+
+    for (int32_t i = 0; i < count; i++) {
+        Ring *ring = mRings[i];
+        int32_t end = android_atomic_acquire_load(&ring->mPos);
+        int32_t start = (end > RING_SIZE) ? end - RING_SIZE : 0;
+        size_t first = records.size();
+
+        threads[i].mTid = ring->mTid;
+        memcpy(threads[i].mName, ring->mName, sizeof(threads[i].mName));
+        threads[i].mInUse = (0 != android_atomic_acquire_load(&ring->mInUse));
+
+        for (int32_t pos = start; pos < end; pos++) {
+            Entry e;
+
+            e.mRecord = ring->mRecords[pos % RING_SIZE];
+            e.mThread = i;
+            records.push_back(e);
+        }
+
+        // the owner may have overwritten the oldest records meanwhile
+        int32_t valid = android_atomic_acquire_load(&ring->mPos) - RING_SIZE + 1;
+        if (valid > start) {
+            records.removeItemsAt(first, ((valid - start) < (end - start)) ? valid - start : end - start);
+        }
+    }
+
+    return count;
+}
+
+} // namespace Camera
+} // namespace Ti
+
+#endif //THREAD_RINGS_H
@@ -24,6 +24,7 @@
 #include "CameraHal.h"
 #include "BaseCameraAdapter.h"
 #include "DebugUtils.h"
+#include "ZslRing.h"
 
 namespace Ti {
 namespace Camera {
@@ -113,6 +114,7 @@ public:
     // API
     virtual status_t UseBuffersPreview(CameraBuffer *bufArr, int num);
     virtual status_t UseBuffersCapture(CameraBuffer *bufArr, int num);
+    virtual bool takesCarvedBuffers(CameraMode mode);
 
     static status_t getCaps(const int sensorId, CameraProperties::Properties* params, V4L_HANDLETYPE handle);
 
@@ -157,6 +159,11 @@ private:
 
     int previewThread();
 
+    // size of the frames streamed by the sensor
+    void getStreamSize(const android::CameraParameters &params, int &width, int &height);
+    status_t allocateZslRing();
+    status_t takeZslPicture();
+
 public:
 
 private:
@@ -230,6 +237,15 @@ private:
     int nQueued;
     int nDequeued;
 
+    // high-quality-zsl capture mode, decided while not streaming
+    bool mZslMode;
+    ZslRing mZslRing;
+
+    // NV12 copy of a stream frame at the stream size when the preview is
+    // scaled, only used by the preview thread
+    unsigned char *mScaleBuffer;
+    size_t mScaleBufferSize;
+
 };
 
 } // namespace Camera
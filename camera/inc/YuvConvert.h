@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file YuvConvert.h
+*
+* Row converters for YUV422I input and NV12 scaler row kernels, with
+* vectorized kernels picked once at run time for the CPU we are running
+* on (NEON, SSSE3/SSE2, AVX2)
+*
+*/
+
+#ifndef YUV_CONVERT_H_
+#define YUV_CONVERT_H_
+
+#include <stdint.h>
+
+namespace Ti {
+namespace Camera {
+
+enum YuvKernelSet {
+    YUV_KERNELS_C,
+    YUV_KERNELS_NEON,
+    YUV_KERNELS_SSE2,
+    YUV_KERNELS_SSSE3,
+    YUV_KERNELS_AVX2,
+};
+
+/**
+ * Expands one row of YUV422I (yuyv or uyvy) to packed YUV444, each chroma
+ * sample is repeated for both pixels of its pair. Any width is supported.
+ */
+void yuv422iToYuv444Row(uint8_t *dst, const uint8_t *src, int width, bool uyvy);
+
+/**
+ * Splits one row of YUV422I yuyv into a row of Y and, when dstUV is not
+ * NULL, a row of interleaved NV12 UV. Any even width is supported.
+ */
+void yuyvToNV12Row(uint8_t *dstY, uint8_t *dstUV, const uint8_t *src, int width);
+
+/**
+ * Vertical step of the separable NV12 bilinear scaler: count samples of
+ * two horizontally interpolated rows (each weighted to a total of 8) are
+ * blended with weights 8 - yf and yf, dst gets the sum divided by 64.
+ */
+void bilinearBlendRow(uint8_t *dst, const uint16_t *row0, const uint16_t *row1, int yf, int count);
+
+/**
+ * Adds count bytes of src to the 32 bit accumulators in acc, used by the
+ * area averaging downscaler to sum up the source rows of an output row.
+ */
+void boxAccumulateRow(uint32_t *acc, const uint8_t *src, int count);
+
+/**
+ * Turns count accumulators into running sums in place, acc[i] gets the sum
+ * of acc[i], acc[i - step], acc[i - 2 * step]... step is 1, or 2 for
+ * interleaved CbCr. The sum of a box of columns is then the difference of
+ * two entries. The sums wrap at 32 bits, the differences stay exact.
+ */
+void boxPrefixSumRow(uint32_t *acc, int count, int step);
+
+/**
+ * Returns the kernel set selected for this CPU
+ */
+YuvKernelSet getYuvKernelSet();
+const char *getYuvKernelSetName();
+
+} // namespace Camera
+} // namespace Ti
+
+#endif // YUV_CONVERT_H_
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZSL_RING_H
+#define ZSL_RING_H
+
+#include <utils/Errors.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Ring of the last full resolution frames seen during preview, so a zero
+ * shutter lag capture can take the frame closest to the shutter press
+ * instead of reconfiguring the sensor.
+ *
+ * put() overwrites the oldest slot which isn't held. The copies are made
+ * outside the lock, a slot is only picked by acquire() once it is filled
+ * and isn't written again until it is given back with release().
+ */
+class ZslRing {
+    public:
+        struct Stats {
+            unsigned int frames;
+            unsigned int captures;
+            // distance between the shutter press and the picked frame
+            nsecs_t lastOffset;
+            nsecs_t maxOffset;
+        };
+
+        struct Frame {
+            int slot;
+            const void *data;
+            size_t size;
+            nsecs_t timestamp;
+        };
+
+        ZslRing();
+        ~ZslRing();
+
+        status_t allocate(size_t count, size_t frameSize);
+        // neither put() nor a held frame may be pending
+        void clear();
+
+        bool isAllocated() const { return !mSlots.isEmpty(); }
+        size_t getFrameSize() const { return mFrameSize; }
+        // bytes taken by all the slots
+        size_t getMemorySize() const { return mSlots.size() * mFrameSize; }
+
+        // copies a frame of at most getFrameSize() bytes into the ring
+        status_t put(const void *data, size_t size, nsecs_t timestamp);
+
+        // holds the frame closest to shutter, waits up to timeout for the
+        // first one, NOT_ENOUGH_DATA if none came
+        status_t acquire(nsecs_t shutter, nsecs_t timeout, Frame &frame);
+        void release(const Frame &frame);
+
+        void getStats(Stats &stats);
+
+    private:
+        enum SlotState {
+            SLOT_EMPTY = 0,
+            SLOT_WRITING,
+            SLOT_FILLED,
+            SLOT_HELD
+        };
+
+        struct Slot {
+            unsigned char *mData;
+            size_t mSize;
+            nsecs_t mTimestamp;
+            SlotState mState;
+        };
+
+        android::Mutex mLock;
+        android::Condition mFilled;
+        android::Vector<Slot> mSlots;
+        size_t mFrameSize;
+        // next slot put() tries
+        size_t mNext;
+        Stats mStats;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif //ZSL_RING_H
@@ -19,6 +19,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/poll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <utils/Errors.h>
 
@@ -39,27 +40,27 @@ namespace Utils {
    @return none
  */
 MessageQueue::MessageQueue()
+    : mEventFd(-1),
+      mHasMsg(false),
+      mMessages(NULL),
+      mCapacity(0),
+      mHead(0),
+      mCount(0),
+      mPendingSignals(0),
+      mStaleSignal(false)
 {
     LOG_FUNCTION_NAME;
 
-    int fds[2] = {-1,-1};
-    android::status_t stat;
-
-    stat = pipe(fds);
-
-    if ( 0 > stat )
+    mEventFd = eventfd(0, EFD_NONBLOCK);
+    if ( 0 > mEventFd )
         {
-        MSGQ_LOGEB("Error while openning pipe: %s", strerror(stat) );
-        this->fd_read = 0;
-        this->fd_write = 0;
-        mHasMsg = false;
+        MSGQ_LOGEB("Error while opening eventfd: %s", strerror(errno) );
         }
-    else
-        {
-        this->fd_read = fds[0];
-        this->fd_write = fds[1];
 
-        mHasMsg = false;
+    mMessages = new Message[INITIAL_MESSAGES];
+    if ( NULL != mMessages )
+        {
+        mCapacity = INITIAL_MESSAGES;
         }
 
     LOG_FUNCTION_NAME_EXIT;
@@ -75,17 +76,83 @@ MessageQueue::~MessageQueue()
 {
     LOG_FUNCTION_NAME;
 
-    if(this->fd_read >= 0)
+    if ( 0 <= mEventFd )
         {
-        close(this->fd_read);
+        close(mEventFd);
         }
 
-    if(this->fd_write >= 0)
+    delete [] mMessages;
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
+/**
+   @brief Make the input file descriptor readable
+
+   @param none
+   @return none
+ */
+void MessageQueue::signal()
+{
+    uint64_t val = 1;
+
+    if ( sizeof(val) != write(mEventFd, &val, sizeof(val)) )
         {
-        close(this->fd_write);
+        MSGQ_LOGEB("write() error: %s", strerror(errno));
         }
+}
 
-    LOG_FUNCTION_NAME_EXIT;
+/**
+   @brief Reset the input file descriptor once the queue is empty, mLock
+          has to be held
+
+   @param none
+   @return none
+ */
+void MessageQueue::unsignal()
+{
+    uint64_t val;
+
+    // non-blocking, nothing to do with EAGAIN
+    read(mEventFd, &val, sizeof(val));
+
+    // a put() still signalling resets the descriptor once it's done
+    mStaleSignal = ( 0 < mPendingSignals );
+}
+
+/**
+   @brief Double the ring, mLock has to be held
+
+   @param none
+   @return true If there is room for another message
+ */
+bool MessageQueue::grow()
+{
+    size_t capacity = mCapacity ? mCapacity * 2 : INITIAL_MESSAGES;
+    Message *messages;
+
+    if ( capacity > MAX_MESSAGES )
+        {
+        return false;
+        }
+
+    messages = new Message[capacity];
+    if ( NULL == messages )
+        {
+        return false;
+        }
+
+    for ( size_t i = 0; i < mCount; i++ )
+        {
+        messages[i] = mMessages[(mHead + i) % mCapacity];
+        }
+
+    delete [] mMessages;
+    mMessages = messages;
+    mCapacity = capacity;
+    mHead = 0;
+
+    return true;
 }
 
 /**
@@ -94,8 +161,7 @@ MessageQueue::~MessageQueue()
    @param msg Message structure to hold the message to be retrieved
    @return android::NO_ERROR On success
    @return android::BAD_VALUE if the message pointer is NULL
-   @return android::NO_INIT If the file read descriptor is not set
-   @return android::UNKNOWN_ERROR if the read operation fromthe file read descriptor fails
+   @return android::NO_INIT If the queue couldn't be allocated
  */
 android::status_t MessageQueue::get(Message* msg)
 {
@@ -108,31 +174,33 @@ android::status_t MessageQueue::get(Message* msg)
         return android::BAD_VALUE;
         }
 
-    if(!this->fd_read)
+    if(!mMessages)
         {
-        MSGQ_LOGEA("read descriptor not initialized for message queue");
+        MSGQ_LOGEA("message queue not initialized");
         LOG_FUNCTION_NAME_EXIT;
         return android::NO_INIT;
         }
 
-    char* p = (char*) msg;
-    size_t read_bytes = 0;
+    {
+    android::AutoMutex lock(mLock);
 
-    while( read_bytes  < sizeof(*msg) )
+    while ( 0 == mCount )
         {
-        int err = read(this->fd_read, p, sizeof(*msg) - read_bytes);
+        mNotEmpty.wait(mLock);
+        }
 
-        if( err < 0 )
-            {
-            MSGQ_LOGEB("read() error: %s", strerror(errno));
-            return android::UNKNOWN_ERROR;
-            }
-        else
-            {
-            read_bytes += err;
-            }
+    *msg = mMessages[mHead];
+    mHead = (mHead + 1) % mCapacity;
+    mCount--;
+
+    if ( 0 == mCount )
+        {
+        unsignal();
         }
 
+    mNotFull.signal();
+    }
+
     MSGQ_LOGDB("MQ.get(%d,%p,%p,%p,%p)", msg->command, msg->arg1,msg->arg2,msg->arg3,msg->arg4);
 
     mHasMsg = false;
@@ -142,6 +210,53 @@ android::status_t MessageQueue::get(Message* msg)
     return 0;
 }
 
+/**
+   @brief Get all pending messages up to a maximum, without blocking
+
+   @param msgs Array to hold the messages
+   @param count Size of the array
+   @return Number of messages retrieved, 0 if the queue is empty
+ */
+size_t MessageQueue::get(Message* msgs, size_t count)
+{
+    size_t n = 0;
+
+    LOG_FUNCTION_NAME;
+
+    if ( ( NULL == msgs ) || ( NULL == mMessages ) )
+        {
+        LOG_FUNCTION_NAME_EXIT;
+        return 0;
+        }
+
+    {
+    android::AutoMutex lock(mLock);
+
+    while ( ( n < count ) && ( 0 < mCount ) )
+        {
+        msgs[n++] = mMessages[mHead];
+        mHead = (mHead + 1) % mCapacity;
+        mCount--;
+        }
+
+    if ( 0 < n )
+        {
+        if ( 0 == mCount )
+            {
+            unsignal();
+            }
+
+        mNotFull.broadcast();
+        }
+
+    mHasMsg = ( 0 < mCount );
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return n;
+}
+
 /**
    @brief Get the input file descriptor of the message queue
 
@@ -151,13 +266,13 @@ android::status_t MessageQueue::get(Message* msg)
 
 int MessageQueue::getInFd()
 {
-    return this->fd_read;
+    return mEventFd;
 }
 
 /**
-   @brief Constructor for the message queue class
+   @brief Set the input file descriptor for the message queue
 
-   @param fd file read descriptor
+   @param fd eventfd descriptor to signal instead of the queue's own
    @return none
  */
 
@@ -165,12 +280,19 @@ void MessageQueue::setInFd(int fd)
 {
     LOG_FUNCTION_NAME;
 
-    if ( -1 != this->fd_read )
+    android::AutoMutex lock(mLock);
+
+    if ( -1 != mEventFd )
         {
-        close(this->fd_read);
+        close(mEventFd);
         }
 
-    this->fd_read = fd;
+    mEventFd = fd;
+
+    if ( 0 < mCount )
+        {
+        signal();
+        }
 
     LOG_FUNCTION_NAME_EXIT;
 }
@@ -181,16 +303,14 @@ void MessageQueue::setInFd(int fd)
    @param msg Message structure to hold the message to be retrieved
    @return android::NO_ERROR On success
    @return android::BAD_VALUE if the message pointer is NULL
-   @return android::NO_INIT If the file write descriptor is not set
-   @return android::UNKNOWN_ERROR if the write operation fromthe file write descriptor fails
+   @return android::NO_INIT If the queue couldn't be allocated
  */
 
 android::status_t MessageQueue::put(Message* msg)
 {
-    LOG_FUNCTION_NAME;
+    bool wasEmpty;
 
-    char* p = (char*) msg;
-    size_t bytes = 0;
+    LOG_FUNCTION_NAME;
 
     if(!msg)
         {
@@ -199,29 +319,53 @@ android::status_t MessageQueue::put(Message* msg)
         return android::BAD_VALUE;
         }
 
-    if(!this->fd_write)
+    if(!mMessages)
         {
-        MSGQ_LOGEA("write descriptor not initialized for message queue");
+        MSGQ_LOGEA("message queue not initialized");
         LOG_FUNCTION_NAME_EXIT;
         return android::NO_INIT;
         }
 
-
     MSGQ_LOGDB("MQ.put(%d,%p,%p,%p,%p)", msg->command, msg->arg1,msg->arg2,msg->arg3,msg->arg4);
 
-    while( bytes  < sizeof(msg) )
+    {
+    android::AutoMutex lock(mLock);
+
+    // like a full pipe, block once the ring can't grow anymore
+    while ( ( mCount == mCapacity ) && !grow() )
         {
-        int err = write(this->fd_write, p, sizeof(*msg) - bytes);
+        mNotFull.wait(mLock);
+        }
 
-        if( err < 0 )
-            {
-            MSGQ_LOGEB("write() error: %s", strerror(errno));
-            LOG_FUNCTION_NAME_EXIT;
-            return android::UNKNOWN_ERROR;
-            }
-        else
+    mMessages[(mHead + mCount) % mCapacity] = *msg;
+    mCount++;
+
+    wasEmpty = ( 1 == mCount );
+    if ( wasEmpty )
+        {
+        mPendingSignals++;
+        }
+
+    mNotEmpty.signal();
+    }
+
+    // signal without holding the lock, the woken thread would block on it
+    // right away
+    if ( wasEmpty )
+        {
+        signal();
+
+        android::AutoMutex lock(mLock);
+        mPendingSignals--;
+
+        // the queue was emptied before the descriptor got signalled
+        if ( mStaleSignal && ( 0 == mPendingSignals ) )
             {
-            bytes += err;
+            if ( 0 == mCount )
+                {
+                unsignal();
+                }
+            mStaleSignal = false;
             }
         }
 
@@ -243,35 +387,9 @@ bool MessageQueue::isEmpty()
 {
     LOG_FUNCTION_NAME;
 
-    struct pollfd pfd;
-
-    pfd.fd = this->fd_read;
-    pfd.events = POLLIN;
-    pfd.revents = 0;
-
-    if(!this->fd_read)
-        {
-        MSGQ_LOGEA("read descriptor not initialized for message queue");
-        LOG_FUNCTION_NAME_EXIT;
-        return android::NO_INIT;
-        }
-
+    android::AutoMutex lock(mLock);
 
-    if( -1 == poll(&pfd,1,0) )
-        {
-        MSGQ_LOGEB("poll() error: %s", strerror(errno));
-        LOG_FUNCTION_NAME_EXIT;
-        return false;
-        }
-
-    if(pfd.revents & POLLIN)
-        {
-        mHasMsg = true;
-        }
-    else
-        {
-        mHasMsg = false;
-        }
+    mHasMsg = ( 0 < mCount );
 
     LOG_FUNCTION_NAME_EXIT;
     return !mHasMsg;
@@ -281,19 +399,19 @@ void MessageQueue::clear()
 {
     LOG_FUNCTION_NAME;
 
-    if(!this->fd_read)
-        {
-        MSGQ_LOGEA("read descriptor not initialized for message queue");
-        LOG_FUNCTION_NAME_EXIT;
-        return;
-        }
+    android::AutoMutex lock(mLock);
 
-    Message msg;
-    while(!isEmpty())
+    if ( 0 < mCount )
         {
-        get(&msg);
+        mHead = 0;
+        mCount = 0;
+        unsignal();
+        mNotFull.broadcast();
         }
 
+    mHasMsg = false;
+
+    LOG_FUNCTION_NAME_EXIT;
 }
 
 
@@ -326,6 +444,8 @@ android::status_t MessageQueue::waitForMsg(MessageQueue *queue1, MessageQueue *q
 
     int n =1;
     struct pollfd pfd[3];
+    MessageQueue *queues[3] = { queue1, queue2, queue3 };
+    int pending = 0;
 
     if(!queue1)
         {
@@ -334,8 +454,23 @@ android::status_t MessageQueue::waitForMsg(MessageQueue *queue1, MessageQueue *q
         return android::BAD_VALUE;
         }
 
+    // messages already queued don't need a poll()
+    for ( int i = 0; i < 3; i++ )
+        {
+        if ( queues[i] && !queues[i]->isEmpty() )
+            {
+            pending++;
+            }
+        }
+
+    if ( 0 < pending )
+        {
+        LOG_FUNCTION_NAME_EXIT;
+        return pending;
+        }
+
     pfd[0].fd = queue1->getInFd();
-    if(!pfd[0].fd)
+    if(0 > pfd[0].fd)
         {
         MSGQ_LOGEA("read descriptor not initialized for message queue1");
         LOG_FUNCTION_NAME_EXIT;
@@ -347,7 +482,7 @@ android::status_t MessageQueue::waitForMsg(MessageQueue *queue1, MessageQueue *q
         {
         MSGQ_LOGDA("queue2 not-null");
         pfd[1].fd = queue2->getInFd();
-        if(!pfd[1].fd)
+        if(0 > pfd[1].fd)
             {
             MSGQ_LOGEA("read descriptor not initialized for message queue2");
             LOG_FUNCTION_NAME_EXIT;
@@ -363,7 +498,7 @@ android::status_t MessageQueue::waitForMsg(MessageQueue *queue1, MessageQueue *q
         {
         MSGQ_LOGDA("queue3 not-null");
         pfd[2].fd = queue3->getInFd();
-        if(!pfd[2].fd)
+        if(0 > pfd[2].fd)
             {
             MSGQ_LOGEA("read descriptor not initialized for message queue3");
             LOG_FUNCTION_NAME_EXIT;
@@ -376,43 +511,39 @@ android::status_t MessageQueue::waitForMsg(MessageQueue *queue1, MessageQueue *q
         }
 
 
-    int ret = poll(pfd, n, timeout);
-    if(ret==0)
+    for (;;)
         {
-        LOG_FUNCTION_NAME_EXIT;
-        return ret;
-        }
-
-    if(ret<android::NO_ERROR)
-        {
-        MSGQ_LOGEB("Message queue returned error %d", ret);
-        LOG_FUNCTION_NAME_EXIT;
-        return ret;
-        }
+        int ret = poll(pfd, n, timeout);
+        if(ret==0)
+            {
+            LOG_FUNCTION_NAME_EXIT;
+            return ret;
+            }
 
-    if (pfd[0].revents & POLLIN)
-        {
-        queue1->setMsg(true);
-        }
+        if(ret<android::NO_ERROR)
+            {
+            MSGQ_LOGEB("Message queue returned error %d", ret);
+            LOG_FUNCTION_NAME_EXIT;
+            return ret;
+            }
 
-    if(queue2)
-        {
-        if (pfd[1].revents & POLLIN)
+        // a descriptor can briefly stay signalled after its queue has been
+        // emptied, only report the queues really holding messages
+        ret = 0;
+        for ( int i = 0; i < 3; i++ )
             {
-            queue2->setMsg(true);
+            if ( queues[i] && !queues[i]->isEmpty() )
+                {
+                ret++;
+                }
             }
-        }
 
-    if(queue3)
-        {
-        if (pfd[2].revents & POLLIN)
+        if ( ( 0 < ret ) || ( 0 <= timeout ) )
             {
-            queue3->setMsg(true);
+            LOG_FUNCTION_NAME_EXIT;
+            return ret;
             }
         }
-
-    LOG_FUNCTION_NAME_EXIT;
-    return ret;
     }
 
 } // namespace Utils
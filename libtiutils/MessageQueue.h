@@ -48,16 +48,29 @@ struct Message
 };
 
 ///Message queue implementation
+///
+///Messages are kept in an in-process ring which grows up to MAX_MESSAGES,
+///put() blocks beyond that. The input file descriptor is an eventfd which is
+///readable as long as the queue holds messages, so queues can still be
+///multiplexed with poll() and waitForMsg().
 class MessageQueue
 {
 public:
 
+    ///Initial ring size and the bound it may grow to
+    static const size_t INITIAL_MESSAGES = 16;
+    static const size_t MAX_MESSAGES = 1024;
+
     MessageQueue();
     ~MessageQueue();
 
-    ///Get a message from the queue
+    ///Get a message from the queue, blocks while the queue is empty
     android::status_t get(Message*);
 
+    ///Get up to count pending messages without blocking, returns how many were
+    ///retrieved
+    size_t get(Message* msgs, size_t count);
+
     ///Get the input file descriptor of the message queue
     int getInFd();
 
@@ -84,9 +97,24 @@ public:
     }
 
 private:
-    int fd_read;
-    int fd_write;
+    bool grow();
+    void signal();
+    void unsignal();
+
+    int mEventFd;
     bool mHasMsg;
+
+    android::Mutex mLock;
+    android::Condition mNotEmpty;
+    android::Condition mNotFull;
+    Message *mMessages;
+    size_t mCapacity;
+    size_t mHead;
+    size_t mCount;
+
+    // put() calls signalling the descriptor outside of mLock
+    int mPendingSignals;
+    bool mStaleSignal;
 };
 
 } // namespace Utils
@@ -0,0 +1,20 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= msgq_benchmark.cpp
+
+LOCAL_SHARED_LIBRARIES:= \
+    libtiutils \
+    libcutils \
+    libutils \
+    liblog
+
+LOCAL_C_INCLUDES += \
+    $(TOP)/hardware/ti/omap4xxx/libtiutils
+
+LOCAL_CFLAGS += -Wall -fno-short-enums -O2
+
+LOCAL_MODULE:= msgq_benchmark
+LOCAL_MODULE_TAGS:= tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compares Ti::Utils::MessageQueue with the pipe based queue it replaced:
+ * one-way throughput between two threads, with single and batch get(), and
+ * per message latency from a ping-pong between two queues.
+ *
+ * usage: msgq_benchmark [messages]
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utils/Timers.h>
+
+#include "MessageQueue.h"
+
+using Ti::Utils::Message;
+using Ti::Utils::MessageQueue;
+
+static const size_t BATCH_SIZE = 32;
+
+///The previous MessageQueue, one write() and read() per message
+class PipeQueue
+{
+public:
+    PipeQueue()
+        {
+        int fds[2] = { -1, -1 };
+
+        if ( 0 > pipe(fds) )
+            {
+            printf("pipe() failed: %s\n", strerror(errno));
+            }
+        mReadFd = fds[0];
+        mWriteFd = fds[1];
+        }
+
+    ~PipeQueue()
+        {
+        close(mReadFd);
+        close(mWriteFd);
+        }
+
+    int getInFd() { return mReadFd; }
+
+    void put(Message *msg)
+        {
+        char *p = (char *) msg;
+        size_t bytes = 0;
+
+        while ( bytes < sizeof(*msg) )
+            {
+            int err = write(mWriteFd, p + bytes, sizeof(*msg) - bytes);
+            if ( 0 > err )
+                {
+                return;
+                }
+            bytes += err;
+            }
+        }
+
+    void get(Message *msg)
+        {
+        char *p = (char *) msg;
+        size_t bytes = 0;
+
+        while ( bytes < sizeof(*msg) )
+            {
+            int err = read(mReadFd, p + bytes, sizeof(*msg) - bytes);
+            if ( 0 > err )
+                {
+                return;
+                }
+            bytes += err;
+            }
+        }
+
+private:
+    int mReadFd;
+    int mWriteFd;
+};
+
+static void waitReadable(int fd)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    poll(&pfd, 1, -1);
+}
+
+template <class Queue>
+struct Producer
+{
+    Queue *queue;
+    unsigned int count;
+
+    static void *run(void *arg)
+        {
+        Producer *p = (Producer *) arg;
+        Message msg = { 0, 0, 0, 0, 0, 0 };
+
+        for ( unsigned int i = 0; i < p->count; i++ )
+            {
+            msg.command = i;
+            p->queue->put(&msg);
+            }
+
+        return NULL;
+        }
+};
+
+///Messages per second from one thread to another, the consumer waits on the
+///input fd like the HAL threads do
+template <class Queue>
+static double throughput(unsigned int count)
+{
+    Queue queue;
+    Producer<Queue> producer = { &queue, count };
+    pthread_t thread;
+    Message msg;
+    nsecs_t start = systemTime();
+
+    pthread_create(&thread, NULL, Producer<Queue>::run, &producer);
+    for ( unsigned int i = 0; i < count; i++ )
+        {
+        waitReadable(queue.getInFd());
+        queue.get(&msg);
+        }
+    pthread_join(thread, NULL);
+
+    return count / ( ( systemTime() - start ) / 1e9 );
+}
+
+static double batchThroughput(unsigned int count)
+{
+    MessageQueue queue;
+    Producer<MessageQueue> producer = { &queue, count };
+    pthread_t thread;
+    Message msgs[BATCH_SIZE];
+    unsigned int received = 0;
+    nsecs_t start = systemTime();
+
+    pthread_create(&thread, NULL, Producer<MessageQueue>::run, &producer);
+    while ( received < count )
+        {
+        waitReadable(queue.getInFd());
+        received += queue.get(msgs, BATCH_SIZE);
+        }
+    pthread_join(thread, NULL);
+
+    return count / ( ( systemTime() - start ) / 1e9 );
+}
+
+template <class Queue>
+struct Echo
+{
+    Queue *ping;
+    Queue *pong;
+    unsigned int count;
+
+    static void *run(void *arg)
+        {
+        Echo *e = (Echo *) arg;
+        Message msg;
+
+        for ( unsigned int i = 0; i < e->count; i++ )
+            {
+            waitReadable(e->ping->getInFd());
+            e->ping->get(&msg);
+            e->pong->put(&msg);
+            }
+
+        return NULL;
+        }
+};
+
+///Average time for a message to reach a waiting thread, in microseconds
+template <class Queue>
+static double latency(unsigned int count)
+{
+    Queue ping, pong;
+    Echo<Queue> echo = { &ping, &pong, count };
+    pthread_t thread;
+    Message msg = { 0, 0, 0, 0, 0, 0 };
+    nsecs_t start = systemTime();
+
+    pthread_create(&thread, NULL, Echo<Queue>::run, &echo);
+    for ( unsigned int i = 0; i < count; i++ )
+        {
+        ping.put(&msg);
+        waitReadable(pong.getInFd());
+        pong.get(&msg);
+        }
+    pthread_join(thread, NULL);
+
+    return ( systemTime() - start ) / 1e3 / ( 2.0 * count );
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int count = 200000;
+
+    if ( 1 < argc )
+        {
+        count = atoi(argv[1]);
+        }
+
+    printf("%u messages of %u bytes\n\n", count, (unsigned int) sizeof(Message));
+    printf("%-28s %14s %14s\n", "", "pipe", "ring+eventfd");
+    printf("%-28s %14.0f %14.0f\n", "throughput (msg/s)",
+           throughput<PipeQueue>(count), throughput<MessageQueue>(count));
+    printf("%-28s %14s %14.0f\n", "batch throughput (msg/s)",
+           "-", batchThroughput(count));
+    printf("%-28s %14.2f %14.2f\n", "latency (us/msg)",
+           latency<PipeQueue>(count / 10), latency<MessageQueue>(count / 10));
+
+    return 0;
+}
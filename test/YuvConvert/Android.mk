@@ -0,0 +1,22 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    yuv_convert_test.cpp \
+    ../../camera/YuvConvert.cpp
+
+LOCAL_SHARED_LIBRARIES:= \
+    libcutils \
+    libutils \
+    liblog
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/../../camera/inc \
+    $(LOCAL_PATH)/../../libtiutils
+
+LOCAL_CFLAGS += -Wall -fno-short-enums -O2
+
+LOCAL_MODULE:= yuv_convert_test
+LOCAL_MODULE_TAGS:= tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the YuvConvert row kernels picked for this CPU against plain
+ * byte-at-a-time references for every width up to MAX_CHECK_WIDTH, then
+ * times both on rows of a 1080p frame.
+ *
+ * usage: yuv_convert_test [frames]
+ *
+ * Returns 0 when every kernel matches its reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/Timers.h>
+
+#include "YuvConvert.h"
+
+using namespace Ti::Camera;
+
+static const int MAX_CHECK_WIDTH = 300;
+static const int BENCH_WIDTH = 1920;
+static const int BENCH_HEIGHT = 1080;
+
+/*--------------------References---------------------------------*/
+
+static void refYuv444Row(uint8_t *dst, const uint8_t *src, int width, bool uyvy)
+{
+    for ( int x = 0; x < width; x++ )
+        {
+        const uint8_t *pair = src + ( x / 2 ) * 4;
+
+        dst[x * 3] = uyvy ? pair[1 + ( x & 1 ) * 2] : pair[( x & 1 ) * 2];
+        dst[x * 3 + 1] = uyvy ? pair[0] : pair[1];
+        dst[x * 3 + 2] = uyvy ? pair[2] : pair[3];
+        }
+}
+
+static void refNV12Row(uint8_t *dstY, uint8_t *dstUV, const uint8_t *src, int width)
+{
+    for ( int x = 0; x < width; x++ )
+        {
+        dstY[x] = src[x * 2];
+        }
+
+    if ( dstUV )
+        {
+        for ( int x = 0; x < width; x += 2 )
+            {
+            dstUV[x] = src[x * 2 + 1];
+            dstUV[x + 1] = src[x * 2 + 3];
+            }
+        }
+}
+
+static void refBlendRow(uint8_t *dst, const uint16_t *row0, const uint16_t *row1, int yf, int count)
+{
+    for ( int i = 0; i < count; i++ )
+        {
+        dst[i] = (uint8_t) ( ( row0[i] * ( 8 - yf ) + row1[i] * yf ) / 64 );
+        }
+}
+
+static void refAccumulateRow(uint32_t *acc, const uint8_t *src, int count)
+{
+    for ( int i = 0; i < count; i++ )
+        {
+        acc[i] += src[i];
+        }
+}
+
+static void refPrefixSumRow(uint32_t *acc, int count, int step)
+{
+    for ( int i = step; i < count; i++ )
+        {
+        acc[i] += acc[i - step];
+        }
+}
+
+/*--------------------Checks---------------------------------*/
+
+static void fillRandom(uint8_t *buf, size_t size)
+{
+    for ( size_t i = 0; i < size; i++ )
+        {
+        buf[i] = (uint8_t) rand();
+        }
+}
+
+///Compares the kernels with the references for every width, the bytes past
+///the end of the row must stay untouched
+static int check()
+{
+    // rows are padded, kernels must not write past their width
+    static const int PAD = 64;
+    static uint8_t src[MAX_CHECK_WIDTH * 4 + PAD];
+    static uint8_t out[MAX_CHECK_WIDTH * 3 + PAD], ref[MAX_CHECK_WIDTH * 3 + PAD];
+    static uint8_t outUV[MAX_CHECK_WIDTH + PAD], refUV[MAX_CHECK_WIDTH + PAD];
+    static uint16_t row0[MAX_CHECK_WIDTH], row1[MAX_CHECK_WIDTH];
+    static uint32_t outAcc[MAX_CHECK_WIDTH], refAcc[MAX_CHECK_WIDTH];
+    int failures = 0;
+
+    for ( int width = 1; width < MAX_CHECK_WIDTH; width++ )
+        {
+        fillRandom(src, sizeof(src));
+
+        for ( int uyvy = 0; uyvy < 2; uyvy++ )
+            {
+            memset(out, 0xa5, sizeof(out));
+            memset(ref, 0xa5, sizeof(ref));
+            yuv422iToYuv444Row(out, src, width, uyvy);
+            refYuv444Row(ref, src, width, uyvy);
+            if ( memcmp(out, ref, sizeof(out)) )
+                {
+                printf("yuv422iToYuv444Row(%s) differs at width %d\n", uyvy ? "uyvy" : "yuyv", width);
+                failures++;
+                }
+            }
+
+        // NV12 rows have whole chroma pairs
+        if ( 0 == ( width & 1 ) )
+            {
+            memset(out, 0xa5, sizeof(out));
+            memset(ref, 0xa5, sizeof(ref));
+            memset(outUV, 0xa5, sizeof(outUV));
+            memset(refUV, 0xa5, sizeof(refUV));
+            yuyvToNV12Row(out, outUV, src, width);
+            refNV12Row(ref, refUV, src, width);
+            if ( memcmp(out, ref, sizeof(out)) || memcmp(outUV, refUV, sizeof(outUV)) )
+                {
+                printf("yuyvToNV12Row differs at width %d\n", width);
+                failures++;
+                }
+            }
+
+        for ( int i = 0; i < width; i++ )
+            {
+            // two taps weighted to a total of 8
+            row0[i] = (uint16_t) ( rand() % ( 255 * 8 + 1 ) );
+            row1[i] = (uint16_t) ( rand() % ( 255 * 8 + 1 ) );
+            }
+        for ( int yf = 0; yf <= 8; yf++ )
+            {
+            memset(out, 0xa5, sizeof(out));
+            memset(ref, 0xa5, sizeof(ref));
+            bilinearBlendRow(out, row0, row1, yf, width);
+            refBlendRow(ref, row0, row1, yf, width);
+            if ( memcmp(out, ref, sizeof(out)) )
+                {
+                printf("bilinearBlendRow differs at width %d, yf %d\n", width, yf);
+                failures++;
+                }
+            }
+
+        for ( int i = 0; i < width; i++ )
+            {
+            outAcc[i] = refAcc[i] = (uint32_t) rand();
+            }
+        boxAccumulateRow(outAcc, src, width);
+        refAccumulateRow(refAcc, src, width);
+        if ( memcmp(outAcc, refAcc, width * sizeof(uint32_t)) )
+            {
+            printf("boxAccumulateRow differs at width %d\n", width);
+            failures++;
+            }
+
+        for ( int step = 1; step <= 2; step++ )
+            {
+            if ( width % step )
+                {
+                continue;
+                }
+            for ( int i = 0; i < width; i++ )
+                {
+                outAcc[i] = refAcc[i] = (uint32_t) rand();
+                }
+            boxPrefixSumRow(outAcc, width, step);
+            refPrefixSumRow(refAcc, width, step);
+            if ( memcmp(outAcc, refAcc, width * sizeof(uint32_t)) )
+                {
+                printf("boxPrefixSumRow(step %d) differs at width %d\n", step, width);
+                failures++;
+                }
+            }
+        }
+
+    return failures;
+}
+
+/*--------------------Benchmark---------------------------------*/
+
+///Milliseconds per 1080p frame for the kernels and the references
+static void bench(int frames)
+{
+    const size_t rowBytes = BENCH_WIDTH * 2;
+    uint8_t *src = (uint8_t *) malloc(rowBytes * BENCH_HEIGHT);
+    uint8_t *dst = (uint8_t *) malloc(BENCH_WIDTH * 3 * BENCH_HEIGHT);
+    uint8_t *dstUV = (uint8_t *) malloc(BENCH_WIDTH * BENCH_HEIGHT / 2);
+    // two different rows, with one row twice the compiler folds the
+    // reference blend to a shift
+    uint16_t *row = (uint16_t *) malloc(BENCH_WIDTH * 2 * sizeof(uint16_t));
+    uint32_t *acc = (uint32_t *) calloc(BENCH_WIDTH, sizeof(uint32_t));
+    nsecs_t kernel[5] = { 0, 0, 0, 0, 0 };
+    nsecs_t reference[5] = { 0, 0, 0, 0, 0 };
+    nsecs_t start;
+
+    if ( !src || !dst || !dstUV || !row || !acc )
+        {
+        printf("Couldn't allocate the benchmark frames\n");
+        goto exit;
+        }
+
+    fillRandom(src, rowBytes * BENCH_HEIGHT);
+    for ( int i = 0; i < BENCH_WIDTH * 2; i++ )
+        {
+        row[i] = src[i] * 8;
+        }
+
+    for ( int f = 0; f < frames; f++ )
+        {
+        start = systemTime();
+        for ( int y = 0; y < BENCH_HEIGHT; y++ )
+            yuv422iToYuv444Row(dst + y * BENCH_WIDTH * 3, src + y * rowBytes, BENCH_WIDTH, false);
+        kernel[0] += systemTime() - start;
+
+        start = systemTime();
+        for ( int y = 0; y < BENCH_HEIGHT; y++ )
+            refYuv444Row(dst + y * BENCH_WIDTH * 3, src + y * rowBytes, BENCH_WIDTH, false);
+        reference[0] += systemTime() - start;
+
+        start = systemTime();
+        for ( int y = 0; y < BENCH_HEIGHT; y++ )
+            yuyvToNV12Row(dst + y * BENCH_WIDTH, ( y & 1 ) ? NULL : dstUV + ( y / 2 ) * BENCH_WIDTH,
+                          src + y * rowBytes, BENCH_WIDTH);
+        kernel[1] += systemTime() - start;
+
+        start = systemTime();
+        for ( int y = 0; y < BENCH_HEIGHT; y++ )
+            refNV12Row(dst + y * BENCH_WIDTH, ( y & 1 ) ? NULL : dstUV + ( y / 2 ) * BENCH_WIDTH,
+                       src + y * rowBytes, BENCH_WIDTH);
+        reference[1] += systemTime() - start;
+
+        start = systemTime();
+        for ( int y = 0; y < BENCH_HEIGHT; y++ )
+            bilinearBlendRow(dst + y * BENCH_WIDTH, row, row + BENCH_WIDTH, y & 7, BENCH_WIDTH);
+        kernel[2] += systemTime() - start;
+
+        start = systemTime();
+        for ( int y = 0; y < BENCH_HEIGHT; y++ )
+            refBlendRow(dst + y * BENCH_WIDTH, row, row + BENCH_WIDTH, y & 7, BENCH_WIDTH);
+        reference[2] += systemTime() - start;
+
+        start = systemTime();
+        for ( int y = 0; y < BENCH_HEIGHT; y++ )
+            boxAccumulateRow(acc, src + y * rowBytes, BENCH_WIDTH);
+        kernel[3] += systemTime() - start;
+
+        start = systemTime();
+        for ( int y = 0; y < BENCH_HEIGHT; y++ )
+            refAccumulateRow(acc, src + y * rowBytes, BENCH_WIDTH);
+        reference[3] += systemTime() - start;
+
+        start = systemTime();
+        for ( int y = 0; y < BENCH_HEIGHT; y++ )
+            boxPrefixSumRow(acc, BENCH_WIDTH, 1 + ( y & 1 ));
+        kernel[4] += systemTime() - start;
+
+        start = systemTime();
+        for ( int y = 0; y < BENCH_HEIGHT; y++ )
+            refPrefixSumRow(acc, BENCH_WIDTH, 1 + ( y & 1 ));
+        reference[4] += systemTime() - start;
+        }
+
+    {
+        static const char * const names[5] = {
+            "yuv422iToYuv444Row", "yuyvToNV12Row", "bilinearBlendRow", "boxAccumulateRow",
+            "boxPrefixSumRow"
+        };
+
+        printf("\n%d frames of %dx%d, ms per frame\n", frames, BENCH_WIDTH, BENCH_HEIGHT);
+        printf("%-24s %10s %10s\n", "", getYuvKernelSetName(), "reference");
+        for ( int i = 0; i < 5; i++ )
+            {
+            printf("%-24s %10.3f %10.3f\n", names[i],
+                   kernel[i] / 1e6 / frames, reference[i] / 1e6 / frames);
+            }
+    }
+
+exit:
+    free(src);
+    free(dst);
+    free(dstUV);
+    free(row);
+    free(acc);
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = 20;
+    int failures;
+
+    if ( 1 < argc )
+        {
+        frames = atoi(argv[1]);
+        }
+
+    printf("YuvConvert kernels: %s\n", getYuvKernelSetName());
+
+    failures = check();
+    if ( failures )
+        {
+        printf("%d mismatches\n", failures);
+        return 1;
+        }
+    printf("All kernels match the references for widths 1..%d\n", MAX_CHECK_WIDTH - 1);
+
+    if ( 0 < frames )
+        {
+        bench(frames);
+        }
+
+    return 0;
+}